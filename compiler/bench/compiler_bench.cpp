@@ -0,0 +1,347 @@
+// Compiler throughput benchmark over generated programs of growing size.
+// Each family scales one dimension of the input; every (family, size) case
+// runs in a child process so its peak RSS is its own.
+//
+//   make bench                          # all families, JSON to bench/results.json
+//   ./bench/compiler_bench fns expr     # selected families, JSON to stdout
+//   ./bench/compiler_bench --scale 0.25 --reps 1 --commit $(git rev-parse --short HEAD)
+//   ./bench/compiler_bench --emit dir   # write the generated programs instead
+//
+// Per case it reports the best of --reps runs of lexing, parsing and x86
+// codegen, and of the whole in-process pipeline (import resolution, codegen,
+// built-in assembler and linker, -terminal). "growth" is the log-log slope of
+// time against size between the smallest and largest case: about 1 for a
+// linear phase, about 2 for a quadratic one.
+#include "../src/modules.h"
+#include "../src/codegen.h"
+#include "../src/x86_asm.h"
+#include "../src/linker.h"
+#include "../src/runtime.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// A generated program: the entry file first, then the modules it imports
+using Files = std::vector<std::pair<std::string, std::string>>;
+
+// `n` functions with a few locals, a branch and a loop each
+static Files gen_fns(int n) {
+    std::string s = "#Mainprogramm.start\n";
+    for (int f = 0; f < n; f++) {
+        const std::string i = std::to_string(f);
+        s += "fn f" + i + " {\n    <.de\n";
+        s += "        var a" + i + ": i32 = " + i + "\n";
+        s += "        var s" + i + ": string = \"f" + i + "\\n\"\n";
+        s += "        a" + i + " = ((a" + i + " * 3) + 7)\n";
+        s += "        if a" + i + " > 100 { a" + i + " = (a" + i + " - 7) }\n";
+        s += "        loop {\n            a" + i + " = (a" + i + " - 1)\n            if a" + i + " == 0 { stop }\n        }\n";
+        s += "        display{s" + i + "}\n    .>\n}\n";
+    }
+    s += "<.de\n    call #f0\n.>\n#Mainprogramm.end\n";
+    return {{"fns.de", s}};
+}
+
+// One assignment whose right-hand side nests `n` parentheses deep,
+// alternating left- and right-leaning operands. x and y change on every
+// iteration of a loop, so the expression cannot fold away.
+static Files gen_expr(int n) {
+    static const char* ops[] = {"+", "*", "-", "+"};
+    std::string e = "x";
+    for (int d = 0; d < n; d++) {
+        const std::string k = std::to_string(d % 97 + 1);
+        e = d % 2 ? "(" + e + " " + ops[d % 4] + " y)" : "(" + k + " " + ops[d % 4] + " " + e + ")";
+    }
+    return {{"expr.de", "#Mainprogramm.start\n<.de\n    var y: i32 = 5\n    var r: i32 = 0\n"
+                        "    for x = 0 to 4 {\n        y = (y + x)\n        r = (r ^ " + e + ")\n    }\n"
+                        "    printnum{r}\n.>\n#Mainprogramm.end\n"}};
+}
+
+// One switch with `n` cases on a loop counter, so every case stays
+static Files gen_switch(int n) {
+    std::string s = "#Mainprogramm.start\n<.de\n    var r: i32 = 0\n    for v = 0 to 3 {\n        switch v {\n";
+    for (int c = 0; c < n; c++)
+        s += "            case " + std::to_string(c) + ":\n                r = (r + " + std::to_string(c % 89) + ")\n";
+    s += "        }\n    }\n    printnum{r}\n.>\n#Mainprogramm.end\n";
+    return {{"switch.de", s}};
+}
+
+// A chain of `n` modules, each importing the next and defining two functions
+static Files gen_imports(int n) {
+    Files files{{"imports.de", "#Mainprogramm.start\nImport{chain_1}\n<.de\n    call #chain_1_a\n.>\n#Mainprogramm.end\n"}};
+    for (int m = 1; m <= n; m++) {
+        const std::string i = std::to_string(m);
+        std::string s;
+        if (m < n) s += "Import{chain_" + std::to_string(m + 1) + "}\n";
+        for (const char* f : {"a", "b"})
+            s += "fn chain_" + i + "_" + f + " {\n    <.de\n        var c" + i + f + ": i32 = " + i +
+                 "\n        c" + i + f + " = (c" + i + f + " * 2)\n    .>\n}\n";
+        files.push_back({"chain_" + i + ".de", s});
+    }
+    return files;
+}
+
+// n/16 structs of 16 fields, an array initialized with `n` values and
+// n/8 more array and struct variables, so the program stays linear in `n`
+static Files gen_decls(int n) {
+    const int types = std::max(1, n / 16);
+    std::string s = "#Mainprogramm.start\n";
+    for (int t = 0; t < types; t++) {
+        s += "struct Rec" + std::to_string(t) + " {\n";
+        for (int f = 0; f < 16; f++) s += "    f" + std::to_string(f) + ": i32\n";
+        s += "}\n";
+    }
+    s += "<.de\n    var table: i32[" + std::to_string(n) + "] = [";
+    for (int i = 0; i < n; i++) s += (i ? ", " : "") + std::to_string(i * 7 % 1000);
+    s += "]\n";
+    for (int v = 0; v < n / 8; v++) {
+        const std::string i = std::to_string(v);
+        s += "    var arr" + i + ": i32[64]\n    var w" + i + ": Rec" + std::to_string(v % types) + "\n";
+        s += "    arr" + i + "[3] = " + i + "\n    w" + i + ".f" + std::to_string(v % 16) + " = table[" + std::to_string(v % n) + "]\n";
+    }
+    s += ".>\n#Mainprogramm.end\n";
+    return {{"decls.de", s}};
+}
+
+struct Family {
+    const char* name;
+    Files (*gen)(int);
+    std::vector<int> sizes;
+};
+
+static const std::vector<Family> families = {
+    {"fns",     gen_fns,     {1000, 2000, 4000, 8000}},
+    {"expr",    gen_expr,    {250, 500, 1000, 2000}},
+    {"switch",  gen_switch,  {500, 1000, 2000, 4000}},
+    {"imports", gen_imports, {50, 100, 200, 400}},
+    {"decls",   gen_decls,   {1000, 2000, 4000, 8000}},
+};
+
+static double ms_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+template<class F>
+static double best_of(int reps, F&& run) {
+    double best = 1e300;
+    for (int r = 0; r < reps; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, ms_since(t0));
+    }
+    return best;
+}
+
+struct Case {
+    size_t bytes = 0, lines = 0, tokens = 0, asm_bytes = 0, exe_bytes = 0;
+    double lex = 0, parse = 0, codegen = 0, e2e = 0;
+};
+
+// Runs in the child: writes the program to dir and times every phase
+static Case run_case(const Files& files, const std::string& dir, int reps) {
+    Case c;
+    for (auto& [name, text] : files) {
+        std::ofstream(dir + "/" + name, std::ios::binary) << text;
+        c.bytes += text.size();
+        c.lines += std::count(text.begin(), text.end(), '\n');
+    }
+    const std::string root = dir + "/" + files[0].first;
+
+    c.lex = best_of(reps, [&] {
+        Arena arena;
+        Interner names;
+        size_t n = 0;
+        for (auto& f : files) n += Lexer(f.second, arena, names).tokenize().size();
+        c.tokens = n;
+    });
+
+    {
+        Arena arena;
+        Interner names;
+        std::vector<std::vector<Token>> toks;
+        for (auto& f : files) toks.push_back(Lexer(f.second, arena, names).tokenize());
+        c.parse = best_of(reps, [&] {
+            Arena nodes;
+            for (size_t i = 0; i < files.size(); i++) Parser(toks[i], nodes, names).parse(i > 0);
+        });
+    }
+
+    {
+        Arena arena;
+        Interner names;
+        ModuleLoader modules(arena, names);
+        ProgramNode* ast = modules.load_program(root);
+        c.codegen = best_of(reps, [&] {
+            CodeGen cg;
+            cg.set_mode(false);
+            c.asm_bytes = cg.generate(ast).size();
+        });
+    }
+
+    c.e2e = best_of(reps, [&] {
+        Arena arena;
+        Interner names;
+        ModuleLoader modules(arena, names);
+        ProgramNode* ast = modules.load_program(root);
+        CodeGen cg;
+        cg.set_mode(false);
+        x86::Assembler as;
+        as.assemble(cg.generate(ast));
+        x86::Linker ln(false);
+        ln.add_object(as.elf_object(false, "bench.asm"), "bench.o");
+        if (!ln.undefined().empty()) {
+            x86::Assembler rt;
+            rt.assemble(x86::runtime_source_32);
+            ln.add_object(rt.elf_object(false, "runtime.asm"), "<runtime>");
+        }
+        c.exe_bytes = ln.link("_start").size();
+    });
+    return c;
+}
+
+static std::string json_str(const std::string& s) {
+    std::string o = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') o += '\\';
+        if ((unsigned char)ch >= 0x20) o += ch;
+    }
+    return o + "\"";
+}
+
+// Forks, runs one case in the child and returns its JSON object
+static std::string measure(const Family& fam, int size, int reps) {
+    char tmpl[] = "/tmp/defacto-bench-XXXXXX";
+    if (!mkdtemp(tmpl)) throw std::runtime_error("mkdtemp failed");
+    const std::string dir = tmpl;
+    int fd[2];
+    if (pipe(fd) != 0) throw std::runtime_error("pipe failed");
+    std::fflush(nullptr);
+    const pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        close(fd[0]);
+        char buf[1024];
+        try {
+            Case c = run_case(fam.gen(size), dir, reps);
+            std::snprintf(buf, sizeof buf,
+                "\"bytes\": %zu, \"lines\": %zu, \"tokens\": %zu, \"asm_bytes\": %zu, \"exe_bytes\": %zu, "
+                "\"lex_ms\": %.3f, \"parse_ms\": %.3f, \"codegen_ms\": %.3f, \"e2e_ms\": %.3f, "
+                "\"tokens_per_s\": %.0f, \"lines_per_s\": %.0f",
+                c.bytes, c.lines, c.tokens, c.asm_bytes, c.exe_bytes, c.lex, c.parse, c.codegen, c.e2e,
+                c.tokens / (c.e2e / 1000.0), c.lines / (c.e2e / 1000.0));
+        } catch (const std::exception& e) {
+            std::snprintf(buf, sizeof buf, "\"error\": %s", json_str(e.what()).c_str());
+        }
+        if (write(fd[1], buf, std::strlen(buf)) < 0) _exit(2);
+        _exit(0);
+    }
+    close(fd[1]);
+    std::string out;
+    char buf[1024];
+    for (ssize_t n; (n = read(fd[0], buf, sizeof buf)) > 0;) out.append(buf, (size_t)n);
+    close(fd[0]);
+    int status = 0;
+    struct rusage ru {};
+    wait4(pid, &status, 0, &ru);
+    fs::remove_all(dir);
+#ifdef __APPLE__
+    const long rss_kb = ru.ru_maxrss / 1024;
+#else
+    const long rss_kb = ru.ru_maxrss;
+#endif
+    if (out.empty()) out = "\"error\": \"child exited with status " + std::to_string(status) + "\"";
+    return "{\"size\": " + std::to_string(size) + ", " + out + ", \"peak_rss_kb\": " + std::to_string(rss_kb) + "}";
+}
+
+// Pulls one number back out of a case object this program wrote
+static double field(const std::string& obj, const char* key) {
+    const auto at = obj.find("\"" + std::string(key) + "\": ");
+    return at == std::string::npos ? NAN : std::atof(obj.c_str() + at + std::strlen(key) + 4);
+}
+
+int main(int argc, char** argv) {
+    double scale = 1.0;
+    int reps = 3;
+    std::string out_path, emit_dir, commit = "unknown";
+    std::vector<std::string> only;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        if (a == "--scale" && i + 1 < argc) scale = std::atof(argv[++i]);
+        else if (a == "--reps" && i + 1 < argc) reps = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--out" && i + 1 < argc) out_path = argv[++i];
+        else if (a == "--commit" && i + 1 < argc) commit = argv[++i];
+        else if (a == "--emit" && i + 1 < argc) emit_dir = argv[++i];
+        else if (a[0] != '-') only.push_back(a);
+        else {
+            std::fprintf(stderr, "usage: %s [--scale f] [--reps n] [--out file.json] [--commit id] [--emit dir] [family...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char head[256];
+    std::snprintf(head, sizeof head, "{\n  \"commit\": %s,\n  \"reps\": %d,\n  \"scale\": %g,\n  \"families\": [",
+                  json_str(commit).c_str(), reps, scale);
+    std::string json = head;
+    bool first_family = true, failed = false;
+    for (auto& fam : families) {
+        if (!only.empty() && std::find(only.begin(), only.end(), fam.name) == only.end()) continue;
+        std::vector<int> sizes;
+        for (int s : fam.sizes) sizes.push_back(std::max(1, (int)(s * scale)));
+
+        if (!emit_dir.empty()) {
+            for (int s : sizes) {
+                const std::string dir = emit_dir + "/" + fam.name + "-" + std::to_string(s);
+                fs::create_directories(dir);
+                for (auto& [name, text] : fam.gen(s)) std::ofstream(dir + "/" + name, std::ios::binary) << text;
+                std::fprintf(stderr, "wrote %s\n", dir.c_str());
+            }
+            continue;
+        }
+
+        std::vector<std::string> cases;
+        for (int s : sizes) {
+            cases.push_back(measure(fam, s, reps));
+            const std::string& c = cases.back();
+            if (c.find("\"error\"") != std::string::npos) {
+                std::fprintf(stderr, "%-8s %6d  %s\n", fam.name, s, c.c_str());
+                failed = true;
+                continue;
+            }
+            std::fprintf(stderr, "%-8s %6d  lex %8.2f  parse %8.2f  codegen %8.2f  e2e %8.2f ms  %9.0f tok/s  %6.0f KB\n",
+                         fam.name, s, field(c, "lex_ms"), field(c, "parse_ms"), field(c, "codegen_ms"),
+                         field(c, "e2e_ms"), field(c, "tokens_per_s"), field(c, "peak_rss_kb"));
+        }
+
+        json += std::string(first_family ? "" : ",") + "\n    {\"family\": " + json_str(fam.name) + ", \"cases\": [";
+        for (size_t i = 0; i < cases.size(); i++) json += std::string(i ? "," : "") + "\n      " + cases[i];
+        json += "\n    ], \"growth\": {";
+        const char* phases[] = {"lex_ms", "parse_ms", "codegen_ms", "e2e_ms"};
+        for (int p = 0; p < 4; p++) {
+            const double t0 = field(cases.front(), phases[p]), t1 = field(cases.back(), phases[p]);
+            const double g = sizes.size() > 1 && t0 > 0 && t1 > 0
+                ? std::log(t1 / t0) / std::log((double)sizes.back() / sizes.front()) : NAN;
+            char buf[64];
+            if (std::isnan(g)) std::snprintf(buf, sizeof buf, "%s\"%.*s\": null", p ? ", " : "", (int)std::strlen(phases[p]) - 3, phases[p]);
+            else std::snprintf(buf, sizeof buf, "%s\"%.*s\": %.2f", p ? ", " : "", (int)std::strlen(phases[p]) - 3, phases[p], g);
+            json += buf;
+        }
+        json += "}}";
+        first_family = false;
+    }
+    json += "\n  ]\n}\n";
+    if (!emit_dir.empty()) return 0;
+
+    if (out_path.empty()) std::fputs(json.c_str(), stdout);
+    else {
+        std::ofstream(out_path) << json;
+        std::fprintf(stderr, "results: %s\n", out_path.c_str());
+    }
+    return failed ? 1 : 0;
+}
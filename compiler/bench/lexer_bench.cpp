@@ -0,0 +1,99 @@
+// Lexer micro-benchmark: the old std::string-per-token lexer against the
+// zero-copy lexer with interned identifiers and the perfect-hash keyword table.
+//
+//   make lexer-bench            # default: ~4 MB of generated source
+//   ./bench/lexer_bench 20      # scale factor (x 1000 generated functions)
+#include "../src/lexer.h"
+#include "baseline_lexer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Counts heap traffic so both sides report what tokenizing actually costs
+static size_t g_alloc_bytes = 0, g_alloc_count = 0;
+
+void* operator new(size_t n) {
+    g_alloc_bytes += n; g_alloc_count++;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+static std::string gen_source(int scale) {
+    static const char* names[] = {"counter", "total", "idx", "buffer_len", "value", "flag", "tmp", "acc"};
+    std::string s;
+    s.reserve((size_t)scale * 1000 * 260);
+    s += "#Mainprogramm.start\n";
+    for (int f = 0; f < scale * 1000; f++) {
+        const char* a = names[f % 8];
+        const char* b = names[(f + 3) % 8];
+        s += "fn helper_" + std::to_string(f) + "(" + a + ": i32, " + b + ": i32) {\n";
+        s += "    var result: i32 = " + std::string(a) + " * 3 + " + b + " / 2;\n";
+        s += "    if " + std::string(a) + " >= 0x10 && " + b + " != 7 {\n";
+        s += "        result = result + " + std::to_string(f % 97) + ";\n";
+        s += "    } else {\n";
+        s += "        display \"value out of range\\n\";\n";
+        s += "    }\n";
+        s += "    for i = 0 to 10 { result = result - i; }  // trailing comment\n";
+        s += "    return result;\n";
+        s += "}\n";
+    }
+    s += "#Mainprogramm.end\n";
+    return s;
+}
+
+struct Result { double ms; size_t tokens, bytes, allocs; };
+
+template<class F>
+static Result measure(F&& run, int reps) {
+    Result best{1e30, 0, 0, 0};
+    for (int r = 0; r < reps; r++) {
+        size_t b0 = g_alloc_bytes, c0 = g_alloc_count;
+        auto t0 = std::chrono::steady_clock::now();
+        size_t n = run();
+        auto t1 = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (ms < best.ms) best = {ms, n, g_alloc_bytes - b0, g_alloc_count - c0};
+    }
+    return best;
+}
+
+static void report(const char* name, const Result& r, size_t src_bytes) {
+    std::printf("  %-10s %9.2f ms  %7.1f MB/s  %9zu tokens  %10zu heap bytes  %8zu allocations\n",
+                name, r.ms, src_bytes / (r.ms * 1000.0), r.tokens, r.bytes, r.allocs);
+}
+
+int main(int argc, char** argv) {
+    int scale = argc > 1 ? std::atoi(argv[1]) : 16;
+    if (scale < 1) scale = 1;
+    const int reps = 5;
+    std::string src = gen_source(scale);
+
+    auto old_side = measure([&] {
+        baseline::Lexer lx(src);
+        return lx.tokenize().size();
+    }, reps);
+
+    auto new_side = measure([&] {
+        Arena arena;
+        Interner names;
+        Lexer lx(src, arena, names);
+        size_t n = lx.tokenize().size();
+        // Arena chunks come from malloc; charge them to the new side too
+        g_alloc_bytes += arena.bytes_reserved(); g_alloc_count += arena.chunk_count();
+        return n;
+    }, reps);
+
+    std::printf("lexer bench: %zu bytes of source, best of %d runs\n", src.size(), reps);
+    report("baseline", old_side, src.size());
+    report("zero-copy", new_side, src.size());
+    std::printf("  speedup %.2fx, heap bytes %.2fx smaller\n",
+                old_side.ms / new_side.ms, (double)old_side.bytes / (new_side.bytes ? new_side.bytes : 1));
+    if (old_side.tokens != new_side.tokens) {
+        std::fprintf(stderr, "token count mismatch: %zu vs %zu\n", old_side.tokens, new_side.tokens);
+        return 1;
+    }
+    return 0;
+}
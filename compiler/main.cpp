@@ -1,8 +1,14 @@
 #include "src/defacto.h"
 #include "src/lexer.h"
 #include "src/parser.h"
+#include "src/modules.h"
+#include "src/cache.h"
 #include "src/codegen.h"
+#include "src/x86_asm.h"
+#include "src/linker.h"
+#include "src/runtime.h"
 #include "src/arm64_codegen.h"
+#include "src/trace.h"
 #ifdef HAS_LLVM
 #include "src/llvm_codegen.h"
 #endif
@@ -12,12 +18,6 @@
 #include <string>
 #include <iostream>
 
-static std::string read_file(const std::string& p){
-    std::ifstream f(p);
-    if(!f) throw std::runtime_error("cannot open '"+p+"'");
-    std::ostringstream s; s<<f.rdbuf(); return s.str();
-}
-
 static std::string sh_quote(const std::string& s){
     std::string out="'";
     for(char c: s){
@@ -28,6 +28,28 @@ static std::string sh_quote(const std::string& s){
     return out;
 }
 
+static void write_file(const std::string& path, const std::string& bytes){
+    std::ofstream f(path, std::ios::binary);
+    if(!f || !f.write(bytes.data(), (std::streamsize)bytes.size())) throw std::runtime_error("cannot write '"+path+"'");
+}
+
+static std::string slurp(const std::string& path){
+    std::ifstream f(path, std::ios::binary);
+    std::stringstream ss;
+    ss<<f.rdbuf();
+    return ss.str();
+}
+
+// std::system, shown in --time-trace as a span named after the tool
+static int run_tool(const std::string& cmd){
+    const auto end=cmd.find(' ');
+    std::string tool=cmd.substr(0,end);
+    const auto slash=tool.find_last_of('/');
+    if(slash!=std::string::npos) tool=tool.substr(slash+1);
+    TraceScope trace(tool, cmd);
+    return std::system(cmd.c_str());
+}
+
 static void usage(const char* prog){
     std::cout
         <<"Defacto Compiler v0.53\n\n"
@@ -35,6 +57,7 @@ static void usage(const char* prog){
         <<"Options:\n"
         <<"  -o <file>       output file (default: a.out)\n"
         <<"  -S              emit assembly only, do not assemble\n"
+        <<"  -j <n>          generate function bodies on n threads (0: one per core)\n"
         <<"  -kernel         bare-metal mode: [BITS 32][ORG 0x1000] + hlt (default)\n"
         <<"  -terminal       terminal mode: Linux 32-bit syscalls\n"
         <<"  -terminal64     terminal mode: Linux 64-bit syscalls\n"
@@ -42,10 +65,29 @@ static void usage(const char* prog){
         <<"  -terminal-arm64 terminal mode: macOS/Linux ARM64 syscalls\n"
 #ifdef HAS_LLVM
         <<"  -llvm           use LLVM backend for optimized codegen\n"
-        <<"  -O0, -O1, -O2, -O3  optimization level (LLVM only, default: -O2)\n"
 #endif
+        <<"  -O0, -O1, -O2, -O3  optimization level (default: -O2)\n"
+        <<"  -mavx2          vectorize loops with AVX2 instead of SSE2 (x86 terminal modes, -O2)\n"
+        <<"  -finline-limit=<n>  inline calls to leaf functions of up to n IR instructions (default: 12, -O2)\n"
+        <<"  -fprofile-generate[=<file>]  count block runs; the program writes them to <file> as it ends\n"
+        <<"                  (default: <input>.deprof; -kernel: to COM1) (native backends)\n"
+        <<"  -fprofile-use[=<file>]  optimize for the counts in <file> (default: <input>.deprof)\n"
+        <<"  --print-ir      print the optimized IR of every region (native backends)\n"
+        <<"  --report-tail-calls  list the calls turned into jumps (native backends, -O1 and up)\n"
+        <<"  -lc             link with the system linker against libc (default: built-in static link)\n"
+        <<"  --nasm          assemble with external nasm instead of the built-in assembler\n"
+        <<"  --asm-check     assemble with both and fail unless the results are identical\n"
+        <<"  --no-cache      always rebuild; do not read or write the build cache\n"
+        <<"  --cache-stats   print build cache statistics (alone: print and exit)\n"
+        <<"  --time-trace=<file>  write a Chrome trace (JSON) of the compiler phases to <file>\n"
         <<"  -v              verbose\n"
         <<"  -h              help\n\n"
+        <<"Environment:\n"
+        <<"  DEFACTO_PATH    ':'-separated directories searched for Import{...}\n"
+        <<"                  (after the importing file's directory and '.', before lib/ and stdlib/)\n"
+        <<"  DEFACTO_CACHE_DIR   build cache location (default: ~/.defacto/cache)\n"
+        <<"  DEFACTO_CACHE_SIZE  build cache bound in MiB, least recently used first out (default: 1024)\n"
+        <<"  DEFACTO_LD      system linker used with -lc (default: ld)\n\n"
         <<"Examples:\n"
         <<"  "<<prog<<" -terminal hello.de       # Linux 32-bit\n"
         <<"  "<<prog<<" -terminal64 hello.de     # Linux 64-bit\n"
@@ -61,8 +103,12 @@ static void usage(const char* prog){
 int main(int argc, char** argv){
     if(argc<2){usage(argv[0]);return 1;}
 
-    std::string input, output="a.out";
-    bool asm_only=false, verbose=false;
+    std::string input, output="a.out", trace_file;
+    bool asm_only=false, verbose=false, use_cache=true, cache_stats=false;
+    bool use_nasm=false, asm_check=false, link_libc=false, print_ir=false, avx2=false, report_tails=false;
+    int jobs=1, inline_limit=ir::Inliner::default_limit;
+    bool prof_gen=false, prof_use=false;
+    std::string prof_file;  // -fprofile-generate= or -fprofile-use=, else <stem>.deprof
     bool bare_metal=true, macos_terminal=false, linux64_terminal=false, arm64_terminal=false, macos_arm64=false;
     
     // LLVM backend options
@@ -85,6 +131,12 @@ int main(int argc, char** argv){
         if(a=="-h"){usage(argv[0]);return 0;}
         else if(a=="-S")        asm_only=true;
         else if(a=="-v")        verbose=true;
+        else if(a=="--no-cache")    use_cache=false;
+        else if(a=="--nasm")        use_nasm=true;
+        else if(a=="-lc")           link_libc=true;
+        else if(a=="--asm-check")   asm_check=true;
+        else if(a=="--cache-stats") cache_stats=true;
+        else if(a.rfind("--time-trace=",0)==0) trace_file=a.substr(13);
         else if(a=="-kernel")   { bare_metal=true; macos_terminal=false; linux64_terminal=false; arm64_terminal=false; }
         else if(a=="-terminal") { bare_metal=false; macos_terminal=false; linux64_terminal=false; arm64_terminal=false; }
         else if(a=="-terminal64") { bare_metal=false; macos_terminal=false; linux64_terminal=true; arm64_terminal=false; }
@@ -92,103 +144,181 @@ int main(int argc, char** argv){
         else if(a=="-terminal-arm64") { bare_metal=false; macos_terminal=false; linux64_terminal=false; arm64_terminal=true; }
 #ifdef HAS_LLVM
         else if(a=="-llvm")     use_llvm=true;
+#endif
         else if(a=="-O0")       opt_level=0;
         else if(a=="-O1")       opt_level=1;
         else if(a=="-O2")       opt_level=2;
         else if(a=="-O3")       opt_level=3;
-#endif
+        else if(a=="--print-ir")    print_ir=true;
+        else if(a=="--report-tail-calls") report_tails=true;
+        else if(a=="-mavx2")        avx2=true;
+        else if(a.rfind("-finline-limit=",0)==0){
+            const std::string n=a.substr(15);
+            if(n.empty() || n.find_first_not_of("0123456789")!=std::string::npos){err("'-finline-limit=' requires a number");return 1;}
+            inline_limit=std::atoi(n.c_str());
+        }
+        else if(a=="-fprofile-generate" || a.rfind("-fprofile-generate=",0)==0){
+            prof_gen=true;
+            if(a=="-fprofile-generate="){err("'-fprofile-generate=' requires a file name");return 1;}
+            if(a.size()>18) prof_file=a.substr(19);
+        }
+        else if(a=="-fprofile-use" || a.rfind("-fprofile-use=",0)==0){
+            prof_use=true;
+            if(a=="-fprofile-use="){err("'-fprofile-use=' requires a file name");return 1;}
+            if(a.size()>13) prof_file=a.substr(14);
+        }
+        else if(a=="-j"){if(++i>=argc){err("'-j' requires a thread count");return 1;} jobs=std::atoi(argv[i]);}
+        else if(a.rfind("-j",0)==0 && a.size()>2 && isdigit((unsigned char)a[2])) jobs=std::atoi(a.c_str()+2);
         else if(a=="-o"){if(++i>=argc){err("'-o' requires filename");return 1;} output=argv[i];}
         else if(a[0]!='-') input=a;
         else{err("unknown option '"+a+"'");return 1;}
     }
+    if(prof_gen && prof_use){err("-fprofile-generate and -fprofile-use cannot be combined");return 1;}
+    if(use_llvm && (prof_gen || prof_use)) warn("profile options apply to the native backends; ignored with -llvm");
+    if(print_ir || report_tails) use_cache=false;  // the listing comes from code generation
+    BuildCache cache;
+    if(cache_stats && input.empty()){cache.print_stats(std::cout);return 0;}
     if(input.empty()){err("no input file");return 1;}
 
+    // The trace is written however main returns, after the outermost span
+    // below has closed
+    struct TraceWriter {
+        std::string path;
+        ~TraceWriter(){
+            if(path.empty()) return;
+            TimeTrace::get().counter("peak RSS", peak_rss_bytes());
+            try{ TimeTrace::get().write(path); }
+            catch(const std::exception& e){ err(e.what()); }
+        }
+    } trace_writer{trace_file};
+    if(!trace_file.empty()) TimeTrace::get().start();
+    TraceScope trace_total("defacto", input);
+
     std::string stem=input;
     const auto dot=stem.find_last_of('.');
     if(dot!=std::string::npos) stem=stem.substr(0,dot);
     std::string asm_file=stem+".asm";
+    // The instrumented program may run anywhere: it gets an absolute path
+    if(prof_file.empty()) prof_file=stem+".deprof";
+    if(prof_gen) prof_file=std::filesystem::absolute(prof_file).string();
+    const std::string obj=stem+".o";
+    // x86 ELF and flat output is assembled in-process; Mach-O, ARM64 and
+    // LLVM's output still go through the external tools
+    const bool builtin_as=!use_nasm && !use_llvm && !arm64_terminal && !macos_terminal;
+    // Linux terminal executables are linked statically in-process with a
+    // small runtime for malloc/free/exit unless -lc asks for the real libc
+    const bool builtin_ld=!link_libc && !bare_metal && !arm64_terminal && !macos_terminal;
 
     try{
         if(verbose) std::cout<<"reading "<<input<<"\n";
-        std::string src = read_file(input);
-        
-        // Find imports in source using simple regex-like parsing
-        std::vector<std::string> imports;
-        size_t pos = 0;
-        while((pos = src.find("Import{", pos)) != std::string::npos) {
-            size_t start = pos + 7;  // length of "Import{"
-            size_t end = src.find("}", start);
-            if(end != std::string::npos) {
-                std::string libname = src.substr(start, end - start);
-                imports.push_back(libname);
-                if(verbose) std::cout<<"  found import: " << libname << "\n";
-            }
-            pos = end + 1;
-        }
-        
-        // Load imported libraries and insert AFTER directives
-        std::string full_src = "";
-        bool inserted = false;
-        
-        // Read main file line by line
-        std::istringstream iss(src);
-        std::string line;
-        bool past_imports = false;
-        while(std::getline(iss, line)) {
-            // Skip Import{} lines (already processed)
-            if(line.find("Import{") != std::string::npos) {
-                past_imports = true;
-                continue;  // Skip this line
-            }
-            full_src += line + "\n";
-            // Insert libraries after all directives and Import statements
-            if(!inserted && past_imports && 
-                line.find("#Mainprogramm.start") == std::string::npos &&
-                line.find("#NO_RUNTIME") == std::string::npos &&
-                line.find("#SAFE") == std::string::npos &&
-                line.find("#DRIVER") == std::string::npos) {
-                // This line is after all directives, insert here
-                for(const auto& lib : imports) {
-                    if(verbose) std::cout<<"  importing: " << lib << ".de\n";
-                    std::string lib_path = lib + ".de";
-                    std::string lib_src;
-                    try {
-                        lib_src = read_file(lib_path);
-                    } catch(...) {
-                        size_t last_slash = input.find_last_of('/');
-                        if(last_slash != std::string::npos) {
-                            std::string base_dir = input.substr(0, last_slash + 1);
-                            lib_src = read_file(base_dir + lib_path);
-                        } else {
-                            try {
-                                lib_src = read_file("lib/" + lib_path);
-                            } catch(...) {
-                                err("library not found: " + lib);
-                                return 1;
-                            }
-                        }
-                    }
-                    full_src += lib_src + "\n";
-                }
-                inserted = true;
-            }
-        }
-
-        if(verbose) std::cout<<"parsing...\n";
-        Lexer  lexer(full_src);
-        Parser parser(lexer.tokenize());
-        auto ast=parser.parse(false);
+        // Owns every AST node; released in one go when it goes out of scope.
+        // Each imported module is lexed and parsed once into this arena; the
+        // loader keeps the sources that tokens and names point into.
+        Arena        arena;
+        std::string  asm_text;
+        Interner     names;
+        ModuleLoader modules(arena, names, verbose);
+        ProgramNode* ast=modules.load_program(input);
+        TimeTrace::get().counter("tokens", modules.token_count());
+        TimeTrace::get().counter("AST nodes", arena.object_count());
+        TimeTrace::get().counter("peak RSS", peak_rss_bytes());
 
         if(verbose){
             std::cout<<"  no_runtime: "<<ast->no_runtime<<"\n";
             std::cout<<"  functions:  "<<ast->functions.size()<<"\n";
+            std::cout<<"  modules:    "<<modules.module_count()<<" ("<<modules.dedup_count()
+                     <<" repeated import(s) reused, "<<modules.token_count()<<" tokens)\n";
             std::cout<<"  mode: "<<(bare_metal?"kernel (bare-metal)":(arm64_terminal?"ARM64 terminal":(linux64_terminal?"Linux 64-bit":"Linux 32-bit")) )<<"\n";
+            std::cout<<"  assembler: "<<(builtin_as?"built-in":"external")<<(asm_check?" (checked against nasm)":"")<<"\n";
+            if(!bare_metal) std::cout<<"  linker: "<<(builtin_ld?"built-in, static":"external")<<"\n";
 #ifdef HAS_LLVM
             std::cout<<"  backend: "<<(use_llvm?"LLVM":"NASM")<<"\n";
-            if(use_llvm) std::cout<<"  optimization: -O"<<opt_level<<"\n";
 #endif
+            std::cout<<"  optimization: -O"<<opt_level<<"\n";
+        }
+
+        std::shared_ptr<ir::Profile> profile;
+        if(prof_use){
+            profile=std::make_shared<ir::Profile>();
+            profile->read(prof_file);
+            if(verbose) std::cout<<"  profile: "<<prof_file<<" ("<<profile->size()<<" region(s))\n";
         }
 
+        // Everything that can change the produced files goes into the key.
+        // The stem is part of it because nasm records the source name.
+        const char* ld_env = std::getenv("DEFACTO_LD");
+        const char* cc_env = std::getenv("DEFACTO_CC");
+        const std::string ld_bin = ld_env ? ld_env : "ld";
+        const std::string cc_bin = cc_env ? cc_env : "clang";
+        if(use_cache){
+            TraceScope trace("cache lookup");
+            cache.begin(argv[0]);
+            cache.add(std::string(bare_metal?"K":"-")+(macos_terminal?"M":"-")+(linux64_terminal?"L":"-")
+                      +(arm64_terminal?"A":"-")+(macos_arm64?"a":"-")+(asm_only?"S":"-")
+                      +(use_llvm?"llvm":builtin_as?"builtin-as":"nasm")+"-O"+std::to_string(opt_level)
+                      +(avx2?"+avx2":"")+"+inline"+std::to_string(inline_limit)
+                      +(builtin_ld?"+builtin-ld":""));
+            cache.add(std::filesystem::path(stem).filename().string());
+            if(prof_gen) cache.add("profile-generate:"+prof_file);
+            if(prof_use) cache.add("profile-use:"+slurp(prof_file));
+            modules.each_source([&](const std::string&, const std::string& text){ cache.add(text); });
+            if(use_llvm) cache.add_tool("llc");
+            if(!asm_only){
+                if(arm64_terminal){
+#ifdef __APPLE__
+                    cache.add_tool("as"); cache.add_tool(cc_bin);
+#else
+                    cache.add_tool("as"); cache.add_tool(ld_bin);
+#endif
+                } else {
+                    if(!builtin_as || asm_check) cache.add_tool("nasm");
+                    if(macos_terminal) cache.add_tool(cc_bin);
+                    else if(!bare_metal){
+#ifdef __APPLE__
+                        cache.add_tool(cc_bin);
+#else
+                        cache.add_tool(ld_bin);
+#endif
+                    }
+                }
+            }
+            cache.finish();
+
+            // A hit restores the outputs of the earlier build; -v also gets
+            // the intermediate .asm and .o it would have kept
+            std::vector<std::pair<std::string,std::string>> want;
+            if(asm_only) want.push_back({"asm", asm_file});
+            else {
+                want.push_back({"bin", output});
+                if(verbose){
+                    want.push_back({"asm", asm_file});
+                    if(!bare_metal) want.push_back({"obj", obj});
+                }
+            }
+            if(cache.fetch(want)){
+                if(verbose) std::cout<<"cache hit: "<<cache.id()<<"\n";
+                if(cache_stats) cache.print_stats(std::cout);
+                std::cout<<"done: "<<(asm_only?asm_file:output)<<"\n";
+                return 0;
+            }
+            if(verbose) std::cout<<"cache miss: "<<cache.id()<<"\n";
+        }
+
+        // Saves whatever this build produced under the key computed above
+        auto store_outputs = [&]{
+            if(!use_cache) return;
+            TraceScope trace("cache store");
+            std::vector<std::pair<std::string,std::string>> files;
+            std::error_code ec;
+            if(std::filesystem::exists(asm_file, ec)) files.push_back({"asm", asm_file});
+            if(!asm_only){
+                if(!bare_metal && std::filesystem::exists(obj, ec)) files.push_back({"obj", obj});
+                files.push_back({"bin", output});
+            }
+            cache.store(files);
+            if(cache_stats) cache.print_stats(std::cout);
+        };
+
 #ifdef HAS_LLVM
         if (use_llvm) {
             // Use LLVM backend
@@ -196,7 +326,11 @@ int main(int argc, char** argv){
             LLVMCodeGen cg;
             cg.set_bare_metal(bare_metal);
             cg.set_64bit(linux64_terminal || macos_terminal || arm64_terminal);
-            std::string ir = cg.generate(ast->main_sec, linux64_terminal || macos_terminal);
+            std::string ir;
+            {
+                TraceScope trace("LLVMCodeGen::generate");
+                ir = cg.generate(ast, linux64_terminal || macos_terminal);
+            }
             
             // Write LLVM IR to file
             std::string ll_file = stem + ".ll";
@@ -209,7 +343,7 @@ int main(int argc, char** argv){
             // Use llc to compile to assembly
             const std::string cmd_llc = "llc -O"+std::to_string(opt_level)+" "+sh_quote(ll_file)+" -o "+sh_quote(asm_file);
             if(verbose) std::cout<<"$ "<<cmd_llc<<"\n";
-            if(std::system(cmd_llc.c_str())!=0){err("LLVM backend (llc) failed");return 1;}
+            if(run_tool(cmd_llc)!=0){err("LLVM backend (llc) failed");return 1;}
             
             // Continue with normal assembly/linking process
         } else
@@ -220,83 +354,178 @@ int main(int argc, char** argv){
                 // Use ARM64 codegen
                 ARM64CodeGen cg;
                 cg.set_mode(macos_arm64);
-                cg.emit(ast.get(), asm_file);
+                cg.set_opt(opt_level);
+                cg.set_print_ir(print_ir);
+                cg.set_inline_limit(inline_limit);
+                if(prof_gen) cg.set_profile_generate(prof_file);
+                if(profile) cg.set_profile_use(profile);
+                {
+                    TraceScope trace("ARM64CodeGen::emit");
+                    cg.emit(ast, asm_file);
+                }
+                if(print_ir) std::cout<<cg.ir_listing();
+                if(report_tails) for(auto& t:cg.tail_calls()) std::cout<<"tail call: "<<t<<"\n";
+                if(verbose) std::cout<<cg.inline_report()<<cg.bounds_report()<<cg.profile_report();
             } else {
                 // Use x86 codegen
                 CodeGen cg;
                 cg.set_mode(bare_metal, macos_terminal, linux64_terminal, arm64_terminal);
-                cg.emit(ast.get(), asm_file);
+                cg.set_jobs(jobs);
+                cg.set_opt(opt_level);
+                cg.set_print_ir(print_ir);
+                cg.set_avx2(avx2);
+                cg.set_inline_limit(inline_limit);
+                if(prof_gen) cg.set_profile_generate(prof_file);
+                if(profile) cg.set_profile_use(profile);
+                {
+                    TraceScope trace("CodeGen::generate");
+                    asm_text=cg.generate(ast);
+                }
+                if(print_ir) std::cout<<cg.ir_listing();
+                if(report_tails) for(auto& t:cg.tail_calls()) std::cout<<"tail call: "<<t<<"\n";
+                if(verbose) std::cout<<cg.inline_report()<<cg.peephole_report()<<cg.vector_report()<<cg.bounds_report()<<cg.profile_report();
+                // The built-in assembler reads the text from memory; the
+                // file is only for -S, -v, nasm and the cross-check
+                if(asm_only || verbose || !builtin_as || asm_check){
+                    write_file(asm_file, asm_text);
+                    std::cout<<"asm: "<<asm_file<<"\n";
+                }
             }
         }
 
-        if(asm_only){std::cout<<"done: "<<asm_file<<"\n";return 0;}
+        if(TimeTrace::get().enabled()){
+            std::error_code ec;
+            const auto on_disk=std::filesystem::file_size(asm_file, ec);
+            TimeTrace::get().counter("asm bytes", asm_text.empty() && !ec ? on_disk : asm_text.size());
+            TimeTrace::get().counter("peak RSS", peak_rss_bytes());
+        }
 
-        if(bare_metal){
-            const std::string cmd="nasm -f bin "+sh_quote(asm_file)+" -o "+sh_quote(output);
+        if(verbose){
+            std::cout<<"  ast arena: "<<arena.peak_bytes()<<" bytes peak, "
+                     <<arena.bytes_reserved()<<" reserved in "<<arena.chunk_count()<<" chunk(s)\n";
+        }
+
+        if(asm_only){store_outputs();std::cout<<"done: "<<asm_file<<"\n";return 0;}
+
+        // Built-in assembler: a flat image for -kernel, an ELF object
+        // otherwise. Input outside its subset falls back to nasm.
+        // The object stays in memory when the built-in linker takes it.
+        bool assembled=false;
+        std::string image;
+        if(builtin_as){
+            try{
+                TraceScope trace("x86::Assembler");
+                x86::Assembler as;
+                as.assemble(asm_text);
+                image=bare_metal ? as.flat_binary() : as.elf_object(linux64_terminal, asm_file);
+                if(bare_metal) write_file(output, image);
+                else if(verbose || !builtin_ld) write_file(obj, image);
+                if(verbose) std::cout<<"  assembled in-process: "<<image.size()<<" bytes\n";
+                assembled=true;
+            }catch(const x86::Unsupported& e){
+                warn(std::string("built-in assembler: ")+e.what()+"; falling back to nasm");
+                if(!verbose && !asm_check) write_file(asm_file, asm_text);
+            }
+        }
+        if(assembled && asm_check){
+            const std::string ref=(bare_metal ? output : obj)+".nasm";
+            const std::string cmd="nasm -f "+std::string(bare_metal?"bin":linux64_terminal?"elf64":"elf32")
+                                 +" "+sh_quote(asm_file)+" -o "+sh_quote(ref);
             if(verbose) std::cout<<"$ "<<cmd<<"\n";
-            if(std::system(cmd.c_str())!=0){err("assembler failed");return 1;}
+            if(run_tool(cmd)!=0){err("asm-check: nasm failed");return 1;}
+            const std::string& a=image;
+            const std::string b=slurp(ref);
+            std::remove(ref.c_str());
+            std::string diff;
+            if(bare_metal){
+                if(a.size()!=b.size()) diff=std::to_string(a.size())+" bytes, nasm wrote "+std::to_string(b.size());
+                else for(size_t i=0;i<a.size() && diff.empty();i++)
+                    if(a[i]!=b[i]) diff="differs from nasm at offset "+std::to_string(i);
+            } else diff=x86::diff_objects(a, b);
+            if(!diff.empty()){err("asm-check: "+diff);return 1;}
+            std::cout<<"asm-check: built-in assembler matches nasm\n";
+        }
+
+        // An externally assembled object must exist before either linker runs
+        if(!assembled && !bare_metal && !arm64_terminal && !macos_terminal){
+            const std::string cmd_nasm="nasm -f "+std::string(linux64_terminal?"elf64 ":"elf32 ")+sh_quote(asm_file)+" -o "+sh_quote(obj);
+            if(verbose) std::cout<<"$ "<<cmd_nasm<<"\n";
+            if(run_tool(cmd_nasm)!=0){err("assembler failed");return 1;}
+        }
+
+        // Built-in static link. A symbol the runtime does not provide (an
+        // extern libc function) hands the job to the system linker.
+        bool linked=false;
+        if(builtin_ld){
+            TraceScope trace("x86::Linker");
+            x86::Linker ln(linux64_terminal);
+            ln.add_object(assembled ? image : slurp(obj), obj);
+            if(!ln.undefined().empty()){
+                x86::Assembler rt;
+                rt.assemble(linux64_terminal ? x86::runtime_source_64 : x86::runtime_source_32);
+                ln.add_object(rt.elf_object(linux64_terminal, "runtime.asm"), "<runtime>");
+            }
+            const auto missing=ln.undefined();
+            if(missing.empty()){
+                write_file(output, ln.link("_start"));
+                std::filesystem::permissions(output, std::filesystem::perms::owner_exec|std::filesystem::perms::group_exec
+                                             |std::filesystem::perms::others_exec, std::filesystem::perm_options::add);
+                if(verbose) std::cout<<"  linked in-process: text "<<ln.group_size[0]+ln.group_size[1]<<", data "
+                                     <<ln.group_size[2]<<", bss "<<ln.group_size[3]<<" bytes\n";
+                linked=true;
+            } else {
+                if(verbose) std::cout<<"  '"<<missing.front()<<"' is not in the built-in runtime; linking with libc\n";
+                if(assembled && !verbose) write_file(obj, image);
+            }
+        }
+
+        if(bare_metal){
+            if(!assembled){
+                const std::string cmd="nasm -f bin "+sh_quote(asm_file)+" -o "+sh_quote(output);
+                if(verbose) std::cout<<"$ "<<cmd<<"\n";
+                if(run_tool(cmd)!=0){err("assembler failed");return 1;}
+            }
         } else if(arm64_terminal) {
             // ARM64 (macOS or Linux) - uses ARM64 assembly directly
-            const std::string obj=stem+".o";
             #ifdef __APPLE__
             const std::string cmd_nasm="as -arch arm64 -o "+sh_quote(obj)+" "+sh_quote(asm_file);
-            const char* cc_env = std::getenv("DEFACTO_CC");
-            const std::string cc_bin = cc_env ? cc_env : "clang";
             const std::string cmd_ld  = cc_bin+" -arch arm64 -o "+sh_quote(output)+" "+sh_quote(obj);
             #else
             const std::string cmd_nasm="as -o "+sh_quote(obj)+" "+sh_quote(asm_file);
-            const char* ld_env = std::getenv("DEFACTO_LD");
-            const std::string ld_bin = ld_env ? ld_env : "ld";
             const std::string cmd_ld  = ld_bin+" -m aarch64linux -o "+sh_quote(output)+" "+sh_quote(obj)+" -lc";
             #endif
             if(verbose) std::cout<<"$ "<<cmd_nasm<<"\n$ "<<cmd_ld<<"\n";
-            if(std::system(cmd_nasm.c_str())!=0){err("assembler failed");return 1;}
-            if(std::system(cmd_ld.c_str())!=0){err("linker failed");return 1;}
-            if(!verbose) std::remove(obj.c_str());
+            if(run_tool(cmd_nasm)!=0){err("assembler failed");return 1;}
+            if(run_tool(cmd_ld)!=0){err("linker failed");return 1;}
+        } else if(linked) {
+            // Done in-process
         } else if(linux64_terminal) {
             // Linux 64-bit ELF
-            const std::string obj=stem+".o";
-            const std::string cmd_nasm="nasm -f elf64 "+sh_quote(asm_file)+" -o "+sh_quote(obj);
-            const char* ld_env = std::getenv("DEFACTO_LD");
-            const std::string ld_bin = ld_env ? ld_env : "ld";
             const std::string cmd_ld  = ld_bin+" -m elf_x86_64 -o "+sh_quote(output)+" "+sh_quote(obj)+" -lc";
-            if(verbose) std::cout<<"$ "<<cmd_nasm<<"\n$ "<<cmd_ld<<"\n";
-            if(std::system(cmd_nasm.c_str())!=0){err("assembler failed");return 1;}
-            if(std::system(cmd_ld.c_str())!=0){err("linker failed");return 1;}
-            if(!verbose) std::remove(obj.c_str());
+            if(verbose) std::cout<<"$ "<<cmd_ld<<"\n";
+            if(run_tool(cmd_ld)!=0){err("linker failed");return 1;}
         } else if(!macos_terminal) {
-            const std::string obj=stem+".o";
-            const std::string cmd_nasm="nasm -f elf32 "+sh_quote(asm_file)+" -o "+sh_quote(obj);
             // Link with libc for malloc/free support
             // On macOS, use clang with -m32; on Linux use ld with -m elf_i386
             #ifdef __APPLE__
-            const char* cc_env = std::getenv("DEFACTO_CC");
-            const std::string cc_bin = cc_env ? cc_env : "clang";
             const std::string cmd_ld  = cc_bin+" -m32 -o "+sh_quote(output)+" "+sh_quote(obj);
             std::cout<<"warning: -terminal mode (32-bit Linux) is not fully supported on macOS.\n";
             std::cout<<"         Consider using -terminal-macos for native macOS binaries.\n";
             #else
-            const char* ld_env = std::getenv("DEFACTO_LD");
-            const std::string ld_bin = ld_env ? ld_env : "ld";
             const std::string cmd_ld  = ld_bin+" -m elf_i386 -o "+sh_quote(output)+" "+sh_quote(obj)+" -lc";
             #endif
-            if(verbose) std::cout<<"$ "<<cmd_nasm<<"\n$ "<<cmd_ld<<"\n";
-            if(std::system(cmd_nasm.c_str())!=0){err("assembler failed");return 1;}
-            if(std::system(cmd_ld.c_str())!=0){err("linker failed");return 1;}
-            if(!verbose) std::remove(obj.c_str());
+            if(verbose) std::cout<<"$ "<<cmd_ld<<"\n";
+            if(run_tool(cmd_ld)!=0){err("linker failed");return 1;}
         } else {
-            const std::string obj=stem+".o";
             const std::string cmd_nasm="nasm -f macho64 "+sh_quote(asm_file)+" -o "+sh_quote(obj);
-            const char* cc_env = std::getenv("DEFACTO_CC");
-            const std::string cc_bin = cc_env ? cc_env : "clang";
             const std::string cmd_ld  = cc_bin+" -arch x86_64 -Wl,-e,_start -Wl,-platform_version,macos,11.0,11.0 -o "+sh_quote(output)+" "+sh_quote(obj);
             if(verbose) std::cout<<"$ "<<cmd_nasm<<"\n$ "<<cmd_ld<<"\n";
-            if(std::system(cmd_nasm.c_str())!=0){err("assembler failed");return 1;}
-            if(std::system(cmd_ld.c_str())!=0){err("linker failed");return 1;}
-            if(!verbose) std::remove(obj.c_str());
+            if(run_tool(cmd_nasm)!=0){err("assembler failed");return 1;}
+            if(run_tool(cmd_ld)!=0){err("linker failed");return 1;}
         }
 
-        if(!verbose) std::remove(asm_file.c_str());
+        store_outputs();
+        if(!verbose){ std::remove(obj.c_str()); std::remove(asm_file.c_str()); }
         std::cout<<"done: "<<output<<"\n";
 
     }catch(const std::exception& e){err(e.what());return 1;}
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator that owns every AST node of one compilation.
+// Nodes must be trivially destructible: the whole tree goes away with the
+// arena, chunk by chunk, without visiting a single node.
+class Arena {
+    struct Chunk { Chunk* next; size_t size; };
+
+    Chunk* head = nullptr;
+    char*  ptr  = nullptr;
+    char*  end  = nullptr;
+    size_t used = 0, reserved = 0, peak = 0, chunks = 0, objects = 0;
+    size_t next_size = 64 * 1024;
+
+    void grow(size_t need) {
+        size_t sz = next_size;
+        while (sz < need + sizeof(Chunk) + alignof(std::max_align_t)) sz *= 2;
+        auto c = static_cast<Chunk*>(std::malloc(sz));
+        if (!c) throw std::bad_alloc();
+        c->next = head; c->size = sz;
+        head = c;
+        ptr = reinterpret_cast<char*>(c + 1);
+        end = reinterpret_cast<char*>(c) + sz;
+        reserved += sz; chunks++;
+        // Geometric growth keeps the chunk count logarithmic in the tree size
+        if (next_size < 16 * 1024 * 1024) next_size *= 2;
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() { release(); }
+
+    void* alloc(size_t n, size_t align) {
+        auto p = reinterpret_cast<uintptr_t>(ptr);
+        auto a = (p + align - 1) & ~(uintptr_t)(align - 1);
+        if (!ptr || a + n > reinterpret_cast<uintptr_t>(end)) {
+            grow(n + align);
+            p = reinterpret_cast<uintptr_t>(ptr);
+            a = (p + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        used += (a - p) + n;
+        if (used > peak) peak = used;
+        ptr = reinterpret_cast<char*>(a + n);
+        return reinterpret_cast<void*>(a);
+    }
+
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed individually");
+        objects++;
+        return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template<class T>
+    T* array(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed individually");
+        return static_cast<T*>(alloc(sizeof(T) * (n ? n : 1), alignof(T)));
+    }
+
+    // Copies s into the arena; the view lives as long as the arena
+    std::string_view str(std::string_view s) {
+        if (s.empty()) return {};
+        auto p = static_cast<char*>(alloc(s.size(), 1));
+        std::memcpy(p, s.data(), s.size());
+        return {p, s.size()};
+    }
+
+    // Frees every chunk at once
+    void release() {
+        while (head) {
+            Chunk* n = head->next;
+            std::free(head);
+            head = n;
+        }
+        ptr = end = nullptr;
+        used = reserved = chunks = objects = 0;
+    }
+
+    size_t bytes_used() const     { return used; }
+    size_t bytes_reserved() const { return reserved; }
+    size_t peak_bytes() const     { return peak; }
+    size_t chunk_count() const    { return chunks; }
+    size_t object_count() const   { return objects; }  // nodes made with make()
+};
+
+// Non-owning string stored in AST nodes. It points into the arena (or at a
+// literal) and converts to std::string where the backends build labels.
+struct Str : std::string_view {
+    constexpr Str() = default;
+    constexpr Str(const char* s) : std::string_view(s) {}
+    constexpr Str(const char* s, size_t n) : std::string_view(s, n) {}
+    constexpr Str(std::string_view s) : std::string_view(s) {}
+    // A std::string may not outlive the node; copy it with Arena::str
+    Str(const std::string&) = delete;
+
+    operator std::string() const { return std::string(data(), size()); }
+    std::string str() const { return std::string(data(), size()); }
+};
+
+inline std::string operator+(const std::string& a, Str b) { std::string r = a; r.append(b.data(), b.size()); return r; }
+inline std::string operator+(Str a, const std::string& b) { std::string r = a; r += b; return r; }
+inline std::string operator+(const char* a, Str b) { std::string r = a; r.append(b.data(), b.size()); return r; }
+inline std::string operator+(Str a, const char* b) { std::string r = a; r += b; return r; }
+inline std::string operator+(char a, Str b) { std::string r(1, a); r.append(b.data(), b.size()); return r; }
+
+// Growable array whose storage lives in an arena. Growing abandons the old
+// block in the arena; lists are small and built once, so the waste is bounded.
+template<class T>
+struct List {
+    static_assert(std::is_trivially_destructible<T>::value, "list elements live in the arena");
+    T*       items = nullptr;
+    uint32_t n = 0, cap = 0;
+
+    void push_back(Arena& a, T v) {
+        if (n == cap) {
+            uint32_t nc = cap ? cap * 2 : 4;
+            T* p = a.array<T>(nc);
+            for (uint32_t i = 0; i < n; i++) new (p + i) T(items[i]);
+            items = p; cap = nc;
+        }
+        new (items + n++) T(v);
+    }
+
+    T*     begin() const { return items; }
+    T*     end() const   { return items + n; }
+    size_t size() const  { return n; }
+    bool   empty() const { return n == 0; }
+    T&     operator[](size_t i) const { return items[i]; }
+    T&     back() const  { return items[n - 1]; }
+    void   clear()       { n = 0; }
+};
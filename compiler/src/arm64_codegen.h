@@ -1,31 +1,94 @@
 #pragma once
 #include "defacto.h"
+#include "ir.h"
+#include "passes.h"
+#include "profile.h"
+#include "regalloc.h"
+#include "trace.h"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
 #include <stdexcept>
 #include <map>
+#include <memory>
 
 // ARM64 Code Generator for Defacto
 // Supports macOS ARM64 and Linux ARM64
+//
+// Lowers the IR of each region (ir.h) like the x86 backend: scalars are
+// 32-bit SSA values in w registers (x19-x28, see plan_regs) or .quad spill
+// slots, every other variable is a .quad (or array) data label.
 
 class ARM64CodeGen {
     std::ostringstream code;
     std::ostringstream data;
     std::ostringstream externs;
 
-    std::map<std::string,std::string> var_lbl;
-    std::map<std::string,bool> var_is_ptr;
-    std::map<std::string,std::string> var_type;
+    // Per-variable facts, indexed by interned name
+    struct VarInfo {
+        std::string lbl, type;
+        bool is_ptr = false, is_const = false;
+        int arr_size = 0;  // elements of an array, 0 for anything else
+    };
+    const Interner* names = nullptr;
+    std::vector<VarInfo> vars;
     std::map<std::string, std::map<std::string, int>> struct_field_offsets;
     std::map<std::string, int> struct_sizes;
-    std::set<std::string> declared, freed, const_declared;
-    std::vector<std::string> loop_ends;
     int lcnt = 0, scnt = 0;
     bool macos_arm64 = true;  // true = macOS, false = Linux ARM64
+    int opt_level = 2;        // -O0..-O3, see passes.h
+    bool print_ir = false;
+    std::ostringstream ir_text;
+    int inline_limit = ir::Inliner::default_limit;  // -finline-limit
+    int inlined = 0;
+    bool safe = false;                     // #SAFE: element accesses check their index
+    int checks = 0, checks_left = 0, checks_hoisted = 0;  // bounds checks built, in place, before loops
+    std::unique_ptr<ir::Inliner> inliner;  // templates of inlinable fns
+    std::vector<std::string> tail_notes;   // calls lowered to jumps
+    // Profile-guided optimization, as in the x86 backend (profile.h)
+    bool prof_gen = false;
+    std::string prof_path;
+    std::shared_ptr<const ir::Profile> profile;
+    std::ostringstream prof;               // the regions' records
+    size_t prof_bytes = 0;
+    int prof_regions = 0, prof_stale = 0;  // instrumented or given counts; profile did not fit
+    std::string prof_lbl;                  // the current region's counters
+    int main_regions = 0;
+
+    // Register allocation: pool is x19-x28 minus every #Rn the program
+    // names; main-section variables a function or a second section
+    // mentions stay in memory (main_pinned)
+    std::vector<std::string> pool;
+    std::vector<bool> main_pinned, promoted;
+    std::unordered_map<std::string, size_t> arity;
+
+    // Lowering of the current region
+    const FuncDecl* func = nullptr;
+    const Liveness* lv = nullptr;
+    std::vector<int> vreg;
+    std::vector<std::string> vslot;          // data label of a spilled value
+    std::vector<std::string> block_lbl;
+    std::vector<int> block_pos;              // layout index of each block
+    std::vector<const LiveRange*> in_regs;
+    std::string region_end, exit_lbl;
+    bool region_end_used = false;
+    std::string tail_entry;                  // fn: label right after the prologue
+    bool tail_entry_used = false;
 
     std::string lbl(const std::string& pfx="L") { return pfx+std::to_string(lcnt++); }
 
+    VarInfo* find_var(Sym s) { return s < vars.size() && !vars[s].lbl.empty() ? &vars[s] : nullptr; }
+    VarInfo* find_var(std::string_view name) { return find_var(names->find(name)); }
+    VarInfo& new_var(Sym s) {
+        if (s >= vars.size()) vars.resize(s + 1);
+        return vars[s];
+    }
+    VarInfo& var(const Expr* e) {
+        VarInfo* v = find_var(e->sym);
+        if (!v) throw std::runtime_error("undeclared variable '" + e->val + "'");
+        return *v;
+    }
+
     // ARM64 register mapping
     // x0-x7: argument/return registers
     // x9-x15: temporary registers
@@ -62,66 +125,82 @@ class ARM64CodeGen {
         return s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X');
     }
 
-    void load(const std::string& dst_reg, const std::string& src) {
-        int dst = std::stoi(dst_reg.substr(1));  // Extract register number from xN
-        
-        if (is_num(src)) {
-            int val = std::stoi(src);
-            if (val >= 0 && val <= 0xFFFF) {
-                code << "    mov " << reg(dst) << ", #" << val << "\n";
-            } else {
-                code << "    movz " << reg(dst) << ", #" << (val & 0xFFFF) << "\n";
-                if (val > 0xFFFF) {
-                    code << "    movk " << reg(dst) << ", #" << ((val >> 16) & 0xFFFF) << ", lsl #16\n";
-                }
-            }
-        } else if (is_reg(src)) {
-            int src_n = reg_num(src);
-            code << "    mov " << reg(dst) << ", " << reg(src_n) << "\n";
-        } else {
-            // Load from memory
-            auto it = var_lbl.find(src);
-            if (it != var_lbl.end()) {
-                code << "    adrp " << reg(dst) << ", " << it->second << "@PAGE\n";
-                code << "    ldr " << reg(dst) << ", [" << reg(dst) << ", " << it->second << "@PAGEOFF]\n";
-            }
-        }
-    }
-
-    void store(const std::string& src_reg, const std::string& dst) {
-        int src = std::stoi(src_reg.substr(1));
-        auto it = var_lbl.find(dst);
-        if (it != var_lbl.end()) {
-            code << "    adrp x16, " << it->second << "@PAGE\n";
-            code << "    str " << reg(src) << ", [x16, " << it->second << "@PAGEOFF]\n";
-        }
-    }
+    // x register of a w one and back
+    static std::string xreg(const std::string& w) { return "x" + w.substr(1); }
+    static std::string wreg(const std::string& x) { return "w" + x.substr(1); }
 
 public:
     void set_mode(bool macos) {
         macos_arm64 = macos;
     }
 
+    // -O0..-O3 for the IR passes (passes.h)
+    void set_opt(int level) { opt_level = level; }
+    // Keep the optimized IR of every region for --print-ir
+    void set_print_ir(bool on) { print_ir = on; }
+    std::string ir_listing() const { return ir_text.str(); }
+    // -finline-limit: largest callee (in IR instructions) inlined unasked
+    void set_inline_limit(int n) { inline_limit = n; }
+    // Calls lowered to jumps, one line each (--report-tail-calls)
+    const std::vector<std::string>& tail_calls() const { return tail_notes; }
+    std::string inline_report() const {
+        if(!inlined) return "";
+        return "  inlined: " + std::to_string(inlined) + " call(s)\n";
+    }
+    // #SAFE: of the bounds checks built, how many went, moved before their
+    // loop or stayed
+    std::string bounds_report() const {
+        if(!checks) return "";
+        return "  bounds checks: " + std::to_string(checks) + ", " + std::to_string(checks - checks_left - checks_hoisted) +
+               " removed, " + std::to_string(checks_hoisted) + " before loops, " + std::to_string(checks_left) + " left\n";
+    }
+    // -fprofile-generate: count block runs and write them to path as the
+    // program ends; -fprofile-use: the counts of such a run
+    void set_profile_generate(const std::string& path) { prof_gen = true; prof_path = path; }
+    void set_profile_use(std::shared_ptr<const ir::Profile> p) { profile = std::move(p); }
+    std::string profile_report() const {
+        if(prof_gen) return "  profile: " + std::to_string(prof_regions) + " region(s) instrumented, written to " + prof_path + "\n";
+        if(!profile) return "";
+        return "  profile: " + std::to_string(prof_regions) + " region(s) matched" +
+               (prof_stale ? ", " + std::to_string(prof_stale) + " stale" : "") + "\n";
+    }
+
     void emit(ProgramNode* prog, const std::string& out_path) {
+        names = prog->names;
+        vars.assign(names->size(), VarInfo{});
+        safe = prog->safe;
         code << ".section __TEXT,__text\n";
         code << ".global _start\n";
-        
+
         // Entry point
         code << "_start:\n";
         code << "    stp x29, x30, [sp, #-16]!\n";  // Save FP and LR
         code << "    mov x29, sp\n";
-        
+
         // Generate struct definitions
-        for(auto& s : prog->structs) gen_struct(s.get());
-        
+        for(auto& s : prog->structs) gen_struct(s);
+        plan_regs(prog);
+        if(opt_level >= 1) {
+            inliner = std::make_unique<ir::Inliner>(opt_level, inline_limit);
+            for(auto f : prog->functions) {
+                auto fd = static_cast<FuncDecl*>(f);
+                const std::string why = inliner->add(fd, *names);
+                if(!why.empty() && fd->hint == FuncDecl::INLINE)
+                    warn("fn " + func_label(fd) + " is marked inline but is not inlined: " + why);
+            }
+        }
+        exit_lbl = lbl("exit");
+
         // Generate main section
         for(auto& s : prog->main_sec) {
             if (s->kind == NT::SECTION) {
-                gen_section(static_cast<SectionNode*>(s.get()));
+                gen_section(static_cast<SectionNode*>(s));
             }
         }
-        
+
         // Exit
+        code << exit_lbl << ":\n";
+        if(prof_gen) code << "    bl __defacto_prof_dump\n";
         code << "    mov x0, #0\n";
         if (macos_arm64) {
             code << "    mov x16, #1\n";
@@ -130,14 +209,16 @@ public:
             code << "    mov x8, #93\n";  // exit syscall
             code << "    svc #0\n";
         }
-        
+
         // Generate functions
-        for(auto& f : prog->functions) gen_func(static_cast<FuncDecl*>(f.get()));
-        
+        for(auto& f : prog->functions) gen_func(static_cast<FuncDecl*>(f));
+        if(checks_left || checks_hoisted) gen_bounds_trap();
+        if(prof_gen) gen_prof_dump();
+
         // Data section
         code << "\n.section __DATA,__data\n";
         code << data.str();
-        
+
         // Write output
         std::ofstream f(out_path);
         if(!f) throw std::runtime_error("cannot write '"+out_path+"'");
@@ -157,259 +238,1031 @@ public:
         struct_sizes[s->name] = offset;
     }
 
+    static bool scalar_type(std::string_view t) { return t == "i32" || t == "i64" || t == "u8" || t == "bool"; }
+    bool is_promoted(Sym s) const { return s < promoted.size() && promoted[s]; }
+
+    static std::string func_label(const FuncDecl* f) {
+        std::string nm = f->name;
+        if(!nm.empty() && nm[0] == '#') nm = nm.substr(1);
+        return nm;
+    }
+
+    // Register pool and the main-section variables that must stay in memory
+    void plan_regs(ProgramNode* prog) {
+        main_pinned.assign(names->size(), false);
+        std::vector<std::string> named;
+        std::vector<bool> main_decl(names->size(), false);
+        for(auto& sec : prog->main_sec)
+            if(sec->kind == NT::SECTION)
+                for(auto d : static_cast<SectionNode*>(sec)->decls) main_decl[static_cast<VarDecl*>(d)->sym] = true;
+        for(auto f : prog->functions) {
+            auto fd = static_cast<FuncDecl*>(f);
+            UseScan scan(*names);
+            scan.decl_inits(fd->body->decls);
+            scan.region(fd->body->stmts);
+            std::vector<Sym> own;
+            for(auto d : fd->body->decls) own.push_back(static_cast<VarDecl*>(d)->sym);
+            for(auto& p : fd->params) own.push_back(names->find(p.first));
+            for(Sym fv : scan.for_vars) if(!main_decl[fv]) own.push_back(fv);
+            std::sort(own.begin(), own.end());
+            for(Sym sym : scan.used)
+                if(sym < main_pinned.size() && !std::binary_search(own.begin(), own.end(), sym)) main_pinned[sym] = true;
+            named.insert(named.end(), scan.explicit_regs.begin(), scan.explicit_regs.end());
+            arity[func_label(fd)] = fd->params.size();
+        }
+        std::vector<int> sections(names->size(), 0);
+        for(auto& sec : prog->main_sec) {
+            if(sec->kind != NT::SECTION) continue;
+            UseScan scan(*names);
+            std::vector<bool> m;
+            scan.decl_inits(static_cast<SectionNode*>(sec)->decls);
+            scan.mentions(static_cast<SectionNode*>(sec)->stmts, m);
+            for(Sym i = 0; i < m.size(); i++) if(m[i] && ++sections[i] > 1) main_pinned[i] = true;
+            named.insert(named.end(), scan.explicit_regs.begin(), scan.explicit_regs.end());
+        }
+        pool.clear();
+        for(int r = 19; r <= 28; r++) {
+            bool taken = false;
+            for(auto& n : named) taken = taken || reg_num(n) == r;
+            if(!taken) pool.push_back(reg(r, true));
+        }
+    }
+
     void gen_section(SectionNode* s) {
+        TraceScope trace("gen_section");
+        ir::Function f(func ? func_label(func) : "main");
+        ir::Builder b(f, *names);
+        b.scan(s->decls, s->stmts);
+        promoted.assign(names->size(), false);
+        auto promote_if = [&](Sym sym, std::string_view type) {
+            if(!sym || !scalar_type(type) || b.escapes(sym)) return;
+            if(!func && sym < main_pinned.size() && main_pinned[sym]) return;
+            promoted[sym] = true;
+        };
+        std::vector<Sym> own;
+        if(func) {
+            for(auto& p : func->params) {
+                Sym sym = names->find(p.first);
+                own.push_back(sym);
+                promote_if(sym, p.second);
+                // Parameters the IR cannot track live in a data label of their own
+                if(!is_promoted(sym)) gen_var_label(sym, "var_" + func_label(func) + "_" + p.first, p.second);
+            }
+        }
+        for(auto d : s->decls) {
+            auto v = static_cast<VarDecl*>(d);
+            own.push_back(v->sym);
+            long long iv;
+            if(!v->is_arr && (!v->init || const_value(v->init, iv))) promote_if(v->sym, v->type);
+        }
         // Generate declarations
-        for(auto& d : s->decls) gen_var(static_cast<VarDecl*>(d.get()));
-        
-        // Generate statements
-        for(auto& st : s->stmts) gen_stmt(st.get());
+        for(auto& d : s->decls) gen_var(static_cast<VarDecl*>(d));
+
+        // Loop counters nobody declared
+        std::vector<Sym> counters;
+        for(Sym fv : b.for_vars()) {
+            if(std::find(own.begin(), own.end(), fv) != own.end() || find_var(fv)) continue;
+            promote_if(fv, "i32");
+            if(is_promoted(fv)) counters.push_back(fv);
+            else gen_var_label(fv, "var_" + names->name(fv), "i32");
+        }
+
+        // #SAFE: arr[i] checks i against the array's size (see ir::bce)
+        if(safe)
+            for(Sym sym = 0; sym < vars.size(); sym++)
+                if(vars[sym].arr_size) b.bound(sym, vars[sym].arr_size);
+
+        if(func)
+            for(size_t i = 0; i < func->params.size(); i++) {
+                Sym sym = names->find(func->params[i].first);
+                if(is_promoted(sym)) b.promote(sym, b.arg(i));
+            }
+        for(auto d : s->decls) {
+            auto v = static_cast<VarDecl*>(d);
+            if(!is_promoted(v->sym)) continue;
+            long long iv = 0;
+            if(v->init) const_value(v->init, iv);
+            b.promote(v->sym, b.constant(iv), v->is_const);
+        }
+        for(Sym c : counters) b.promote(c, b.constant(0));
+        {
+            TraceScope t("build_ir", f.name);
+            b.build(s->stmts);
+        }
+        if(prof_gen || profile) {
+            const std::string region = func ? f.name : main_regions ? "main." + std::to_string(main_regions) : "main";
+            if(!func) main_regions++;
+            if(prof_gen) gen_prof_record(f, region);
+            else switch(profile->annotate(f, region)) {
+                case ir::Profile::MATCHED: prof_regions++; break;
+                case ir::Profile::STALE:
+                    warn("profile of " + region + " does not match the source; not used");
+                    prof_stale++;
+                    break;
+                case ir::Profile::MISSING: break;
+            }
+        }
+        if(inliner) inlined += inliner->run(f);
+        resolve(f);
+        checks += count_checks(f, OP::LT);
+        ir::PassManager(opt_level, true).run(f);
+        checks_left += count_checks(f, OP::LT);
+        checks_hoisted += count_checks(f, OP::LE);
+        if(print_ir) ir::print(f, ir_text);
+        f.split_critical_edges();
+        lower(f);
+    }
+
+    static int count_checks(const ir::Function& f, OP kind) {
+        int n = 0;
+        for(auto bl : f.blocks)
+            for(auto i : bl->insts) n += i->op == ir::Op::Check && i->bop == kind;
+        return n;
+    }
+
+    // Counters for the blocks of f, named region in the profile
+    void gen_prof_record(ir::Function& f, const std::string& region) {
+        const int n = ir::instrument(f);
+        prof_lbl = lbl("prof");
+        prof << "    .long " << region.size() << ", " << n << ", " << ir::shape(f) << ", 0\n    .byte ";
+        for(size_t k = 0; k < (region.size() + 7) / 8 * 8; k++)
+            prof << (k ? ", " : "") << (k < region.size() ? (int)(unsigned char)region[k] : 0);
+        prof << "\n" << prof_lbl << ": .zero " << 8 * n << "\n";
+        prof_bytes += ir::profile_record_bytes(region.size(), n);
+        prof_regions++;
+    }
+
+    // Writes the profile image to prof_path as the program ends
+    void gen_prof_dump() {
+        const std::string svc = macos_arm64 ? "    svc #0x80\n" : "    svc #0\n";
+        code << "\n__defacto_prof_dump:\n";
+        if(macos_arm64) {
+            addr_of("x0", "__defacto_prof_path");
+            code << "    mov x1, #0x601\n    mov x2, #420\n    mov x16, #5\n" << svc;
+            code << "    b.cs __defacto_prof_done\n";  // an error sets the carry flag
+        } else {
+            code << "    mov x0, #-100\n";  // AT_FDCWD
+            addr_of("x1", "__defacto_prof_path");
+            code << "    mov x2, #0x241\n    mov x3, #420\n    mov x8, #56\n" << svc;
+            code << "    tbnz x0, #63, __defacto_prof_done\n";
+        }
+        code << "    mov x9, x0\n";
+        addr_of("x1", "__defacto_prof");
+        load_imm("x2", ir::profile_header_bytes + prof_bytes);
+        code << (macos_arm64 ? "    mov x16, #4\n" : "    mov x8, #64\n") << svc;
+        code << "    mov x0, x9\n" << (macos_arm64 ? "    mov x16, #6\n" : "    mov x8, #57\n") << svc;
+        code << "__defacto_prof_done:\n    ret\n";
+        data << "__defacto_prof_path: .byte ";
+        for(unsigned char ch : prof_path) data << (int)ch << ", ";
+        data << "0\n    .p2align 3\n__defacto_prof: .ascii \"DEPROF1\\n\"\n";
+        data << "    .long " << prof_regions << ", 0\n" << prof.str();
+    }
+
+    // Where a failed #SAFE check jumps: a message on stderr and exit code 1
+    void gen_bounds_trap() {
+        const std::string msg = "error: array index out of range\n";
+        data << "__defacto_bounds_msg: .ascii \"error: array index out of range\\n\"\n";
+        code << "__defacto_bounds:\n";
+        if(prof_gen) code << "    bl __defacto_prof_dump\n";
+        code << "    mov x0, #2\n";
+        code << "    adrp x1, __defacto_bounds_msg@PAGE\n";
+        code << "    add x1, x1, __defacto_bounds_msg@PAGEOFF\n";
+        code << "    mov x2, #" << msg.size() << "\n";
+        code << (macos_arm64 ? "    mov x16, #4\n    svc #0x80\n" : "    mov x8, #64\n    svc #0\n");
+        code << "    mov x0, #1\n";
+        code << (macos_arm64 ? "    mov x16, #1\n    svc #0x80\n" : "    mov x8, #93\n    svc #0\n");
+    }
+
+    // A .quad data label for a scalar, pointer or string the IR reaches by name
+    void gen_var_label(Sym sym, const std::string& lb, const std::string& type) {
+        VarInfo& info = new_var(sym);
+        info = VarInfo{};
+        info.lbl = lb;
+        info.type = type;
+        info.is_ptr = (type == "string" || type == "pointer" || type.find('*') == 0);
+        data << lb << ": .quad 0\n";
     }
 
     void gen_var(VarDecl* v) {
         std::string lb = "var_" + v->name;
-        var_lbl[v->name] = lb;
-        var_type[v->name] = v->type;
-        var_is_ptr[v->name] = (v->type == "string" || v->type == "pointer" || v->type.find('*') == 0);
-        
-        if(v->is_const) const_declared.insert(v->name);
-        else declared.insert(v->name);
-        
+        VarInfo& info = new_var(v->sym);
+        info.lbl = lb;
+        info.type = v->type;
+        info.is_ptr = (v->type == "string" || v->type == "pointer" || v->type.find('*') == 0);
+        info.is_const = v->is_const;
+
         if(v->is_arr) {
+            info.arr_size = v->arr_size;
             int esz = (v->type == "u8") ? 1 : 4;
-            data << lb << ": .space " << (v->arr_size * esz) << "\n";
+            if(v->init && v->init->kind == EK::ARRAY) {
+                data << lb << ": " << (esz == 1 ? ".byte " : ".word ");
+                for(size_t i = 0; i < v->init->items.size(); i++) {
+                    long long ev = 0;
+                    const_value(v->init->items[i], ev);
+                    data << (i ? ", " : "") << ev;
+                }
+                data << "\n";
+                int rest = v->arr_size - (int)v->init->items.size();
+                if(rest > 0) data << "    .space " << rest * esz << "\n";
+            } else {
+                data << lb << ": .space " << (v->arr_size * esz) << "\n";
+            }
             return;
         }
-        
+
         if(v->type == "string") {
             std::string sl = "str_" + std::to_string(scnt++);
-            if(!v->init.empty()) {
-                std::string str = v->init;
-                if(str.size() >= 2 && str.front() == '"' && str.back() == '"')
-                    str = str.substr(1, str.size() - 2);
-                data << sl << ": .asciz \"" << str << "\"\n";
+            if(v->init && v->init->kind == EK::STR) {
+                data << sl << ": .asciz \"" << v->init->val << "\"\n";
                 data << lb << ": .quad " << sl << "\n";
             } else {
                 data << lb << ": .quad 0\n";
             }
             return;
         }
-        
-        // Default initialization
-        data << lb << ": .quad " << (v->init.empty() ? "0" : v->init) << "\n";
+
+        if(struct_sizes.count(v->type)) {
+            data << lb << ": .space " << struct_sizes[v->type] << "\n";
+            return;
+        }
+
+        // An SSA value needs no storage
+        if(is_promoted(v->sym)) return;
+        // Default initialization; runtime initializers are emitted as an Assign
+        long long val = 0;
+        if(v->init) const_value(v->init, val);
+        data << lb << ": .quad " << val << "\n";
+    }
+
+    // Every name an instruction refers to must be a variable; pointers are
+    // marked wide (x registers)
+    void resolve(ir::Function& f) {
+        using ir::Op;
+        for(auto bl : f.blocks)
+            for(auto i : bl->insts) {
+                switch(i->op) {
+                    case Op::Load: case Op::Store: case Op::Addr:
+                    case Op::LoadElem: case Op::StoreElem: case Op::LoadField: case Op::StoreField:
+                    case Op::LoadDeref: case Op::StoreDeref:
+                        break;
+                    case Op::Str: case Op::GetReg:
+                        i->wide = true;
+                        continue;
+                    case Op::Call: {
+                        auto c = static_cast<FuncCall*>(i->node);
+                        VarInfo* v = c->result.empty() ? nullptr : find_var(c->result);
+                        i->wide = v && v->is_ptr;
+                        if(c->args.size() > 8)
+                            throw std::runtime_error("call " + c->name + ": more than 8 arguments are not supported on ARM64");
+                        continue;
+                    }
+                    default: continue;
+                }
+                VarInfo* v = find_var(i->sym);
+                if(!v) throw std::runtime_error("undeclared variable '" + i->name + "'");
+                if(v->is_const && (i->op == Op::Store || i->op == Op::StoreElem || i->op == Op::StoreField || i->op == Op::StoreDeref))
+                    throw std::runtime_error("cannot assign to const '" + i->name + "'");
+                if(i->op == Op::LoadField || i->op == Op::StoreField) field_offset(i->expr);
+                i->wide = (i->op == Op::Load && v->is_ptr) || i->op == Op::Addr;
+            }
     }
 
+    // Statements the IR carries as Stmt
     void gen_stmt(Node* n) {
-        if(!n) return;
         switch(n->kind) {
-            case NT::ASSIGN: gen_assign(static_cast<Assign*>(n)); break;
             case NT::DISPLAY: gen_display(static_cast<DisplayNode*>(n)); break;
-            case NT::IF_STMT: gen_if(static_cast<IfNode*>(n)); break;
-            case NT::LOOP: gen_loop(static_cast<LoopNode*>(n)); break;
-            case NT::FOR: gen_for(static_cast<ForNode*>(n)); break;
-            case NT::WHILE: gen_while(static_cast<WhileNode*>(n)); break;
-            case NT::SWITCH_STMT: gen_switch(static_cast<SwitchNode*>(n)); break;
             // case NT::ASM_STMT: gen_asm(static_cast<AsmStmtNode*>(n)); break;  // TODO
             default: break;
         }
     }
 
-    void gen_assign(Assign* a) {
-        // Simple assignment for now
-        load("x0", a->value);
-        store("x0", a->target);
+    // Address of a data label into dst
+    void addr_of(const std::string& dst, const std::string& lb) {
+        code << "    adrp " << dst << ", " << lb << "@PAGE\n";
+        code << "    add " << dst << ", " << dst << ", " << lb << "@PAGEOFF\n";
+    }
+
+    // Base register of an element access: the array address hoist_bases
+    // left as operand k, else formed in x16 here
+    std::string base(const ir::Inst* i, size_t k, const VarInfo& arr) {
+        if(i->ops.size() > k) return use(i->ops[k], "x16");
+        addr_of("x16", arr.lbl);
+        return "x16";
+    }
+
+    void load_imm(const std::string& dst, long long v) {
+        if(v >= -0x10000 && v <= 0xFFFF) {  // movz or movn
+            code << "    mov " << dst << ", #" << v << "\n";
+            return;
+        }
+        unsigned long long u = dst[0] == 'w' ? (unsigned long long)(uint32_t)v : (unsigned long long)v;
+        code << "    movz " << dst << ", #" << (u & 0xFFFF) << "\n";
+        for(int sh = 16; sh < (dst[0] == 'w' ? 32 : 64); sh += 16)
+            if((u >> sh) & 0xFFFF)
+                code << "    movk " << dst << ", #" << ((u >> sh) & 0xFFFF) << ", lsl #" << sh << "\n";
+    }
+
+    int field_offset(const Expr* e) {
+        auto& base = e->lhs->val;
+        auto& fields = struct_field_offsets[var(e->lhs).type];
+        auto it = fields.find(e->val);
+        if(it == fields.end()) throw std::runtime_error("unknown field '" + base + "." + e->val + "'");
+        return it->second;
     }
 
-    void gen_bitwise(const std::string& dst, const std::string& left, const std::string& right, const std::string& op) {
-        load("x0", left);
-        if(is_num(right)) {
-            int val = std::stoi(right);
-            if (val >= 0 && val <= 0xFFFF) {
-                if (op == "&") code << "    and " << dst << ", x0, #" << val << "\n";
-                else if (op == "|") code << "    orr " << dst << ", x0, #" << val << "\n";
-                else if (op == "^") code << "    eor " << dst << ", x0, #" << val << "\n";
+    const char* cond_code(OP op) {
+        switch(op) {
+            case OP::EQ: return "eq"; case OP::NE: return "ne";
+            case OP::LT: return "lt"; case OP::GT: return "gt";
+            case OP::LE: return "le"; default:     return "ge";
+        }
+    }
+
+    const char* inverse_cond(OP op) {
+        switch(op) {
+            case OP::EQ: return "ne"; case OP::NE: return "eq";
+            case OP::LT: return "ge"; case OP::GT: return "le";
+            case OP::LE: return "gt"; default:     return "lt";
+        }
+    }
+
+    // ---- lowering ----
+    // w9-w11 are scratch for operands and results, x16/x17 for addresses;
+    // x0-x7 carry call arguments and the result
+
+    bool in_reg(const ir::Inst* v) const { return !v->is_const() && vreg[v->id] >= 0; }
+    bool placed(const ir::Inst* v) const { return in_reg(v) || !vslot[v->id].empty(); }
+
+    // Register holding v: its own, or scratch loaded with it
+    std::string use(const ir::Inst* v, const std::string& scratch) {
+        const bool w = v->wide;
+        if(in_reg(v)) return w ? xreg(pool[vreg[v->id]]) : pool[vreg[v->id]];
+        const std::string r = w ? xreg(scratch) : scratch;
+        if(v->is_const()) load_imm(r, v->imm);
+        else {
+            code << "    adrp x16, " << vslot[v->id] << "@PAGE\n";
+            code << "    ldr " << r << ", [x16, " << vslot[v->id] << "@PAGEOFF]\n";
+        }
+        return r;
+    }
+    // Right operand of add/sub/cmp: a 12-bit immediate if it fits
+    std::string use_imm(const ir::Inst* v, const std::string& scratch) {
+        if(v->is_const() && v->imm >= 0 && v->imm <= 4095) return "#" + std::to_string(v->imm);
+        return use(v, scratch);
+    }
+
+    // Register an instruction computes v in
+    std::string work(const ir::Inst* v) const {
+        const std::string r = in_reg(v) ? pool[vreg[v->id]] : "w9";
+        return v->wide ? xreg(r) : r;
+    }
+    // v = r, where v lives
+    void put(const ir::Inst* v, const std::string& r) {
+        if(!placed(v)) return;
+        if(in_reg(v)) {
+            const std::string d = v->wide ? xreg(pool[vreg[v->id]]) : pool[vreg[v->id]];
+            if(d != r) code << "    mov " << d << ", " << r << "\n";
+            return;
+        }
+        code << "    adrp x16, " << vslot[v->id] << "@PAGE\n";
+        code << "    str " << (v->wide ? xreg(r) : r) << ", [x16, " << vslot[v->id] << "@PAGEOFF]\n";
+    }
+
+    std::string where(const ir::Inst* v) const { return in_reg(v) ? pool[vreg[v->id]] : vslot[v->id]; }
+
+    // The phis of s take their operands for the edge from b, all at once;
+    // w11 breaks cycles
+    void phi_moves(const ir::Block* b, const ir::Block* s) {
+        struct Move { const ir::Inst* dst; const ir::Inst* src; bool parked; };
+        std::vector<Move> moves;
+        const size_t k = s->pred_index(b);
+        for(auto v : s->insts) {
+            if(v->op != ir::Op::Phi) break;
+            const ir::Inst* o = v->ops[k];
+            if(placed(v) && (o->is_const() || where(o) != where(v))) moves.push_back({v, o, false});
+        }
+        while(!moves.empty()) {
+            size_t i = 0;
+            for(; i < moves.size(); i++) {
+                const std::string d = where(moves[i].dst);
+                bool read = false;
+                for(size_t j = 0; j < moves.size() && !read; j++)
+                    read = j != i && !moves[j].parked && !moves[j].src->is_const() && where(moves[j].src) == d;
+                if(!read) break;
             }
-        } else {
-            load("x1", right);
-            if (op == "&") code << "    and " << dst << ", x0, x1\n";
-            else if (op == "|") code << "    orr " << dst << ", x0, x1\n";
-            else if (op == "^") code << "    eor " << dst << ", x0, x1\n";
-            else if (op == "<<") code << "    lsl " << dst << ", x0, x1\n";
-            else if (op == ">>") code << "    lsr " << dst << ", x0, x1\n";
+            if(i == moves.size()) {
+                const std::string src = use(moves[0].src, "w9");
+                code << "    mov w11, " << src << "\n";
+                moves[0].parked = true;
+                continue;
+            }
+            const ir::Inst* d = moves[i].dst;
+            if(!moves[i].parked && moves[i].src->is_const() && in_reg(d)) load_imm(work(d), moves[i].src->imm);
+            else put(d, moves[i].parked ? "w11" : use(moves[i].src, "w9"));
+            moves.erase(moves.begin() + i);
         }
     }
 
-    void gen_display(DisplayNode* d) {
-        auto it = var_lbl.find(d->var);
-        if(it == var_lbl.end()) return;
-        
-        // Write syscall
-        if (macos_arm64) {
-            code << "    mov x1, 1\n";  // stdout
-            code << "    adrp x0, " << it->second << "@PAGE\n";
-            code << "    add x0, x0, " << it->second << "@PAGEOFF\n";
-            code << "    mov x2, #100\n";  // max length
-            code << "    mov x16, #4\n";   // write syscall
-            code << "    svc #0x80\n";
-        } else {
-            code << "    mov x0, #1\n";  // stdout
-            code << "    adrp x1, " << it->second << "@PAGE\n";
-            code << "    add x1, x1, " << it->second << "@PAGEOFF\n";
-            code << "    mov x2, #100\n";
-            code << "    mov x8, #64\n";  // write syscall
-            code << "    svc #0\n";
+    // Pool registers live across i, saved in pairs around it; a call may
+    // use every one of them
+    std::vector<std::string> save(const ir::Inst* i) {
+        std::vector<std::string> saved;
+        for(auto r : in_regs) {
+            const std::string x = xreg(pool[r->reg]);
+            if(std::find(saved.begin(), saved.end(), x) == saved.end() && lv->live_across(r->value, i)) saved.push_back(x);
         }
+        if(saved.size() % 2) saved.push_back("xzr");
+        for(size_t k = 0; k < saved.size(); k += 2)
+            code << "    stp " << saved[k] << ", " << saved[k + 1] << ", [sp, #-16]!\n";
+        return saved;
+    }
+    void restore(const std::vector<std::string>& saved) {
+        for(size_t k = saved.size(); k >= 2; k -= 2)
+            code << "    ldp " << (saved[k - 2]) << ", " << (saved[k - 1] == "xzr" ? "xzr" : saved[k - 1]) << ", [sp], #16\n";
     }
 
-    void gen_if(IfNode* n) {
-        std::string L = lbl("if_skip");
-        std::string Le = lbl("if_end");
-        
-        // Load and compare
-        load("x0", n->left);
-        if(is_num(n->right)) {
-            code << "    mov x1, #" << n->right << "\n";
-        } else {
-            load("x1", n->right);
+    // cmp of a against b; op is swapped with them when a is a constant
+    void compare(const ir::Inst* a, const ir::Inst* b, OP& op) {
+        if(a->is_const() && !b->is_const()) { std::swap(a, b); op = ir::swap_cmp(op); }
+        const std::string A = use(a, "w9");
+        const std::string B = narrow(use_imm(b, "w10"));
+        code << "    cmp " << narrow(A) << ", " << B << "\n";
+    }
+    static std::string narrow(const std::string& r) { return r[0] == 'x' ? wreg(r) : r; }
+
+    // x / d and x % d truncate like sdiv. A constant d = +-2^k is a shift
+    // of x biased by 2^k - 1 when negative, any other constant a
+    // multiply-high (ir::signed_magic); the rest is sdiv (and msub).
+    void lower_div(const ir::Inst* i) {
+        const ir::Inst* a = i->ops[0];
+        const ir::Inst* b = i->ops[1];
+        const bool mod = i->bop == OP::MOD;
+        const std::string W = work(i);
+        const long long d = b->is_const() ? ir::wrap32(b->imm) : 0;
+        const long long ad = d < 0 ? -d : d;
+        int k;
+        if(ad >= 2 && d != INT32_MIN && ir::power_of_two(ad, k)) {
+            const std::string X = narrow(use(a, "w11"));
+            code << "    asr w9, " << X << ", #31\n";
+            code << "    add w9, " << X << ", w9, lsr #" << 32 - k << "\n";
+            if(mod) {
+                code << "    and w9, w9, #" << -ad << "\n";
+                code << "    sub " << W << ", " << X << ", w9\n";
+            } else if(d < 0) {
+                code << "    asr w9, w9, #" << k << "\n";
+                code << "    neg " << W << ", w9\n";
+            } else code << "    asr " << W << ", w9, #" << k << "\n";
+            put(i, W);
+            return;
         }
-        
-        // Compare and branch
-        code << "    cmp x0, x1\n";
-        if(n->op == "==") code << "    b.ne " << L << "\n";
-        else if(n->op == "!=") code << "    b.eq " << L << "\n";
-        else if(n->op == "<") code << "    b.ge " << L << "\n";
-        else if(n->op == ">") code << "    b.le " << L << "\n";
-        else if(n->op == "<=") code << "    b.gt " << L << "\n";
-        else if(n->op == ">=") code << "    b.lt " << L << "\n";
-        
-        for(auto& s : n->then_body) gen_stmt(s.get());
-        
-        if(!n->else_body.empty()) {
-            code << "    b " << Le << "\n";
-            code << L << ":\n";
-            for(auto& s : n->else_body) gen_stmt(s.get());
-            code << Le << ":\n";
-        } else {
-            code << L << ":\n";
+        if(ad >= 2 && d != INT32_MIN) {
+            const ir::DivMagic m = ir::signed_magic((uint32_t)ad);
+            const std::string X = narrow(use(a, "w11"));
+            load_imm("w10", (int32_t)m.mul);
+            code << "    smull x9, " << X << ", w10\n";
+            if(m.add) {
+                code << "    asr x9, x9, #32\n";
+                code << "    add w9, w9, " << X << "\n";
+                if(m.shift) code << "    asr w9, w9, #" << m.shift << "\n";
+            } else code << "    asr x9, x9, #" << 32 + m.shift << "\n";
+            code << "    add w9, w9, " << X << ", lsr #31\n";
+            if(mod) {
+                load_imm("w10", ad);
+                code << "    msub " << W << ", w9, w10, " << X << "\n";
+            } else if(d < 0) code << "    neg " << W << ", w9\n";
+            else if(W != "w9") code << "    mov " << W << ", w9\n";
+            put(i, W);
+            return;
         }
+        const std::string A = narrow(use(a, "w9"));
+        const std::string B = narrow(use(b, "w10"));
+        if(mod) {
+            code << "    sdiv w11, " << A << ", " << B << "\n";
+            code << "    msub " << W << ", w11, " << B << ", " << A << "\n";
+        } else code << "    sdiv " << W << ", " << A << ", " << B << "\n";
+        put(i, W);
     }
 
-    void gen_loop(LoopNode* l) {
-        std::string ls = lbl("loop_start");
-        std::string le = lbl("loop_end");
-        loop_ends.push_back(le);
-        
-        code << ls << ":\n";
-        for(auto& s : l->body) gen_stmt(s.get());
-        
-        code << "    b " << ls << "\n";
-        code << le << ":\n";
-        loop_ends.pop_back();
+    void lower_bin(const ir::Inst* i) {
+        const ir::Inst* a = i->ops[0];
+        const ir::Inst* b = i->ops[1];
+        OP op = i->bop;
+        const std::string W = work(i);
+        if(is_compare(op)) {
+            compare(a, b, op);
+            code << "    cset " << W << ", " << cond_code(op) << "\n";
+            put(i, W);
+            return;
+        }
+        if(op == OP::DIV || op == OP::MOD) {
+            lower_div(i);
+            return;
+        }
+        if(a->is_const() && !b->is_const() && ir::commutative(op)) std::swap(a, b);
+        const std::string A = narrow(use(a, "w9"));
+        if((op == OP::ADD || op == OP::SUB) && b->is_const() && b->imm >= 0 && b->imm <= 4095) {
+            code << "    " << (op == OP::ADD ? "add " : "sub ") << W << ", " << A << ", #" << b->imm << "\n";
+            put(i, W);
+            return;
+        }
+        if((op == OP::SHL || op == OP::SHR) && b->is_const()) {
+            code << "    " << (op == OP::SHL ? "lsl " : "asr ") << W << ", " << A << ", #" << (b->imm & 31) << "\n";
+            put(i, W);
+            return;
+        }
+        const std::string B = narrow(use(b, "w10"));
+        switch(op) {
+            case OP::ADD: code << "    add " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::SUB: code << "    sub " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::MUL: code << "    mul " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::AND: code << "    and " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::OR:  code << "    orr " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::XOR: code << "    eor " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::SHL: code << "    lsl " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::SHR: code << "    asr " << W << ", " << A << ", " << B << "\n"; break;
+            case OP::LAND:
+                code << "    cmp " << A << ", #0\n";
+                code << "    ccmp " << B << ", #0, #4, ne\n";
+                code << "    cset " << W << ", ne\n";
+                break;
+            default:  // LOR
+                code << "    orr w11, " << A << ", " << B << "\n";
+                code << "    cmp w11, #0\n";
+                code << "    cset " << W << ", ne\n";
+                break;
+        }
+        put(i, W);
     }
 
-    void gen_for(ForNode* f) {
-        std::string fs = lbl("for_start");
-        std::string fe = lbl("for_end");
-        
-        // Init
-        load("x0", f->init_value);
-        store("x0", f->init_var);
-        
-        code << fs << ":\n";
-        
-        // Condition
-        auto it = var_lbl.find(f->init_var);
-        code << "    ldr x0, [x29, #" << it->second << "@PAGEOFF]\n";
-        if(is_num(f->cond_right)) {
-            code << "    mov x1, #" << f->cond_right << "\n";
-        }
-        code << "    cmp x0, x1\n";
-        code << "    b.ge " << fe << "\n";
-        
-        loop_ends.push_back(fe);
-        for(auto& s : f->body) gen_stmt(s.get());
-        loop_ends.pop_back();
-        
-        // Step
-        code << "    ldr x0, [x29, #" << it->second << "@PAGEOFF]\n";
-        code << "    add x0, x0, #1\n";
-        code << "    str x0, [x29, #" << it->second << "@PAGEOFF]\n";
-        
-        code << "    b " << fs << "\n";
-        code << fe << ":\n";
+    void lower_call(const ir::Inst* i) {
+        auto c = static_cast<FuncCall*>(i->node);
+        std::string nm = c->name;
+        if(!nm.empty() && nm[0] == '#') nm = nm.substr(1);
+        auto ar = arity.find(nm);
+        if(ar != arity.end() && ar->second != c->args.size())
+            warn("call #" + nm + ": expects " + std::to_string(ar->second) + " argument(s), got " + std::to_string(c->args.size()));
+        const auto saved = save(i);
+        // Values live in x19-x28 or slots, never in argument registers
+        for(size_t k = 0; k < i->ops.size(); k++) {
+            const ir::Inst* a = i->ops[k];
+            const std::string dst = reg(int(k), !a->wide);
+            const std::string src = use(a, dst);
+            if(src != dst) code << "    mov " << dst << ", " << src << "\n";
+        }
+        code << "    bl " << nm << "\n";
+        restore(saved);
+        put(i, i->wide ? "x0" : "w0");
     }
 
-    void gen_while(WhileNode* w) {
-        std::string ws = lbl("while_start");
-        std::string we = lbl("while_end");
-        
-        code << ws << ":\n";
-        
-        load("x0", w->left);
-        if(is_num(w->right)) {
-            code << "    mov x1, #" << w->right << "\n";
+    void jump(const ir::Block* to, const ir::Block* next) {
+        if(to != next) code << "    b " << block_lbl[to->id] << "\n";
+    }
+
+    // Tail calls (-O1 and up, see ir::tail_position), as in the x86
+    // backend: a call of the fn itself branches back to after its
+    // prologue with the new arguments in x0-x7; a call of another fn
+    // restores x29/x30 and branches, so the callee returns to our caller
+    bool lower_tail_call(const ir::Inst* i) {
+        if(!func || opt_level < 1 || i->ops.size() > 8 || !ir::tail_position(i)) return false;
+        auto c = static_cast<FuncCall*>(i->node);
+        std::string nm = c->name;
+        if(!nm.empty() && nm[0] == '#') nm = nm.substr(1);
+        auto ar = arity.find(nm);
+        if(ar == arity.end() || ar->second != i->ops.size()) return false;
+        const bool self = nm == func_label(func);
+        for(size_t k = 0; k < i->ops.size(); k++) {
+            const ir::Inst* a = i->ops[k];
+            const std::string dst = reg(int(k), !a->wide);
+            const std::string src = use(a, dst);
+            if(src != dst) code << "    mov " << dst << ", " << src << "\n";
+        }
+        if(self) {
+            code << "    b " << tail_entry << "\n";
+            tail_entry_used = true;
         } else {
-            load("x1", w->right);
+            code << "    ldp x29, x30, [sp], #16\n";
+            code << "    b " << nm << "\n";
         }
-        
-        code << "    cmp x0, x1\n";
-        if(w->op == "<") code << "    b.ge " << we << "\n";
-        
-        loop_ends.push_back(we);
-        for(auto& s : w->body) gen_stmt(s.get());
-        loop_ends.pop_back();
-        
-        code << "    b " << ws << "\n";
-        code << we << ":\n";
+        tail_notes.push_back(func_label(func) + ": call #" + nm + (self ? " restarts the function" : " is a jump"));
+        return true;
     }
 
-    void gen_switch(SwitchNode* s) {
-        std::string end = lbl("switch_end");
-        std::vector<std::string> labels;
-        
-        load("x0", s->value);
-        
-        for(size_t i = 0; i < s->cases.size(); i++) {
-            std::string lbl = "case_" + std::to_string(i);
-            labels.push_back(lbl);
-            
-            if(is_num(s->cases[i].first)) {
-                code << "    cmp x0, #" << s->cases[i].first << "\n";
+    // A CondBr testing a value against zero for (in)equality is a cbz/cbnz
+    // and sets no flags
+    static bool zero_test(const ir::Inst* c) {
+        return (c->bop == OP::EQ || c->bop == OP::NE) && c->ops[1]->is_const() && c->ops[1]->imm == 0 && !c->ops[0]->is_const();
+    }
+
+    // The CondBr c of its block, lowered where next follows. A block that
+    // only repeats its predecessor's cmp branches on the flags it left.
+    void cond_branch(const ir::Inst* c, const ir::Block* next) {
+        const ir::Block* bl = c->block;
+        const ir::Inst* a = c->ops[0];
+        const ir::Inst* b = c->ops[1];
+        long long holds;
+        if(a->is_const() && b->is_const() && ir::eval(c->bop, a->imm, b->imm, holds)) {
+            jump(bl->succs[holds ? 0 : 1], next);
+            return;
+        }
+        OP op = c->bop;
+        const ir::Block* t = bl->succs[0];
+        const ir::Block* e = bl->succs[1];
+        if(zero_test(c)) {
+            const std::string A = narrow(use(a, "w9"));
+            if(t == next) code << "    " << (op == OP::EQ ? "cbnz " : "cbz ") << A << ", " << block_lbl[e->id] << "\n";
+            else {
+                code << "    " << (op == OP::EQ ? "cbz " : "cbnz ") << A << ", " << block_lbl[t->id] << "\n";
+                jump(e, next);
             }
-            code << "    b.ne " << lbl << "_next\n";
-            code << "    b " << lbl << "\n";
-            code << lbl << "_next:\n";
+            return;
         }
-        
-        if(!s->default_body.empty()) {
-            code << "    b default_case\n";
-        } else {
-            code << "    b " << end << "\n";
+        const ir::Inst* p = bl->preds.size() == 1 ? bl->preds[0]->term() : nullptr;
+        if(!ir::reuses_compare(p, c, op) || zero_test(p)) { op = c->bop; compare(a, b, op); }
+        if(t == next) code << "    b." << inverse_cond(op) << " " << block_lbl[e->id] << "\n";
+        else {
+            code << "    b." << cond_code(op) << " " << block_lbl[t->id] << "\n";
+            jump(e, next);
         }
-        
-        for(size_t i = 0; i < s->cases.size(); i++) {
-            code << labels[i] << ":\n";
-            for(auto& stmt : s->cases[i].second) gen_stmt(stmt.get());
-            code << "    b " << end << "\n";
+    }
+
+    // Loop rotation (-O2): a back edge into a header that only tests
+    // repeats the test at the bottom of the loop (see the x86 backend)
+    bool rotated(const ir::Block* b, const ir::Block* h) const {
+        if(opt_level < 2 || block_pos[h->id] > block_pos[b->id]) return false;
+        const ir::Inst* t = h->term();
+        if(!t || t->op != ir::Op::CondBr) return false;
+        for(auto i : h->insts) if(i != t && i->op != ir::Op::Phi) return false;
+        for(auto s : h->succs) if(!s->insts.empty() && s->insts.front()->op == ir::Op::Phi) return false;
+        return true;
+    }
+
+    // cmp of w register x against a constant
+    void cmp_imm(const std::string& x, long long v) {
+        if(v >= 0 && v <= 4095) code << "    cmp " << x << ", #" << v << "\n";
+        else if(v < 0 && v >= -4095) code << "    cmn " << x << ", #" << -v << "\n";
+        else {
+            load_imm("w10", v);
+            code << "    cmp " << x << ", w10\n";
         }
-        
-        if(!s->default_body.empty()) {
-            code << "default_case:\n";
-            for(auto& stmt : s->default_body) gen_stmt(stmt.get());
+    }
+
+    // Constant cases: a binary decision tree over the sorted values
+    // (ir::SwitchPlan) with compare chains and bounds-checked jump tables
+    // of .quad addresses at its leaves, after the cases a profile found
+    // hot. Other case sets compare in order.
+    void lower_switch(const ir::Inst* i, const ir::Block* next) {
+        const ir::Block* bl = i->block;
+        const std::string X = narrow(use(i->ops[0], "w11"));
+        ir::SwitchPlan plan;
+        if(!plan.build(i)) {
+            for(size_t k = 1; k < i->ops.size(); k++) {
+                const std::string C = narrow(use_imm(i->ops[k], "w10"));
+                code << "    cmp " << X << ", " << C << "\n";
+                code << "    b.eq " << block_lbl[bl->succs[k - 1]->id] << "\n";
+            }
+            jump(bl->succs.back(), next);
+            return;
+        }
+        for(auto& c : plan.peel(i)) {
+            cmp_imm(X, c.first);
+            code << "    b.eq " << block_lbl[bl->succs[c.second]->id] << "\n";
         }
+        switch_tree(plan, 0, plan.cases.size(), X, bl, next);
+    }
+
+    // plan.cases[from, to); next is the block after the tree, null inside it
+    void switch_tree(const ir::SwitchPlan& plan, size_t from, size_t to, const std::string& x,
+                     const ir::Block* bl, const ir::Block* next) {
+        const std::string& def = block_lbl[bl->succs.back()->id];
+        if(plan.chain(from, to)) {
+            for(size_t k = from; k < to; k++) {
+                cmp_imm(x, plan.cases[k].first);
+                code << "    b.eq " << block_lbl[bl->succs[plan.cases[k].second]->id] << "\n";
+            }
+            if(next) jump(bl->succs.back(), next);
+            else code << "    b " << def << "\n";
+            return;
+        }
+        if(plan.table(from, to)) {
+            const long long lo = plan.cases[from].first;
+            const std::string tbl = lbl("switch_table");
+            if(lo >= 0 && lo <= 4095) code << "    sub w9, " << x << ", #" << lo << "\n";
+            else if(lo < 0 && lo >= -4095) code << "    add w9, " << x << ", #" << -lo << "\n";
+            else {
+                load_imm("w10", lo);
+                code << "    sub w9, " << x << ", w10\n";
+            }
+            cmp_imm("w9", plan.span(from, to) - 1);
+            code << "    b.hi " << def << "\n";
+            addr_of("x16", tbl);
+            code << "    ldr x17, [x16, w9, uxtw #3]\n";
+            code << "    br x17\n";
+            data << "    .p2align 3\n" << tbl << ":\n";
+            for(size_t k = from; k < to; k++) {
+                for(long long gap = k > from ? plan.cases[k - 1].first + 1 : lo; gap < plan.cases[k].first; gap++)
+                    data << "    .quad " << def << "\n";
+                data << "    .quad " << block_lbl[bl->succs[plan.cases[k].second]->id] << "\n";
+            }
+            return;
+        }
+        const size_t mid = from + (to - from) / 2;
+        const std::string upper = lbl("switch_gt");
+        cmp_imm(x, plan.cases[mid].first);
+        code << "    b.eq " << block_lbl[bl->succs[plan.cases[mid].second]->id] << "\n";
+        code << "    b.gt " << upper << "\n";
+        switch_tree(plan, from, mid, x, bl, nullptr);
+        code << upper << ":\n";
+        switch_tree(plan, mid + 1, to, x, bl, next);
+    }
+
+    void lower_inst(const ir::Inst* i, const ir::Block* next) {
+        using ir::Op;
+        const ir::Block* bl = i->block;
+        switch(i->op) {
+            case Op::Const: case Op::Arg: case Op::Phi: return;
+            case Op::Bin: lower_bin(i); return;
+            case Op::Neg: {
+                const std::string W = work(i);
+                const std::string A = narrow(use(i->ops[0], "w9"));
+                code << "    neg " << W << ", " << A << "\n";
+                put(i, W);
+                return;
+            }
+            case Op::Not: {
+                const std::string A = narrow(use(i->ops[0], "w9"));
+                code << "    cmp " << A << ", #0\n";
+                const std::string W = work(i);
+                code << "    cset " << W << ", eq\n";
+                put(i, W);
+                return;
+            }
+            case Op::Str: {
+                std::string sl = "str_" + std::to_string(scnt++);
+                data << sl << ": .asciz \"" << i->expr->val << "\"\n";
+                const std::string W = work(i);
+                addr_of(W, sl);
+                put(i, W);
+                return;
+            }
+            case Op::Addr: {
+                const std::string W = work(i);
+                addr_of(W, find_var(i->sym)->lbl);
+                put(i, W);
+                return;
+            }
+            case Op::Load: {
+                const std::string& lb = find_var(i->sym)->lbl;
+                const std::string W = work(i);
+                code << "    adrp x16, " << lb << "@PAGE\n";
+                code << "    ldr " << W << ", [x16, " << lb << "@PAGEOFF]\n";
+                put(i, W);
+                return;
+            }
+            case Op::Store: {
+                const VarInfo& v = *find_var(i->sym);
+                const ir::Inst* s = i->ops[0];
+                std::string src = use(s, "w9");
+                // Variables are .quad: a 32-bit value is stored sign-extended
+                if(!s->wide && !v.is_ptr) { code << "    sxtw x17, " << src << "\n"; src = "x17"; }
+                else src = xreg(src);
+                code << "    adrp x16, " << v.lbl << "@PAGE\n";
+                code << "    str " << src << ", [x16, " << v.lbl << "@PAGEOFF]\n";
+                return;
+            }
+            case Op::LoadElem: {
+                const VarInfo& arr = *find_var(i->sym);
+                const std::string I = narrow(use(i->ops[0], "w10"));
+                const std::string X = base(i, 1, arr);
+                const std::string W = work(i);
+                if(arr.type == "u8") code << "    ldrb " << W << ", [" << X << ", " << I << ", sxtw]\n";
+                else code << "    ldr " << W << ", [" << X << ", " << I << ", sxtw #2]\n";
+                put(i, W);
+                return;
+            }
+            case Op::StoreElem: {
+                const VarInfo& arr = *find_var(i->sym);
+                const std::string I = narrow(use(i->ops[0], "w10"));
+                const std::string V = narrow(use(i->ops[1], "w9"));
+                const std::string X = base(i, 2, arr);
+                if(arr.type == "u8") code << "    strb " << V << ", [" << X << ", " << I << ", sxtw]\n";
+                else code << "    str " << V << ", [" << X << ", " << I << ", sxtw #2]\n";
+                return;
+            }
+            case Op::LoadField: {
+                addr_of("x16", var(i->expr->lhs).lbl);
+                const std::string W = work(i);
+                code << "    ldr " << W << ", [x16, #" << field_offset(i->expr) << "]\n";
+                put(i, W);
+                return;
+            }
+            case Op::StoreField: {
+                const std::string V = narrow(use(i->ops[0], "w9"));
+                addr_of("x16", var(i->expr->lhs).lbl);
+                code << "    str " << V << ", [x16, #" << field_offset(i->expr) << "]\n";
+                return;
+            }
+            case Op::LoadDeref: {
+                const std::string& lb = find_var(i->sym)->lbl;
+                code << "    adrp x16, " << lb << "@PAGE\n";
+                code << "    ldr x17, [x16, " << lb << "@PAGEOFF]\n";
+                const std::string W = work(i);
+                code << "    ldr " << W << ", [x17]\n";
+                put(i, W);
+                return;
+            }
+            case Op::StoreDeref: {
+                const std::string& lb = find_var(i->sym)->lbl;
+                const std::string V = narrow(use(i->ops[0], "w9"));
+                code << "    adrp x16, " << lb << "@PAGE\n";
+                code << "    ldr x17, [x16, " << lb << "@PAGEOFF]\n";
+                code << "    str " << V << ", [x17]\n";
+                return;
+            }
+            case Op::GetReg: {
+                const std::string W = work(i);
+                code << "    mov " << W << ", " << reg(reg_num(i->name)) << "\n";
+                put(i, W);
+                return;
+            }
+            case Op::SetReg: {
+                const ir::Inst* v = i->ops[0];
+                const std::string src = use(v, "w9");
+                if(v->wide) code << "    mov " << reg(reg_num(i->name)) << ", " << src << "\n";
+                else code << "    sxtw " << reg(reg_num(i->name)) << ", " << src << "\n";
+                return;
+            }
+            // printnum, putchar and color have no ARM64 implementation yet
+            case Op::Print: case Op::PutChar: case Op::Color: return;
+            case Op::Call: lower_call(i); return;
+            case Op::Stmt: gen_stmt(i->node); return;
+            case Op::Check:
+                // An index compares unsigned, so a negative one fails too; a
+                // check moved before a loop bounds its limit, signed
+                cmp_imm(narrow(use(i->ops[0], "w9")), i->imm);
+                code << "    b." << (i->bop == OP::LT ? "hs" : "gt") << " __defacto_bounds\n";
+                return;
+            case Op::Count:
+                addr_of("x16", prof_lbl);
+                if(i->imm > 4095) {
+                    load_imm("x17", 8 * i->imm);
+                    code << "    add x16, x16, x17\n";
+                }
+                code << "    ldr x17, [x16, #" << (i->imm > 4095 ? 0 : 8 * i->imm) << "]\n";
+                code << "    add x17, x17, #1\n";
+                code << "    str x17, [x16, #" << (i->imm > 4095 ? 0 : 8 * i->imm) << "]\n";
+                return;
+            case Op::Br: {
+                const ir::Block* s = bl->succs[0];
+                phi_moves(bl, s);
+                if(rotated(bl, s)) cond_branch(s->term(), next);
+                else jump(s, next);
+                return;
+            }
+            case Op::CondBr: cond_branch(i, next); return;
+            case Op::Switch: {
+                if(bl->succs.size() > 1) lower_switch(i, next);
+                else {
+                    phi_moves(bl, bl->succs[0]);
+                    jump(bl->succs[0], next);
+                }
+                return;
+            }
+            case Op::Ret:
+                if(!i->ops.empty()) {
+                    const ir::Inst* v = i->ops[0];
+                    const std::string src = use(v, "w0");
+                    if(src != "w0" && src != "x0") code << "    mov " << (v->wide ? "x0" : "w0") << ", " << src << "\n";
+                }
+                if(!func) code << "    b " << exit_lbl << "\n";
+                else if(next) code << "    b " << region_end << "\n";
+                return;
+            case Op::End:
+                if(next) { code << "    b " << region_end << "\n"; region_end_used = true; }
+                return;
+        }
+    }
+
+    void lower(ir::Function& f) {
+        Liveness live(f);
+        {
+            TraceScope t("regalloc", f.name);
+            linear_scan(live.ranges, (int)pool.size());
+        }
+        lv = &live;
+        vreg.assign(f.inst_count(), -1);
+        vslot.assign(f.inst_count(), "");
+        in_regs.clear();
+        // Values left in memory share .quad slots where their ranges do not meet
+        std::vector<const LiveRange*> spilled;
+        for(auto& r : live.ranges) {
+            if(r.segs.empty()) continue;
+            if(r.reg >= 0) { vreg[r.value->id] = r.reg; in_regs.push_back(&r); }
+            else spilled.push_back(&r);
+        }
+        std::sort(spilled.begin(), spilled.end(), [](const LiveRange* a, const LiveRange* b) { return a->start() < b->start(); });
+        std::vector<int> slot_end;
+        std::vector<std::string> slots;
+        for(auto r : spilled) {
+            size_t k = 0;
+            while(k < slots.size() && slot_end[k] >= r->start()) k++;
+            if(k == slots.size()) {
+                slots.push_back(lbl("spill"));
+                data << "    .p2align 3\n" << slots.back() << ": .quad 0\n";
+                slot_end.push_back(0);
+            }
+            slot_end[k] = r->segs.back().second;
+            vslot[r->value->id] = slots[k];
+        }
+
+        int nb = 0;
+        for(auto bl : f.blocks) nb = std::max(nb, bl->id + 1);
+        const std::vector<ir::Block*> order = ir::layout(f);  // emission order
+        block_lbl.assign(nb, "");
+        block_pos.assign(nb, 0);
+        for(size_t k = 1; k < f.blocks.size(); k++) block_lbl[f.blocks[k]->id] = lbl(f.blocks[k]->tag);
+        for(size_t k = 0; k < order.size(); k++) block_pos[order[k]->id] = (int)k;
+        if(!func) region_end = lbl("section_end");
+        region_end_used = false;
+
+        // Arguments first, while x0-x7 still hold them
+        for(auto v : f.entry()->insts)
+            if(v->op == ir::Op::Arg) put(v, reg(int(v->imm), true));
+        if(func)
+            for(size_t k = 0; k < func->params.size() && k < 8; k++) {
+                Sym sym = names->find(func->params[k].first);
+                if(is_promoted(sym)) continue;
+                const VarInfo& p = *find_var(sym);
+                code << "    adrp x16, " << p.lbl << "@PAGE\n";
+                code << "    str " << reg(int(k)) << ", [x16, " << p.lbl << "@PAGEOFF]\n";
+            }
+        {
+            TraceScope t("lower", f.name);
+            for(size_t k = 0; k < order.size(); k++) {
+                const ir::Block* bl = order[k];
+                if(k) code << block_lbl[bl->id] << ":\n";
+                const ir::Block* next = k + 1 < order.size() ? order[k + 1] : nullptr;
+                for(auto i : bl->insts) {
+                    // Nothing after a tail call runs: the block ends with it
+                    if(i->op == ir::Op::Call && lower_tail_call(i)) break;
+                    lower_inst(i, next);
+                }
+            }
+        }
+        if(!func && region_end_used) code << region_end << ":\n";
+        lv = nullptr;
+    }
+
+    void gen_display(DisplayNode* d) {
+        VarInfo* it = find_var(d->var);
+        if(!it) return;
         
-        code << end << ":\n";
+        // Write syscall
+        if (macos_arm64) {
+            code << "    mov x1, 1\n";  // stdout
+            code << "    adrp x0, " << it->lbl << "@PAGE\n";
+            code << "    add x0, x0, " << it->lbl << "@PAGEOFF\n";
+            code << "    mov x2, #100\n";  // max length
+            code << "    mov x16, #4\n";   // write syscall
+            code << "    svc #0x80\n";
+        } else {
+            code << "    mov x0, #1\n";  // stdout
+            code << "    adrp x1, " << it->lbl << "@PAGE\n";
+            code << "    add x1, x1, " << it->lbl << "@PAGEOFF\n";
+            code << "    mov x2, #100\n";
+            code << "    mov x8, #64\n";  // write syscall
+            code << "    svc #0\n";
+        }
     }
 
     void gen_func(FuncDecl* f) {
-        std::string nm = f->name;
-        if(!nm.empty() && nm[0] == '#') nm = nm.substr(1);
+        TraceScope trace("gen_func", f->name);
+        std::string nm = func_label(f);
+        
+        // The body goes first so the prologue knows whether it is re-entered
+        std::ostringstream body;
+        code.swap(body);
+        tail_entry = lbl("tail_entry");
+        tail_entry_used = false;
+        
+        // Parameters shadow main's variables of the same name for the body
+        std::vector<std::pair<Sym, VarInfo>> shadowed;
+        for(auto& p : f->params) {
+            Sym sym = names->find(p.first);
+            shadowed.push_back({sym, sym < vars.size() ? vars[sym] : VarInfo{}});
+        }
+        func = f;
+        region_end = lbl("func_ret");
+        gen_section(f->body);
+        func = nullptr;
+        for(auto it = shadowed.rbegin(); it != shadowed.rend(); ++it) new_var(it->first) = it->second;
+        code.swap(body);
         
         code << "\n" << nm << ":\n";
         code << "    stp x29, x30, [sp, #-16]!\n";
         code << "    mov x29, sp\n";
-        
-        gen_section(f->body.get());
-        
+        if(tail_entry_used) code << tail_entry << ":\n";
+        code << body.str();
+        code << region_end << ":\n";
         code << "    ldp x29, x30, [sp], #16\n";
         code << "    ret\n";
     }
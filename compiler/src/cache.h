@@ -0,0 +1,193 @@
+#pragma once
+#include "sha256.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Content-addressed store for finished builds. The key covers the compiler
+// binary, every module's text, the target mode and the external tools, so
+// a hit can skip codegen, assembly and linking. Entries are directories
+// named by key; an entry's mtime is its last use, which drives LRU eviction.
+//
+//   DEFACTO_CACHE_DIR   cache location (default ~/.defacto/cache)
+//   DEFACTO_CACHE_SIZE  size bound in MiB (default 1024)
+class BuildCache {
+    std::filesystem::path root;
+    uint64_t limit = 1024ull << 20;
+    Sha256   key_hash;
+    std::string key;
+    bool enabled = false;
+
+    // Identity of an executable without running it: resolved path, size and mtime
+    static std::string file_id(const std::filesystem::path& p) {
+        std::error_code ec;
+        auto sz = std::filesystem::file_size(p, ec);
+        if (ec) return "missing:" + p.string();
+        auto t = std::filesystem::last_write_time(p, ec).time_since_epoch().count();
+        return p.string() + ":" + std::to_string(sz) + ":" + std::to_string(t);
+    }
+
+    static std::filesystem::path find_tool(const std::string& name) {
+        if (name.find('/') != std::string::npos) return name;
+        const char* path = std::getenv("PATH");
+        std::stringstream ss(path ? path : "");
+        std::string dir;
+        while (std::getline(ss, dir, ':')) {
+            std::error_code ec;
+            auto cand = std::filesystem::path(dir.empty() ? "." : dir) / name;
+            if (std::filesystem::is_regular_file(cand, ec)) return cand;
+        }
+        return name;
+    }
+
+    // Suffix for temporaries, unique across concurrent builds
+    static std::string unique() { return std::to_string(std::random_device{}()); }
+
+    std::filesystem::path entry() const { return root / key.substr(0, 2) / key; }
+
+    struct Stats { uint64_t hits = 0, misses = 0, evictions = 0; };
+
+    Stats load_stats() const {
+        Stats s;
+        std::ifstream f(root / "stats");
+        std::string k; uint64_t v;
+        while (f >> k >> v) {
+            if (k == "hits") s.hits = v;
+            else if (k == "misses") s.misses = v;
+            else if (k == "evictions") s.evictions = v;
+        }
+        return s;
+    }
+
+    // Best effort: concurrent builds may lose an increment, never an entry
+    void bump(uint64_t Stats::* field, uint64_t by = 1) const {
+        Stats s = load_stats();
+        s.*field += by;
+        auto tmp = root / ("stats." + unique());
+        {
+            std::ofstream f(tmp);
+            f << "hits " << s.hits << "\nmisses " << s.misses << "\nevictions " << s.evictions << "\n";
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, root / "stats", ec);
+        if (ec) std::filesystem::remove(tmp, ec);
+    }
+
+    struct Entry { std::filesystem::path dir; uint64_t bytes; std::filesystem::file_time_type used; };
+
+    std::vector<Entry> entries() const {
+        std::vector<Entry> out;
+        std::error_code ec;
+        for (auto& shard : std::filesystem::directory_iterator(root, ec)) {
+            if (!shard.is_directory()) continue;
+            for (auto& e : std::filesystem::directory_iterator(shard.path(), ec)) {
+                if (!e.is_directory() || e.path().filename().string().find('.') != std::string::npos) continue;
+                uint64_t bytes = 0;
+                for (auto& f : std::filesystem::directory_iterator(e.path(), ec))
+                    if (f.is_regular_file()) bytes += f.file_size();
+                out.push_back({e.path(), bytes, std::filesystem::last_write_time(e.path(), ec)});
+            }
+        }
+        return out;
+    }
+
+    void evict() const {
+        auto all = entries();
+        uint64_t total = 0;
+        for (auto& e : all) total += e.bytes;
+        if (total <= limit) return;
+        std::sort(all.begin(), all.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        uint64_t removed = 0;
+        for (auto& e : all) {
+            if (total <= limit) break;
+            std::error_code ec;
+            std::filesystem::remove_all(e.dir, ec);
+            if (!ec) { total -= e.bytes; removed++; }
+        }
+        if (removed) bump(&Stats::evictions, removed);
+    }
+
+public:
+    BuildCache() {
+        if (const char* d = std::getenv("DEFACTO_CACHE_DIR")) root = d;
+        else if (const char* h = std::getenv("HOME")) root = std::filesystem::path(h) / ".defacto" / "cache";
+        if (const char* s = std::getenv("DEFACTO_CACHE_SIZE")) limit = std::strtoull(s, nullptr, 10) << 20;
+    }
+
+    const std::filesystem::path& dir() const { return root; }
+
+    // Starts a key; the compiler's own binary is part of it, so rebuilding
+    // defacto invalidates everything it produced
+    void begin(const char* argv0) {
+        std::error_code ec;
+        auto self = std::filesystem::read_symlink("/proc/self/exe", ec);
+        key_hash.field("defacto-cache-1");
+        key_hash.field(file_id(ec ? find_tool(argv0) : self));
+        enabled = !root.empty() && (std::filesystem::create_directories(root, ec), !ec);
+    }
+
+    void add(std::string_view field)       { key_hash.field(field); }
+    void add_tool(const std::string& name) { key_hash.field(file_id(find_tool(name))); }
+
+    void finish() { key = key_hash.hex(); }
+    const std::string& id() const { return key; }
+
+    // Copies every stored file of a matching entry to dests (by name);
+    // false on a miss or if anything is missing
+    bool fetch(const std::vector<std::pair<std::string, std::string>>& dests) {
+        if (!enabled) return false;
+        auto e = entry();
+        std::error_code ec;
+        bool ok = std::filesystem::is_directory(e, ec);
+        for (auto& d : dests) {
+            if (!ok) break;
+            ok = std::filesystem::copy_file(e / d.first, d.second,
+                                            std::filesystem::copy_options::overwrite_existing, ec) && !ec;
+        }
+        if (!ok) { bump(&Stats::misses); return false; }
+        std::filesystem::last_write_time(e, std::filesystem::file_time_type::clock::now(), ec);
+        bump(&Stats::hits);
+        return true;
+    }
+
+    // Stores the named files under the current key, then evicts least
+    // recently used entries until the cache is back under its bound
+    void store(const std::vector<std::pair<std::string, std::string>>& files) {
+        if (!enabled) return;
+        std::error_code ec;
+        auto e = entry();
+        auto tmp = e.string() + ".tmp" + unique();
+        std::filesystem::create_directories(tmp, ec);
+        if (ec) return;
+        for (auto& f : files) {
+            std::filesystem::copy_file(f.second, std::filesystem::path(tmp) / f.first,
+                                       std::filesystem::copy_options::overwrite_existing, ec);
+            if (ec) { std::filesystem::remove_all(tmp, ec); return; }
+        }
+        // Publish atomically; a racing build of the same key already did the work
+        std::filesystem::rename(tmp, e, ec);
+        if (ec) std::filesystem::remove_all(tmp, ec);
+        evict();
+    }
+
+    void print_stats(std::ostream& os) const {
+        Stats s = load_stats();
+        uint64_t bytes = 0;
+        auto all = entries();
+        for (auto& e : all) bytes += e.bytes;
+        uint64_t lookups = s.hits + s.misses;
+        os << "cache: " << root.string() << "\n"
+           << "  entries:   " << all.size() << "\n"
+           << "  size:      " << bytes / 1024 << " KiB of " << (limit >> 20) << " MiB\n"
+           << "  hits:      " << s.hits << "\n"
+           << "  misses:    " << s.misses << "\n"
+           << "  hit rate:  " << (lookups ? s.hits * 100 / lookups : 0) << "%\n"
+           << "  evictions: " << s.evictions << "\n";
+    }
+};
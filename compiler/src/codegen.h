@@ -1,32 +1,190 @@
 #pragma once
 #include "defacto.h"
+#include "ir.h"
+#include "passes.h"
+#include "peephole.h"
+#include "profile.h"
+#include "regalloc.h"
+#include "trace.h"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
 #include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 class CodeGen {
     std::ostringstream code;
     std::ostringstream data;
+    std::ostringstream rodata;   // switch jump tables
     std::ostringstream externs;  // For extern declarations (malloc, free)
 
-    std::map<std::string,std::string> var_lbl;
-    std::map<std::string,bool> var_is_ptr;
-    std::map<std::string,bool> var_on_heap;  // true if variable allocated on heap
-    std::map<std::string,std::string> var_type;  // variable name -> type name
+    // Everything known about one variable; indexed by the interned name
+    struct VarInfo {
+        std::string lbl, type;
+        bool is_ptr = false;
+        bool on_heap = false;   // true if variable allocated on heap
+        bool is_const = false, declared = false, freed = false;
+        bool driver = false;    // driver constant, never auto-freed
+        int frame = 0;          // fn local: [ebp - frame]; 0 = .data label
+        int arr_size = 0;       // elements of an array, 0 for anything else
+    };
+    const Interner* names = nullptr;
+    std::vector<VarInfo> vars;
+    std::vector<Sym> decl_order;  // auto-free walks variables in declaration order
     std::map<std::string, std::map<std::string, int>> struct_field_offsets;  // struct_type -> (field_name -> offset)
     std::map<std::string, int> struct_sizes;  // struct_type -> total size in bytes
-    std::set<std::string> declared, freed, const_declared, driver_constants;
-    std::vector<std::string> loop_ends;
     int lcnt = 0, scnt = 0;
     bool bare_metal = true;
     bool macos_terminal = false;
     bool linux64_terminal = false;  // Linux 64-bit mode
+    bool x64 = false;               // 64-bit code: either of the two above
     bool arm64_terminal = false;    // ARM64 mode (macOS/Linux)
     bool use_allocator = false;  // Use system allocator (malloc/free)
+    int  jobs = 1;               // threads for function bodies
+    int  opt_level = 2;          // -O0..-O3, see passes.h
+    bool print_ir = false;       // --print-ir: listing of every region after the passes
+    std::ostringstream ir_text;
+    std::string peephole_stats;  // Peephole::report() of the last generate()
+    bool avx2 = false;           // -mavx2: vectorize with ymm registers, else SSE2
+    int  vectorized = 0;         // loops given a vector prefix
+    int  inline_limit = ir::Inliner::default_limit;  // -finline-limit
+    int  inlined = 0;            // calls replaced by the callee's body
+    bool safe = false;           // #SAFE: element accesses check their index
+    int  checks = 0, checks_left = 0, checks_hoisted = 0;  // bounds checks built, in place, before loops
+    std::shared_ptr<const ir::Inliner> inliner;  // built by plan_inlining, shared with the workers
+    // Profile-guided optimization (profile.h). -fprofile-generate: every
+    // region counts its blocks into a record of prof, which the program
+    // writes to prof_path as it ends; -fprofile-use: profile gives the
+    // blocks their counts before the passes run.
+    bool prof_gen = false;
+    std::string prof_path;
+    std::shared_ptr<const ir::Profile> profile;
+    std::ostringstream prof;
+    size_t prof_bytes = 0;                // of the records in prof
+    int  prof_regions = 0, prof_stale = 0;  // instrumented or given counts; profile did not fit
+    std::string prof_lbl;                 // the current region's counters
+    int  main_regions = 0;                // main sections so far: "main", "main.1", ...
 
-    std::string lbl(const std::string& pfx="L") { return pfx+std::to_string(lcnt++); }
-    std::string addr(const std::string& sym) { return macos_terminal ? ("rel "+sym) : sym; }
+    // A function body is generated by a worker CodeGen of its own (see
+    // gen_functions). It reads the main program's variables through outer
+    // and keeps copies of everything it declares or modifies in local, so
+    // workers never write shared state and can run on any thread.
+    const CodeGen* outer = nullptr;
+    std::unordered_map<Sym, VarInfo> local;
+    std::string label_ns;                 // keeps labels unique per function
+    std::vector<std::string> deferred;    // warnings, reported in function order
+    std::vector<std::string> tail_notes;  // calls lowered to jumps, for --report-tail-calls
+    std::string tail_entry;               // fn: label right after the prologue
+    bool tail_entry_used = false;
+    int frame_size = 0;                   // bytes of fn locals below ebp
+
+    // Calling convention. 32-bit: the first two arguments in ecx/edx, the
+    // rest pushed right to left; 64-bit: System V, rdi/rsi/rdx/rcx/r8/r9
+    // then the stack. The caller pops stack arguments; the result is in
+    // eax/rax. extern (C) functions get all 32-bit arguments on the stack.
+    struct Param { Sym sym; std::string in; };  // in: incoming register, "" = stack
+    const FuncDecl* func = nullptr;       // fn being generated by this worker
+    std::vector<Param> params;
+    std::unordered_map<std::string, size_t> arity;  // fn name -> parameter count
+    std::unordered_set<std::string> wide_result;    // fns returning i64 in rax
+    std::vector<std::string> extern_names;
+
+    // Register allocation (regalloc.h). pool is what the allocator may hand
+    // out: ebx/esi/edi (ebx, r10d-r15d in 64-bit) minus every register the
+    // program names as #Rn. Main-section variables that a function or a
+    // second section mentions stay in memory (main_pinned); the scalars of
+    // a region that do not become SSA values of its IR (ir.h).
+    std::vector<std::string> pool;
+    std::vector<bool> main_pinned;
+    std::vector<bool> promoted;           // by symbol, for the current region
+
+    // Lowering of the current region's IR: where each value lives (a pool
+    // register or a slot, by value id) and the label and layout position
+    // of each block
+    const Liveness* lv = nullptr;
+    std::vector<int> vreg;
+    std::vector<std::string> vslot;
+    std::vector<std::string> block_lbl;
+    std::vector<int> block_pos;
+    std::vector<ir::VecLoop> vec_loops;  // the region's vectorizable loops
+    std::vector<int> vec_of;             // by header block id, or -1
+    std::vector<const LiveRange*> in_regs;  // values given a register
+    std::string region_end;               // where End jumps; fn: the epilogue
+    bool region_end_used = false;
+
+    CodeGen(const CodeGen& parent, std::string ns)
+        : names(parent.names), struct_field_offsets(parent.struct_field_offsets),
+          struct_sizes(parent.struct_sizes), bare_metal(parent.bare_metal),
+          macos_terminal(parent.macos_terminal), linux64_terminal(parent.linux64_terminal), x64(parent.x64),
+          arm64_terminal(parent.arm64_terminal), use_allocator(parent.use_allocator),
+          opt_level(parent.opt_level), print_ir(parent.print_ir), avx2(parent.avx2), safe(parent.safe), inliner(parent.inliner),
+          prof_gen(parent.prof_gen), profile(parent.profile), outer(&parent), label_ns(std::move(ns)), pool(parent.pool) {}
+
+    VarInfo* find_var(Sym s){
+        if(outer){
+            auto it=local.find(s);
+            if(it!=local.end()) return &it->second;
+            if(s<outer->vars.size() && !outer->vars[s].lbl.empty()) return &(local[s]=outer->vars[s]);
+            return nullptr;
+        }
+        return s<vars.size() && !vars[s].lbl.empty() ? &vars[s] : nullptr;
+    }
+    VarInfo* find_var(std::string_view name){ return find_var(names->find(name)); }
+    VarInfo& var(Sym s, Str name){
+        VarInfo* v=find_var(s);
+        if(!v) throw std::runtime_error("undefined variable '"+name+"'");
+        return *v;
+    }
+    VarInfo& var(const Expr* e){ return var(e->sym, e->val); }
+    VarInfo& new_var(Sym s){
+        if(outer){
+            auto it=local.find(s);
+            if(it==local.end())
+                it=local.emplace(s, s<outer->vars.size() ? outer->vars[s] : VarInfo{}).first;
+            return it->second;
+        }
+        if(s>=vars.size()) vars.resize(s+1);
+        return vars[s];
+    }
+
+    std::string lbl(const std::string& pfx="L") { return label_ns+pfx+std::to_string(lcnt++); }
+    std::string str_lbl() { return label_ns+"str_"+std::to_string(scnt++); }
+    void cg_warn(const std::string& msg){ if(outer) deferred.push_back(msg); else warn(msg); }
+    std::string addr(const std::string& sym) { return x64 ? ("rel "+sym) : sym; }
+    // System call numbers of 64-bit code: macOS puts the BSD calls in class
+    // 2 (0x2000000 + n), Linux x86-64 numbers them from its own table
+    enum Sys { SYS_READ, SYS_WRITE, SYS_EXIT, SYS_OPEN, SYS_CLOSE };
+    std::string sysno(Sys c) const {
+        static const char* const mac[] = {"0x2000003", "0x2000004", "0x2000001", "0x2000005", "0x2000006"};
+        static const char* const lnx[] = {"0", "1", "60", "2", "3"};
+        return macos_terminal ? mac[c] : lnx[c];
+    }
+    // A scalar as an instruction operand: its register or its dword slot
+    std::string operand(const VarInfo& v) { return "dword ["+mem(v)+"]"; }
+    // Address of a variable inside [], for fn locals relative to the frame pointer
+    std::string mem(const VarInfo& v) {
+        if(v.frame>0) return fp()+"-"+std::to_string(v.frame);
+        if(v.frame<0) return fp()+"+"+std::to_string(-v.frame);  // stack argument
+        return addr(v.lbl);
+    }
+    std::string fp() const { return x64 ? "rbp" : "ebp"; }
+    const CodeGen& root() const { return outer ? *outer : *this; }
+    void load_addr(const std::string& dst, const VarInfo& v){
+        if(v.frame || x64) code<<"    lea "<<dst<<", ["<<mem(v)<<"]\n";
+        else code<<"    mov "<<dst<<", "<<v.lbl<<"\n";
+    }
+    static std::string reg64(const std::string& r32) {
+        return r32[0]=='e' ? "r"+r32.substr(1) : r32.substr(0, r32.size()-1);  // ebx -> rbx, r12d -> r12
+    }
+    static std::string reg32(const std::string& r64) {
+        return r64[1]>='0' && r64[1]<='9' ? r64+"d" : "e"+r64.substr(1);  // rdi -> edi, r8 -> r8d
+    }
+    static bool is_reg64(const std::string& r) { return r.size()>1 && r[0]=='r' && r.back()!='d'; }
 
     std::string reg(const std::string& r) {
         static const std::map<std::string,std::string> m32 = {
@@ -41,7 +199,7 @@ class CodeGen {
             {"#R9","rbx"}, {"#R10","rcx"},{"#R11","rdx"},{"#R12","rsi"},
             {"#R13","rdi"},{"#R14","rax"},{"#R15","rbp"},{"#R16","rsp"}
         };
-        const auto& m = macos_terminal ? m64 : m32;
+        const auto& m = x64 ? m64 : m32;
         auto it=m.find(r); return it!=m.end()?it->second:"eax";
     }
 
@@ -63,262 +221,167 @@ class CodeGen {
         else if(src.size() > 0 && src[0] == '&') {
             // Address-of: &var -> load address of var
             std::string varname = src.substr(1);
-            auto it = var_lbl.find(varname);
-            if(it == var_lbl.end()) throw std::runtime_error("undefined variable '"+varname+"'");
-            code<<"    mov "<<dst<<", "<<addr(it->second)<<"\n";
+            VarInfo* v = find_var(varname);
+            if(!v) throw std::runtime_error("undefined variable '"+varname+"'");
+            load_addr(dst, *v);
         }
         else if(src.size() > 0 && src[0] == '*') {
             // Dereference: *ptr -> load value from pointer
             std::string ptrname = src.substr(1);
-            auto it = var_lbl.find(ptrname);
-            if(it == var_lbl.end()) throw std::runtime_error("undefined pointer '"+ptrname+"'");
-            if(macos_terminal){
+            VarInfo* v = find_var(ptrname);
+            if(!v) throw std::runtime_error("undefined pointer '"+ptrname+"'");
+            if(x64){
                 // 64-bit: load 8-byte pointer
-                code<<"    mov rcx, qword ["<<addr(it->second)<<"]\n";
+                code<<"    mov rcx, qword ["<<mem(*v)<<"]\n";
                 code<<"    mov "<<dst<<", dword [rcx]\n";
             } else {
                 // 32-bit: load 4-byte pointer
-                code<<"    mov ecx, dword ["<<addr(it->second)<<"]\n";
+                code<<"    mov ecx, dword ["<<mem(*v)<<"]\n";
                 code<<"    mov "<<dst<<", dword [ecx]\n";
             }
         }
-        else if(src.size() > 0 && src[0] == '(') {
-            // Expression in parentheses: evaluate it
-            expr(dst, src);
-        }
         else{
             std::string aname, aidx;
             if(parse_arr_ref(src,aname,aidx)){
-                auto it=var_lbl.find(aname);
-                if(it==var_lbl.end()) throw std::runtime_error("undefined array '"+aname+"'");
+                VarInfo* arr=find_var(aname);
+                if(!arr) throw std::runtime_error("undefined array '"+aname+"'");
                 if(is_reg(aidx)) code<<"    mov ecx, "<<reg(aidx)<<"\n";
                 else if(is_num(aidx)) code<<"    mov ecx, "<<aidx<<"\n";
                 else{
-                    auto jt=var_lbl.find(aidx);
-                    if(jt==var_lbl.end()) throw std::runtime_error("undefined variable '"+aidx+"'");
-                    code<<"    mov ecx, dword ["<<addr(jt->second)<<"]\n";
+                    VarInfo* iv=find_var(aidx);
+                    if(!iv) throw std::runtime_error("undefined variable '"+aidx+"'");
+                    code<<"    mov ecx, "<<operand(*iv)<<"\n";
                 }
-                code<<"    mov "<<dst<<", dword ["<<addr(it->second)<<" + ecx*4]\n";
+                code<<"    mov "<<dst<<", dword ["<<mem(*arr)<<" + ecx*4]\n";
                 return;
             }
-            auto it=var_lbl.find(src);
-            if(it==var_lbl.end()) throw std::runtime_error("undefined variable '"+src+"'");
-            if(macos_terminal && var_is_ptr[src]) code<<"    mov "<<dst<<", qword ["<<addr(it->second)<<"]\n";
-            else code<<"    mov "<<dst<<", dword ["<<addr(it->second)<<"]\n";
+            VarInfo* v=find_var(src);
+            if(!v) throw std::runtime_error("undefined variable '"+src+"'");
+            if(x64 && v->is_ptr) code<<"    mov "<<dst<<", qword ["<<mem(*v)<<"]\n";
+            else code<<"    mov "<<dst<<", dword ["<<mem(*v)<<"]\n";
         }
     }
 
-    void store(const std::string& src_reg, const std::string& dst){
-        if(const_declared.count(dst)) throw std::runtime_error("cannot assign to const '"+dst+"'");
-
-        // Check for dereference: *ptr = value
-        if(dst.size() > 0 && dst[0] == '*') {
-            std::string ptrname = dst.substr(1);
-            auto it = var_lbl.find(ptrname);
-            if(it == var_lbl.end()) throw std::runtime_error("undefined pointer '"+ptrname+"'");
-            if(macos_terminal){
-                // 64-bit: load 8-byte pointer
-                code<<"    mov rcx, qword ["<<addr(it->second)<<"]\n";
-                code<<"    mov dword [rcx], "<<src_reg<<"\n";
-            } else {
-                // 32-bit: load 4-byte pointer
-                code<<"    mov ecx, dword ["<<addr(it->second)<<"]\n";
-                code<<"    mov dword [ecx], "<<src_reg<<"\n";
-            }
-            return;
+    // Jump mnemonic taken when "a op b" holds (signed compare)
+    static const char* jcc(OP op){
+        switch(op){
+            case OP::EQ: return "je";  case OP::NE: return "jne";
+            case OP::LT: return "jl";  case OP::GT: return "jg";
+            case OP::LE: return "jle"; case OP::GE: return "jge";
+            default:     return "jmp";
         }
+    }
+    static OP negate(OP op){
+        switch(op){
+            case OP::EQ: return OP::NE; case OP::NE: return OP::EQ;
+            case OP::LT: return OP::GE; case OP::GE: return OP::LT;
+            case OP::GT: return OP::LE; case OP::LE: return OP::GT;
+            default:     return op;
+        }
+    }
 
-        auto it=var_lbl.find(dst);
-        if(it==var_lbl.end()) throw std::runtime_error("undefined variable '"+dst+"'");
-        if(macos_terminal && var_is_ptr[dst]) code<<"    mov qword ["<<addr(it->second)<<"], "<<src_reg<<"\n";
-        else code<<"    mov dword ["<<addr(it->second)<<"], "<<src_reg<<"\n";
+    // Bytes per element: u8 1, i64 8 in 64-bit code, everything else 4
+    int elem_size(const VarInfo& arr) const { return arr.type=="u8" ? 1 : x64 && arr.type=="i64" ? 8 : 4; }
+
+    // Byte offset of struct_var.field
+    int field_offset(const Expr* e){
+        VarInfo& sv=var(e->lhs);
+        auto sit=struct_field_offsets.find(sv.type);
+        if(sit==struct_field_offsets.end()) throw std::runtime_error("'"+e->lhs->val+"' is not a struct");
+        auto fit=sit->second.find(e->val);
+        if(fit==sit->second.end())
+            throw std::runtime_error("unknown field '"+e->val+"' in struct '"+sv.type+"'");
+        return fit->second;
     }
 
-    void expr(const std::string& dst, const std::string& e){
-        // Parse and evaluate nested expressions
-        // Format: ((a+b)*c) or (a+(b*c)) etc.
-        std::string s = e;
-        
-        // Remove outer parentheses if present
-        while (s.size() >= 2 && s[0] == '(' && s[s.size()-1] == ')') {
-            // Check if these parens match each other
-            int depth = 0;
-            bool match = true;
-            for (size_t i = 0; i < s.size(); i++) {
-                if (s[i] == '(') depth++;
-                else if (s[i] == ')') depth--;
-                if (depth == 0 && i < s.size() - 1) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match) {
-                s = s.substr(1, s.size() - 2);
-            } else {
-                break;
-            }
-        }
-        
-        // Find the main operator (lowest precedence first: + or -)
-        // Scan from right to left to handle left-associative operators
-        size_t op_pos = std::string::npos;
-        char op_char = 0;
-        int paren_depth = 0;
-        
-        // First pass: look for + or - (lowest precedence)
-        for (int i = (int)s.size() - 1; i >= 0; i--) {
-            char c = s[i];
-            if (c == ')') paren_depth++;
-            else if (c == '(') paren_depth--;
-            else if (paren_depth == 0 && (c == '+' || c == '-')) {
-                // Make sure it's not part of a negative number
-                if (i == 0 || (s[i-1] != '(' && s[i-1] != '+' && s[i-1] != '-' && s[i-1] != '*' && s[i-1] != '/')) {
-                    op_pos = i;
-                    op_char = c;
-                    break;
-                }
-            }
-        }
-        
-        // Second pass: if no + or -, look for * or / (higher precedence)
-        if (op_pos == std::string::npos) {
-            paren_depth = 0;
-            for (int i = (int)s.size() - 1; i >= 0; i--) {
-                char c = s[i];
-                if (c == ')') paren_depth++;
-                else if (c == '(') paren_depth--;
-                else if (paren_depth == 0 && (c == '*' || c == '/')) {
-                    op_pos = i;
-                    op_char = c;
-                    break;
-                }
-            }
-        }
-        
-        // No operator found: it's a value
-        if (op_pos == std::string::npos) {
-            load(dst, s);
-            return;
-        }
-        
-        // Split into left and right parts
-        std::string left_str = s.substr(0, op_pos);
-        std::string right_str = s.substr(op_pos + 1);
-        char op = op_char;
-        
-        // Evaluate left side first
-        expr(dst, left_str);
-        
-        // Check if right side is an expression
-        if (right_str.size() > 0 && right_str[0] == '(') {
-            // Evaluate right side into edx (not to conflict with dst)
-            if (macos_terminal) {
-                code << "    push r" << dst.substr(1) << "\n";  // Save left result (rax/rbx/etc)
-            } else {
-                code << "    push " << dst << "\n";  // Save left result
-            }
-            expr("edx", right_str);
-            if (macos_terminal) {
-                code << "    pop r" << dst.substr(1) << "\n";  // Restore left result
-            } else {
-                code << "    pop " << dst << "\n";  // Restore left result
-            }
-            // Apply operator
-            if (op == '+') {
-                code << "    add " << dst << ", edx\n";
-            } else if (op == '-') {
-                code << "    sub " << dst << ", edx\n";
-            } else if (op == '*') {
-                code << "    imul " << dst << ", edx\n";
-            } else if (op == '/') {
-                if (macos_terminal) {
-                    code << "    push rdx\n";
-                    code << "    xor edx, edx\n";
-                    code << "    mov ecx, ecx\n";
-                    if (dst != "eax") code << "    mov eax, " << dst << "\n";
-                    code << "    idiv ecx\n";
-                    if (dst != "eax") code << "    mov " << dst << ", eax\n";
-                    code << "    pop rdx\n";
-                } else {
-                    code << "    push edx\n    xor edx, edx\n";
-                    code << "    mov eax, " << dst << "\n";
-                    code << "    idiv ecx\n";
-                    code << "    mov " << dst << ", eax\n";
-                    code << "    pop edx\n";
-                }
-            }
-        } else {
-            // Right side is a simple value
-            auto rhs = [&]()->std::string {
-                if (is_reg(right_str)) return reg(right_str);
-                if (is_num(right_str) || is_hex(right_str)) return right_str;
-                auto it = var_lbl.find(right_str);
-                if (it == var_lbl.end()) throw std::runtime_error("undefined variable '" + right_str + "'");
-                return "dword [" + addr(it->second) + "]";
-            };
-            
-            if (op == '+') {
-                code << "    add " << dst << ", " << rhs() << "\n";
-            } else if (op == '-') {
-                code << "    sub " << dst << ", " << rhs() << "\n";
-            } else if (op == '*') {
-                // imul doesn't support mem operand directly in 64-bit, load to ecx first
-                std::string rhs_val = rhs();
-                if (rhs_val.find('[') != std::string::npos) {
-                    code << "    mov ecx, " << rhs_val << "\n";
-                    code << "    imul " << dst << ", ecx\n";
-                } else {
-                    code << "    imul " << dst << ", " << rhs_val << "\n";
-                }
-            } else if (op == '/') {
-                if (macos_terminal) {
-                    code << "    push rdx\n";
-                    code << "    xor edx, edx\n";
-                    code << "    mov ecx, " << rhs() << "\n";
-                    if (dst != "eax") code << "    mov eax, " << dst << "\n";
-                    code << "    idiv ecx\n";
-                    if (dst != "eax") code << "    mov " << dst << ", eax\n";
-                    code << "    pop rdx\n";
-                } else {
-                    code << "    push edx\n    xor edx, edx\n    mov ecx, " << rhs() << "\n";
-                    if (dst != "eax") code << "    mov eax, " << dst << "\n";
-                    code << "    idiv ecx\n";
-                    if (dst != "eax") code << "    mov " << dst << ", eax\n";
-                    code << "    pop edx\n";
-                }
-            }
+    // Memory operand of struct_var.field
+    std::string field_mem(const Expr* e){
+        const int off=field_offset(e);
+        VarInfo& sv=var(e->lhs);
+        if(x64){
+            code<<"    lea rdx, ["<<mem(sv)<<"]\n";
+            return "dword [rdx + "+std::to_string(off)+"]";
         }
+        return "dword ["+mem(sv)+" + "+std::to_string(off)+"]";
+    }
+
+    // Bytes of a string literal as a db list
+    void emit_str(const std::string& lb, const std::string& s){
+        data<<"    "<<lb<<": db ";
+        for(unsigned char ch : s) data<<static_cast<int>(ch)<<", ";
+        data<<"0\n";
+    }
+
+    // Reserves a frame slot; locals are 4-byte aligned, 8 in 64-bit
+    int frame_slot(int bytes){
+        const int align = x64 ? 8 : 4;
+        frame_size = (frame_size + bytes + align - 1) / align * align;
+        return frame_size;
+    }
+
+    // Whether v is a qword: pointers, and i64 in 64-bit code
+    bool quad(const VarInfo& v) const { return x64 && (v.is_ptr || v.type=="i64"); }
+
+    int var_bytes(const VarDecl* v, const VarInfo& info) const {
+        if(v->is_arr) return v->arr_size * elem_size(info);
+        auto sit = struct_sizes.find(v->type);
+        if(sit != struct_sizes.end()) return sit->second;
+        return quad(info) ? 8 : 4;
     }
 
     void gen_var(VarDecl* v){
         std::string lb="var_"+v->name;
-        var_lbl[v->name]=lb;
-        var_type[v->name]=v->type;  // Store variable type
-        var_is_ptr[v->name]=(v->type=="string"||v->type=="pointer"||v->type.find('*')==0);
-        var_on_heap[v->name]=false;  // By default, variables are on stack/data section
-        if(v->is_const) const_declared.insert(v->name);
-        else declared.insert(v->name);
+        VarInfo& info=new_var(v->sym);
+        if(outer){
+            // fn locals live in the frame; init_frame stores their initial values
+            info=VarInfo{};
+            info.lbl=lb;
+            info.type=v->type;
+            info.is_ptr=(v->type=="string"||v->type=="pointer"||v->type.find('*')==0);
+            info.is_const=v->is_const;
+            if(v->is_arr) info.arr_size=v->arr_size;
+            if(!is_promoted(v->sym)) info.frame=frame_slot(std::max(var_bytes(v, info), 1));
+            return;
+        }
+        info.lbl=lb;
+        info.type=v->type;  // Store variable type
+        info.is_ptr=(v->type=="string"||v->type=="pointer"||v->type.find('*')==0);
+        info.on_heap=false;  // By default, variables are on stack/data section
+        info.is_const=v->is_const;
+        if(!v->is_const && !info.declared){ info.declared=true; decl_order.push_back(v->sym); }
+        const Expr* init=v->init;
+        long long iv=0;
+        bool has_const=init && const_value(init,iv,x64 && v->type=="i64");
         if(v->is_arr){
-            int esz=(v->type=="u8")?1:4;
+            info.arr_size=v->arr_size;
+            const int esz=elem_size(info);
+            if(esz==8) data<<"    align 8\n";
+            if(init && init->kind==EK::ARRAY && !init->items.empty()){
+                // Array initializer: listed elements, rest zero-filled
+                int n=std::min<int>(init->items.size(), v->arr_size);
+                data<<"    "<<lb<<": "<<(esz==1?"db ":esz==8?"dq ":"dd ");
+                for(int i=0;i<n;i++){
+                    long long ev=0;
+                    const_value(init->items[i],ev,esz==8);
+                    data<<(i?", ":"")<<ev;
+                }
+                data<<"\n";
+                if(v->arr_size>n) data<<"    times "<<(v->arr_size-n)*esz<<" db 0\n";
+                return;
+            }
             data<<"    "<<lb<<": times "<<v->arr_size*esz<<" db 0\n"; return;
         }
         if(v->type=="string"){
-            std::string sl="str_"+std::to_string(scnt++);
-            if(!v->init.empty()){
-                std::string s=v->init;
-                if(s.size()>=2 && s.front()=='"' && s.back()=='"') s=s.substr(1,s.size()-2);
-                data<<"    "<<sl<<": db ";
-                for(size_t i=0;i<s.size();++i){
-                    data<<static_cast<int>(static_cast<unsigned char>(s[i]))<<", ";
-                }
-                data<<"0\n";
-                if(macos_terminal){
+            std::string sl=str_lbl();
+            if(init && init->kind==EK::STR){
+                emit_str(sl, init->val);
+                if(x64){
                     data<<"    align 8\n";
                     data<<"    "<<lb<<": dq "<<sl<<"\n";
                 }
                 else data<<"    "<<lb<<": dd "<<sl<<"\n";
             } else {
-                if(macos_terminal){
+                if(x64){
                     data<<"    align 8\n";
                     data<<"    "<<lb<<": dq 0\n";
                 }
@@ -329,33 +392,20 @@ class CodeGen {
         // Check if type is a pointer (*i32, *string, etc.)
         if(v->type.find('*')==0){
             // Pointer variable
-            if(v->init.find('&')==0){
+            if(init && init->kind==EK::ADDR){
                 // Initialize with address: var ptr: *i32 = &x
-                // Need runtime initialization for 64-bit
-                std::string refvar = v->init.substr(1);
-                if(macos_terminal){
+                // 64-bit needs runtime initialization (see gen_section)
+                if(x64){
                     data<<"    align 8\n";
                     data<<"    "<<lb<<": dq 0\n";
-                    // Will be initialized at runtime
-                } else {
-                    data<<"    "<<lb<<": dd var_"+refvar+"\n";
-                }
-            } else if(v->init=="0" || v->init.empty()){
-                // Null or uninitialized pointer
-                if(macos_terminal){
-                    data<<"    align 8\n";
-                    data<<"    "<<lb<<": dq "<<(v->init.empty()?"0":v->init)<<"\n";
                 } else {
-                    data<<"    "<<lb<<": dd "<<(v->init.empty()?"0":v->init)<<"\n";
+                    data<<"    "<<lb<<": dd var_"+init->lhs->val+"\n";
                 }
+            } else if(x64){
+                data<<"    align 8\n";
+                data<<"    "<<lb<<": dq "<<iv<<"\n";
             } else {
-                // Other initializer
-                if(macos_terminal){
-                    data<<"    align 8\n";
-                    data<<"    "<<lb<<": dq "<<v->init<<"\n";
-                } else {
-                    data<<"    "<<lb<<": dd "<<v->init<<"\n";
-                }
+                data<<"    "<<lb<<": dd "<<iv<<"\n";
             }
             return;
         }
@@ -366,26 +416,13 @@ class CodeGen {
             data<<"    "<<lb<<": times "<<sit->second<<" db 0\n";
             return;
         }
-        // Check if initializer is dereference: *ptr - need runtime initialization
-        if(v->init.find('*')==0){
-            // Runtime initialization required - initialize to 0 and assign later
-            std::string ptrname = v->init.substr(1);
-            // Use proper size based on type
-            if(macos_terminal && (v->type=="i64"||v->type=="string"||v->type=="pointer"||v->type.find('*')==0)){
-                data<<"    align 8\n";
-                data<<"    "<<lb<<": dq 0\n";
-            } else {
-                data<<"    "<<lb<<": dd 0\n";
-            }
-            // Store the initialization for later - will be handled in gen_section
-            // For now, just initialize to 0
-            return;
-        }
-        if(macos_terminal && (v->type=="pointer"||v->type.find('*')==0)){
+        // Runtime initializers were turned into assignments by the parser
+        if(!has_const) iv=0;
+        if(x64 && (v->type=="pointer" || v->type=="i64")){
             data<<"    align 8\n";
-            data<<"    "<<lb<<": dq "<<(v->init.empty()?"0":v->init)<<"\n";
+            data<<"    "<<lb<<": dq "<<iv<<"\n";
         } else {
-            data<<"    "<<lb<<": dd "<<(v->init.empty()?"0":v->init)<<"\n";
+            data<<"    "<<lb<<": dd "<<iv<<"\n";
         }
     }
 
@@ -422,13 +459,12 @@ class CodeGen {
     }
 
     void gen_display(DisplayNode* d){
-            auto it=var_lbl.find(d->var);
-            if(it==var_lbl.end()){warn("display: unknown variable '"+d->var+"'");return;}
+            VarInfo* it = find_var(d->var);
+            if(!it){cg_warn("display: unknown variable '"+d->var+"'");return;}
             
             // Check variable type - if i32/i64, use printnum instead
-            auto tit = var_type.find(d->var);
-            if(tit != var_type.end()){
-                std::string type = tit->second;
+            {
+                const std::string& type = it->type;
                 // If it's a numeric type (i32, i64, u8), use printnum
                 if(type == "i32" || type == "i64" || type == "u8"){
                     PrintNumNode pn;
@@ -440,7 +476,7 @@ class CodeGen {
             
             if(bare_metal){
             std::string L=lbl("disp");
-            code<<"    mov esi, dword ["<<it->second<<"]\n";
+            code<<"    mov esi, dword ["<<mem(*it)<<"]\n";
             code<<"    mov edi, dword [__defacto_cursor]\n";
             code<<L<<"_loop:\n";
             code<<"    movzx eax, byte [esi]\n";
@@ -468,30 +504,30 @@ class CodeGen {
             code<<"    mov dword [__defacto_cursor], edi\n";
         } else {
             std::string L=lbl("print");
-            if(macos_terminal){
-                code<<"    mov rsi, qword ["<<addr(it->second)<<"]\n";
+            if(x64){
+                code<<"    mov rsi, qword ["<<mem(*it)<<"]\n";
                 code<<"    mov rcx, rsi\n";
             } else {
-                code<<"    mov esi, dword ["<<addr(it->second)<<"]\n";
+                code<<"    mov esi, dword ["<<mem(*it)<<"]\n";
                 code<<"    mov ecx, esi\n";
             }
             code<<L<<"_len:\n";
-            if(macos_terminal) code<<"    cmp byte [rcx], 0\n";
+            if(x64) code<<"    cmp byte [rcx], 0\n";
             else code<<"    cmp byte [ecx], 0\n";
             code<<"    je "<<L<<"_write\n";
-            if(macos_terminal) code<<"    inc rcx\n";
+            if(x64) code<<"    inc rcx\n";
             else code<<"    inc ecx\n";
             code<<"    jmp "<<L<<"_len\n";
             code<<L<<"_write:\n";
-            if(macos_terminal) code<<"    sub rcx, rsi\n";
+            if(x64) code<<"    sub rcx, rsi\n";
             else code<<"    sub ecx, esi\n";
-            if(macos_terminal){
-                code<<"    mov rax, 0x2000004\n";
+            if(x64){
+                code<<"    mov eax, "<<sysno(SYS_WRITE)<<"\n";
                 code<<"    mov rdi, 1\n";
-                code<<"    mov rsi, qword ["<<addr(it->second)<<"]\n";
+                code<<"    mov rsi, qword ["<<mem(*it)<<"]\n";
                 code<<"    mov rdx, rcx\n";
                 code<<"    syscall\n";
-                code<<"    mov rax, 0x2000004\n";
+                code<<"    mov eax, "<<sysno(SYS_WRITE)<<"\n";
                 code<<"    mov rdi, 1\n";
                 code<<"    lea rsi, ["<<addr(L+"_nl")<<"]\n";
                 code<<"    mov rdx, 1\n";
@@ -500,6 +536,7 @@ class CodeGen {
                 code<<"    mov eax, 4\n";
                 code<<"    mov ebx, 1\n";
                 code<<"    mov edx, ecx\n";
+                code<<"    mov ecx, esi\n";
                 code<<"    int 0x80\n";
                 code<<"    mov eax, 4\n";
                 code<<"    mov ebx, 1\n";
@@ -512,25 +549,57 @@ class CodeGen {
     }
 
     void gen_printnum(PrintNumNode* p){
-        auto it = var_lbl.find(p->var);
-        if(it == var_lbl.end()){
-            warn("printnum: unknown variable '"+p->var+"'");
+        VarInfo* it = find_var(p->var);
+        if(!it){
+            cg_warn("printnum: unknown variable '"+p->var+"'");
             return;
         }
-        
+        if(x64 && it->type=="i64") gen_printnum("qword ["+mem(*it)+"]", true);
+        else gen_printnum(operand(*it));
+    }
+
+    // eax = eax / 10 and ecx = eax % 10, unsigned, by multiply-high
+    // (ir::unsigned_magic) rather than div; clobbers edx
+    void div10(){
+        const ir::DivMagic m=ir::unsigned_magic(10);
+        const char* q=x64 ? "rdx" : "edx";
+        code<<"    mov ecx, eax\n";
+        code<<"    mov edx, "<<m.mul<<"\n";
+        code<<"    mul edx\n";
+        if(m.shift) code<<"    shr edx, "<<m.shift<<"\n";
+        code<<"    lea eax, ["<<q<<" + "<<q<<"*4]\n";
+        code<<"    add eax, eax\n";
+        code<<"    sub ecx, eax\n";
+        code<<"    mov eax, edx\n";
+    }
+
+    // rax = rax / 10 and rcx = rax % 10, unsigned 64-bit, by multiply-high
+    // with ceil(2^67 / 10) and a shift by 3; clobbers rdx
+    void div10_64(){
+        code<<"    mov rcx, rax\n";
+        code<<"    mov rdx, 0xCCCCCCCCCCCCCCCD\n";
+        code<<"    mul rdx\n";
+        code<<"    shr rdx, 3\n";
+        code<<"    lea rax, [rdx + rdx*4]\n";
+        code<<"    add rax, rax\n";
+        code<<"    sub rcx, rax\n";
+        code<<"    mov rax, rdx\n";
+    }
+
+    // Prints the 32-bit operand src (register, memory or immediate); a
+    // wide one is 64-bit, in 64-bit code
+    void gen_printnum(const std::string& src, bool wide=false){
         std::string L = lbl("pnum");
         
         if(bare_metal){
             // Bare-metal: вывод числа через VGA память
             // Алгоритм: делим на 10, получаем цифры, конвертируем в ASCII
-            code<<"    mov eax, dword ["<<addr(it->second)<<"]\n";
-            code<<"    mov ecx, 10\n";
+            code<<"    mov eax, "<<src<<"\n";
             code<<"    mov edi, dword [__defacto_cursor]\n";
             code<<"    xor ebx, ebx  ; счетчик цифр\n";
             code<<L<<"_div:\n";
-            code<<"    xor edx, edx\n";
-            code<<"    div ecx\n";
-            code<<"    push dx  ; сохраняем цифру\n";
+            div10();
+            code<<"    push cx  ; сохраняем цифру\n";
             code<<"    inc ebx\n";
             code<<"    test eax, eax\n";
             code<<"    jnz "<<L<<"_div\n";
@@ -544,23 +613,24 @@ class CodeGen {
             code<<"    dec ebx\n";
             code<<"    jnz "<<L<<"_print\n";
             code<<"    mov dword [__defacto_cursor], edi\n";
-        } else if(macos_terminal){
+        } else if(x64){
             // macOS terminal (64-bit): конвертация числа в строку и вывод
-            code<<"    mov eax, dword ["<<addr(it->second)<<"]\n";
-            code<<"    mov ecx, 10\n";
-            code<<"    sub rsp, 16  ; буфер\n";
+            // 20 digits of a 64-bit value need the larger buffer
+            const int buf=wide ? 32 : 16;
+            if(src!=(wide ? "rax" : "eax")) code<<"    mov "<<(wide ? "rax, " : "eax, ")<<src<<"\n";
+            code<<"    sub rsp, "<<buf<<"  ; буфер\n";
             code<<"    mov rdi, rsp\n";
-            code<<"    mov byte [rdi + 15], 0  ; null терминатор\n";
-            code<<"    mov ebx, 14  ; позиция\n";
+            code<<"    mov byte [rdi + "<<buf-1<<"], 0  ; null терминатор\n";
+            code<<"    mov ebx, "<<buf-2<<"  ; позиция\n";
             code<<"    xor esi, esi  ; счетчик цифр\n";
             code<<L<<"_div:\n";
-            code<<"    xor edx, edx\n";
-            code<<"    div ecx\n";
-            code<<"    add dl, 48\n";
-            code<<"    mov [rdi + rbx], dl\n";
+            if(wide) div10_64();
+            else div10();
+            code<<"    add cl, 48\n";
+            code<<"    mov [rdi + rbx], cl\n";
             code<<"    dec ebx\n";
             code<<"    inc esi\n";
-            code<<"    test eax, eax\n";
+            code<<(wide ? "    test rax, rax\n" : "    test eax, eax\n");
             code<<"    jnz "<<L<<"_div\n";
             code<<"    inc ebx  ; корректировка\n";
             code<<"    mov rsi, rdi\n";
@@ -573,13 +643,13 @@ class CodeGen {
             code<<"    jmp "<<L<<"_len\n";
             code<<L<<"_write:\n";
             code<<"    sub rcx, rsi\n";
-            code<<"    mov rax, 0x2000004\n";
+            code<<"    mov eax, "<<sysno(SYS_WRITE)<<"\n";
             code<<"    mov rdi, 1\n";
             code<<"    mov rdx, rcx\n";
             code<<"    syscall\n";
-            code<<"    add rsp, 16\n";
+            code<<"    add rsp, "<<buf<<"\n";
             // newline
-            code<<"    mov rax, 0x2000004\n";
+            code<<"    mov eax, "<<sysno(SYS_WRITE)<<"\n";
             code<<"    mov rdi, 1\n";
             code<<"    lea rsi, ["<<addr(L+"_nl")<<"]\n";
             code<<"    mov rdx, 1\n";
@@ -587,27 +657,25 @@ class CodeGen {
             data<<"    "<<L<<"_nl: db 10\n";
         } else {
             // Linux terminal: конвертация числа в строку и вывод
-            code<<"    mov eax, dword ["<<addr(it->second)<<"]\n";
-            code<<"    mov ecx, 10\n";
+            code<<"    mov eax, "<<src<<"\n";
             code<<"    sub esp, 16\n";
             code<<"    mov edi, esp\n";
             code<<"    mov byte [edi + 15], 0\n";
             code<<"    mov ebx, 14\n";
             code<<"    xor esi, esi\n";
             code<<L<<"_div:\n";
-            code<<"    xor edx, edx\n";
-            code<<"    div ecx\n";
-            code<<"    add dl, 48\n";
-            code<<"    mov [edi + ebx], dl\n";
+            div10();
+            code<<"    add cl, 48\n";
+            code<<"    mov [edi + ebx], cl\n";
             code<<"    dec ebx\n";
             code<<"    inc esi\n";
             code<<"    test eax, eax\n";
             code<<"    jnz "<<L<<"_div\n";
             code<<"    inc ebx\n";
-            code<<"    mov eax, 4\n";
-            code<<"    mov ebx, 1\n";
             code<<"    mov ecx, edi\n";
             code<<"    add ecx, ebx\n";
+            code<<"    mov eax, 4\n";
+            code<<"    mov ebx, 1\n";
             code<<"    mov edx, esi\n";
             code<<"    int 0x80\n";
             code<<"    add esp, 16\n";
@@ -621,30 +689,19 @@ class CodeGen {
         }
     }
 
-    void gen_color(ColorNode* c){
+    // src: the 32-bit operand holding the attribute byte
+    void gen_color(const std::string& src){
         if(!bare_metal) return;
-        const std::string& v=c->value;
-        if(is_num(v)||is_hex(v)){
-            code<<"    mov al, "<<v<<"\n";
-            code<<"    mov byte [__defacto_attr], al\n";
-            return;
-        }
-        if(is_reg(v)){
-            code<<"    mov eax, "<<reg(v)<<"\n";
-            code<<"    mov byte [__defacto_attr], al\n";
-            return;
-        }
-        auto it=var_lbl.find(v);
-        if(it==var_lbl.end()) throw std::runtime_error("color: undefined variable '"+v+"'");
-        code<<"    mov eax, dword ["<<it->second<<"]\n";
+        if(is_num(src)) code<<"    mov al, "<<src<<"\n";
+        else code<<"    mov eax, "<<src<<"\n";
         code<<"    mov byte [__defacto_attr], al\n";
     }
 
     void gen_readkey(ReadKeyNode* k){
-        auto it=var_lbl.find(k->var);
-        if(it==var_lbl.end()) throw std::runtime_error("readkey: undefined variable '"+k->var+"'");
+        VarInfo* it = find_var(k->var);
+        if(!it) throw std::runtime_error("readkey: undefined variable '"+k->var+"'");
         if(!bare_metal){
-            code<<"    mov dword ["<<addr(it->second)<<"], 0\n";
+            code<<"    mov "<<(quad(*it) ? "qword [" : "dword [")<<mem(*it)<<"], 0\n";
             return;
         }
         std::string L=lbl("key");
@@ -681,18 +738,18 @@ class CodeGen {
         code<<L<<"_5:\n";
         code<<"    mov eax, 53\n";
         code<<L<<"_done:\n";
-        code<<"    mov dword ["<<it->second<<"], eax\n";
+        code<<"    mov dword ["<<mem(*it)<<"], eax\n";
     }
 
     void gen_readchar(ReadCharNode* k){
-        auto it = var_lbl.find(k->var);
-        if(it == var_lbl.end()) throw std::runtime_error("readchar: undefined variable '"+k->var+"'");
+        VarInfo* it = find_var(k->var);
+        if(!it) throw std::runtime_error("readchar: undefined variable '"+k->var+"'");
         
         if(!bare_metal){
             // Terminal mode: читаем 1 байт со stdin
-            if(macos_terminal){
+            if(x64){
                 // macOS: sys_read
-                code<<"    mov rax, 0x2000003\n";
+                code<<"    mov eax, "<<sysno(SYS_READ)<<"\n";
                 code<<"    mov rdi, 0  ; stdin\n";
                 code<<"    sub rsp, 8\n";
                 code<<"    mov rsi, rsp  ; буфер на стеке\n";
@@ -701,7 +758,7 @@ class CodeGen {
                 code<<"    mov eax, dword [rsp]\n";
                 code<<"    add rsp, 8\n";
                 code<<"    and eax, 0xFF  ; только 1 байт\n";
-                code<<"    mov dword ["<<addr(it->second)<<"], eax\n";
+                code<<"    mov "<<(quad(*it) ? "qword [" : "dword [")<<mem(*it)<<"], "<<(quad(*it) ? "rax" : "eax")<<"\n";
             } else {
                 // Linux: sys_read
                 code<<"    mov eax, 3\n";
@@ -713,7 +770,7 @@ class CodeGen {
                 code<<"    mov eax, dword [esp]\n";
                 code<<"    add esp, 4\n";
                 code<<"    and eax, 0xFF\n";
-                code<<"    mov dword ["<<addr(it->second)<<"], eax\n";
+                code<<"    mov dword ["<<mem(*it)<<"], eax\n";
             }
             return;
         }
@@ -846,19 +903,13 @@ class CodeGen {
         code<<L<<"_n:\n    mov eax, 110\n    jmp "<<L<<"_done\n";
         code<<L<<"_m:\n    mov eax, 109\n";
         code<<L<<"_done:\n";
-        code<<"    mov dword ["<<it->second<<"], eax\n";
+        code<<"    mov dword ["<<mem(*it)<<"], eax\n";
     }
 
-    void gen_putchar(PutCharNode* p){
+    // src: the 32-bit operand holding the character
+    void gen_putchar(const std::string& src){
         if(!bare_metal) return;
-        const std::string& v=p->value;
-        if(is_reg(v)) code<<"    mov eax, "<<reg(v)<<"\n";
-        else if(is_num(v)||is_hex(v)) code<<"    mov eax, "<<v<<"\n";
-        else{
-            auto it=var_lbl.find(v);
-            if(it==var_lbl.end()) throw std::runtime_error("putchar: undefined variable '"+v+"'");
-            code<<"    mov eax, dword ["<<it->second<<"]\n";
-        }
+        code<<"    mov eax, "<<src<<"\n";
         std::string L=lbl("putc");
         code<<"    mov edi, dword [__defacto_cursor]\n";
         code<<"    cmp al, 10\n";
@@ -915,222 +966,169 @@ class CodeGen {
         code<<"    jmp "<<L<<"_hang\n";
     }
 
-    void gen_assign(Assign* a){
-        if(const_declared.count(a->target))
-            throw std::runtime_error("cannot assign to const '"+a->target+"'");
-        if(a->is_reg){
-            std::string dst=reg(a->target);
-            if(a->value[0]=='(') expr(dst,a->value); else load(dst,a->value); return;
+    // Counter of "for i = 0 to 10" that was never declared; a frame slot
+    // in fn bodies, so recursive calls get their own
+    VarInfo& for_var(Sym s){
+        VarInfo& v = new_var(s);
+        if(outer) v = VarInfo{};
+        v.lbl = "var_" + names->name(s);
+        v.type = "i32";
+        if(outer) v.frame = frame_slot(4);
+        else data << "    " << v.lbl << ": dd 0\n";
+        return v;
+    }
+
+    // Parameters become locals: register arguments get a frame slot unless
+    // they are SSA values (see lower_arg), stack arguments stay where the
+    // caller pushed them, above the return address
+    void bind_params(){
+        static const char* const r32[] = {"ecx", "edx"};
+        static const char* const r64[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        const size_t nreg = x64 ? 6 : 2;
+        const int word = x64 ? 8 : 4;
+        params.clear();
+        for(size_t i=0;i<func->params.size();i++){
+            const auto& p=func->params[i];
+            Sym s=names->find(p.first);
+            if(!s) continue;
+            VarInfo& v=new_var(s);
+            v=VarInfo{};
+            v.lbl="var_"+p.first;
+            v.type=p.second;
+            v.is_ptr=(p.second=="string"||p.second=="pointer"||p.second.find('*')==0);
+            if(i<nreg){
+                if(!is_promoted(s)) v.frame=frame_slot(word);
+                params.push_back({s, x64 ? r64[i] : r32[i]});
+            } else {
+                v.frame=-(2*word + int(i-nreg)*word);
+                params.push_back({s, ""});
+            }
         }
-        // Check for dereference assignment: *ptr = value
-        if(a->target.size() > 0 && a->target[0] == '*') {
-            std::string ptrname = a->target.substr(1);
-            load("eax", a->value);
-            store("eax", "*" + ptrname);
-            return;
+    }
+
+    bool is_param(Sym s) const {
+        for(auto& p:params) if(p.sym==s) return true;
+        return false;
+    }
+
+    // Whether a fn body's `for` over s gets a counter of its own: only a
+    // variable the main section declares is shared
+    bool own_counter(Sym s){
+        if(s<outer->vars.size() && outer->vars[s].declared) return false;
+        auto it=local.find(s);
+        return it==local.end() || !it->second.frame;
+    }
+
+    // Initial values of fn locals, stored on every call. Variables that
+    // are SSA values start out as constants of the IR instead.
+    void init_frame(SectionNode* s){
+        // Arguments first, while ecx/edx (rdi..r9) still hold them
+        for(auto& p:params){
+            if(is_promoted(p.sym) || p.in.empty()) continue;
+            VarInfo& v=*find_var(p.sym);
+            const bool q=quad(v);
+            code<<"    mov "<<(q ? "qword [" : "dword [")<<mem(v)<<"], "<<(x64 && !q ? reg32(p.in) : p.in)<<"\n";
         }
-        // Check for struct field access: struct.field
-        auto dot_pos = a->target.find('.');
-        if(dot_pos != std::string::npos){
-            std::string struct_var = a->target.substr(0, dot_pos);
-            std::string field_name = a->target.substr(dot_pos + 1);
-            // Look up the variable's type
-            auto tvit = var_type.find(struct_var);
-            if(tvit == var_type.end()){
-                throw std::runtime_error("undefined variable '"+struct_var+"'");
-            }
-            std::string struct_type = tvit->second;
-            // Look up struct layout by type
-            auto sit = struct_field_offsets.find(struct_type);
-            if(sit == struct_field_offsets.end()){
-                // Not a struct, treat as regular variable (backward compatibility)
-            } else {
-                auto fit = sit->second.find(field_name);
-                if(fit == sit->second.end()){
-                    throw std::runtime_error("unknown field '"+field_name+"' in struct '"+struct_type+"'");
-                }
-                auto vit = var_lbl.find(struct_var);
-                if(vit == var_lbl.end()){
-                    throw std::runtime_error("undefined struct variable '"+struct_var+"'");
-                }
-                int offset = fit->second;
-                load("eax", a->value);
-                if(offset == 0){
-                    if(macos_terminal){
-                        code<<"    mov qword [rel "<<vit->second<<"], rax\n";
-                    } else {
-                        code<<"    mov dword ["<<addr(vit->second)<<"], eax\n";
-                    }
+        for(auto d:s->decls){
+            auto v=static_cast<VarDecl*>(d);
+            VarInfo& info=var(v->sym, v->name);
+            if(is_promoted(v->sym)) continue;
+            const std::string m=mem(info);
+            const Expr* init=v->init;
+            long long iv=0;
+            bool has_const=init && const_value(init,iv,x64 && v->type=="i64");
+            if(v->is_arr || struct_sizes.count(v->type)){
+                int bytes=(var_bytes(v, info)+3)/4*4;
+                if(bytes<=32){
+                    for(int o=0;o<bytes;o+=4) code<<"    mov dword ["<<m<<" + "<<o<<"], 0\n";
                 } else {
-                    if(macos_terminal){
-                        // 64-bit: load base address into rbx, then store
-                        code<<"    lea rbx, [rel "<<vit->second<<"]\n";
-                        code<<"    mov dword [rbx + "<<offset<<"], eax\n";
-                    } else {
-                        code<<"    mov ebx, "<<addr(vit->second)<<"\n";
-                        code<<"    mov dword [ebx + "<<offset<<"], eax\n";
+                    // Only ecx: parameters may already sit in edi/esi/ebx
+                    std::string L=lbl("zero");
+                    code<<"    mov ecx, "<<bytes/4<<"\n"<<L<<":\n";
+                    code<<"    mov dword ["<<m<<" + "<<(x64 ? "rcx" : "ecx")<<"*4 - 4], 0\n";
+                    code<<"    dec ecx\n    jnz "<<L<<"\n";
+                }
+                if(v->is_arr && init && init->kind==EK::ARRAY){
+                    int esz=elem_size(info);
+                    int n=std::min<int>(init->items.size(), v->arr_size);
+                    for(int i=0;i<n;i++){
+                        long long ev=0;
+                        const_value(init->items[i],ev,esz==8);
+                        if(!ev) continue;
+                        if(esz==8){
+                            code<<"    mov rax, "<<ev<<"\n";
+                            code<<"    mov qword ["<<m<<" + "<<i*esz<<"], rax\n";
+                        } else code<<"    mov "<<(esz==1?"byte":"dword")<<" ["<<m<<" + "<<i*esz<<"], "<<ev<<"\n";
                     }
                 }
-                return;
+                continue;
             }
-        }
-        if(a->is_arr){
-            auto it=var_lbl.find(a->target);
-            if(it==var_lbl.end()) throw std::runtime_error("undefined array '"+a->target+"'");
-            load("eax",a->value);
-            if(is_reg(a->idx)) code<<"    mov ecx, "<<reg(a->idx)<<"\n";
-            else if(is_num(a->idx)) code<<"    mov ecx, "<<a->idx<<"\n";
-            else{auto jt=var_lbl.find(a->idx);code<<"    mov ecx, dword ["<<addr(jt->second)<<"]\n";}
-            code<<"    mov dword ["<<addr(it->second)<<" + ecx*4], eax\n"; return;
-        }
-        if(a->value[0]=='('){expr("eax",a->value);store("eax",a->target);}
-        else if(is_reg(a->value)) store(reg(a->value),a->target);
-        else if(is_num(a->value)||is_hex(a->value)){
-            auto it=var_lbl.find(a->target);
-            if(it==var_lbl.end()) throw std::runtime_error("undefined variable '"+a->target+"'");
-            code<<"    mov dword ["<<addr(it->second)<<"], "<<a->value<<"\n";
-        } else{load("eax",a->value);store("eax",a->target);}
-    }
-
-    void gen_loop(LoopNode* l){
-        std::string ls=lbl("loop_s"),le=lbl("loop_e");
-        loop_ends.push_back(le);
-        code<<ls<<":\n";
-        for(auto& s:l->body) gen_stmt(s.get());
-        code<<"    jmp "<<ls<<"\n"<<le<<":\n";
-        loop_ends.pop_back();
-    }
-
-    void gen_while(WhileNode* w){
-        std::string ws=lbl("while_s"), we=lbl("while_e");
-        code<<ws<<":\n";
-        // Check condition
-        load("eax", w->left);
-        if(is_num(w->right)) code<<"    cmp eax, "<<w->right<<"\n";
-        else if(is_reg(w->right)) code<<"    cmp eax, "<<reg(w->right)<<"\n";
-        else {
-            auto it=var_lbl.find(w->right);
-            code<<"    cmp eax, dword ["<<addr(it->second)<<"]\n";
-        }
-        // Jump based on operator
-        if(w->op=="==") code<<"    je "<<we<<"\n";
-        else if(w->op=="!=") code<<"    jne "<<we<<"\n";
-        else if(w->op=="<") code<<"    jge "<<we<<"\n";
-        else if(w->op==">") code<<"    jle "<<we<<"\n";
-        else if(w->op=="<=") code<<"    jg "<<we<<"\n";
-        else if(w->op==">=") code<<"    jl "<<we<<"\n";
-        // Body
-        loop_ends.push_back(we);
-        for(auto& s:w->body) gen_stmt(s.get());
-        loop_ends.pop_back();
-        code<<"    jmp "<<ws<<"\n"<<we<<":\n";
-    }
-
-    void gen_for(ForNode* f){
-        std::string fs=lbl("for_s"), fe=lbl("for_e");
-        // Init: var = value
-        // Check if variable exists, if not create it (for new "for i = 0 to 10" syntax)
-        auto it = var_lbl.find(f->init_var);
-        if (it == var_lbl.end()) {
-            // Variable not declared, create it automatically
-            std::string lb = "var_" + f->init_var;
-            var_lbl[f->init_var] = lb;
-            var_type[f->init_var] = "i32";
-            var_is_ptr[f->init_var] = false;
-            var_on_heap[f->init_var] = false;
-            data << "    " << lb << ": dd " << f->init_value << "\n";
-            it = var_lbl.find(f->init_var);
-        } else {
-            // Variable exists, assign init_value
-            if (is_num(f->init_value)) code << "    mov dword [" << addr(it->second) << "], " << f->init_value << "\n";
-            else {
-                load("eax", f->init_value);
-                code << "    mov dword [" << addr(it->second) << "], eax\n";
+            if(quad(info)){
+                if(init && init->kind==EK::STR){
+                    std::string sl=str_lbl();
+                    emit_str(sl, init->val);
+                    code<<"    lea rax, ["<<addr(sl)<<"]\n";
+                } else if(init && init->kind==EK::ADDR) load_addr("rax", var(init->lhs));
+                else code<<"    mov rax, "<<(has_const ? iv : 0)<<"\n";
+                code<<"    mov qword ["<<m<<"], rax\n";
+                continue;
+            }
+            if(init && init->kind==EK::STR){
+                std::string sl=str_lbl();
+                emit_str(sl, init->val);
+                code<<"    mov dword ["<<m<<"], "<<sl<<"\n";
+            } else if(init && init->kind==EK::ADDR && info.is_ptr){
+                load_addr("eax", var(init->lhs));
+                code<<"    mov dword ["<<m<<"], eax\n";
+            } else {
+                code<<"    mov dword ["<<m<<"], "<<(has_const ? iv : 0)<<"\n";
             }
         }
-        code << fs << ":\n";
-        // Check condition
-        load("eax", f->cond_left);
-        if(is_num(f->cond_right)) code<<"    cmp eax, "<<f->cond_right<<"\n";
-        else if(is_reg(f->cond_right)) code<<"    cmp eax, "<<reg(f->cond_right)<<"\n";
-        else {
-            auto jt=var_lbl.find(f->cond_right);
-            code<<"    cmp eax, dword ["<<addr(jt->second)<<"]\n";
-        }
-        // Jump based on operator
-        if(f->cond_op=="==") code<<"    je "<<fe<<"\n";
-        else if(f->cond_op=="!=") code<<"    jne "<<fe<<"\n";
-        else if(f->cond_op=="<") code<<"    jge "<<fe<<"\n";
-        else if(f->cond_op==">") code<<"    jle "<<fe<<"\n";
-        else if(f->cond_op=="<=") code<<"    jg "<<fe<<"\n";
-        else if(f->cond_op==">=") code<<"    jl "<<fe<<"\n";
-        // Body
-        loop_ends.push_back(fe);
-        for(auto& s:f->body) gen_stmt(s.get());
-        loop_ends.pop_back();
-        // Step: var = step_value
-        auto step_it=var_lbl.find(f->step_var);
-        if(step_it==var_lbl.end()) throw std::runtime_error("undefined variable '"+f->step_var+"'");
-        // Parse step expression and store
-        load("eax", f->step_value);
-        code<<"    mov dword ["<<addr(step_it->second)<<"], eax\n";
-        code<<"    jmp "<<fs<<"\n"<<fe<<":\n";
-    }
-
-    void gen_if(IfNode* n){
-        std::string L=lbl("if_skip"), Le=lbl("if_end");
-        load("eax",n->left);
-        if(is_num(n->right))      code<<"    cmp eax, "<<n->right<<"\n";
-        else if(is_reg(n->right)) code<<"    cmp eax, "<<reg(n->right)<<"\n";
-        else{auto it=var_lbl.find(n->right);code<<"    cmp eax, dword ["<<addr(it->second)<<"]\n";}
-        if(n->op=="==")      code<<"    jne "<<L<<"\n";
-        else if(n->op=="!=") code<<"    je  "<<L<<"\n";
-        else if(n->op=="<")  code<<"    jge "<<L<<"\n";
-        else if(n->op==">")  code<<"    jle "<<L<<"\n";
-        else if(n->op=="<=") code<<"    jg  "<<L<<"\n";
-        else if(n->op==">=") code<<"    jl  "<<L<<"\n";
-        for(auto& s:n->then_body) gen_stmt(s.get());
-        if(!n->else_body.empty()){
-            code<<"    jmp "<<Le<<"\n";
-            code<<L<<":\n";
-            for(auto& s:n->else_body) gen_stmt(s.get());
-            code<<Le<<":\n";
-        } else {
-            code<<L<<":\n";
+    }
+
+    // Whether the code for n overwrites pool register r: calls may use any
+    // of them, the I/O helpers use ebx/esi/edi as scratch. In 64-bit code
+    // syscall clobbers r11, and so do malloc and free (runtime.h).
+    bool clobbers(const Node* n, const std::string& r) const {
+        switch(n->kind){
+            case NT::FUNC_CALL: case NT::DRV_CALL: return true;
+            case NT::DISPLAY: case NT::PRINTNUM:  return !x64 || r=="ebx" || r=="r11d";
+            case NT::PUTCHAR: case NT::CLEAR:     return bare_metal;
+            case NT::READCHAR: return !bare_metal && (x64 ? r=="r11d" : r=="ebx");
+            case NT::ALLOC_NODE: case NT::DEALLOC_NODE: return x64 && (r=="r10d" || r=="r11d");
+            default: return false;
         }
     }
 
+    // Statements the IR carries as Stmt: generated from the AST, they
+    // read and write variables by name (those stay in memory)
     void gen_stmt(Node* n){
-        if(!n) return;
         switch(n->kind){
-            case NT::ASSIGN:   gen_assign(static_cast<Assign*>(n)); break;
-            case NT::REG_OP:   {auto r=static_cast<RegOp*>(n); if(r->op=="MOV") load(reg(r->target),r->source); break;}
-            case NT::LOOP:     gen_loop(static_cast<LoopNode*>(n)); break;
-            case NT::WHILE:    gen_while(static_cast<WhileNode*>(n)); break;
-            case NT::FOR:      gen_for(static_cast<ForNode*>(n)); break;
-            case NT::IF_STMT:  gen_if(static_cast<IfNode*>(n)); break;
-            case NT::SWITCH_STMT: gen_switch(static_cast<SwitchNode*>(n)); break;
             case NT::DISPLAY:  gen_display(static_cast<DisplayNode*>(n)); break;
-            case NT::PRINTNUM: gen_printnum(static_cast<PrintNumNode*>(n)); break;
-            case NT::COLOR:    gen_color(static_cast<ColorNode*>(n)); break;
             case NT::READKEY:  gen_readkey(static_cast<ReadKeyNode*>(n)); break;
             case NT::READCHAR: gen_readchar(static_cast<ReadCharNode*>(n)); break;
-            case NT::PUTCHAR:  gen_putchar(static_cast<PutCharNode*>(n)); break;
             case NT::CLEAR:    gen_clear(static_cast<ClearNode*>(n)); break;
             case NT::REBOOT:   gen_reboot(static_cast<RebootNode*>(n)); break;
-            case NT::FREE:     if(const_declared.count(static_cast<FreeNode*>(n)->var))
-                                   throw std::runtime_error("cannot free const '"+static_cast<FreeNode*>(n)->var+"'");
-                               freed.insert(static_cast<FreeNode*>(n)->var);
-                               break;
+            case NT::FREE: {
+                auto fn = static_cast<FreeNode*>(n);
+                VarInfo* v = find_var(fn->var);
+                if(v && v->is_const) throw std::runtime_error("cannot free const '"+fn->var+"'");
+                if(v) v->freed = true;
+                break;
+            }
             case NT::DEALLOC_NODE: {
                 // Generate free() call for heap-allocated memory
                 auto dn = static_cast<DeallocNode*>(n);
-                auto it = var_lbl.find(dn->ptr);
-                if(it != var_lbl.end()){
-                    code<<"    push dword ["<<addr(it->second)<<"]\n";
+                VarInfo* it = find_var(dn->ptr);
+                if(it && x64){
+                    code<<"    mov rdi, qword ["<<mem(*it)<<"]\n";
+                    code<<"    call free\n";
+                    code<<"    mov qword ["<<mem(*it)<<"], 0\n";
+                } else if(it){
+                    code<<"    push dword ["<<mem(*it)<<"]\n";
                     code<<"    call free\n";
                     code<<"    add esp, 4\n";
-                    code<<"    mov dword ["<<addr(it->second)<<"], 0\n";
+                    code<<"    mov dword ["<<mem(*it)<<"], 0\n";
                 }
                 break;
             }
@@ -1138,6 +1136,12 @@ class CodeGen {
                 // Generate malloc() call - result in EAX
                 auto an = static_cast<AllocNode*>(n);
                 std::string size = an->size;
+                if(x64){
+                    // System V: the size in edi, the pointer back in rax
+                    load("edi", size);
+                    code<<"    call malloc\n";
+                    break;
+                }
                 if(is_num(size)){
                     code<<"    push "<<size<<"\n";
                 } else {
@@ -1149,23 +1153,6 @@ class CodeGen {
                 // Result (pointer) is in EAX
                 break;
             }
-            case NT::FUNC_CALL:{
-                std::string nm=static_cast<FuncCall*>(n)->name;
-                if(!nm.empty()&&nm[0]=='#') {
-                    nm=nm.substr(1);
-                    // Check if this is a driver call (keyboard, mouse, volume)
-                    if(nm == "keyboard_driver" || nm == "mouse_driver" || nm == "volume_driver") {
-                        // Extract driver type from name (e.g., "keyboard_driver" -> "keyboard")
-                        std::string drv_type = nm.substr(0, nm.find("_driver"));
-                        code<<"    call __defacto_drv_"<<drv_type<<"\n";
-                    } else {
-                        code<<"    call "<<nm<<"\n";
-                    }
-                } else {
-                    code<<"    call "<<nm<<"\n";
-                }
-                break;
-            }
             case NT::DRV_CALL: {
                 auto dc=static_cast<DriverCall*>(n);
                 if (dc->use_builtin) {
@@ -1185,69 +1172,1326 @@ class CodeGen {
                 }
                 break;
             }
-            case NT::BREAK:    if(loop_ends.empty()) throw std::runtime_error("'stop' outside loop");
-                               code<<"    jmp "<<loop_ends.back()<<"\n"; break;
-            case NT::CONTINUE_STMT: {
-                // Continue jumps to the beginning of the loop
-                // For while/for loops, this is handled by the loop structure
-                if(loop_ends.empty()) throw std::runtime_error("'continue' outside loop");
-                // For now, treat continue same as break (jump to end)
-                // TODO: implement proper continue with loop start labels
-                code<<"    jmp "<<loop_ends.back()<<"\n";
-                break;
-            }
-            case NT::RETURN:   {
-                auto rn = static_cast<ReturnNode*>(n);
-                // Load return value into eax (if provided)
-                if (!rn->value.empty()) {
-                    load("eax", rn->value);
-                }
-                // For now, just return from function
-                // TODO: implement proper function epilogue jump
-                code<<"    mov esp, ebp\n    pop ebp\n    ret\n";
-                break;
-            }
             default: break;
         }
     }
 
+    bool is_promoted(Sym s) const { return s<promoted.size() && promoted[s]; }
+
+    // A region goes through the IR: its scalars that nothing reaches by
+    // name or address become SSA values (kept in pool registers where the
+    // allocator finds room), the passes of -O run over it, and every
+    // instruction is lowered on its own.
     void gen_section(SectionNode* s){
-        for(auto& d:s->decls) gen_var(static_cast<VarDecl*>(d.get()));
+        TraceScope trace("gen_section", outer ? "" : "main");
+        ir::Function f(outer ? func_label(func) : "main");
+        ir::Builder b(f, *names);
+        b.scan(s->decls, s->stmts);
+        promoted.assign(names->size(), false);
+        auto promote_if=[&](Sym sym, std::string_view type){
+            if(!sym || !scalar_type(type) || b.escapes(sym)) return;
+            if(!outer && sym<main_pinned.size() && main_pinned[sym]) return;
+            promoted[sym]=true;
+        };
+        std::vector<Sym> own;  // declared by the region itself
+        if(func) for(auto& p:func->params){ own.push_back(names->find(p.first)); promote_if(own.back(), p.second); }
+        for(auto d:s->decls){
+            auto v=static_cast<VarDecl*>(d);
+            own.push_back(v->sym);
+            long long iv;
+            if(!v->is_arr && (!v->init || const_value(v->init, iv, x64 && v->type=="i64"))) promote_if(v->sym, v->type);
+        }
+        if(func) bind_params();
+        for(auto& d:s->decls) gen_var(static_cast<VarDecl*>(d));
 
-        // Handle address-of initializers FIRST: var ptr: *i32 = &x (runtime init for 64-bit)
-        // This must come before dereference initializers
+        // Address-of initializers need runtime init in 64-bit: var ptr: *i32 = &x
         for(auto& d:s->decls) {
-            auto v = static_cast<VarDecl*>(d.get());
-            if(v->init.find('&')==0 && v->type.find('*')==0){
-                std::string refvar = v->init.substr(1);
-                if(macos_terminal){
-                    // 64-bit: load address into register and store
-                    code<<"    lea rax, [rel var_"<<refvar<<"]\n";
-                    code<<"    mov qword [rel var_"<<v->name<<"], rax\n";
+            auto v = static_cast<VarDecl*>(d);
+            if(!outer && x64 && v->init && v->init->kind==EK::ADDR && v->type.find('*')==0){
+                code<<"    lea rax, [rel var_"<<v->init->lhs->val<<"]\n";
+                code<<"    mov qword [rel var_"<<v->name<<"], rax\n";
+            }
+        }
+
+        // Loop counters nobody declared: SSA values too, or a slot of their own
+        std::vector<Sym> counters;
+        for(Sym fv:b.for_vars()){
+            if(std::find(own.begin(), own.end(), fv)!=own.end()) continue;
+            if(outer ? !own_counter(fv) : find_var(fv)!=nullptr) continue;
+            promote_if(fv, "i32");
+            if(is_promoted(fv)) counters.push_back(fv);
+            else for_var(fv);
+        }
+
+        // i64 computes in 64 bits in 64-bit code (see lower_bin64)
+        if(x64){
+            b.wide_code(func && func->return_type=="i64", root().wide_result);
+            for(auto& l:local) if(l.second.type=="i64") b.widen(l.first);
+            const auto& vs=outer ? outer->vars : vars;
+            for(Sym sym=0; sym<vs.size(); sym++)
+                if(vs[sym].type=="i64" && (!outer || !local.count(sym))) b.widen(sym);
+        }
+        // #SAFE: arr[i] checks i against the array's size (see ir::bce)
+        if(safe){
+            for(auto& l:local) if(l.second.arr_size) b.bound(l.first, l.second.arr_size);
+            const auto& vs=outer ? outer->vars : vars;
+            for(Sym sym=0; sym<vs.size(); sym++)
+                if(vs[sym].arr_size && (!outer || !local.count(sym))) b.bound(sym, vs[sym].arr_size);
+        }
+        for(size_t i=0;i<params.size();i++){
+            if(!is_promoted(params[i].sym)) continue;
+            ir::Inst* a=b.arg(i);
+            a->wide=find_var(params[i].sym)->type=="i64" && x64;
+            b.promote(params[i].sym, a);
+        }
+        for(auto d:s->decls){
+            auto v=static_cast<VarDecl*>(d);
+            if(!is_promoted(v->sym)) continue;
+            long long iv=0;
+            const bool w=x64 && v->type=="i64";
+            if(v->init) const_value(v->init, iv, w);
+            b.promote(v->sym, b.constant(iv, w), v->is_const);
+        }
+        for(Sym c:counters) b.promote(c, b.constant(0));
+        {
+            TraceScope t("build_ir", f.name);
+            b.build(s->stmts);
+        }
+        if(prof_gen || profile){
+            const std::string region=outer ? f.name : main_regions ? "main."+std::to_string(main_regions) : "main";
+            if(!outer) main_regions++;
+            if(prof_gen) gen_prof_record(f, region);
+            else switch(profile->annotate(f, region)){
+                case ir::Profile::MATCHED: prof_regions++; break;
+                case ir::Profile::STALE:
+                    cg_warn("profile of "+region+" does not match the source; not used");
+                    prof_stale++;
+                    break;
+                case ir::Profile::MISSING: break;
+            }
+        }
+        if(inliner) inlined+=inliner->run(f);
+        resolve(f);
+        checks+=count_checks(f, OP::LT);
+        ir::PassManager(opt_level).run(f);
+        checks_left+=count_checks(f, OP::LT);
+        checks_hoisted+=count_checks(f, OP::LE);
+        if(print_ir) ir::print(f, ir_text);
+        f.split_critical_edges();
+        lower(f, s);
+    }
+
+    // Counters for the blocks of f, named region in the profile: a record
+    // of the image gen_prof_dump writes (profile.h)
+    void gen_prof_record(ir::Function& f, const std::string& region){
+        const int n=ir::instrument(f);
+        prof_lbl=lbl("prof");
+        prof<<"    dd "<<region.size()<<", "<<n<<", "<<ir::shape(f)<<", 0\n    db ";
+        for(size_t k=0;k<(region.size()+7)/8*8;k++) prof<<(k ? ", " : "")<<(k<region.size() ? (int)(unsigned char)region[k] : 0);
+        prof<<"\n"<<prof_lbl<<": times "<<n<<" dq 0\n";
+        prof_bytes+=ir::profile_record_bytes(region.size(), n);
+        prof_regions++;
+    }
+
+    static int count_checks(const ir::Function& f, OP kind){
+        int n=0;
+        for(auto bl:f.blocks)
+            for(auto i:bl->insts) n+=i->op==ir::Op::Check && i->bop==kind;
+        return n;
+    }
+
+    // Every name an instruction refers to must be a variable of the region;
+    // 64-bit pointers are marked wide
+    void resolve(ir::Function& f){
+        using ir::Op;
+        for(auto bl:f.blocks)
+            for(auto i:bl->insts){
+                switch(i->op){
+                    case Op::Load: case Op::Store: case Op::Addr:
+                    case Op::LoadElem: case Op::StoreElem: case Op::LoadField: case Op::StoreField:
+                    case Op::LoadDeref: case Op::StoreDeref:
+                        break;
+                    case Op::Str: case Op::GetReg:
+                        i->wide=x64;
+                        continue;
+                    case Op::Call: {
+                        auto c=static_cast<FuncCall*>(i->node);
+                        VarInfo* v=c->result.empty() ? nullptr : find_var(c->result);
+                        std::string nm=c->name;
+                        if(!nm.empty() && nm[0]=='#') nm=nm.substr(1);
+                        i->wide=x64 && ((v && v->is_ptr) || root().wide_result.count(nm));
+                        continue;
+                    }
+                    default: continue;
                 }
+                VarInfo* v=find_var(i->sym);
+                if(!v){
+                    const char* what = i->op==Op::LoadElem || i->op==Op::StoreElem ? "array"
+                                     : i->op==Op::LoadDeref || i->op==Op::StoreDeref ? "pointer" : "variable";
+                    throw std::runtime_error(std::string("undefined ")+what+" '"+i->name+"'");
+                }
+                if(v->is_const && (i->op==Op::Store || i->op==Op::StoreElem || i->op==Op::StoreField || i->op==Op::StoreDeref))
+                    throw std::runtime_error("cannot assign to const '"+i->name+"'");
+                if(i->op==Op::LoadField || i->op==Op::StoreField) field_offset(i->expr);
+                i->wide=(i->op==Op::Load && quad(*v)) || (i->op==Op::LoadElem && elem_size(*v)==8) || (x64 && i->op==Op::Addr);
             }
+    }
+
+    // ---- lowering ----
+
+    bool in_reg(const ir::Inst* v) const { return !v->is_const() && vreg[v->id]>=0; }
+    bool in_mem(const ir::Inst* v) const { return !v->is_const() && vreg[v->id]<0; }
+    // Whether anything reads v, so it has a register or a slot
+    bool placed(const ir::Inst* v) const { return in_reg(v) || !vslot[v->id].empty(); }
+
+    // v as an operand: an immediate, its pool register or its slot
+    std::string at(const ir::Inst* v, bool wide=false) const {
+        if(v->is_const()) return std::to_string(wide ? v->imm : ir::wrap32(v->imm));
+        if(vreg[v->id]>=0) return wide ? reg64(pool[vreg[v->id]]) : pool[vreg[v->id]];
+        return std::string(wide ? "qword [" : "dword [")+vslot[v->id]+"]";
+    }
+
+    // Register an instruction computes v in: v's own, else eax (rax)
+    std::string work(const ir::Inst* v, bool wide=false) const {
+        if(in_reg(v)) return at(v, wide);
+        return wide ? "rax" : "eax";
+    }
+    // The same, unless v's register is also its second operand's
+    std::string work2(const ir::Inst* v, bool wide=false) const {
+        if(in_reg(v) && !(in_reg(v->ops[1]) && vreg[v->ops[1]->id]==vreg[v->id])) return at(v, wide);
+        return wide ? "rax" : "eax";
+    }
+
+    // r = s; a 64-bit r only takes a wide s, a narrow one is zero-extended
+    void fetch(std::string r, const ir::Inst* s){
+        if(is_reg64(r) && !s->wide && !s->is_const()) r=reg32(r);
+        if(s->is_const()){
+            if(s->imm==0) code<<"    xor "<<(is_reg64(r) ? reg32(r) : r)<<", "<<(is_reg64(r) ? reg32(r) : r)<<"\n";
+            else code<<"    mov "<<r<<", "<<(is_reg64(r) ? s->imm : ir::wrap32(s->imm))<<"\n";
+            return;
         }
+        const std::string src=at(s, is_reg64(r));
+        if(src!=r) code<<"    mov "<<r<<", "<<src<<"\n";
+    }
 
-        // Handle dereference initializers SECOND: var y: i32 = *ptr
-        for(auto& d:s->decls) {
-            auto v = static_cast<VarDecl*>(d.get());
-            if(v->init.find('*')==0){
-                std::string ptrname = v->init.substr(1);
-                // Generate: y = *ptr
-                auto assign = std::make_unique<Assign>();
-                assign->target = v->name;
-                assign->value = "*" + ptrname;
-                gen_assign(assign.get());
+    // r = s for a 64-bit r, sign-extending a narrow s (i64 arithmetic)
+    void fetch64(const std::string& r, const ir::Inst* s){
+        if(s->wide || s->is_const()) fetch(r, s);
+        else code<<"    movsxd "<<r<<", "<<at(s)<<"\n";
+    }
+
+    // s as the source operand of a 64-bit instruction: an imm32 or a wide
+    // value where it is, else s in r
+    std::string operand64(const ir::Inst* s, const std::string& r){
+        if(s->is_const() ? ir::fits32(s->imm) : s->wide) return at(s, true);
+        fetch64(r, s);
+        return r;
+    }
+
+    // v = r, where v lives
+    void put(const ir::Inst* v, const std::string& r){
+        if(!placed(v)) return;
+        const std::string d=at(v, is_reg64(r));
+        if(d!=r) code<<"    mov "<<d<<", "<<r<<"\n";
+    }
+
+    // d = s; memory to memory goes through eax, a wide d takes s
+    // sign-extended
+    void move(const ir::Inst* d, const ir::Inst* s){
+        if(d->wide){
+            if(in_reg(d)) fetch64(at(d, true), s);
+            else if(s->is_const() ? ir::fits32(s->imm) : s->wide && in_reg(s)) code<<"    mov "<<at(d, true)<<", "<<at(s, true)<<"\n";
+            else { fetch64("rax", s); code<<"    mov "<<at(d, true)<<", rax\n"; }
+            return;
+        }
+        if(in_reg(d)) fetch(at(d), s);
+        else if(!in_mem(s)) code<<"    mov "<<at(d)<<", "<<at(s)<<"\n";
+        else code<<"    mov eax, "<<at(s)<<"\n    mov "<<at(d)<<", eax\n";
+    }
+
+    // The phis of s take their operands for the edge from b, all at once:
+    // a move goes first when no other one still reads its destination,
+    // and ecx breaks cycles
+    void phi_moves(const ir::Block* b, const ir::Block* s){
+        struct Move { const ir::Inst* dst; const ir::Inst* src; bool parked; };
+        std::vector<Move> moves;
+        const size_t k=s->pred_index(b);
+        for(auto v:s->insts){
+            if(v->op!=ir::Op::Phi) break;
+            const ir::Inst* o=v->ops[k];
+            if(placed(v) && (o->is_const() || at(o)!=at(v) || (v->wide && !o->wide))) moves.push_back({v, o, false});
+        }
+        while(!moves.empty()){
+            size_t i=0;
+            for(; i<moves.size(); i++){
+                const std::string d=at(moves[i].dst);
+                bool read=false;
+                for(size_t j=0; j<moves.size() && !read; j++)
+                    read = j!=i && !moves[j].parked && !moves[j].src->is_const() && at(moves[j].src)==d;
+                if(!read) break;
             }
+            if(i==moves.size()){
+                if(moves[0].dst->wide) fetch64("rcx", moves[0].src);
+                else code<<"    mov ecx, "<<at(moves[0].src)<<"\n";
+                moves[0].parked=true;
+                continue;
+            }
+            if(moves[i].parked) code<<"    mov "<<at(moves[i].dst, moves[i].dst->wide)<<", "<<(moves[i].dst->wide ? "rcx" : "ecx")<<"\n";
+            else move(moves[i].dst, moves[i].src);
+            moves.erase(moves.begin()+i);
         }
+    }
 
-        for(auto& st:s->stmts) gen_stmt(st.get());
+    // Pool registers live across i that it would overwrite, pushed; the
+    // caller pops them with restore()
+    template<class Clobbers>
+    std::vector<std::string> save(const ir::Inst* i, Clobbers clobbered){
+        std::vector<std::string> saved;
+        for(auto r:in_regs){
+            const std::string& reg=pool[r->reg];
+            if(!clobbered(reg) || std::find(saved.begin(), saved.end(), reg)!=saved.end()) continue;
+            if(lv->live_across(r->value, i)) saved.push_back(reg);
+        }
+        for(auto& r:saved) code<<"    push "<<(x64 ? reg64(r) : r)<<"\n";
+        return saved;
+    }
+    void restore(const std::vector<std::string>& saved){
+        for(auto r=saved.rbegin(); r!=saved.rend(); ++r) code<<"    pop "<<(x64 ? reg64(*r) : *r)<<"\n";
+    }
+
+    // cmp of a against b, with the operands swapped (and op with them)
+    // when a is a constant; a register against 0 is a test. 64-bit when
+    // wide (i64 operands) or either side needs it.
+    void compare(const ir::Inst* a, const ir::Inst* b, OP& op, bool wide=false){
+        if(a->is_const() && !b->is_const()){ std::swap(a, b); op=ir::swap_cmp(op); }
+        auto big=[](const ir::Inst* v){ return v->wide || (v->is_const() && !ir::fits32(v->imm)); };
+        if(x64 && (wide || big(a) || big(b))){
+            std::string A=at(a, true);
+            if(!a->wide || (in_mem(a) && in_mem(b))){ fetch64("rax", a); A="rax"; }
+            const std::string B=operand64(b, "rcx");
+            if(b->is_const() && b->imm==0 && A[0]!='q') code<<"    test "<<A<<", "<<A<<"\n";
+            else code<<"    cmp "<<A<<", "<<B<<"\n";
+            return;
+        }
+        std::string A=at(a);
+        if(a->is_const() || (in_mem(a) && in_mem(b))){ fetch("eax", a); A="eax"; }
+        if(b->is_const() && b->imm==0 && A[0]!='d') code<<"    test "<<A<<", "<<A<<"\n";
+        else code<<"    cmp "<<A<<", "<<at(b)<<"\n";
+    }
+
+    static const char* setcc(OP op){
+        switch(op){
+            case OP::EQ: return "sete";  case OP::NE: return "setne";
+            case OP::LT: return "setl";  case OP::GT: return "setg";
+            case OP::LE: return "setle"; default:     return "setge";
+        }
+    }
+
+    // Memory operand of arr[idx]; the index goes through ecx from a slot
+    std::string elem_at(const VarInfo& arr, const ir::Inst* idx){
+        const int esz=elem_size(arr);
+        const std::string sz = esz==1 ? "byte" : esz==8 ? "qword" : "dword", scale = esz==1 ? "" : "*"+std::to_string(esz);
+        std::string base=mem(arr);
+        if(x64){
+            code<<"    lea rdx, ["<<base<<"]\n";
+            base="rdx";
+        }
+        if(idx->is_const()) return sz+" ["+base+" + "+std::to_string(idx->imm*esz)+"]";
+        std::string r;
+        if(in_reg(idx)) r=at(idx, x64);
+        else {
+            code<<"    mov ecx, "<<at(idx)<<"\n";
+            r=x64 ? "rcx" : "ecx";
+        }
+        return sz+" ["+base+" + "+r+scale+"]";
+    }
+
+    // Source operand of a 32-bit store of v: an immediate, a register, or
+    // v loaded into eax
+    std::string store_src(const ir::Inst* v){
+        if(!in_mem(v)) return at(v);
+        fetch("eax", v);
+        return "eax";
+    }
+
+    // x / d and x % d round toward zero like idiv. A constant d = +-2^k is
+    // a shift of x biased by 2^k - 1 when negative, any other constant a
+    // multiply-high (ir::signed_magic); d = -1 and variables use idiv,
+    // which traps where it should.
+    void lower_div(const ir::Inst* i){
+        const ir::Inst* a=i->ops[0];
+        const ir::Inst* b=i->ops[1];
+        const bool mod=i->bop==OP::MOD;
+        const long long d=b->is_const() ? ir::wrap32(b->imm) : 0;
+        const long long ad=d<0 ? -d : d;
+        int k;
+        if(ad>=2 && d!=INT32_MIN && ir::power_of_two(ad, k)){
+            fetch("eax", a);
+            code<<"    cdq\n";
+            code<<"    and edx, "<<ad-1<<"\n";
+            if(mod){
+                code<<"    add edx, eax\n";
+                code<<"    and edx, "<<-ad<<"\n";
+                code<<"    sub eax, edx\n";
+            } else {
+                code<<"    add eax, edx\n";
+                code<<"    sar eax, "<<k<<"\n";
+                if(d<0) code<<"    neg eax\n";
+            }
+            put(i, "eax");
+            return;
+        }
+        if(ad>=2 && d!=INT32_MIN){
+            const ir::DivMagic m=ir::signed_magic((uint32_t)ad);
+            std::string X=at(a);
+            if(a->is_const()){ fetch("ecx", a); X="ecx"; }
+            code<<"    mov eax, "<<(int32_t)m.mul<<"\n";
+            code<<"    imul "<<X<<"\n";
+            if(m.add) code<<"    add edx, "<<X<<"\n";
+            if(m.shift) code<<"    sar edx, "<<m.shift<<"\n";
+            code<<"    mov eax, "<<X<<"\n";
+            code<<"    shr eax, 31\n";
+            code<<"    add edx, eax\n";
+            if(mod){
+                code<<"    imul edx, edx, "<<ad<<"\n";
+                code<<"    mov eax, "<<X<<"\n";
+                code<<"    sub eax, edx\n";
+                put(i, "eax");
+            } else {
+                if(d<0) code<<"    neg edx\n";
+                put(i, "edx");
+            }
+            return;
+        }
+        fetch("eax", a);
+        code<<"    cdq\n";
+        if(b->is_const()){ code<<"    mov ecx, "<<b->imm<<"\n    idiv ecx\n"; }
+        else code<<"    idiv "<<at(b)<<"\n";
+        put(i, mod ? "edx" : "eax");
+    }
+
+    // i64 arithmetic in 64-bit code: the same instructions on 64-bit
+    // registers, narrow operands sign-extended and immediates that do not
+    // fit an imm32 in rcx. Division is always idiv.
+    void lower_bin64(const ir::Inst* i){
+        const ir::Inst* a=i->ops[0];
+        const ir::Inst* b=i->ops[1];
+        OP op=i->bop;
+        if(op==OP::DIV || op==OP::MOD){
+            fetch64("rax", a);
+            if(b->is_const()) fetch("rcx", b);
+            const std::string B=b->is_const() ? "rcx" : operand64(b, "rcx");
+            code<<"    cqo\n    idiv "<<B<<"\n";
+            put(i, op==OP::MOD ? "rdx" : "rax");
+            return;
+        }
+        if(a->is_const() && !b->is_const() && ir::commutative(op)) std::swap(a, b);
+        const std::string W = a==i->ops[0] ? work2(i, true) : work(i, true);
+        if(op==OP::SHL || op==OP::SHR){
+            const char* mn = op==OP::SHL ? "shl" : "sar";
+            if(b->is_const()){
+                fetch64(W, a);
+                code<<"    "<<mn<<" "<<W<<", "<<(b->imm & 63)<<"\n";
+            } else {
+                fetch("ecx", b);
+                fetch64(W, a);
+                code<<"    "<<mn<<" "<<W<<", cl\n";
+            }
+            put(i, W);
+            return;
+        }
+        if(op==OP::MUL && b->is_const() && ir::fits32(b->imm) && !a->is_const()){
+            std::string A=at(a, true);
+            if(!a->wide){ fetch64(W, a); A=W; }
+            code<<"    imul "<<W<<", "<<A<<", "<<b->imm<<"\n";
+            put(i, W);
+            return;
+        }
+        const char* mn;
+        switch(op){
+            case OP::ADD: mn="add"; break;  case OP::SUB: mn="sub"; break;
+            case OP::AND: mn="and"; break;  case OP::OR:  mn="or";  break;
+            case OP::XOR: mn="xor"; break;  default:      mn="imul"; break;
+        }
+        fetch64(W, a);
+        const std::string B=operand64(b, "rcx");
+        code<<"    "<<mn<<" "<<W<<", "<<B<<"\n";
+        put(i, W);
+    }
+
+    void lower_bin(const ir::Inst* i){
+        const ir::Inst* a=i->ops[0];
+        const ir::Inst* b=i->ops[1];
+        OP op=i->bop;
+        if(is_compare(op)){
+            compare(a, b, op, i->wide);
+            const std::string W=work(i);
+            code<<"    "<<setcc(op)<<" al\n    movzx "<<W<<", al\n";
+            put(i, i->wide ? reg64(W) : W);
+            return;
+        }
+        if(op==OP::LAND || op==OP::LOR){
+            // Both sides reduced to 0/1, then combined bitwise
+            const bool q=x64 && (a->wide || b->wide);
+            fetch(q ? "rax" : "eax", a);
+            code<<(q ? "    test rax, rax\n" : "    test eax, eax\n")<<"    setne al\n    movzx eax, al\n";
+            fetch(q ? "rcx" : "ecx", b);
+            code<<(q ? "    test rcx, rcx\n" : "    test ecx, ecx\n")<<"    setne cl\n    movzx ecx, cl\n";
+            code<<"    "<<(op==OP::LAND ? "and" : "or")<<" eax, ecx\n";
+            put(i, i->wide ? "rax" : "eax");
+            return;
+        }
+        if(i->wide){
+            lower_bin64(i);
+            return;
+        }
+        if(op==OP::DIV || op==OP::MOD){
+            lower_div(i);
+            return;
+        }
+        if(a->is_const() && !b->is_const() && ir::commutative(op)) std::swap(a, b);
+        const std::string W = a==i->ops[0] ? work2(i) : work(i);
+        if(op==OP::SHL || op==OP::SHR){
+            const char* mn = op==OP::SHL ? "shl" : "sar";
+            if(b->is_const()){
+                fetch(W, a);
+                code<<"    "<<mn<<" "<<W<<", "<<(b->imm & 31)<<"\n";
+            } else {
+                fetch("ecx", b);
+                fetch(W, a);
+                code<<"    "<<mn<<" "<<W<<", cl\n";
+            }
+            put(i, W);
+            return;
+        }
+        if(op==OP::MUL && b->is_const() && !a->is_const()){
+            code<<"    imul "<<W<<", "<<at(a)<<", "<<b->imm<<"\n";
+            put(i, W);
+            return;
+        }
+        const char* mn;
+        switch(op){
+            case OP::ADD: mn="add"; break;  case OP::SUB: mn="sub"; break;
+            case OP::AND: mn="and"; break;  case OP::OR:  mn="or";  break;
+            case OP::XOR: mn="xor"; break;  default:      mn="imul"; break;
+        }
+        fetch(W, a);
+        code<<"    "<<mn<<" "<<W<<", "<<at(b)<<"\n";
+        put(i, W);
+    }
+
+    void lower_call(const ir::Inst* i){
+        static const char* const r32[] = {"ecx", "edx"};
+        static const char* const w64[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        auto c=static_cast<FuncCall*>(i->node);
+        std::string nm=c->name;
+        if(!nm.empty() && nm[0]=='#') nm=nm.substr(1);
+        const CodeGen& r=root();
+        auto ar=r.arity.find(nm);
+        if(ar!=r.arity.end() && ar->second!=c->args.size())
+            cg_warn("call #"+nm+": expects "+std::to_string(ar->second)+" argument(s), got "+std::to_string(c->args.size()));
+        const bool cdecl32=!x64 && std::find(r.extern_names.begin(), r.extern_names.end(), nm)!=r.extern_names.end();
+        const size_t nargs=i->ops.size();
+        const size_t nreg=std::min(nargs, cdecl32 ? size_t(0) : x64 ? size_t(6) : size_t(2));
+        // The callee may use every pool register
+        const auto saved=save(i, [](const std::string&){ return true; });
+        // 64-bit code passes every argument sign-extended, for i64 parameters
+        for(size_t k=nargs; k-- > nreg;){
+            const ir::Inst* a=i->ops[k];
+            if(x64){ fetch64("rax", a); code<<"    push rax\n"; }
+            else code<<"    push "<<at(a)<<"\n";
+        }
+        // Values live in pool registers or slots, never in argument registers
+        for(size_t k=0;k<nreg;k++){
+            if(x64) fetch64(w64[k], i->ops[k]);
+            else fetch(r32[k], i->ops[k]);
+        }
+        // Check if this is a driver call (keyboard, mouse, volume)
+        if(nm == "keyboard_driver" || nm == "mouse_driver" || nm == "volume_driver")
+            code<<"    call __defacto_drv_"<<nm.substr(0, nm.find("_driver"))<<"\n";
+        else code<<"    call "<<nm<<"\n";
+        if(nargs>nreg) code<<"    add "<<(x64 ? "rsp, " : "esp, ")<<(nargs-nreg)*(x64 ? 8 : 4)<<"\n";
+        restore(saved);
+        // The result is stored once the saved registers are back
+        put(i, i->wide ? "rax" : "eax");
+    }
+
+    // Incoming parameter, at the top of a fn body
+    void lower_arg(const ir::Inst* v){
+        const Param& p=params[v->imm];
+        const std::string in = x64 && !v->wide && !p.in.empty() ? reg32(p.in) : p.in;
+        if(!in_reg(v)){
+            if(placed(v) && !in.empty()) code<<"    mov "<<at(v, v->wide)<<", "<<in<<"\n";
+            return;
+        }
+        if(in.empty()) code<<"    mov "<<at(v, v->wide)<<", "<<(v->wide ? "qword [" : "dword [")<<mem(*find_var(p.sym))<<"]\n";
+        else code<<"    mov "<<at(v, v->wide)<<", "<<in<<"\n";
+    }
+
+    void jump(const ir::Block* to, const ir::Block* next){
+        if(to!=next) code<<"    jmp "<<block_lbl[to->id]<<"\n";
+    }
+
+    // Tail calls (-O1 and up; see ir::tail_position). A call of the fn
+    // itself restarts it: the arguments go where its own came in and the
+    // jump lands after the prologue, reusing the frame. A call of another
+    // fn whose arguments all travel in registers leaves the frame first and
+    // jumps, so the callee returns straight to our caller. False when the
+    // call must stay a call.
+    bool lower_tail_call(const ir::Inst* i){
+        static const char* const r32[] = {"ecx", "edx"};
+        static const char* const w64[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        if(!outer || opt_level<1 || !ir::tail_position(i)) return false;
+        auto c=static_cast<FuncCall*>(i->node);
+        std::string nm=c->name;
+        if(!nm.empty() && nm[0]=='#') nm=nm.substr(1);
+        const CodeGen& r=root();
+        auto ar=r.arity.find(nm);
+        const size_t nargs=i->ops.size();
+        if(ar==r.arity.end() || ar->second!=nargs || (nm.size()>7 && nm.compare(nm.size()-7, 7, "_driver")==0)) return false;
+        const bool self=nm==func_label(func);
+        const size_t nreg=std::min(nargs, x64 ? size_t(6) : size_t(2));
+        if(!self && nargs>nreg) return false;
+        if(self && params.size()!=nargs) return false;
+        // Values live in pool registers or slots, never in argument registers
+        for(size_t k=0;k<nreg;k++){
+            if(x64) fetch64(w64[k], i->ops[k]);
+            else fetch(r32[k], i->ops[k]);
+        }
+        // Stack arguments may read each other's incoming slots: all are
+        // read before any is written
+        for(size_t k=nreg;k<nargs;k++){
+            const ir::Inst* a=i->ops[k];
+            if(x64){ fetch64("rax", a); code<<"    push rax\n"; }
+            else code<<"    push "<<at(a)<<"\n";
+        }
+        for(size_t k=nargs; k-- > nreg;)
+            code<<"    pop "<<(x64 ? "qword [" : "dword [")<<mem(*find_var(params[k].sym))<<"]\n";
+        if(self){
+            code<<"    jmp "<<tail_entry<<"\n";
+            tail_entry_used=true;
+        } else {
+            const std::string bp=fp();
+            code<<"    mov "<<(x64 ? "rsp, " : "esp, ")<<bp<<"\n    pop "<<bp<<"\n    jmp "<<nm<<"\n";
+        }
+        tail_notes.push_back(func_label(func)+": call #"+nm+(self ? " restarts the function" : " is a jump"));
+        return true;
+    }
+
+    // Auto-vectorization (-O2, terminal modes; the kernel does not enable
+    // SSE). Each VecLoop (passes.h) of the region gets a vector prefix on
+    // the edge into its header: once the phis hold i = from and the
+    // accumulator's start, SSE2 (AVX2 with -mavx2) runs the body W elements
+    // at a time while W remain, leaving i and the accumulator where the
+    // scalar loop, now the epilogue, picks them up.
+    void find_vector_loops(const ir::Function& f, int nb){
+        vec_loops.clear();
+        vec_of.assign(nb, -1);
+        if(opt_level<2 || bare_metal) return;
+        auto elem=[&](Sym s){
+            const VarInfo* v=find_var(s);
+            return v && v->arr_size && (v->type=="i32" || v->type=="u8") ? elem_size(*v) : 0;
+        };
+        for(auto bl:f.blocks){
+            ir::VecLoop v;
+            if(!ir::vector_loop(bl, elem, v)) continue;
+            vec_of[bl->id]=(int)vec_loops.size();
+            vec_loops.push_back(v);
+        }
+    }
+
+    void vectorize(const ir::VecLoop& v){
+        const int lanes=(avx2 ? 32 : 16)/v.esize;
+        if(v.from<0 || v.to-v.from<lanes) return;
+        const long long end=v.from+(v.to-v.from)/lanes*lanes;
+        // Emit aside: the prefix is dropped if it runs out of registers
+        std::ostringstream scalar;
+        code.swap(scalar);
+        if(vector_prefix(v, lanes, end)) vectorized++;
+        else code.str("");
+        code.swap(scalar);
+        code<<scalar.str();
+    }
+
+    bool vector_prefix(const ir::VecLoop& v, int lanes, long long end){
+        using ir::Op;
+        const bool y=avx2;
+        const std::string sfx = v.esize==1 ? "b" : "d";
+        auto R=[&](int r){ return (y ? "ymm" : "xmm")+std::to_string(r); };
+        auto X=[&](int r){ return "xmm"+std::to_string(r); };
+        // d = a op b, where d is a's register or one b does not use
+        auto op3=[&](const std::string& op, int d, int a, const std::string& b){
+            if(y) code<<"    v"<<op<<" "<<R(d)<<", "<<R(a)<<", "<<b<<"\n";
+            else {
+                if(d!=a) code<<"    movdqa "<<R(d)<<", "<<R(a)<<"\n";
+                code<<"    "<<op<<" "<<R(d)<<", "<<b<<"\n";
+            }
+        };
+        auto x3=[&](const std::string& op, int d, int a, const std::string& b){
+            if(y) code<<"    v"<<op<<" "<<X(d)<<", "<<X(a)<<", "<<b<<"\n";
+            else code<<"    "<<op<<" "<<X(d)<<", "<<b<<"\n";
+        };
+
+        // Registers: taken ones stay with a leaf for the whole loop, a body
+        // value's until its last use in the body
+        bool out_of_regs=false;
+        std::vector<bool> busy(8, false);
+        auto take=[&]{
+            for(int r=0;r<8;r++) if(!busy[r]){ busy[r]=true; return r; }
+            out_of_regs=true;
+            return 0;
+        };
+        std::unordered_map<const ir::Inst*, int> vr, left;
+        for(auto i:v.body->insts)
+            for(auto o:i->ops) if(o->block==v.body) left[o]++;
+        auto done=[&](const ir::Inst* o){
+            if(o->block==v.body && --left[o]==0) busy[vr[o]]=false;
+        };
+
+        // Array bases: labels or frame offsets, in 64-bit code registers
+        std::unordered_map<Sym, std::string> base;
+        const char* const base64[] = {"rsi", "rdi", "r8", "r9"};
+        auto elem=[&](const ir::Inst* i){
+            std::string& b=base[i->sym];
+            if(b.empty()){
+                const VarInfo& arr=*find_var(i->sym);
+                if(!x64) b=mem(arr);
+                else if(base.size()>4){ out_of_regs=true; b="rsi"; }
+                else { b=base64[base.size()-1]; load_addr(b, arr); }
+            }
+            return "["+b+" + "+(x64 ? "rcx" : "ecx")+(v.esize==4 ? "*4" : "")+"]";
+        };
+        // r = eax in every lane
+        auto splat=[&](int r){
+            if(y){
+                code<<"    vmovd "<<X(r)<<", eax\n";
+                code<<"    vpbroadcast"<<sfx<<" "<<R(r)<<", "<<X(r)<<"\n";
+                return;
+            }
+            code<<"    movd "<<R(r)<<", eax\n";
+            if(v.esize==1) code<<"    punpcklbw "<<R(r)<<", "<<R(r)<<"\n    pshuflw "<<R(r)<<", "<<R(r)<<", 0\n";
+            code<<"    pshufd "<<R(r)<<", "<<R(r)<<", 0\n";
+        };
+
+        // Leaves, set up before the loop: values from outside it, and i as
+        // lanes from, from+1, ... stepped by a splat of W
+        const ir::Inst* step=v.iv->ops[v.header->pred_index(v.body)];
+        int lanes_r=-1, step_r=-1, acc_r=-1, zero_r=-1;
+        for(auto i:v.body->insts){
+            if(i==step || i->op==Op::Br) continue;
+            if(i->op==Op::LoadElem || i->op==Op::StoreElem) elem(i);
+            for(size_t k=0;k<i->ops.size();k++){
+                const ir::Inst* o=i->ops[k];
+                if(o->block==v.body || o==v.acc || vr.count(o)) continue;
+                if(k==0 && (i->op==Op::LoadElem || i->op==Op::StoreElem)) continue;
+                if(k==1 && i->op==Op::Bin && (i->bop==OP::SHL || i->bop==OP::SHR)) continue;
+                if(o==v.iv){
+                    lanes_r=vr[o]=take();
+                    step_r=take();
+                    const std::string c=lbl("vlanes");
+                    rodata<<c<<": dd 0, 1, 2, 3, 4, 5, 6, 7\n";
+                    fetch("eax", v.iv);
+                    splat(lanes_r);
+                    code<<"    mov eax, "<<lanes<<"\n";
+                    splat(step_r);
+                    if(y) code<<"    vpaddd "<<R(lanes_r)<<", "<<R(lanes_r)<<", ["<<addr(c)<<"]\n";
+                    else {
+                        const int t=take();
+                        code<<"    movdqu "<<R(t)<<", ["<<addr(c)<<"]\n";
+                        code<<"    paddd "<<R(lanes_r)<<", "<<R(t)<<"\n";
+                        busy[t]=false;
+                    }
+                    continue;
+                }
+                vr[o]=take();
+                fetch("eax", o);
+                splat(vr[o]);
+            }
+        }
+        const bool u8_sum = v.acc && v.esize==1 && v.root->bop==OP::ADD;
+        if(v.acc){
+            acc_r=take();
+            if(v.root->bop==OP::AND) op3("pcmpeqd", acc_r, acc_r, R(acc_r));
+            else op3("pxor", acc_r, acc_r, R(acc_r));
+        }
+        if(u8_sum){
+            zero_r=take();
+            op3("pxor", zero_r, zero_r, R(zero_r));
+        }
+
+        const std::string loop=lbl("vloop");
+        code<<"    mov ecx, "<<v.from<<"\n";
+        code<<loop<<":\n";
+        auto dest=[&](const ir::Inst* a){  // a's register if this is its last use
+            if(a->block==v.body && left[a]==1){ left[a]=0; return vr[a]; }
+            const int d=take();
+            done(a);
+            return d;
+        };
+        auto bitwise=[](OP op){ return op==OP::AND ? "pand" : op==OP::OR ? "por" : "pxor"; };
+        for(auto i:v.body->insts){
+            if(i==step || i->op==Op::Br) continue;
+            switch(i->op){
+                case Op::LoadElem:
+                    vr[i]=take();
+                    code<<"    "<<(y ? "vmovdqu " : "movdqu ")<<R(vr[i])<<", "<<elem(i)<<"\n";
+                    break;
+                case Op::StoreElem:
+                    code<<"    "<<(y ? "vmovdqu " : "movdqu ")<<elem(i)<<", "<<R(vr[i->ops[1]])<<"\n";
+                    done(i->ops[1]);
+                    break;
+                case Op::Neg: case Op::Not: {
+                    const ir::Inst* a=i->ops[0];
+                    const int d=vr[i]=take();
+                    if(i->op==Op::Neg){
+                        op3("pxor", d, d, R(d));
+                        op3("psub"+sfx, d, d, R(vr[a]));
+                    } else {
+                        op3("pcmpeqd", d, d, R(d));
+                        op3("pxor", d, d, R(vr[a]));
+                    }
+                    done(a);
+                    break;
+                }
+                case Op::Bin: {
+                    const ir::Inst* a=i->ops[0];
+                    const ir::Inst* b=i->ops[1];
+                    if(i==v.root){
+                        const ir::Inst* t = a==v.acc ? b : a;
+                        if(u8_sum){
+                            op3("psadbw", vr[t], vr[t], R(zero_r));
+                            op3("paddq", acc_r, acc_r, R(vr[t]));
+                        } else op3(i->bop==OP::ADD ? "padd"+sfx : bitwise(i->bop), acc_r, acc_r, R(vr[t]));
+                        done(t);
+                        break;
+                    }
+                    if(i->bop==OP::SHL || i->bop==OP::SHR){
+                        const int d=vr[i]=dest(a);
+                        const std::string k=std::to_string(b->imm & 31);
+                        const std::string op = i->bop==OP::SHL ? "pslld" : "psrad";
+                        if(y) code<<"    v"<<op<<" "<<R(d)<<", "<<R(vr[a])<<", "<<k<<"\n";
+                        else {
+                            if(d!=vr[a]) code<<"    movdqa "<<R(d)<<", "<<R(vr[a])<<"\n";
+                            code<<"    "<<op<<" "<<R(d)<<", "<<k<<"\n";
+                        }
+                        break;
+                    }
+                    // A commutative op reuses whichever operand dies here
+                    if(ir::commutative(i->bop) && !(a->block==v.body && left[a]==1) && b->block==v.body && left[b]==1)
+                        std::swap(a, b);
+                    const int ra=vr[a], rb=vr[b];
+                    if(i->bop==OP::MUL && !y){
+                        // SSE2 has no 32-bit pmulld: the even and odd lanes
+                        // as 64-bit products, interleaved back
+                        const int t1=take(), t2=take();
+                        const int d=vr[i]=dest(a);
+                        code<<"    movdqa "<<R(t1)<<", "<<R(ra)<<"\n    psrlq "<<R(t1)<<", 32\n";
+                        code<<"    movdqa "<<R(t2)<<", "<<R(rb)<<"\n    psrlq "<<R(t2)<<", 32\n";
+                        code<<"    pmuludq "<<R(t1)<<", "<<R(t2)<<"\n";
+                        op3("pmuludq", d, ra, R(rb));
+                        code<<"    pshufd "<<R(d)<<", "<<R(d)<<", 0x08\n";
+                        code<<"    pshufd "<<R(t1)<<", "<<R(t1)<<", 0x08\n";
+                        code<<"    punpckldq "<<R(d)<<", "<<R(t1)<<"\n";
+                        busy[t1]=busy[t2]=false;
+                        done(b);
+                        break;
+                    }
+                    const int d=vr[i]=dest(a);
+                    std::string op;
+                    switch(i->bop){
+                        case OP::ADD: op="padd"+sfx; break;
+                        case OP::SUB: op="psub"+sfx; break;
+                        case OP::MUL: op="pmulld"; break;
+                        default: op=bitwise(i->bop); break;
+                    }
+                    op3(op, d, ra, R(rb));
+                    done(b);
+                    break;
+                }
+                default: break;
+            }
+        }
+        if(lanes_r>=0) op3("paddd", lanes_r, lanes_r, R(step_r));
+        code<<"    add ecx, "<<lanes<<"\n";
+        code<<"    cmp ecx, "<<end<<"\n";
+        code<<"    jl "<<loop<<"\n";
+
+        // Fold the accumulator's lanes into eax and that into the scalar one
+        if(v.acc){
+            const int t=take();
+            const std::string op = u8_sum ? "paddq" : v.root->bop==OP::ADD ? "paddd" : bitwise(v.root->bop);
+            if(y){
+                code<<"    vextracti128 "<<X(t)<<", "<<R(acc_r)<<", 1\n";
+                x3(op, acc_r, acc_r, X(t));
+            }
+            code<<"    "<<(y ? "v" : "")<<"pshufd "<<X(t)<<", "<<X(acc_r)<<", 0x4E\n";
+            x3(op, acc_r, acc_r, X(t));
+            if(!u8_sum){
+                code<<"    "<<(y ? "v" : "")<<"pshufd "<<X(t)<<", "<<X(acc_r)<<", 0xB1\n";
+                x3(op, acc_r, acc_r, X(t));
+            }
+            code<<"    "<<(y ? "vmovd" : "movd")<<" eax, "<<X(acc_r)<<"\n";
+            const char* g = v.root->bop==OP::ADD ? "add" : v.root->bop==OP::AND ? "and" : v.root->bop==OP::OR ? "or" : "xor";
+            if(v.esize==1 && !u8_sum){
+                for(int sh:{16, 8}) code<<"    mov edx, eax\n    shr edx, "<<sh<<"\n    "<<g<<" eax, edx\n";
+                code<<"    and eax, 255\n";
+            }
+            if(placed(v.acc)) code<<"    "<<g<<" "<<at(v.acc)<<", eax\n";
+        }
+        if(placed(v.iv)) code<<"    mov "<<at(v.iv)<<", "<<end<<"\n";
+        if(y) code<<"    vzeroupper\n";
+        return !out_of_regs;
+    }
+
+    // The CondBr t of its block, lowered where next follows. A block that
+    // only repeats its predecessor's compare (x < y || x == y) branches on
+    // the flags that one left.
+    void cond_branch(const ir::Inst* t, const ir::Block* next){
+        const ir::Block* bl=t->block;
+        const ir::Inst* a=t->ops[0];
+        const ir::Inst* b=t->ops[1];
+        long long holds;
+        if(a->is_const() && b->is_const() && ir::eval(t->bop, a->imm, b->imm, holds, t->wide)){
+            jump(bl->succs[holds ? 0 : 1], next);
+            return;
+        }
+        OP op=t->bop;
+        if(bl->preds.size()!=1 || !ir::reuses_compare(bl->preds[0]->term(), t, op)){ op=t->bop; compare(a, b, op, t->wide); }
+        if(bl->succs[0]==next) code<<"    "<<jcc(negate(op))<<" "<<block_lbl[bl->succs[1]->id]<<"\n";
+        else {
+            code<<"    "<<jcc(op)<<" "<<block_lbl[bl->succs[0]->id]<<"\n";
+            jump(bl->succs[1], next);
+        }
+    }
+
+    // Loop rotation (-O2): the back edge b -> h into a header that only
+    // tests (phis and a CondBr) repeats the test at the bottom of the loop,
+    // one branch per iteration instead of a jump and a branch. h's phis are
+    // in place once b's moves are done, and its successors take no phis
+    // from it (split_critical_edges gave those an edge block).
+    bool rotated(const ir::Block* b, const ir::Block* h) const {
+        if(opt_level<2 || block_pos[h->id]>block_pos[b->id]) return false;
+        const ir::Inst* t=h->term();
+        if(!t || t->op!=ir::Op::CondBr) return false;
+        for(auto i:h->insts) if(i!=t && i->op!=ir::Op::Phi) return false;
+        for(auto s:h->succs) if(!s->insts.empty() && s->insts.front()->op==ir::Op::Phi) return false;
+        return true;
+    }
+
+    // A Switch with constant cases is a binary decision tree over their
+    // sorted values (ir::SwitchPlan) whose leaves are compare chains or
+    // bounds-checked jump tables in .rodata, after the cases a profile
+    // found hot; x is a register. Any other case set is compared in source
+    // order.
+    void lower_switch(const ir::Inst* i, const std::string& x, const ir::Block* next){
+        const ir::Block* bl=i->block;
+        ir::SwitchPlan plan;
+        if(!plan.build(i)){
+            for(size_t k=1;k<i->ops.size();k++){
+                code<<"    cmp "<<x<<", "<<at(i->ops[k])<<"\n";
+                code<<"    je "<<block_lbl[bl->succs[k-1]->id]<<"\n";
+            }
+            jump(bl->succs.back(), next);
+            return;
+        }
+        for(auto& c:plan.peel(i)){
+            code<<"    cmp "<<x<<", "<<c.first<<"\n";
+            code<<"    je "<<block_lbl[bl->succs[c.second]->id]<<"\n";
+        }
+        switch_tree(plan, 0, plan.cases.size(), x, bl, next);
+    }
+
+    // Dispatch on plan.cases[from, to); next is the block laid out after
+    // the tree, or null inside it
+    void switch_tree(const ir::SwitchPlan& plan, size_t from, size_t to, const std::string& x,
+                     const ir::Block* bl, const ir::Block* next){
+        const std::string& def=block_lbl[bl->succs.back()->id];
+        if(plan.chain(from, to)){
+            for(size_t k=from;k<to;k++){
+                code<<"    cmp "<<x<<", "<<plan.cases[k].first<<"\n";
+                code<<"    je "<<block_lbl[bl->succs[plan.cases[k].second]->id]<<"\n";
+            }
+            if(next) jump(bl->succs.back(), next);
+            else code<<"    jmp "<<def<<"\n";
+            return;
+        }
+        if(plan.table(from, to)){
+            const long long lo=plan.cases[from].first;
+            const std::string tbl=lbl("switch_table");
+            if(x!="eax") code<<"    mov eax, "<<x<<"\n";
+            if(lo) code<<"    sub eax, "<<lo<<"\n";
+            code<<"    cmp eax, "<<plan.span(from, to)-1<<"\n";
+            code<<"    ja "<<def<<"\n";
+            if(x64){
+                code<<"    lea rdx, [rel "<<tbl<<"]\n";
+                code<<"    jmp [rdx + rax*8]\n";
+            } else code<<"    jmp [" << tbl << " + eax*4]\n";
+            rodata<<"align "<<(x64 ? 8 : 4)<<"\n"<<tbl<<":\n";
+            for(size_t k=from;k<to;k++){
+                for(long long gap=(k>from ? plan.cases[k-1].first+1 : lo); gap<plan.cases[k].first; gap++)
+                    rodata<<(x64 ? "    dq " : "    dd ")<<def<<"\n";
+                rodata<<(x64 ? "    dq " : "    dd ")<<block_lbl[bl->succs[plan.cases[k].second]->id]<<"\n";
+            }
+            return;
+        }
+        const size_t mid=from+(to-from)/2;
+        const std::string upper=lbl("switch_gt");
+        code<<"    cmp "<<x<<", "<<plan.cases[mid].first<<"\n";
+        code<<"    je "<<block_lbl[bl->succs[plan.cases[mid].second]->id]<<"\n";
+        code<<"    jg "<<upper<<"\n";
+        switch_tree(plan, from, mid, x, bl, nullptr);
+        code<<upper<<":\n";
+        switch_tree(plan, mid+1, to, x, bl, next);
+    }
+
+    void lower_inst(const ir::Inst* i, const ir::Block* next){
+        using ir::Op;
+        const ir::Block* bl=i->block;
+        switch(i->op){
+            case Op::Const: case Op::Arg: case Op::Phi: return;
+            case Op::Bin: lower_bin(i); return;
+            case Op::Neg: {
+                const std::string W=work(i, i->wide);
+                if(i->wide) fetch64(W, i->ops[0]);
+                else fetch(W, i->ops[0]);
+                code<<"    neg "<<W<<"\n";
+                put(i, W);
+                return;
+            }
+            case Op::Not: {
+                const ir::Inst* a=i->ops[0];
+                const bool q=x64 && a->wide;
+                if(in_reg(a)) code<<"    test "<<at(a, q)<<", "<<at(a, q)<<"\n";
+                else if(in_mem(a)) code<<"    cmp "<<at(a, q)<<", 0\n";
+                else { fetch("eax", a); code<<"    test eax, eax\n"; }
+                const std::string W=work(i);
+                code<<"    sete al\n    movzx "<<W<<", al\n";
+                put(i, i->wide ? reg64(W) : W);
+                return;
+            }
+            case Op::Str: {
+                std::string sl=str_lbl();
+                emit_str(sl, i->expr->val);
+                const std::string W=work(i, x64);
+                if(x64) code<<"    lea "<<W<<", ["<<addr(sl)<<"]\n";
+                else code<<"    mov "<<W<<", "<<sl<<"\n";
+                put(i, W);
+                return;
+            }
+            case Op::Load: {
+                const VarInfo& v=*find_var(i->sym);
+                const std::string W=work(i, i->wide);
+                code<<"    mov "<<W<<", "<<(i->wide ? "qword [" : "dword [")<<mem(v)<<"]\n";
+                put(i, W);
+                return;
+            }
+            case Op::Store: {
+                const VarInfo& v=*find_var(i->sym);
+                const ir::Inst* s=i->ops[0];
+                const bool q=quad(v);
+                std::string src;
+                if(q && !s->wide && !s->is_const()){ src="rax"; fetch64(src, s); }
+                else if(q && s->is_const() && !ir::fits32(s->imm)){ src="rax"; fetch(src, s); }
+                else if(!in_mem(s)) src=at(s, q);
+                else { src=q ? "rax" : "eax"; fetch(src, s); }
+                code<<"    mov "<<(q ? "qword [" : "dword [")<<mem(v)<<"], "<<src<<"\n";
+                return;
+            }
+            case Op::Addr: {
+                const std::string W=work(i, x64);
+                load_addr(W, *find_var(i->sym));
+                put(i, W);
+                return;
+            }
+            case Op::LoadElem: {
+                const VarInfo& arr=*find_var(i->sym);
+                const std::string m=elem_at(arr, i->ops[0]);
+                const std::string W=work(i, i->wide);
+                code<<"    "<<(elem_size(arr)==1 ? "movzx " : "mov ")<<W<<", "<<m<<"\n";
+                put(i, W);
+                return;
+            }
+            case Op::StoreElem: {
+                const VarInfo& arr=*find_var(i->sym);
+                const ir::Inst* s=i->ops[1];
+                std::string src;
+                if(elem_size(arr)==1){
+                    if(s->is_const()) src=std::to_string(s->imm & 255);
+                    else { fetch("eax", s); src="al"; }
+                } else if(elem_size(arr)==8){
+                    // as Store does for a qword variable
+                    if(!s->wide && !s->is_const()){ src="rax"; fetch64(src, s); }
+                    else if(s->is_const() && !ir::fits32(s->imm)){ src="rax"; fetch(src, s); }
+                    else if(!in_mem(s)) src=at(s, true);
+                    else { src="rax"; fetch(src, s); }
+                } else src=store_src(s);
+                const std::string m=elem_at(arr, i->ops[0]);
+                code<<"    mov "<<m<<", "<<src<<"\n";
+                return;
+            }
+            case Op::LoadField: {
+                const std::string m=field_mem(i->expr);
+                const std::string W=work(i);
+                code<<"    mov "<<W<<", "<<m<<"\n";
+                put(i, W);
+                return;
+            }
+            case Op::StoreField: {
+                const std::string src=store_src(i->ops[0]);
+                const std::string m=field_mem(i->expr);
+                code<<"    mov "<<m<<", "<<src<<"\n";
+                return;
+            }
+            case Op::LoadDeref: {
+                const VarInfo& p=*find_var(i->sym);
+                if(x64) code<<"    mov rcx, qword ["<<mem(p)<<"]\n";
+                else code<<"    mov ecx, dword ["<<mem(p)<<"]\n";
+                const std::string W=work(i);
+                code<<"    mov "<<W<<", dword ["<<(x64 ? "rcx" : "ecx")<<"]\n";
+                put(i, W);
+                return;
+            }
+            case Op::StoreDeref: {
+                const VarInfo& p=*find_var(i->sym);
+                const std::string src=store_src(i->ops[0]);
+                if(x64) code<<"    mov rcx, qword ["<<mem(p)<<"]\n";
+                else code<<"    mov ecx, dword ["<<mem(p)<<"]\n";
+                code<<"    mov dword ["<<(x64 ? "rcx" : "ecx")<<"], "<<src<<"\n";
+                return;
+            }
+            case Op::GetReg: {
+                const std::string r=reg(i->name);
+                const std::string W=work(i, x64);
+                if(W!=r) code<<"    mov "<<W<<", "<<r<<"\n";
+                put(i, W);
+                return;
+            }
+            case Op::SetReg: fetch(reg(i->name), i->ops[0]); return;
+            case Op::Print: {
+                const auto saved=save(i, [&](const std::string& r){ return !x64 || r=="ebx" || r=="r11d"; });
+                if(i->node) gen_printnum(static_cast<PrintNumNode*>(i->node));
+                else if(i->wide){ fetch64("rax", i->ops[0]); gen_printnum("rax", true); }
+                else gen_printnum(at(i->ops[0]));
+                restore(saved);
+                return;
+            }
+            case Op::PutChar: {
+                if(!bare_metal) return;
+                const auto saved=save(i, [](const std::string&){ return true; });
+                gen_putchar(at(i->ops[0]));
+                restore(saved);
+                return;
+            }
+            case Op::Color: {
+                const ir::Inst* v=i->ops[0];
+                gen_color(v->is_const() ? std::to_string(v->imm & 255) : at(v));
+                return;
+            }
+            case Op::Call: lower_call(i); return;
+            case Op::Stmt: {
+                const auto saved=save(i, [&](const std::string& r){ return clobbers(i->node, r); });
+                gen_stmt(i->node);
+                restore(saved);
+                return;
+            }
+            case Op::Check: {
+                // An index compares unsigned, so a negative one fails too; a
+                // check moved before a loop bounds its limit, signed
+                const ir::Inst* v=i->ops[0];
+                const bool q=x64 && v->wide;
+                std::string X=at(v, q);
+                if(v->is_const()){
+                    if(q) fetch64("rax", v);
+                    else fetch("eax", v);
+                    X=q ? "rax" : "eax";
+                }
+                code<<"    cmp "<<X<<", "<<i->imm<<"\n";
+                code<<"    "<<(i->bop==OP::LT ? "jae" : "jg")<<" __defacto_bounds\n";
+                return;
+            }
+            case Op::Count: {
+                // The region's counter imm, a quad: 32-bit code carries into the high half
+                const long long at=8*i->imm;
+                if(x64) code<<"    add qword [rel "<<prof_lbl<<"+"<<at<<"], 1\n";
+                else code<<"    add dword ["<<prof_lbl<<"+"<<at<<"], 1\n    adc dword ["<<prof_lbl<<"+"<<at+4<<"], 0\n";
+                return;
+            }
+            case Op::Br: {
+                const ir::Block* s=bl->succs[0];
+                phi_moves(bl, s);
+                if(vec_of[s->id]>=0 && vec_loops[vec_of[s->id]].body!=bl) vectorize(vec_loops[vec_of[s->id]]);
+                if(rotated(bl, s)) cond_branch(s->term(), next);
+                else jump(s, next);
+                return;
+            }
+            case Op::CondBr: cond_branch(i, next); return;
+            case Op::Switch: {
+                if(bl->succs.size()==1){
+                    phi_moves(bl, bl->succs[0]);
+                    jump(bl->succs[0], next);
+                    return;
+                }
+                const ir::Inst* v=i->ops[0];
+                if(i->wide){
+                    // i64 cases may not fit the plan's 32-bit values: compared in order
+                    std::string X=at(v, true);
+                    if(!v->wide || !in_reg(v)){ fetch64("rax", v); X="rax"; }
+                    for(size_t k=1;k<i->ops.size();k++){
+                        const std::string C=operand64(i->ops[k], "rcx");
+                        code<<"    cmp "<<X<<", "<<C<<"\n";
+                        code<<"    je "<<block_lbl[bl->succs[k-1]->id]<<"\n";
+                    }
+                    jump(bl->succs.back(), next);
+                    return;
+                }
+                std::string X=at(v);
+                if(!in_reg(v)){ fetch("eax", v); X="eax"; }
+                lower_switch(i, X, next);
+                return;
+            }
+            case Op::Ret:
+                if(!i->ops.empty()){
+                    if(x64 && outer && func->return_type=="i64") fetch64("rax", i->ops[0]);
+                    else fetch("eax", i->ops[0]);
+                }
+                if(!outer){
+                    if(prof_gen) code<<"    call __defacto_prof_dump\n";
+                    code<<"    mov esp, ebp\n    pop ebp\n    ret\n";
+                }
+                else if(next){ code<<"    jmp "<<region_end<<"\n"; }
+                return;
+            case Op::End:
+                if(next){ code<<"    jmp "<<region_end<<"\n"; region_end_used=true; }
+                return;
+        }
+    }
+
+    void lower(ir::Function& f, SectionNode* s){
+        Liveness live(f);
+        {
+            TraceScope t("regalloc", f.name);
+            linear_scan(live.ranges, (int)pool.size());
+        }
+        lv=&live;
+        vreg.assign(f.inst_count(), -1);
+        vslot.assign(f.inst_count(), "");
+        in_regs.clear();
+        // Values left in memory share slots where their ranges do not meet
+        std::vector<const LiveRange*> spilled;
+        for(auto& r:live.ranges){
+            if(r.segs.empty()) continue;
+            const ir::Inst* v=r.value;
+            if(r.reg>=0){ vreg[v->id]=r.reg; in_regs.push_back(&r); }
+            else if(v->op==ir::Op::Arg && params[v->imm].in.empty()) vslot[v->id]=mem(*find_var(params[v->imm].sym));
+            else spilled.push_back(&r);
+        }
+        std::sort(spilled.begin(), spilled.end(), [](const LiveRange* a, const LiveRange* b){ return a->start()<b->start(); });
+        std::vector<int> slot_end;
+        std::vector<std::string> slots;
+        for(auto r:spilled){
+            size_t k=0;
+            while(k<slots.size() && slot_end[k]>=r->start()) k++;
+            if(k==slots.size()){
+                if(outer) slots.push_back(fp()+"-"+std::to_string(frame_slot(x64 ? 8 : 4)));
+                else {
+                    const std::string l=lbl("spill");
+                    if(x64) data<<"    align 8\n    "<<l<<": dq 0\n";
+                    else data<<"    "<<l<<": dd 0\n";
+                    slots.push_back(addr(l));
+                }
+                slot_end.push_back(0);
+            }
+            slot_end[k]=r->segs.back().second;
+            vslot[r->value->id]=slots[k];
+        }
+
+        int nb=0;
+        for(auto bl:f.blocks) nb=std::max(nb, bl->id+1);
+        // Blocks go out in ir::layout order: with a profile, rarely taken
+        // sides of branches last
+        const std::vector<ir::Block*> order=ir::layout(f);
+        block_lbl.assign(nb, "");
+        block_pos.assign(nb, 0);
+        for(size_t k=1;k<f.blocks.size();k++) block_lbl[f.blocks[k]->id]=lbl(f.blocks[k]->tag);
+        for(size_t k=0;k<order.size();k++) block_pos[order[k]->id]=(int)k;
+        find_vector_loops(f, nb);
+        if(!outer) region_end=lbl("section_end");
+        region_end_used=false;
+
+        // Arguments first, while ecx/edx (rdi..r9) still hold them
+        for(auto v:f.entry()->insts) if(v->op==ir::Op::Arg) lower_arg(v);
+        if(outer) init_frame(s);
+        {
+            TraceScope t("lower", f.name);
+            for(size_t k=0;k<order.size();k++){
+                const ir::Block* bl=order[k];
+                if(k) code<<block_lbl[bl->id]<<":\n";
+                const ir::Block* next = k+1<order.size() ? order[k+1] : nullptr;
+                for(auto i:bl->insts){
+                    // Nothing after a tail call runs: the block ends with it
+                    if(i->op==ir::Op::Call && lower_tail_call(i)) break;
+                    lower_inst(i, next);
+                }
+            }
+        }
+        if(!outer && region_end_used) code<<region_end<<":\n";
+        lv=nullptr;
+    }
+
+    static bool scalar_type(std::string_view t){ return t=="i32" || t=="i64" || t=="u8" || t=="bool"; }
+
+    // Register pool of the whole program and the main-section variables
+    // that must stay in memory
+    void plan_regs(ProgramNode* prog){
+        static const char* const pool32[] = {"ebx", "esi", "edi"};
+        static const char* const pool64[] = {"ebx", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+        pool.clear();
+        main_pinned.assign(names->size(), false);
+        if(arm64_terminal) return;
+        std::vector<std::string> named;
+        std::vector<bool> main_decl(names->size(), false);
+        for(auto& sec:prog->main_sec)
+            if(sec->kind==NT::SECTION)
+                for(auto d:static_cast<SectionNode*>(sec)->decls) main_decl[static_cast<VarDecl*>(d)->sym]=true;
+        for(auto f:prog->functions){
+            auto fd=static_cast<FuncDecl*>(f);
+            UseScan scan(*names);
+            scan.decl_inits(fd->body->decls);
+            scan.region(fd->body->stmts);
+            // The function's own locals and loop counters are not main's
+            std::vector<Sym> own;
+            for(auto d:fd->body->decls) own.push_back(static_cast<VarDecl*>(d)->sym);
+            for(auto& p:fd->params) own.push_back(names->find(p.first));
+            arity[func_label(fd)]=fd->params.size();
+            if(x64 && fd->return_type=="i64") wide_result.insert(func_label(fd));
+            for(Sym fv:scan.for_vars) if(!main_decl[fv]) own.push_back(fv);
+            std::sort(own.begin(), own.end());
+            for(Sym sym:scan.used)
+                if(sym<main_pinned.size() && !std::binary_search(own.begin(), own.end(), sym)) main_pinned[sym]=true;
+            named.insert(named.end(), scan.explicit_regs.begin(), scan.explicit_regs.end());
+        }
+        std::vector<int> sections(names->size(), 0);
+        for(auto& sec:prog->main_sec){
+            if(sec->kind!=NT::SECTION) continue;
+            UseScan scan(*names);
+            std::vector<bool> m;
+            scan.decl_inits(static_cast<SectionNode*>(sec)->decls);
+            scan.mentions(static_cast<SectionNode*>(sec)->stmts, m);
+            for(Sym i=0;i<m.size();i++) if(m[i] && ++sections[i]>1) main_pinned[i]=true;
+            named.insert(named.end(), scan.explicit_regs.begin(), scan.explicit_regs.end());
+        }
+        for(auto r:x64 ? std::vector<const char*>(std::begin(pool64), std::end(pool64))
+                                  : std::vector<const char*>(std::begin(pool32), std::end(pool32))){
+            bool taken=false;
+            for(auto& n:named) taken = taken || reg(n)==r || reg(n)==reg64(r);
+            if(!taken) pool.push_back(r);
+        }
     }
 
     void gen_driver(DriverDecl* d){
         // Generate driver declaration (new syntax)
         // Register driver name so it can be called
-        driver_constants.insert(d->name);
+        if(VarInfo* v = find_var(d->name)) v->driver = true;
         
         std::string driver_type = d->type;
         // Remove # prefix if present
@@ -1291,66 +2535,13 @@ class CodeGen {
         // Generate extern declaration
         // For now, just declare it as external
         code << "extern " << e->name << "\n";
-    }
-
-    void gen_switch(SwitchNode* s){
-        // Generate switch statement
-        // switch value { case 1: ... case 2: ... default: ... }
-        std::string switch_end = lbl("switch_end");
-        std::vector<std::string> case_labels;
-        
-        // Load switch value into eax
-        load("eax", s->value);
-        
-        // Generate case comparisons
-        for (auto& c : s->cases) {
-            std::string case_label = lbl("case");
-            std::string next_label = lbl("case_next");
-            case_labels.push_back(case_label);
-            
-            // Compare with case value
-            if (is_num(c.first)) {
-                code << "    cmp eax, " << c.first << "\n";
-            } else {
-                load("ebx", c.first);
-                code << "    cmp eax, ebx\n";
-            }
-            code << "    jne " << next_label << "\n";
-            code << "    jmp " << case_label << "\n";
-            code << next_label << ":\n";
-        }
-        
-        // Jump to default or end
-        if (!s->default_body.empty()) {
-            code << "    jmp " << lbl("default") << "\n";
-        } else {
-            code << "    jmp " << switch_end << "\n";
-        }
-        
-        // Generate case bodies
-        for (size_t i = 0; i < s->cases.size(); i++) {
-            code << case_labels[i] << ":\n";
-            for (auto& stmt : s->cases[i].second) {
-                gen_stmt(stmt.get());
-            }
-            code << "    jmp " << switch_end << "\n";
-        }
-        
-        // Generate default body
-        if (!s->default_body.empty()) {
-            code << lbl("default") << ":\n";
-            for (auto& stmt : s->default_body) {
-                gen_stmt(stmt.get());
-            }
-        }
-        
-        code << switch_end << ":\n";
+        extern_names.push_back(e->name);
     }
 
     void gen_driver_section(DriverSectionNode* s){
         // Register driver constant so it doesn't need to be freed
         if (!s->driver_name.empty()) {
-            driver_constants.insert(s->driver_name);
+            if(VarInfo* v = find_var(s->driver_name)) v->driver = true;
         }
 
         // Generate driver initialization code
@@ -1401,33 +2592,185 @@ class CodeGen {
         }
     }
 
-    void gen_func(FuncDecl* f){
+    // Whether fd takes, keeps or returns an i64, which 64-bit code computes
+    // in 64 bits (the inliner's copies are 32-bit)
+    bool uses_i64(const FuncDecl* fd) const {
+        if(!x64) return false;
+        if(fd->return_type=="i64") return true;
+        for(auto& p:fd->params) if(p.second=="i64") return true;
+        for(auto d:fd->body->decls) if(static_cast<VarDecl*>(d)->type=="i64") return true;
+        return false;
+    }
+
+    // Templates of the functions whose calls the IR may replace with their
+    // bodies (ir::Inliner); `inline fn` that cannot be is a warning
+    void plan_inlining(ProgramNode* prog){
+        if(opt_level<1) return;
+        auto in=std::make_shared<ir::Inliner>(opt_level, inline_limit);
+        for(auto f:prog->functions){
+            auto fd=static_cast<FuncDecl*>(f);
+            const std::string why=uses_i64(fd) ? "it has i64 values" : in->add(fd, *names);
+            if(!why.empty() && fd->hint==FuncDecl::INLINE) warn("fn "+func_label(fd)+" is marked inline but is not inlined: "+why);
+        }
+        inliner=std::move(in);
+    }
+
+    static std::string func_label(const FuncDecl* f){
         std::string nm=f->name;
         if(!nm.empty()&&nm[0]=='#') nm=nm.substr(1);
-        std::string func_ret = lbl("func_ret");
-        code<<"\n"<<nm<<":\n    push ebp\n    mov ebp, esp\n";
-        gen_section(f->body.get());
-        code<<func_ret<<":\n";
-        code<<"    mov esp, ebp\n    pop ebp\n    ret\n";
+        return nm;
+    }
+
+    void gen_func(FuncDecl* f){
+        TraceScope trace("gen_func", f->name);
+        std::string nm=func_label(f);
+        region_end = lbl("func_ret");
+        tail_entry = lbl("tail_entry");
+        // The body goes first so the prologue knows the frame size
+        std::ostringstream head;
+        code.swap(head);
+        func=f;
+        gen_section(f->body);
+        code.swap(head);
+        const std::string bp=fp(), sp=x64 ? "rsp" : "esp";
+        code<<"\n"<<nm<<":\n    push "<<bp<<"\n    mov "<<bp<<", "<<sp<<"\n";
+        if(frame_size) code<<"    sub "<<sp<<", "<<(x64 ? (frame_size+15)/16*16 : frame_size)<<"\n";
+        if(tail_entry_used) code<<tail_entry<<":\n";
+        code<<head.str();
+        code<<region_end<<":\n";
+        code<<"    mov "<<sp<<", "<<bp<<"\n    pop "<<bp<<"\n    ret\n";
+    }
+
+    // Every function body goes to its own worker, on up to `jobs` threads.
+    // Results are appended in declaration order, so the output does not
+    // depend on the thread count; so do the warnings and the first error.
+    void gen_functions(ProgramNode* prog){
+        struct Out { std::string code, data, rodata, ir, prof; size_t prof_bytes = 0; int vectorized = 0, inlined = 0, checks = 0, checks_left = 0, checks_hoisted = 0, prof_regions = 0, prof_stale = 0; std::vector<std::string> warnings, tail_notes; std::exception_ptr error; };
+        const size_t n=prog->functions.size();
+        std::vector<Out> out(n);
+        auto run=[&](size_t i){
+            auto f=static_cast<FuncDecl*>(prog->functions[i]);
+            try{
+                CodeGen w(*this, func_label(f)+".");
+                w.gen_func(f);
+                out[i].code=w.code.str();
+                out[i].data=w.data.str();
+                out[i].rodata=w.rodata.str();
+                out[i].ir=w.ir_text.str();
+                out[i].vectorized=w.vectorized;
+                out[i].inlined=w.inlined;
+                out[i].checks=w.checks;
+                out[i].checks_left=w.checks_left;
+                out[i].checks_hoisted=w.checks_hoisted;
+                out[i].prof=w.prof.str();
+                out[i].prof_bytes=w.prof_bytes;
+                out[i].prof_regions=w.prof_regions;
+                out[i].prof_stale=w.prof_stale;
+                out[i].tail_notes=std::move(w.tail_notes);
+                out[i].warnings=std::move(w.deferred);
+            }catch(...){ out[i].error=std::current_exception(); }
+        };
+        size_t threads=std::min<size_t>(jobs>0 ? jobs : std::max(1u, std::thread::hardware_concurrency()), n);
+        if(threads<=1){
+            for(size_t i=0;i<n;i++) run(i);
+        } else {
+            std::atomic<size_t> next{0};
+            std::vector<std::thread> pool;
+            for(size_t t=0;t<threads;t++)
+                pool.emplace_back([&]{ for(size_t i; (i=next++)<n;) run(i); });
+            for(auto& t:pool) t.join();
+        }
+        for(auto& o:out){
+            for(auto& w:o.warnings) warn(w);
+            if(o.error) std::rethrow_exception(o.error);
+            code<<o.code;
+            data<<o.data;
+            rodata<<o.rodata;
+            ir_text<<o.ir;
+            vectorized+=o.vectorized;
+            inlined+=o.inlined;
+            checks+=o.checks;
+            checks_left+=o.checks_left;
+            checks_hoisted+=o.checks_hoisted;
+            prof<<o.prof;
+            prof_bytes+=o.prof_bytes;
+            prof_regions+=o.prof_regions;
+            prof_stale+=o.prof_stale;
+            tail_notes.insert(tail_notes.end(), o.tail_notes.begin(), o.tail_notes.end());
+        }
+    }
+
+    // Where a failed #SAFE check jumps: a message on stderr and exit code 1;
+    // bare metal halts
+    void gen_bounds_trap(){
+        const std::string msg="error: array index out of range\n";
+        code<<"\n__defacto_bounds:\n";
+        if(prof_gen) code<<"    call __defacto_prof_dump\n";
+        if(bare_metal){
+            code<<"    cli\n    hlt\n    jmp __defacto_bounds\n";
+            return;
+        }
+        emit_str("__defacto_bounds_msg", msg);
+        if(x64){
+            code<<"    mov eax, "<<sysno(SYS_WRITE)<<"\n    mov edi, 2\n";
+            code<<"    lea rsi, ["<<addr("__defacto_bounds_msg")<<"]\n    mov edx, "<<msg.size()<<"\n    syscall\n";
+            code<<"    mov eax, "<<sysno(SYS_EXIT)<<"\n    mov edi, 1\n    syscall\n";
+        } else {
+            code<<"    mov eax, 4\n    mov ebx, 2\n    mov ecx, __defacto_bounds_msg\n";
+            code<<"    mov edx, "<<msg.size()<<"\n    int 0x80\n";
+            code<<"    mov eax, 1\n    mov ebx, 1\n    int 0x80\n";
+        }
+    }
+
+    // -fprofile-generate: writes the profile image, the header and every
+    // region's record, to prof_path, or to COM1 on bare metal. Called as the
+    // program ends; uses the syscall (int 0x80) registers.
+    void gen_prof_dump(){
+        const size_t bytes=ir::profile_header_bytes+prof_bytes;
+        code<<"\n__defacto_prof_dump:\n";
+        if(bare_metal){
+            code<<"    mov esi, __defacto_prof\n    mov ecx, "<<bytes<<"\n";
+            code<<"__defacto_prof_byte:\n    mov dx, 0x3FD\n";
+            code<<"__defacto_prof_wait:\n    in al, dx\n    test al, 0x20\n    jz __defacto_prof_wait\n";
+            code<<"    mov dx, 0x3F8\n    mov al, [esi]\n    out dx, al\n";
+            code<<"    inc esi\n    dec ecx\n    jnz __defacto_prof_byte\n    ret\n";
+        } else if(x64){
+            emit_str("__defacto_prof_path", prof_path);
+            code<<"    mov eax, "<<sysno(SYS_OPEN)<<"\n    lea rdi, ["<<addr("__defacto_prof_path")<<"]\n";
+            code<<"    mov esi, "<<(macos_terminal ? "0x601" : "0x241")<<"\n    mov edx, 420\n    syscall\n";
+            // Errors: macOS sets the carry flag, Linux returns -errno
+            if(macos_terminal) code<<"    jc __defacto_prof_done\n";
+            else code<<"    test eax, eax\n    js __defacto_prof_done\n";
+            code<<"    mov edi, eax\n    mov eax, "<<sysno(SYS_WRITE)<<"\n    lea rsi, ["<<addr("__defacto_prof")<<"]\n";
+            code<<"    mov edx, "<<bytes<<"\n    syscall\n";
+            code<<"    mov eax, "<<sysno(SYS_CLOSE)<<"\n    syscall\n";
+            code<<"__defacto_prof_done:\n    ret\n";
+        } else {
+            emit_str("__defacto_prof_path", prof_path);
+            code<<"    mov eax, 5\n    mov ebx, __defacto_prof_path\n    mov ecx, 0x241\n    mov edx, 420\n    int 0x80\n";
+            code<<"    test eax, eax\n    js __defacto_prof_done\n";
+            code<<"    mov ebx, eax\n    mov eax, 4\n    mov ecx, __defacto_prof\n    mov edx, "<<bytes<<"\n    int 0x80\n";
+            code<<"    mov eax, 6\n    int 0x80\n";
+            code<<"__defacto_prof_done:\n    ret\n";
+        }
+        data<<"    align 8\n__defacto_prof: db \"DEPROF1\", 10\n    dd "<<prof_regions<<", 0\n"<<prof.str();
     }
 
     void gen_auto_free(){
         // Automatically free all declared variables at the end of the section
-        for(auto& v:declared){
-            if(!freed.count(v) && !driver_constants.count(v)){
-                auto it=var_lbl.find(v);
-                if(it!=var_lbl.end()){
-                    // Generate free code based on variable type
-                    if(var_is_ptr[v]){
-                        // For string/pointer types, free the allocated string data
-                        code<<"    ; auto-free: "+v+"\n";
-                        // String data is static, no runtime free needed for bare-metal
-                    } else {
-                        // For i32/i64/u8 types, just mark as freed (static allocation)
-                        code<<"    ; auto-free: "+v+"\n";
-                    }
-                    freed.insert(v);
+        for(Sym id:decl_order){
+            VarInfo& v=vars[id];
+            if(!v.freed && !v.driver){
+                // Generate free code based on variable type
+                if(v.is_ptr){
+                    // For string/pointer types, free the allocated string data
+                    code<<"    ; auto-free: "+names->name(id)+"\n";
+                    // String data is static, no runtime free needed for bare-metal
+                } else {
+                    // For i32/i64/u8 types, just mark as freed (static allocation)
+                    code<<"    ; auto-free: "+names->name(id)+"\n";
                 }
+                v.freed=true;
             }
         }
     }
@@ -1438,15 +2781,68 @@ class CodeGen {
     }
 
 public:
+    CodeGen() = default;
+
     void set_mode(bool bm, bool macos=false, bool linux64=false, bool arm64=false){
         bare_metal=bm;
         macos_terminal=macos;
         linux64_terminal=linux64;
+        x64=macos || linux64;
         arm64_terminal=arm64;
         use_allocator = !bm;  // Use allocator in terminal mode
     }
 
-    void emit(ProgramNode* prog, const std::string& out_path){
+    // 0 = one thread per core
+    void set_jobs(int n){ jobs=n; }
+
+    // -O0..-O3 for the IR passes (passes.h)
+    void set_opt(int level){ opt_level=level; }
+
+    // Keep a listing of every region's IR after the passes, for --print-ir
+    void set_print_ir(bool on){ print_ir=on; }
+    std::string ir_listing() const { return ir_text.str(); }
+    // Instructions the peephole pass removed, by rule; empty at -O0
+    std::string peephole_report() const { return peephole_stats; }
+    // -mavx2: vector loops use AVX2 instead of SSE2
+    void set_avx2(bool on){ avx2=on; }
+    // -finline-limit: largest callee (in IR instructions) inlined unasked
+    void set_inline_limit(int n){ inline_limit=n; }
+    std::string inline_report() const {
+        if(!inlined) return "";
+        return "  inlined: "+std::to_string(inlined)+" call(s)\n";
+    }
+    // Calls lowered to jumps, one line each (--report-tail-calls)
+    const std::vector<std::string>& tail_calls() const { return tail_notes; }
+    std::string vector_report() const {
+        if(!vectorized) return "";
+        return "  vectorized: "+std::to_string(vectorized)+" loop(s), "+(avx2 ? "AVX2" : "SSE2")+"\n";
+    }
+    // #SAFE: of the bounds checks built, how many went, moved before their
+    // loop or stayed
+    std::string bounds_report() const {
+        if(!checks) return "";
+        return "  bounds checks: "+std::to_string(checks)+", "+std::to_string(checks-checks_left-checks_hoisted)+
+               " removed, "+std::to_string(checks_hoisted)+" before loops, "+std::to_string(checks_left)+" left\n";
+    }
+    // -fprofile-generate: count block runs and write them to path (bare
+    // metal: to COM1) as the program ends
+    void set_profile_generate(const std::string& path){ prof_gen=true; prof_path=path; }
+    // -fprofile-use: counts of an earlier run for the passes and the layout
+    void set_profile_use(std::shared_ptr<const ir::Profile> p){ profile=std::move(p); }
+    std::string profile_report() const {
+        if(prof_gen) return "  profile: "+std::to_string(prof_regions)+" region(s) instrumented, written to "+
+                            (bare_metal ? std::string("COM1") : prof_path)+"\n";
+        if(!profile) return "";
+        return "  profile: "+std::to_string(prof_regions)+" region(s) matched"+
+               (prof_stale ? ", "+std::to_string(prof_stale)+" stale" : "")+"\n";
+    }
+
+    // Whole NASM program as text; emit() writes it to a file, the built-in
+    // assembler takes it straight from memory
+    std::string generate(ProgramNode* prog){
+        names=prog->names;
+        vars.assign(names->size(), VarInfo{});
+        safe=prog->safe;
         code<<"global _start\n";
         
         // Add extern declarations for malloc/free in terminal mode
@@ -1456,7 +2852,7 @@ public:
             code<<"extern exit\n";
         }
 
-        if(macos_terminal || arm64_terminal) code<<"section .text\n";
+        if(x64 || arm64_terminal) code<<"section .text\n";
         
         if(arm64_terminal) {
             // ARM64 uses different entry point and calling convention
@@ -1468,38 +2864,41 @@ public:
         } else {
             code<<"_start:\n";
             // Setup stack frame for terminal mode
-            if(!bare_metal && !macos_terminal){
+            if(!bare_metal && !x64){
                 code<<"    push ebp\n";
                 code<<"    mov ebp, esp\n";
             }
         }
 
         // Generate struct definitions first
-        for(auto& s:prog->structs) gen_struct(s.get());
+        for(auto& s:prog->structs) gen_struct(s);
+        plan_regs(prog);
+        plan_inlining(prog);
 
         // Generate extern declarations
         for(auto& e:prog->externs) {
-            gen_extern(e.get());
+            gen_extern(e);
         }
 
         // Generate driver declarations (new syntax)
         for(auto& d:prog->drivers) {
-            gen_driver(d.get());
+            gen_driver(d);
         }
 
         // Generate driver code first if present (old syntax)
         for(auto& s:prog->main_sec) {
             if (s->kind == NT::DRIVER_SECTION) {
-                gen_driver_section(static_cast<DriverSectionNode*>(s.get()));
+                gen_driver_section(static_cast<DriverSectionNode*>(s));
             }
         }
 
         for(auto& s:prog->main_sec) {
             if (s->kind == NT::SECTION) {
-                gen_section(static_cast<SectionNode*>(s.get()));
+                gen_section(static_cast<SectionNode*>(s));
             }
         }
         check_mem();
+        if(prof_gen) code<<"    call __defacto_prof_dump\n";
 
         if(bare_metal){
             code<<"\n.hang:\n    cli\n    hlt\n    jmp .hang\n";
@@ -1510,8 +2909,8 @@ public:
             code<<"_init_mouse:\n    ret\n";
             code<<"_init_speaker:\n    ret\n";
         } else {
-            if(macos_terminal){
-                code<<"\n    mov rax, 0x2000001\n    xor rdi, rdi\n    syscall\n";
+            if(x64){
+                code<<"\n    mov eax, "<<sysno(SYS_EXIT)<<"\n    xor edi, edi\n    syscall\n";
             } else {
                 code<<"\n    mov eax, 1\n";
                 code<<"    xor ebx, ebx\n";
@@ -1519,18 +2918,23 @@ public:
             }
         }
 
-        for(auto& f:prog->functions) gen_func(static_cast<FuncDecl*>(f.get()));
-
-        std::ofstream f(out_path);
-        if(!f) throw std::runtime_error("cannot write '"+out_path+"'");
+        gen_functions(prog);
+        if(checks_left || checks_hoisted) gen_bounds_trap();
+        if(prof_gen) gen_prof_dump();
 
+        std::ostringstream f;
         if(bare_metal){
             f<<"[BITS 32]\n[ORG 0x1000]\n\n";
         } else {
-            if(macos_terminal) f<<"[BITS 64]\nDEFAULT REL\n";
+            if(x64) f<<"[BITS 64]\nDEFAULT REL\n";
             else f<<"[BITS 32]\n";
         }
-        f<<code.str()<<"\n";
+        if(opt_level>=1){
+            TraceScope trace("peephole");
+            x86::Peephole peep(x64);
+            f<<peep.run(code.str())<<"\n";
+            peephole_stats=peep.report();
+        } else f<<code.str()<<"\n";
         
         // Add data section
         if(!bare_metal) f<<"section .data\n";
@@ -1539,6 +2943,18 @@ public:
             f<<"__defacto_attr: db 15\n";
         }
         f<<data.str()<<"\n";
+        if(rodata.tellp()>0){
+            if(!bare_metal) f<<"section .rodata\n";
+            f<<rodata.str()<<"\n";
+        }
+        return f.str();
+    }
+
+    void emit(ProgramNode* prog, const std::string& out_path){
+        const std::string text=generate(prog);
+        std::ofstream f(out_path);
+        if(!f) throw std::runtime_error("cannot write '"+out_path+"'");
+        f<<text;
         f.close();
         std::cout<<"asm: "<<out_path<<"\n";
     }
@@ -1,10 +1,12 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 #include <map>
 #include <set>
 #include <iostream>
+#include "arena.h"
 
 // Color macros - renamed to avoid conflicts with LLVM
 #define DEFACTO_RED    "\033[1;31m"
@@ -33,23 +35,84 @@ enum class TT {
     I32, I64, U8, STR, PTR, BOOL,
     TRUE, FALSE,
     REGISTER, IDENT, NUMBER, STR_LIT, HEX,
-    EQ, EQEQ, NEQ, LT, GT, LTE, GTE, PLUS, MINUS, MUL, DIV, LSHIFT,
+    EQ, EQEQ, NEQ, LT, GT, LTE, GTE, PLUS, MINUS, MUL, DIV, MOD, LSHIFT,
     LPAREN, RPAREN, LBRACE, RBRACE, LBRACK, RBRACK,
     COLON, SEMICOLON, COMMA, DOT,
     DRV_FUNC_ASSIGN, DRV_CALL, DRV_CALL_NOT,
-    AMP, STAR, TOK_NULL, ALLOC, DEALLOC,
+    AMP, STAR, PIPE, CARET, TOK_NULL, ALLOC, DEALLOC,
     LOGIC_AND, LOGIC_OR, LOGIC_NOT,
     ARROW, TYPE,
     LANGLE, RANGLE,  // For generics <T>
     EOF_T
 };
 
+// Interned identifier: 0 means "no symbol", valid ids start at 1
+using Sym = uint32_t;
+
+// Maps identifier text to dense integer ids so symbol tables can be plain
+// vectors. Stored views must outlive the interner (source buffer or arena).
+class Interner {
+    std::vector<Str> names{Str()};
+    std::vector<uint32_t> hashes{0};
+    std::vector<Sym> slots = std::vector<Sym>(256, 0);
+
+    static uint32_t hash(std::string_view s) {
+        uint32_t h = 2166136261u;  // FNV-1a
+        for (unsigned char c : s) { h ^= c; h *= 16777619u; }
+        return h;
+    }
+
+    void rehash() {
+        std::vector<Sym> grown(slots.size() * 2, 0);
+        size_t mask = grown.size() - 1;
+        for (Sym id = 1; id < names.size(); id++) {
+            size_t i = hashes[id] & mask;
+            while (grown[i]) i = (i + 1) & mask;
+            grown[i] = id;
+        }
+        slots.swap(grown);
+    }
+
+public:
+    Sym intern(Str s) {
+        uint32_t h = hash(s);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            Sym id = slots[i];
+            if (!id) {
+                id = (Sym)names.size();
+                names.push_back(s);
+                hashes.push_back(h);
+                slots[i] = id;
+                if (names.size() * 2 > slots.size()) rehash();
+                return id;
+            }
+            if (hashes[id] == h && names[id] == s) return id;
+        }
+    }
+
+    // Read-only lookup; 0 if the name was never interned
+    Sym find(std::string_view s) const {
+        uint32_t h = hash(s);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask; slots[i]; i = (i + 1) & mask) {
+            Sym id = slots[i];
+            if (hashes[id] == h && names[id] == s) return id;
+        }
+        return 0;
+    }
+
+    Str name(Sym id) const { return names[id]; }
+    size_t size() const { return names.size(); }  // one past the largest id
+};
+
 struct Token {
-    TT          type;
-    std::string val;
-    int         line, col;
-    Token(TT t, std::string v, int l=0, int c=0)
-        : type(t), val(std::move(v)), line(l), col(c) {}
+    TT   type;
+    Str  val;      // slice of the source text, or a literal for fixed tokens
+    Sym  sym = 0;  // interned id for identifiers
+    int  line, col;
+    Token(TT t, Str v, int l=0, int c=0)
+        : type(t), val(v), line(l), col(c) {}
 };
 
 enum class NT {
@@ -66,9 +129,134 @@ enum class NT {
     GENERIC_INST, TYPE_PARAM  // Generics support
 };
 
-struct Node { NT kind; virtual ~Node() = default; };
-using NodePtr = std::unique_ptr<Node>;
-using NodeList = std::vector<NodePtr>;
+// Expression tree - built once by the parser and walked directly by every backend
+enum class EK {
+    NUM,     // integer literal (decimal or 0x hex), text in val
+    STR,     // string literal, text in val (without quotes)
+    VAR,     // variable name in val
+    REG,     // explicit register #R1..#R16 in val
+    ADDR,    // &lhs
+    DEREF,   // *lhs
+    INDEX,   // lhs[rhs]
+    FIELD,   // lhs.val
+    UNARY,   // op lhs (NEG, NOT)
+    BINARY,  // lhs op rhs
+    ARRAY    // [items...] initializer
+};
+
+enum class OP {
+    NONE,
+    ADD, SUB, MUL, DIV, MOD,
+    AND, OR, XOR, SHL, SHR,
+    EQ, NE, LT, GT, LE, GE,
+    LAND, LOR,
+    NEG, NOT
+};
+
+struct Expr;
+using ExprPtr = Expr*;
+
+// Arena-allocated like the statement nodes; lhs/rhs are null when unused
+struct Expr {
+    EK kind;
+    OP op = OP::NONE;
+    Str val;
+    Sym sym = 0;  // interned name for VAR
+    ExprPtr lhs = nullptr, rhs = nullptr;
+    List<ExprPtr> items;
+    int line = 0, col = 0;
+    explicit Expr(EK k, Str v = Str(), int l = 0, int c = 0)
+        : kind(k), val(v), line(l), col(c) {}
+};
+
+inline ExprPtr make_unary(Arena& a, OP op, ExprPtr operand, int l = 0, int c = 0) {
+    auto e = a.make<Expr>(EK::UNARY, Str(), l, c);
+    e->op = op; e->lhs = operand;
+    return e;
+}
+inline ExprPtr make_binary(Arena& a, OP op, ExprPtr lhs, ExprPtr rhs, int l = 0, int c = 0) {
+    auto e = a.make<Expr>(EK::BINARY, Str(), l, c);
+    e->op = op; e->lhs = lhs; e->rhs = rhs;
+    return e;
+}
+
+inline bool is_compare(OP op) {
+    return op==OP::EQ||op==OP::NE||op==OP::LT||op==OP::GT||op==OP::LE||op==OP::GE;
+}
+
+inline const char* op_str(OP op) {
+    switch (op) {
+        case OP::ADD: return "+";  case OP::SUB: return "-";
+        case OP::MUL: return "*";  case OP::DIV: return "/";
+        case OP::MOD: return "%";
+        case OP::AND: return "&";  case OP::OR:  return "|";
+        case OP::XOR: return "^";  case OP::SHL: return "<<";
+        case OP::SHR: return ">>"; case OP::EQ:  return "==";
+        case OP::NE:  return "!="; case OP::LT:  return "<";
+        case OP::GT:  return ">";  case OP::LE:  return "<=";
+        case OP::GE:  return ">="; case OP::LAND: return "&&";
+        case OP::LOR: return "||"; case OP::NEG: return "-";
+        case OP::NOT: return "!";  default: return "";
+    }
+}
+
+inline long long parse_int(const std::string& s) {
+    if (!s.empty() && s[0] == '-') return -parse_int(s.substr(1));
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        return std::stoll(s.substr(2), nullptr, 16);
+    return std::stoll(s);
+}
+
+// Fold an expression made only of literals, with the wrap-around of the
+// generated code: 32 bits, or 64 when wide. False if it depends on anything
+// at run time or would trap there (division by zero, MIN / -1), and for
+// shift counts outside the width, which the hardware masks.
+inline bool const_value(const Expr* e, long long& out, bool wide = false) {
+    if (!e) return false;
+    auto wrap = [wide](uint64_t v) { return wide ? (long long)v : (long long)(int32_t)(uint32_t)v; };
+    if (e->kind == EK::NUM) {
+        out = wrap((uint64_t)parse_int(e->val));
+        return true;
+    }
+    long long a = 0, b = 0;
+    if (e->kind == EK::UNARY) {
+        if (!const_value(e->lhs, a, wide)) return false;
+        out = e->op == OP::NEG ? wrap(0 - (uint64_t)a) : !a;
+        return true;
+    }
+    if (e->kind != EK::BINARY) return false;
+    if (!const_value(e->lhs, a, wide) || !const_value(e->rhs, b, wide)) return false;
+    const long long min = wide ? INT64_MIN : INT32_MIN;
+    const int bits = wide ? 64 : 32;
+    switch (e->op) {
+        case OP::ADD: out = wrap((uint64_t)a + (uint64_t)b); break;
+        case OP::SUB: out = wrap((uint64_t)a - (uint64_t)b); break;
+        case OP::MUL: out = wrap((uint64_t)a * (uint64_t)b); break;
+        case OP::DIV: if (b == 0 || (a == min && b == -1)) return false; out = a / b; break;
+        case OP::MOD: if (b == 0 || (a == min && b == -1)) return false; out = a % b; break;
+        case OP::AND: out = a & b; break;
+        case OP::OR:  out = a | b; break;
+        case OP::XOR: out = a ^ b; break;
+        case OP::SHL: if (b < 0 || b >= bits) return false; out = wrap((uint64_t)a << b); break;
+        case OP::SHR: if (b < 0 || b >= bits) return false; out = a >> b; break;
+        case OP::EQ:  out = a == b; break;
+        case OP::NE:  out = a != b; break;
+        case OP::LT:  out = a < b; break;
+        case OP::GT:  out = a > b; break;
+        case OP::LE:  out = a <= b; break;
+        case OP::GE:  out = a >= b; break;
+        case OP::LAND: out = a && b; break;
+        case OP::LOR: out = a || b; break;
+        default: return false;
+    }
+    return true;
+}
+
+// AST nodes live in the Arena of the compilation and are trivially
+// destructible; backends dispatch on kind and static_cast to the node type.
+struct Node { NT kind; };
+using NodePtr = Node*;
+using NodeList = List<NodePtr>;
 
 struct SectionNode : Node {
     NodeList decls, stmts;
@@ -77,88 +265,93 @@ struct SectionNode : Node {
 
 // Generics support - type parameters (must be before StructDecl)
 struct TypeParam {
-    std::string name;      // T, U, etc.
-    std::string constraint; // optional constraint (e.g., "comparable")
+    Str name;      // T, U, etc.
+    Str constraint; // optional constraint (e.g., "comparable")
 };
 
 // Struct support - must be before ProgramNode
 struct StructDecl : Node {
-    std::string name;
-    std::vector<std::pair<std::string, std::string>> fields;  // field name -> type
+    Str name;
+    List<std::pair<Str, Str>> fields;  // field name -> type
     
     // Generics support
-    std::vector<TypeParam> type_params;  // Generic type parameters
-    std::map<std::string, std::string> type_substitutions;  // T -> i32 for instantiated structs
+    List<TypeParam> type_params;  // Generic type parameters
+    List<std::pair<Str, Str>> type_substitutions;  // T -> i32 for instantiated structs
     
     StructDecl() { kind = NT::STRUCT_DECL; }
 };
 
 // Switch/Case support
 struct SwitchNode : Node {
-    std::string value;  // value to switch on
-    std::vector<std::pair<std::string, NodeList>> cases;  // case value -> body
+    ExprPtr value = nullptr;  // value to switch on
+    List<std::pair<ExprPtr, NodeList>> cases;  // case value -> body
     NodeList default_body;  // default case body
     SwitchNode() { kind = NT::SWITCH_STMT; }
 };
 
 struct ExternDecl : Node {
-    std::string name;
-    std::string library;  // optional library name
+    Str name;
+    Str library;  // optional library name
     ExternDecl() { kind = NT::EXTERN_DECL; }
 };
 
 struct IncludeNode : Node {
-    std::string path;
+    Str path;
     IncludeNode() { kind = NT::INCLUDE; }
 };
 
 // Driver support - must be before ProgramNode
 struct DriverDecl : Node {
-    std::string name;
-    std::string type;  // keyboard, mouse, volume
+    Str name;
+    Str type;  // keyboard, mouse, volume
     DriverDecl() { kind = NT::DRIVER_DECL; }
 };
 
 struct ProgramNode : Node {
     bool no_runtime = false, safe = false;
+    const Interner* names = nullptr;  // symbol ids used by VarDecl/Expr
     NodeList interrupts, functions, main_sec;
-    std::vector<std::unique_ptr<StructDecl>> structs;
-    std::vector<std::unique_ptr<DriverDecl>> drivers;  // New driver declarations
-    std::vector<std::unique_ptr<ExternDecl>> externs;  // Extern function declarations
-    std::vector<std::string> imports;  // List of imported libraries
+    List<StructDecl*> structs;
+    List<DriverDecl*> drivers;  // New driver declarations
+    List<ExternDecl*> externs;  // Extern function declarations
+    List<Str> imports;  // List of imported libraries
     ProgramNode() { kind = NT::PROGRAM; }
 };
 
 struct VarDecl : Node {
-    std::string name, type, init;
+    Str name, type;
+    Sym sym = 0;
+    ExprPtr init = nullptr;  // initializer; non-constant ones are also emitted as an Assign in place
     int arr_size = 0;
-    std::string arr_size_expr;  // Expression for array size (e.g., "N", "10 + 5")
+    Str arr_size_expr;  // Expression for array size (e.g., "N", "10 + 5")
     bool is_arr  = false;
     bool is_const = false;
     
     // Generics support
-    std::vector<TypeParam> type_params;  // For generic functions/structs
-    std::string instantiated_type;  // Concrete type after instantiation
+    List<TypeParam> type_params;  // For generic functions/structs
+    Str instantiated_type;  // Concrete type after instantiation
     
     VarDecl() { kind = NT::VAR_DECL; }
 };
 
 struct FuncDecl : Node {
-    std::string name;
-    std::vector<std::pair<std::string, std::string>> params;  // param name -> type
-    std::string return_type;
-    std::unique_ptr<SectionNode> body;
+    Str name;
+    List<std::pair<Str, Str>> params;  // param name -> type
+    Str return_type;
+    SectionNode* body = nullptr;
+    enum Hint : uint8_t { AUTO, INLINE, NOINLINE } hint = AUTO;  // inline fn / noinline fn
     
     // Generics support
-    std::vector<TypeParam> type_params;  // Generic type parameters
-    std::map<std::string, std::string> type_substitutions;  // T -> i32, etc.
+    List<TypeParam> type_params;  // Generic type parameters
+    List<std::pair<Str, Str>> type_substitutions;  // T -> i32, etc.
     
     FuncDecl() { kind = NT::FUNC_DECL; }
 };
 
 struct FuncCall : Node {
-    std::string name;
-    std::vector<std::string> args;  // Function arguments
+    Str name;
+    List<ExprPtr> args;  // Function arguments
+    Str result;      // x in "x = call #f(...)"; empty when the value is dropped
     FuncCall() { kind = NT::FUNC_CALL; }
 };
 
@@ -167,24 +360,24 @@ struct ContinueNode : Node {
 };
 
 struct EnumDecl : Node {
-    std::string name;
-    std::vector<std::string> variants;
+    Str name;
+    List<Str> variants;
     EnumDecl() { kind = NT::ENUM_DECL; }
 };
 
 struct ArrayInit : Node {
-    std::vector<std::string> values;
+    List<Str> values;
     ArrayInit() { kind = NT::ARRAY_INIT; }
 };
 
 struct ReturnNode : Node {
-    std::string value;
+    ExprPtr value = nullptr;  // null for return{}
     ReturnNode() { kind = NT::RETURN; }
 };
 
 struct Assign : Node {
-    std::string target, value, idx;
-    bool is_reg = false, is_arr = false;
+    ExprPtr target = nullptr;  // VAR, REG, INDEX, FIELD or DEREF
+    ExprPtr value = nullptr;
     Assign() { kind = NT::ASSIGN; }
 };
 
@@ -194,62 +387,65 @@ struct LoopNode : Node {
 };
 
 struct WhileNode : Node {
-    std::string left, op, right;
+    ExprPtr cond = nullptr;
     NodeList body;
     WhileNode() { kind = NT::WHILE; }
 };
 
 struct ForNode : Node {
-    std::string init_var, init_value;
-    std::string cond_left, cond_op, cond_right;
-    std::string step_var, step_value;
+    Str init_var;
+    Sym init_sym = 0;
+    ExprPtr init = nullptr;   // start value
+    ExprPtr cond = nullptr;   // init_var < limit
+    ExprPtr step = nullptr;   // init_var + 1
     NodeList body;
     ForNode() { kind = NT::FOR; }
 };
 
 struct IfNode : Node {
-    std::string left, op, right;
+    ExprPtr cond = nullptr;
     NodeList then_body, else_body;
     IfNode() { kind = NT::IF_STMT; }
 };
 
 struct RegOp : Node {
-    std::string op, target, source;
+    Str op, target;
+    ExprPtr source = nullptr;  // MOV only
     RegOp() { kind = NT::REG_OP; }
 };
 
 struct DisplayNode : Node {
-    std::string var;
+    Str var;
     DisplayNode() { kind = NT::DISPLAY; }
 };
 
 struct PrintNumNode : Node {
-    std::string var;
+    Str var;
     PrintNumNode() { kind = NT::PRINTNUM; }
 };
 
 struct FreeNode : Node {
-    std::string var;
+    Str var;
     FreeNode() { kind = NT::FREE; }
 };
 
 struct ColorNode : Node {
-    std::string value;
+    ExprPtr value = nullptr;
     ColorNode() { kind = NT::COLOR; }
 };
 
 struct ReadKeyNode : Node {
-    std::string var;
+    Str var;
     ReadKeyNode() { kind = NT::READKEY; }
 };
 
 struct ReadCharNode : Node {
-    std::string var;
+    Str var;
     ReadCharNode() { kind = NT::READCHAR; }
 };
 
 struct PutCharNode : Node {
-    std::string value;
+    ExprPtr value = nullptr;
     PutCharNode() { kind = NT::PUTCHAR; }
 };
 
@@ -267,84 +463,84 @@ struct BreakNode : Node {
 
 struct InterruptNode : Node {
     int num = 0;
-    std::string func;
+    Str func;
     InterruptNode() { kind = NT::INTERRUPT; }
 };
 
 // Driver support
 struct DriverSectionNode : Node {
     NodeList decls, stmts;
-    std::string driver_name;
-    std::string driver_type;  // keyboard, mouse, volume
+    Str driver_name;
+    Str driver_type;  // keyboard, mouse, volume
     DriverSectionNode() { kind = NT::DRIVER_SECTION; }
 };
 
 struct ConstDriverDecl : Node {
-    std::string name;
+    Str name;
     ConstDriverDecl() { kind = NT::CONST_DRIVER_DECL; }
 };
 
 struct DriverFuncAssign : Node {
-    std::string driver_name;
-    std::string driver_type;
+    Str driver_name;
+    Str driver_type;
     DriverFuncAssign() { kind = NT::DRV_FUNC_ASSIGN; }
 };
 
 struct DriverCall : Node {
-    std::string driver_target;
-    std::string builtin_name;
+    Str driver_target;
+    Str builtin_name;
     bool use_builtin = true;
     DriverCall() { kind = NT::DRV_CALL; }
 };
 
 struct StructFieldAccess : Node {
-    std::string struct_var;
-    std::string field_name;
+    Str struct_var;
+    Str field_name;
     StructFieldAccess() { kind = NT::STRUCT_FIELD_ACCESS; }
 };
 
 // Pointer support
 struct PtrAddrNode : Node {
-    std::string var;  // Variable to take address of
+    Str var;  // Variable to take address of
     PtrAddrNode() { kind = NT::PTR_ADDR; }
 };
 
 struct PtrDerefNode : Node {
-    std::string ptr;  // Pointer to dereference
+    Str ptr;  // Pointer to dereference
     PtrDerefNode() { kind = NT::PTR_DEREF; }
 };
 
 struct AllocNode : Node {
-    std::string size;  // Size in bytes
+    Str size;  // Size in bytes
     AllocNode() { kind = NT::ALLOC_NODE; }
 };
 
 struct DeallocNode : Node {
-    std::string ptr;  // Pointer to free
+    Str ptr;  // Pointer to free
     DeallocNode() { kind = NT::DEALLOC_NODE; }
 };
 
 // Improved arrays - slice support
 struct ArraySlice : Node {
-    std::string array_name;
-    std::string start_expr;  // Start index expression
-    std::string end_expr;    // End index expression
+    Str array_name;
+    Str start_expr;  // Start index expression
+    Str end_expr;    // End index expression
     ArraySlice() { kind = NT::ARRAY_SLICE; }
 };
 
 // Array with expression index
 struct ArrayAccess : Node {
-    std::string array_name;
-    std::string index_expr;  // Can be expression like "i + 1"
+    Str array_name;
+    Str index_expr;  // Can be expression like "i + 1"
     bool is_assignment = false;
-    std::string value;  // Value to assign (if is_assignment)
+    Str value;  // Value to assign (if is_assignment)
     ArrayAccess() { kind = NT::ARRAY_ACCESS; }
 };
 
 // Bounds check node (for runtime checks)
 struct BoundsCheck : Node {
-    std::string index;
-    std::string bound;
-    std::string array_name;
+    Str index;
+    Str bound;
+    Str array_name;
     BoundsCheck() { kind = NT::BOUNDS_CHECK; }
 };
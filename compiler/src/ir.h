@@ -0,0 +1,1279 @@
+#pragma once
+#include "defacto.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Target-independent SSA IR between the parser and the native backends.
+//
+// A Function holds one region: the main section or a fn body. Scalars the
+// backend lets the builder promote become SSA values, with phis where control
+// flow joins; every other variable is reached through explicit loads and
+// stores. Statements the IR does not model (display, readkey, drivers, ...)
+// travel as Stmt instructions that the backend still generates from the AST.
+//
+// Blocks are kept in the layout the source implies: a loop's blocks are
+// contiguous and come after its header, and a block is never placed before
+// one that dominates it. The passes preserve this and the register
+// allocator (regalloc.h) relies on it.
+
+namespace ir {
+
+enum class Op : uint8_t {
+    Const,                   // imm
+    Str,                     // address of the string literal expr->val
+    Arg,                     // incoming parameter number imm
+    Phi,                     // one operand per predecessor, in order
+    Bin,                     // ops[0] bop ops[1]
+    Neg, Not,                // ops[0]
+    Load, Store,             // variable sym [= ops[0]]
+    Addr,                    // &sym
+    LoadElem, StoreElem,     // sym[ops[0]] [= ops[1]]
+    LoadField, StoreField,   // expr (a FIELD expression) [= ops[0]]
+    LoadDeref, StoreDeref,   // *sym [= ops[0]]
+    GetReg, SetReg,          // register name [= ops[0]]
+    Print, PutChar, Color,   // printnum/putchar/color of ops[0]; Print of a
+                             // memory variable has no operand and keeps node
+    Call,                    // node is the FuncCall, ops are its arguments
+    Stmt,                    // node is generated by the backend from the AST
+    Check,                   // stop the program unless ops[0] bop imm: LT is
+                             // 0 <= ops[0] < imm, LE signed (Builder::bound)
+    Count,                   // add 1 to the region's counter imm (profile.h)
+    Br,                      // succs[0]
+    CondBr,                  // ops[0] bop ops[1] ? succs[0] : succs[1]
+    Switch,                  // ops[0] == ops[k] ? succs[k-1] : succs.back()
+    Ret,                     // return ops[0] (if any) from the fn
+    End                      // leave the region: fall into what follows it
+};
+
+struct Block;
+
+struct Inst {
+    Op   op;
+    OP   bop = OP::NONE;
+    bool wide = false;              // 64-bit value (pointer, i64); see Builder::widen
+    int  id = 0;
+    long long imm = 0;
+    Sym  sym = 0;
+    Str  name;                      // variable or register as written
+    const Expr* expr = nullptr;
+    Node* node = nullptr;
+    Block* block = nullptr;         // null once removed
+    std::vector<Inst*> ops, users;  // users may repeat, once per use
+
+    bool is_term() const { return op >= Op::Br; }
+    bool is_const() const { return op == Op::Const; }
+    // Produces a value other instructions can use
+    bool has_value() const {
+        switch (op) {
+            case Op::Store: case Op::StoreElem: case Op::StoreField: case Op::StoreDeref:
+            case Op::SetReg: case Op::Print: case Op::PutChar: case Op::Color: case Op::Stmt:
+            case Op::Check: case Op::Count:
+                return false;
+            default: return !is_term();
+        }
+    }
+    // Can be removed when unused and merged with an equal instruction
+    bool pure() const {
+        switch (op) {
+            case Op::Const: case Op::Str: case Op::Arg: case Op::Phi: case Op::Bin:
+            case Op::Neg: case Op::Not: case Op::Addr:
+                return true;
+            default: return false;
+        }
+    }
+    // Reads memory or registers that other instructions may change; can be
+    // removed when unused, but never merged
+    bool reads_state() const {
+        return op == Op::Load || op == Op::LoadElem || op == Op::LoadField ||
+               op == Op::LoadDeref || op == Op::GetReg;
+    }
+};
+
+struct Block {
+    int id = 0;
+    const char* tag = "bb";         // what the source made it: label prefix
+    long long count = -1;           // runs in the -fprofile-use profile, -1 unknown
+    std::vector<Inst*> insts;       // phis first, terminator last
+    std::vector<Block*> preds, succs;
+
+    // SSA construction (Braun et al., "Simple and Efficient Construction of
+    // Static Single Assignment Form", CC 2013)
+    bool sealed = false;
+    std::unordered_map<Sym, Inst*> defs;
+    std::vector<std::pair<Sym, Inst*>> incomplete;
+
+    Inst* term() const { return insts.empty() || !insts.back()->is_term() ? nullptr : insts.back(); }
+    size_t pred_index(const Block* p) const {
+        return std::find(preds.begin(), preds.end(), p) - preds.begin();
+    }
+};
+
+// 32-bit two's complement, what every scalar holds at run time
+inline long long wrap32(long long v) { return (int32_t)(uint32_t)v; }
+// Whether v is a sign-extended imm32, what 64-bit instructions take
+inline bool fits32(long long v) { return v == wrap32(v); }
+
+// a op b on 64-bit values (i64 in 64-bit code); false where that traps
+inline bool eval64(OP op, long long a, long long b, long long& out) {
+    const uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (op) {
+        case OP::ADD: out = (long long)(ua + ub); break;
+        case OP::SUB: out = (long long)(ua - ub); break;
+        case OP::MUL: out = (long long)(ua * ub); break;
+        case OP::DIV:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return false;
+            out = a / b; break;
+        case OP::MOD:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return false;
+            out = a % b; break;
+        case OP::SHL: out = (long long)(ua << (ub & 63)); break;
+        case OP::SHR: out = a >> (ub & 63); break;
+        case OP::AND: out = a & b; break;
+        case OP::OR:  out = a | b; break;
+        case OP::XOR: out = a ^ b; break;
+        case OP::EQ:  out = a == b; break;
+        case OP::NE:  out = a != b; break;
+        case OP::LT:  out = a < b; break;
+        case OP::GT:  out = a > b; break;
+        case OP::LE:  out = a <= b; break;
+        case OP::GE:  out = a >= b; break;
+        case OP::LAND: out = a && b; break;
+        case OP::LOR: out = a || b; break;
+        default: return false;
+    }
+    return true;
+}
+
+// a op b as the generated code computes it; false where that traps (division
+// by zero or overflow) and must be left to run time. A wide op is eval64's.
+inline bool eval(OP op, long long a, long long b, long long& out, bool wide = false) {
+    if (wide) return eval64(op, a, b, out);
+    const int32_t x = (int32_t)a, y = (int32_t)b;
+    const uint32_t ux = (uint32_t)x, uy = (uint32_t)y;
+    switch (op) {
+        case OP::ADD: out = (int32_t)(ux + uy); break;
+        case OP::SUB: out = (int32_t)(ux - uy); break;
+        case OP::MUL: out = (int32_t)(ux * uy); break;
+        case OP::DIV:
+            if (y == 0 || (x == INT32_MIN && y == -1)) return false;
+            out = x / y; break;
+        case OP::MOD:
+            if (y == 0 || (x == INT32_MIN && y == -1)) return false;
+            out = x % y; break;
+        case OP::AND: out = x & y; break;
+        case OP::OR:  out = x | y; break;
+        case OP::XOR: out = x ^ y; break;
+        case OP::SHL: out = (int32_t)(ux << (uy & 31)); break;  // x86 masks the count
+        case OP::SHR: out = x >> (uy & 31); break;
+        case OP::EQ:  out = x == y; break;
+        case OP::NE:  out = x != y; break;
+        case OP::LT:  out = x < y; break;
+        case OP::GT:  out = x > y; break;
+        case OP::LE:  out = x <= y; break;
+        case OP::GE:  out = x >= y; break;
+        case OP::LAND: out = x && y; break;
+        case OP::LOR: out = x || y; break;
+        default: return false;
+    }
+    return true;
+}
+
+// Compare with the operands swapped: a < b is b > a
+inline OP swap_cmp(OP op) {
+    switch (op) {
+        case OP::LT: return OP::GT; case OP::GT: return OP::LT;
+        case OP::LE: return OP::GE; case OP::GE: return OP::LE;
+        default: return op;
+    }
+}
+
+// The compare that holds where op does not
+inline OP negate_cmp(OP op) {
+    switch (op) {
+        case OP::EQ: return OP::NE; case OP::NE: return OP::EQ;
+        case OP::LT: return OP::GE; case OP::GE: return OP::LT;
+        case OP::GT: return OP::LE; case OP::LE: return OP::GT;
+        default: return op;
+    }
+}
+
+inline bool commutative(OP op) {
+    return op == OP::ADD || op == OP::MUL || op == OP::AND || op == OP::OR || op == OP::XOR ||
+           op == OP::EQ || op == OP::NE || op == OP::LAND || op == OP::LOR;
+}
+
+// Division by a constant d >= 2 as a multiply-high (Hacker's Delight,
+// 10-1 and 10-8). Signed: q = hi32(x * (int32_t)mul), plus x when add is
+// set, arithmetically shifted right by shift, plus 1 when x is negative.
+// Unsigned: q = hi32(x * mul) >> shift; when add is set the multiplier
+// needs a 33rd bit and q = (((x - hi) >> 1) + hi) >> (shift - 1) instead.
+struct DivMagic {
+    uint32_t mul = 0;
+    int shift = 0;
+    bool add = false;
+};
+
+inline DivMagic signed_magic(uint32_t d) {  // 2 <= d < 2^31
+    const uint32_t two31 = 0x80000000u;
+    const uint32_t anc = two31 - 1 - two31 % d;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / d, r2 = two31 - q2 * d;
+    uint32_t delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2; r1 *= 2;
+        if (r1 >= anc) { q1++; r1 -= anc; }
+        q2 *= 2; r2 *= 2;
+        if (r2 >= d) { q2++; r2 -= d; }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    DivMagic m;
+    m.mul = q2 + 1;
+    m.shift = p - 32;
+    m.add = (int32_t)m.mul < 0;
+    return m;
+}
+
+inline DivMagic unsigned_magic(uint32_t d) {  // d >= 2
+    const uint32_t nc = UINT32_MAX - (0u - d) % d;
+    uint32_t q1 = 0x80000000u / nc, r1 = 0x80000000u - q1 * nc;
+    uint32_t q2 = 0x7FFFFFFFu / d, r2 = 0x7FFFFFFFu - q2 * d;
+    uint32_t delta;
+    DivMagic m;
+    int p = 31;
+    do {
+        p++;
+        if (r1 >= nc - r1) { q1 = 2 * q1 + 1; r1 = 2 * r1 - nc; }
+        else { q1 = 2 * q1; r1 = 2 * r1; }
+        if (r2 + 1 >= d - r2) {
+            if (q2 >= 0x7FFFFFFFu) m.add = true;
+            q2 = 2 * q2 + 1; r2 = 2 * r2 + 1 - d;
+        } else {
+            if (q2 >= 0x80000000u) m.add = true;
+            q2 = 2 * q2; r2 = 2 * r2 + 1;
+        }
+        delta = d - 1 - r2;
+    } while (p < 64 && (q1 < delta || (q1 == delta && r1 == 0)));
+    m.mul = q2 + 1;
+    m.shift = p - 32;
+    return m;
+}
+
+// Whether d is a power of two, 2^k with k >= 1, and k
+inline bool power_of_two(long long d, int& k) {
+    if (d < 2 || d > 0x40000000 || (d & (d - 1))) return false;
+    for (k = 0; (1LL << k) != d; k++) {}
+    return true;
+}
+
+class Function {
+    std::vector<std::unique_ptr<Inst>> inst_pool;
+    std::vector<std::unique_ptr<Block>> block_pool;
+
+public:
+    std::string name;
+    std::vector<Block*> blocks;     // layout order; blocks[0] is the entry
+    std::unordered_map<long long, Inst*> consts;
+
+    explicit Function(std::string n) : name(std::move(n)) {}
+
+    Block* entry() const { return blocks.front(); }
+    // Its blocks have counts from a profile (profile.h); those the passes
+    // add have none
+    bool profiled() const { return entry()->count >= 0; }
+    int inst_count() const { return (int)inst_pool.size(); }
+
+    Block* new_block(const char* tag) {
+        block_pool.push_back(std::make_unique<Block>());
+        Block* b = block_pool.back().get();
+        b->id = (int)block_pool.size() - 1;
+        b->tag = tag;
+        return b;
+    }
+
+    Inst* make(Op op) {
+        inst_pool.push_back(std::make_unique<Inst>());
+        Inst* i = inst_pool.back().get();
+        i->op = op;
+        i->id = (int)inst_pool.size() - 1;
+        return i;
+    }
+
+    // Appended to b, before its terminator if it has one
+    Inst* add(Block* b, Op op) {
+        Inst* i = make(op);
+        i->block = b;
+        auto at = b->term() && op != Op::Phi ? b->insts.end() - 1 : b->insts.end();
+        if (op == Op::Phi) at = std::find_if(b->insts.begin(), b->insts.end(), [](Inst* x) { return x->op != Op::Phi; });
+        b->insts.insert(at, i);
+        return i;
+    }
+
+    // Constants live at the top of the entry block, one per value; only
+    // wide ones (i64 in 64-bit code) keep more than 32 bits
+    Inst* constant(long long v, bool wide = false) {
+        if (!wide) v = wrap32(v);
+        auto it = consts.find(v);
+        if (it != consts.end() && it->second->block) return it->second;
+        Inst* c = make(Op::Const);
+        c->imm = v;
+        c->block = entry();
+        auto& e = entry()->insts;
+        e.insert(std::find_if(e.begin(), e.end(), [](Inst* x) { return x->op != Op::Arg; }), c);
+        return consts[v] = c;
+    }
+
+    void use(Inst* user, Inst* v) {
+        user->ops.push_back(v);
+        v->users.push_back(user);
+    }
+
+    static void drop_user(Inst* v, Inst* user) {
+        auto it = std::find(v->users.begin(), v->users.end(), user);
+        if (it != v->users.end()) v->users.erase(it);
+    }
+
+    void set_op(Inst* user, size_t k, Inst* v) {
+        drop_user(user->ops[k], user);
+        user->ops[k] = v;
+        v->users.push_back(user);
+    }
+
+    // Every use of old becomes a use of v
+    void replace(Inst* old, Inst* v) {
+        if (old == v) return;
+        for (Inst* u : old->users) {
+            for (auto& o : u->ops) if (o == old) o = v;
+            v->users.push_back(u);
+        }
+        // A user that named old twice was pushed twice; that is one per use
+        old->users.clear();
+        if (old->is_const() && consts.count(old->imm) && consts[old->imm] == old) consts.erase(old->imm);
+    }
+
+    // Detaches i from its operands; the caller removes it from its block
+    void kill(Inst* i) {
+        for (Inst* o : i->ops) drop_user(o, i);
+        i->ops.clear();
+        i->block = nullptr;
+        if (i->is_const() && consts.count(i->imm) && consts[i->imm] == i) consts.erase(i->imm);
+    }
+
+    void erase(Inst* i) {
+        Block* b = i->block;
+        b->insts.erase(std::find(b->insts.begin(), b->insts.end(), i));
+        kill(i);
+    }
+
+    // Removes the edge p -> b and the matching phi operands
+    void remove_pred(Block* b, Block* p) {
+        size_t k = b->pred_index(p);
+        if (k == b->preds.size()) return;
+        b->preds.erase(b->preds.begin() + k);
+        for (Inst* i : b->insts) {
+            if (i->op != Op::Phi) break;
+            drop_user(i->ops[k], i);
+            i->ops.erase(i->ops.begin() + k);
+        }
+    }
+
+    // Retargets the edge p -> from to p -> to; to takes from's phi operands
+    // for it only if it has no phis (callers make sure)
+    void redirect(Block* p, Block* from, Block* to) {
+        for (auto& s : p->succs) if (s == from) s = to;
+        from->preds.erase(std::find(from->preds.begin(), from->preds.end(), p));
+        to->preds.push_back(p);
+    }
+
+    // Blocks not reachable from the entry are unlinked and dropped
+    bool remove_unreachable() {
+        std::vector<bool> seen(block_pool.size(), false);
+        std::vector<Block*> work{entry()};
+        seen[entry()->id] = true;
+        while (!work.empty()) {
+            Block* b = work.back(); work.pop_back();
+            for (Block* s : b->succs) if (!seen[s->id]) { seen[s->id] = true; work.push_back(s); }
+        }
+        bool changed = false;
+        for (Block* b : blocks) {
+            if (seen[b->id]) continue;
+            changed = true;
+            for (Block* s : b->succs) if (seen[s->id]) remove_pred(s, b);
+        }
+        if (!changed) return false;
+        for (Block* b : blocks) {
+            if (seen[b->id]) continue;
+            for (Inst* i : b->insts) kill(i);
+            b->insts.clear();
+            b->succs.clear();
+            b->preds.clear();
+        }
+        blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](Block* b) { return !seen[b->id]; }), blocks.end());
+        return true;
+    }
+
+    // Phi moves need a block of their own on an edge from a block with
+    // several successors into one with several predecessors. The new block
+    // goes right before the target, or right after the source on a back edge.
+    // Phis of a block with one predecessor, which dropping dead edges leaves
+    // behind, become their operand first: no edge would carry their moves.
+    void split_critical_edges() {
+        for (Block* b : blocks) {
+            if (b->preds.size() != 1) continue;
+            while (!b->insts.empty() && b->insts.front()->op == Op::Phi) {
+                Inst* phi = b->insts.front();
+                replace(phi, phi->ops[0]);
+                erase(phi);
+            }
+        }
+        for (size_t bi = 0; bi < blocks.size(); bi++) {
+            Block* p = blocks[bi];
+            if (p->succs.size() < 2) continue;
+            for (size_t k = 0; k < p->succs.size(); k++) {
+                Block* s = p->succs[k];
+                if (s->preds.size() < 2 || s->insts.empty() || s->insts.front()->op != Op::Phi) continue;
+                Block* e = new_block("edge");
+                e->sealed = true;
+                p->succs[k] = e;
+                e->preds.push_back(p);
+                *std::find(s->preds.begin(), s->preds.end(), p) = e;
+                e->succs.push_back(s);
+                add(e, Op::Br);
+                auto ps = std::find(blocks.begin(), blocks.end(), p) - blocks.begin();
+                auto ss = std::find(blocks.begin(), blocks.end(), s) - blocks.begin();
+                blocks.insert(blocks.begin() + (ss > ps ? ss : ps + 1), e);
+                if (ss <= ps) bi++;
+            }
+        }
+    }
+};
+
+// Immediate dominators (Cooper, Harvey and Kennedy, "A Simple, Fast
+// Dominance Algorithm") indexed by block id, and the reverse postorder
+// they were computed in
+struct DomTree {
+    std::vector<Block*> idom, rpo;
+    std::vector<int> order;  // rpo index by block id
+
+    explicit DomTree(const Function& f) {
+        int n = 0;
+        for (Block* b : f.blocks) n = std::max(n, b->id + 1);
+        idom.assign(n, nullptr);
+        order.assign(n, -1);
+        std::vector<bool> seen(n, false);
+        std::vector<std::pair<Block*, size_t>> stack{{f.entry(), 0}};
+        seen[f.entry()->id] = true;
+        while (!stack.empty()) {
+            auto& [b, k] = stack.back();
+            if (k < b->succs.size()) {
+                Block* s = b->succs[k++];
+                if (!seen[s->id]) { seen[s->id] = true; stack.push_back({s, 0}); }
+            } else {
+                rpo.push_back(b);
+                stack.pop_back();
+            }
+        }
+        std::reverse(rpo.begin(), rpo.end());
+        for (size_t i = 0; i < rpo.size(); i++) order[rpo[i]->id] = (int)i;
+        idom[f.entry()->id] = f.entry();
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t i = 1; i < rpo.size(); i++) {
+                Block* b = rpo[i];
+                Block* d = nullptr;
+                for (Block* p : b->preds) {
+                    if (!idom[p->id]) continue;
+                    d = d ? intersect(p, d) : p;
+                }
+                if (d && idom[b->id] != d) { idom[b->id] = d; changed = true; }
+            }
+        }
+    }
+
+    // Whether every path from the entry to b passes through a
+    bool dominates(const Block* a, const Block* b) const {
+        if ((size_t)b->id >= idom.size() || !idom[b->id]) return false;
+        while (b != a) {
+            const Block* d = idom[b->id];
+            if (d == b) return false;
+            b = d;
+        }
+        return true;
+    }
+
+    Block* intersect(Block* a, Block* b) const {
+        while (a != b) {
+            while (order[a->id] > order[b->id]) a = idom[a->id];
+            while (order[b->id] > order[a->id]) b = idom[b->id];
+        }
+        return a;
+    }
+};
+
+// How the backends dispatch a Switch whose cases are all constants: the
+// cases sorted by (32-bit) value with the successor index each selects,
+// the first of equal cases winning as in the source. A run of cases is
+// split at its middle into a binary decision tree until it is either short
+// enough for a compare chain or dense enough for a jump table.
+struct SwitchPlan {
+    std::vector<std::pair<long long, size_t>> cases;
+
+    static constexpr size_t min_table = 4;   // cases
+    static constexpr long long max_fill = 3;  // table slots per case
+    static constexpr size_t max_chain = 3;   // compares before splitting
+    static constexpr size_t max_peel = 2;    // hot cases tested first (peel)
+
+    // False when some case is not a constant: then only a chain will do
+    bool build(const Inst* sw) {
+        cases.clear();
+        for (size_t k = 1; k < sw->ops.size(); k++) {
+            if (!sw->ops[k]->is_const()) return false;
+            cases.push_back({wrap32(sw->ops[k]->imm), k - 1});
+        }
+        std::stable_sort(cases.begin(), cases.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        cases.erase(std::unique(cases.begin(), cases.end(),
+                                [](const auto& a, const auto& b) { return a.first == b.first; }), cases.end());
+        return true;
+    }
+    long long span(size_t from, size_t to) const { return cases[to - 1].first - cases[from].first + 1; }
+    bool table(size_t from, size_t to) const {
+        return to - from >= min_table && span(from, to) <= max_fill * (long long)(to - from);
+    }
+    bool chain(size_t from, size_t to) const { return to - from <= max_chain; }
+
+    // With a profile: takes out of cases, hottest first, those the backend
+    // tests before the tree (value and successor index). Each took at least
+    // half of the runs the ones before it left, and no other case leads to
+    // its block.
+    std::vector<std::pair<long long, size_t>> peel(const Inst* sw) {
+        std::vector<std::pair<long long, size_t>> out;
+        const Block* b = sw->block;
+        long long left = b->count;
+        if (left <= 0) return out;
+        std::vector<std::pair<long long, size_t>> runs;  // count, index into cases
+        for (size_t k = 0; k < cases.size(); k++) {
+            const Block* s = b->succs[cases[k].second];
+            if (s->preds.size() == 1 && s->count >= 0) runs.push_back({s->count, k});
+        }
+        std::stable_sort(runs.begin(), runs.end(), [](const auto& x, const auto& y) { return x.first > y.first; });
+        std::vector<size_t> taken;
+        for (auto& [n, k] : runs) {
+            if (out.size() == max_peel || n * 2 < left) break;
+            out.push_back(cases[k]);
+            taken.push_back(k);
+            left -= n;
+        }
+        std::sort(taken.rbegin(), taken.rend());
+        for (size_t k : taken) cases.erase(cases.begin() + k);
+        return out;
+    }
+};
+
+// Whether CondBr t can branch on the flags CondBr p left: t is all of a
+// block that only p's block branches to, and compares the same two
+// values. Backends compare the non-constant operand first; op is t's
+// condition in the order p's operands were compared.
+inline bool reuses_compare(const Inst* p, const Inst* t, OP& op) {
+    const Block* b = t->block;
+    if (!p || p->op != Op::CondBr || p->wide != t->wide || b->insts.size() != 1 || b->preds.size() != 1 || b->preds[0] != p->block) return false;
+    const Inst* p0 = p->ops[0];
+    const Inst* p1 = p->ops[1];
+    const Inst* t0 = t->ops[0];
+    const Inst* t1 = t->ops[1];
+    if (p0->is_const() && p1->is_const()) return false;
+    if (p0->is_const()) std::swap(p0, p1);
+    op = t->bop;
+    if (t0->is_const() && !t1->is_const()) { std::swap(t0, t1); op = swap_cmp(op); }
+    if (t0 == p0 && t1 == p1) return true;
+    if (t0 == p1 && t1 == p0) { op = swap_cmp(op); return true; }
+    return false;
+}
+
+// Whether a call is the last thing its fn does: its block returns its
+// result (or nothing) right after it, or jumps, through blocks that only
+// jump, to one that does so through a phi. What follows the call is then
+// dead once the backend makes it a jump.
+inline bool tail_position(const Inst* call) {
+    const Block* b = call->block;
+    auto it = std::find(b->insts.begin(), b->insts.end(), call);
+    if (it + 1 == b->insts.end() || !(*(it + 1))->is_term()) return false;
+    auto returns = [](const Inst* r, const Inst* v) {
+        return r->op == Op::End || (r->op == Op::Ret && (r->ops.empty() || r->ops[0] == v));
+    };
+    const Inst* t = *(it + 1);
+    if (returns(t, call)) return true;
+    if (t->op != Op::Br) return false;
+    const Block* from = b;
+    const Block* s = b->succs[0];
+    for (int hops = 0; s->insts.size() == 1 && s->insts[0]->op == Op::Br; hops++) {
+        if (hops == 8) return false;
+        from = s;
+        s = s->succs[0];
+    }
+    const Inst* r = s->term();
+    if (!r) return false;
+    for (const Inst* i : s->insts) if (i != r && i->op != Op::Phi) return false;
+    if (returns(r, call)) return true;
+    if (r->op != Op::Ret) return false;
+    const Inst* v = r->ops[0];
+    return v->op == Op::Phi && v->block == s && v->ops[s->pred_index(from)] == call;
+}
+
+// Lowers the statements of one region. Call scan() first, then promote()
+// the variables the backend allows (escapes() tells which of them the IR
+// cannot track), then build().
+class Builder {
+    Function& f;
+    const Interner& names;
+    Block* cur = nullptr;
+    std::vector<bool> promoted, escaped, readonly, wide_syms;
+    std::vector<int> bounds;  // elements of the arrays whose indexes are checked
+    bool wide_ctx = false;  // constants of the expression at hand are wide
+    bool wide_args = false, wide_ret = false;  // see wide_code
+    const std::unordered_set<std::string>* wide_calls = nullptr;
+    std::vector<Sym> loop_vars;
+    struct Loop { Block* brk; Block* cont; };
+    std::vector<Loop> loops;
+
+    bool is_promoted(Sym s) const { return s < promoted.size() && promoted[s]; }
+    bool is_wide(Sym s) const { return s < wide_syms.size() && wide_syms[s]; }
+    // Whether e computes in 64 bits: it reads a variable widen() named
+    bool wide(const Expr* e) const {
+        if (wide_syms.empty() || !e) return false;
+        switch (e->kind) {
+            case EK::VAR: return is_wide(e->sym);
+            case EK::INDEX: return is_wide(e->lhs->sym);
+            case EK::UNARY: return wide(e->lhs);
+            case EK::BINARY: return wide(e->lhs) || wide(e->rhs);
+            default: return false;
+        }
+    }
+    void escape(Sym s) {
+        if (!s) return;
+        if (s >= escaped.size()) escaped.resize(s + 1, false);
+        escaped[s] = true;
+    }
+    // A name as the AST carries it in text: x, &x, *p or arr[i]
+    void escape(Str name) {
+        if (!name.empty() && (name[0] == '&' || name[0] == '*')) name = name.substr(1);
+        auto lb = name.find('[');
+        if (lb != Str::npos) {
+            auto rb = name.find(']', lb);
+            if (rb != Str::npos) escape(name.substr(lb + 1, rb - lb - 1));
+            name = name.substr(0, lb);
+        }
+        escape(names.find(name));
+    }
+
+    // ---- SSA construction ----
+    // A trivial phi that was removed forwards to the value replacing it;
+    // the defs maps may still name it
+    std::unordered_map<Inst*, Inst*> forward;
+
+    Inst* resolve(Inst* v) const {
+        for (auto it = forward.find(v); it != forward.end(); it = forward.find(v)) v = it->second;
+        return v;
+    }
+
+    void write(Sym s, Block* b, Inst* v) { b->defs[s] = v; }
+
+    Inst* read(Sym s, Block* b) {
+        auto it = b->defs.find(s);
+        if (it != b->defs.end()) return it->second = resolve(it->second);
+        Inst* v;
+        if (!b->sealed) {
+            v = f.add(b, Op::Phi);
+            v->wide = is_wide(s);
+            b->incomplete.push_back({s, v});
+        } else if (b->preds.size() == 1) {
+            v = read(s, b->preds[0]);
+        } else if (b->preds.empty()) {
+            v = f.constant(0);  // unreachable code
+        } else {
+            v = f.add(b, Op::Phi);
+            v->wide = is_wide(s);
+            write(s, b, v);
+            v = phi_operands(s, v);
+        }
+        write(s, b, v);
+        return v;
+    }
+
+    Inst* phi_operands(Sym s, Inst* phi) {
+        for (Block* p : phi->block->preds) f.use(phi, read(s, p));
+        return trivial_phi(phi);
+    }
+
+    // A phi that merges only itself and one other value is that value
+    Inst* trivial_phi(Inst* phi) {
+        Inst* same = nullptr;
+        for (Inst* o : phi->ops) {
+            if (o == same || o == phi) continue;
+            if (same) return phi;
+            same = o;
+        }
+        if (!same) same = f.constant(0);
+        std::vector<Inst*> users;
+        for (Inst* u : phi->users) if (u != phi) users.push_back(u);
+        f.replace(phi, same);
+        f.erase(phi);
+        forward[phi] = same;
+        for (Inst* u : users) if (u->op == Op::Phi && u->block) trivial_phi(u);
+        return resolve(same);
+    }
+
+    void seal(Block* b) {
+        for (auto& [s, phi] : b->incomplete) phi_operands(s, phi);
+        b->incomplete.clear();
+        b->sealed = true;
+    }
+
+    // ---- blocks ----
+    void enter(Block* b) {
+        cur = b;
+        f.blocks.push_back(b);
+    }
+    void edge(Block* from, Block* to) {
+        from->succs.push_back(to);
+        to->preds.push_back(from);
+    }
+    void jump(Block* to) {
+        edge(cur, to);
+        f.add(cur, Op::Br);
+    }
+    // After a terminator in the middle of a body: what follows is unreachable
+    void dead_end() {
+        Block* b = f.new_block("dead");
+        b->sealed = true;
+        enter(b);
+    }
+
+    // ---- values ----
+    Inst* inst(Op op, Sym s = 0, Str name = Str()) {
+        Inst* i = f.add(cur, op);
+        i->sym = s;
+        i->name = name;
+        return i;
+    }
+    Inst* unary(Op op, Inst* a) { Inst* i = inst(op); f.use(i, a); return i; }
+    Inst* binary(OP bop, Inst* a, Inst* b) {
+        Inst* i = inst(Op::Bin);
+        i->bop = bop;
+        f.use(i, a);
+        f.use(i, b);
+        return i;
+    }
+
+    Inst* var(Sym s, Str name) {
+        if (is_promoted(s)) return read(s, cur);
+        Inst* i = inst(Op::Load, s, name);
+        i->wide = is_wide(s);
+        return i;
+    }
+    // v as the value of a variable that is not wide: the low half of a
+    // wide one, by a 32-bit or
+    Inst* narrow(Inst* v) {
+        if (v->is_const()) return f.constant(v->imm);
+        return v->wide ? binary(OP::OR, v, f.constant(0)) : v;
+    }
+    void check(Sym s, Str name, Inst* idx) {
+        if (s >= bounds.size() || !bounds[s]) return;
+        Inst* c = inst(Op::Check, s, name);
+        c->bop = OP::LT;
+        c->imm = bounds[s];
+        f.use(c, idx);
+    }
+    void assign(Sym s, Str name, Inst* v) {
+        if (is_promoted(s)) {
+            if (readonly[s]) throw std::runtime_error("cannot assign to const '" + name + "'");
+            write(s, cur, is_wide(s) ? v : narrow(v));
+            return;
+        }
+        f.use(inst(Op::Store, s, name), v);
+    }
+
+    // e with 64-bit constants when w: the value of an i64, or of an
+    // expression that reads one
+    Inst* expr(const Expr* e, bool w) {
+        const bool saved = wide_ctx;
+        wide_ctx = w;
+        Inst* i = expr(e);
+        wide_ctx = saved;
+        return i;
+    }
+    // Operations on literals fold as they are lowered, bottom-up, so every
+    // node is visited once; in a wide context they keep 64 bits
+    Inst* expr(const Expr* e) {
+        switch (e->kind) {
+            case EK::NUM: return f.constant(parse_int(e->val), wide_ctx);
+            case EK::STR: { Inst* i = inst(Op::Str); i->expr = e; return i; }
+            case EK::VAR: return var(e->sym, e->val);
+            case EK::REG: return inst(Op::GetReg, 0, e->val);
+            case EK::ADDR: return inst(Op::Addr, e->lhs->sym, e->lhs->val);
+            case EK::DEREF: return inst(Op::LoadDeref, e->lhs->kind == EK::VAR ? e->lhs->sym : 0, e->lhs->val);
+            case EK::INDEX: {
+                Inst* idx = expr(e->rhs);
+                check(e->lhs->sym, e->lhs->val, idx);
+                Inst* i = inst(Op::LoadElem, e->lhs->sym, e->lhs->val);
+                f.use(i, idx);
+                return i;
+            }
+            case EK::FIELD: { Inst* i = inst(Op::LoadField, e->lhs->sym, e->lhs->val); i->expr = e; return i; }
+            case EK::UNARY: {
+                const bool w = wide(e), cw = wide_ctx || w;
+                Inst* a = expr(e->lhs, cw);
+                if (a->is_const())
+                    return e->op == OP::NOT ? f.constant(!a->imm) : f.constant((long long)(0 - (uint64_t)a->imm), cw);
+                Inst* i = unary(e->op == OP::NEG ? Op::Neg : Op::Not, a);
+                i->wide = w;
+                return i;
+            }
+            case EK::BINARY: {
+                const bool w = wide(e), cw = wide_ctx || w;
+                Inst* a = expr(e->lhs, cw);
+                Inst* b = expr(e->rhs, cw);
+                long long v;
+                if (a->is_const() && b->is_const() && eval(e->op, a->imm, b->imm, v, cw)) return f.constant(v, cw);
+                Inst* i = binary(e->op, a, b);
+                i->wide = w;
+                return i;
+            }
+            default:
+                throw std::runtime_error("array initializer used as a value at line " + std::to_string(e->line));
+        }
+    }
+
+    // Conditions of if, while and for. && and || become a chain of
+    // branches, the right side in a block of its own that the left side
+    // falls into, and ! swaps the targets; nothing is materialized.
+    void branch(const Expr* c, Block* t, Block* e) {
+        if (c->kind == EK::UNARY && c->op == OP::NOT) return branch(c->lhs, e, t);
+        if (c->kind == EK::BINARY && (c->op == OP::LAND || c->op == OP::LOR)) {
+            Block* rhs = f.new_block(c->op == OP::LAND ? "and_rhs" : "or_rhs");
+            if (c->op == OP::LAND) branch(c->lhs, rhs, e);
+            else branch(c->lhs, t, rhs);
+            seal(rhs);
+            enter(rhs);
+            return branch(c->rhs, t, e);
+        }
+        Inst* br;
+        if (c->kind == EK::BINARY && is_compare(c->op)) {
+            Inst* a = expr(c->lhs, wide(c));
+            Inst* b = expr(c->rhs, wide(c));
+            br = inst(Op::CondBr);
+            br->bop = c->op;
+            br->wide = wide(c);
+            f.use(br, a);
+            f.use(br, b);
+        } else {
+            Inst* v = expr(c, wide(c));
+            br = inst(Op::CondBr);
+            br->bop = OP::NE;
+            br->wide = wide(c);
+            f.use(br, v);
+            f.use(br, f.constant(0));
+        }
+        edge(cur, t);
+        edge(cur, e);
+    }
+
+    // ---- statements ----
+    void body(const NodeList& l) { for (auto s : l) stmt(s); }
+
+    void stmt(Node* n) {
+        if (!n) return;
+        switch (n->kind) {
+            case NT::ASSIGN: {
+                auto a = static_cast<Assign*>(n);
+                const Expr* t = a->target;
+                const Sym ts = t->kind == EK::VAR ? t->sym : t->kind == EK::INDEX ? t->lhs->sym : 0;
+                Inst* v = expr(a->value, ts && is_wide(ts));
+                switch (t->kind) {
+                    case EK::VAR: assign(t->sym, t->val, v); return;
+                    case EK::REG: f.use(inst(Op::SetReg, 0, t->val), v); return;
+                    case EK::DEREF:
+                        f.use(inst(Op::StoreDeref, t->lhs->kind == EK::VAR ? t->lhs->sym : 0, t->lhs->val), v);
+                        return;
+                    case EK::FIELD: {
+                        Inst* i = inst(Op::StoreField, t->lhs->sym, t->lhs->val);
+                        i->expr = t;
+                        f.use(i, v);
+                        return;
+                    }
+                    case EK::INDEX: {
+                        Inst* idx = expr(t->rhs);
+                        check(t->lhs->sym, t->lhs->val, idx);
+                        Inst* i = inst(Op::StoreElem, t->lhs->sym, t->lhs->val);
+                        f.use(i, idx);
+                        f.use(i, v);
+                        return;
+                    }
+                    default: throw std::runtime_error("invalid assignment target");
+                }
+            }
+            case NT::IF_STMT: {
+                auto i = static_cast<IfNode*>(n);
+                Block* then = f.new_block("if_then");
+                Block* els = i->else_body.empty() ? nullptr : f.new_block("if_else");
+                Block* join = f.new_block("if_end");
+                branch(i->cond, then, els ? els : join);
+                seal(then);
+                enter(then);
+                body(i->then_body);
+                jump(join);
+                if (els) {
+                    seal(els);
+                    enter(els);
+                    body(i->else_body);
+                    jump(join);
+                }
+                seal(join);
+                enter(join);
+                return;
+            }
+            case NT::WHILE: {
+                auto w = static_cast<WhileNode*>(n);
+                Block* head = f.new_block("while_s");
+                jump(head);
+                enter(head);
+                Block* loop = f.new_block("while_body");
+                Block* exit = f.new_block("while_e");
+                branch(w->cond, loop, exit);
+                seal(loop);
+                loops.push_back({exit, head});
+                enter(loop);
+                body(w->body);
+                jump(head);
+                loops.pop_back();
+                seal(head);
+                seal(exit);
+                enter(exit);
+                return;
+            }
+            case NT::FOR: {
+                auto fr = static_cast<ForNode*>(n);
+                assign(fr->init_sym, fr->init_var, expr(fr->init, is_wide(fr->init_sym)));
+                Block* head = f.new_block("for_s");
+                jump(head);
+                enter(head);
+                Block* loop = f.new_block("for_body");
+                Block* step = f.new_block("for_step");
+                Block* exit = f.new_block("for_e");
+                branch(fr->cond, loop, exit);
+                seal(loop);
+                loops.push_back({exit, step});
+                enter(loop);
+                body(fr->body);
+                jump(step);
+                loops.pop_back();
+                seal(step);
+                enter(step);
+                assign(fr->init_sym, fr->init_var, expr(fr->step, is_wide(fr->init_sym)));
+                jump(head);
+                seal(head);
+                seal(exit);
+                enter(exit);
+                return;
+            }
+            case NT::LOOP: {
+                Block* head = f.new_block("loop_s");
+                Block* exit = f.new_block("loop_e");
+                jump(head);
+                enter(head);
+                loops.push_back({exit, head});
+                body(static_cast<LoopNode*>(n)->body);
+                jump(head);
+                loops.pop_back();
+                seal(head);
+                seal(exit);
+                enter(exit);
+                return;
+            }
+            case NT::BREAK:
+                if (loops.empty()) throw std::runtime_error("'stop' outside loop");
+                jump(loops.back().brk);
+                dead_end();
+                return;
+            case NT::CONTINUE_STMT:
+                if (loops.empty()) throw std::runtime_error("'continue' outside loop");
+                jump(loops.back().cont);
+                dead_end();
+                return;
+            case NT::SWITCH_STMT: {
+                auto s = static_cast<SwitchNode*>(n);
+                Inst* sw = nullptr;
+                {
+                    const bool w = wide(s->value);
+                    Inst* v = expr(s->value, w);
+                    std::vector<Inst*> cases;
+                    for (auto& c : s->cases) cases.push_back(expr(c.first, w));
+                    sw = inst(Op::Switch);
+                    sw->wide = w;
+                    f.use(sw, v);
+                    for (Inst* c : cases) f.use(sw, c);
+                }
+                Block* end = f.new_block("switch_end");
+                std::vector<Block*> targets;
+                for (size_t i = 0; i < s->cases.size(); i++) targets.push_back(f.new_block("case"));
+                Block* def = s->default_body.empty() ? end : f.new_block("default");
+                Block* from = cur;
+                for (Block* t : targets) edge(from, t);
+                edge(from, def);
+                for (size_t i = 0; i < targets.size(); i++) {
+                    seal(targets[i]);
+                    enter(targets[i]);
+                    body(s->cases[i].second);
+                    jump(end);
+                }
+                if (def != end) {
+                    seal(def);
+                    enter(def);
+                    body(s->default_body);
+                    jump(end);
+                }
+                seal(end);
+                enter(end);
+                return;
+            }
+            case NT::RETURN: {
+                auto r = static_cast<ReturnNode*>(n);
+                Inst* v = r->value ? expr(r->value, wide_ret) : nullptr;
+                Inst* ret = inst(Op::Ret);
+                if (v) f.use(ret, v);
+                dead_end();
+                return;
+            }
+            case NT::PRINTNUM: case NT::DISPLAY: {
+                Str v = n->kind == NT::PRINTNUM ? static_cast<PrintNumNode*>(n)->var : static_cast<DisplayNode*>(n)->var;
+                Sym s = names.find(v);
+                if (is_promoted(s)) {
+                    Inst* p = inst(Op::Print);
+                    p->wide = is_wide(s);
+                    f.use(p, read(s, cur));
+                    return;
+                }
+                if (n->kind == NT::DISPLAY) inst(Op::Stmt)->node = n;
+                else inst(Op::Print, s, v)->node = n;
+                return;
+            }
+            case NT::PUTCHAR: f.use(inst(Op::PutChar), expr(static_cast<PutCharNode*>(n)->value, false)); return;
+            case NT::COLOR:   f.use(inst(Op::Color), expr(static_cast<ColorNode*>(n)->value, false)); return;
+            case NT::REG_OP: {
+                auto r = static_cast<RegOp*>(n);
+                if (r->op == "MOV") f.use(inst(Op::SetReg, 0, r->target), expr(r->source, false));
+                return;
+            }
+            case NT::FUNC_CALL: {
+                auto c = static_cast<FuncCall*>(n);
+                std::vector<Inst*> args;
+                for (auto a : c->args) args.push_back(expr(a, wide_args));
+                Inst* call = inst(Op::Call);
+                call->node = n;
+                if (wide_calls) {
+                    std::string nm = c->name;
+                    if (!nm.empty() && nm[0] == '#') nm.erase(0, 1);
+                    call->wide = wide_calls->count(nm) > 0;
+                }
+                for (Inst* a : args) f.use(call, a);
+                if (!c->result.empty()) assign(names.find(c->result), c->result, call);
+                return;
+            }
+            default:
+                inst(Op::Stmt)->node = n;
+                return;
+        }
+    }
+
+    // ---- escape scan ----
+    void scan_expr(const Expr* e) {
+        if (!e) return;
+        if ((e->kind == EK::ADDR || e->kind == EK::DEREF) && e->lhs) escape(e->lhs->sym);
+        scan_expr(e->lhs);
+        scan_expr(e->rhs);
+        for (auto i : e->items) scan_expr(i);
+    }
+    void scan_body(const NodeList& l) { for (auto s : l) scan_stmt(s); }
+    void scan_stmt(Node* n) {
+        if (!n) return;
+        switch (n->kind) {
+            case NT::ASSIGN: {
+                auto a = static_cast<Assign*>(n);
+                scan_expr(a->target); scan_expr(a->value);
+                return;
+            }
+            case NT::IF_STMT: {
+                auto i = static_cast<IfNode*>(n);
+                scan_expr(i->cond); scan_body(i->then_body); scan_body(i->else_body);
+                return;
+            }
+            case NT::WHILE: {
+                auto w = static_cast<WhileNode*>(n);
+                scan_expr(w->cond); scan_body(w->body);
+                return;
+            }
+            case NT::FOR: {
+                auto fr = static_cast<ForNode*>(n);
+                if (std::find(loop_vars.begin(), loop_vars.end(), fr->init_sym) == loop_vars.end())
+                    loop_vars.push_back(fr->init_sym);
+                scan_expr(fr->init); scan_expr(fr->cond); scan_expr(fr->step); scan_body(fr->body);
+                return;
+            }
+            case NT::LOOP: scan_body(static_cast<LoopNode*>(n)->body); return;
+            case NT::SWITCH_STMT: {
+                auto s = static_cast<SwitchNode*>(n);
+                scan_expr(s->value);
+                for (auto& c : s->cases) { scan_expr(c.first); scan_body(c.second); }
+                scan_body(s->default_body);
+                return;
+            }
+            case NT::REG_OP:    scan_expr(static_cast<RegOp*>(n)->source); return;
+            case NT::PUTCHAR:   scan_expr(static_cast<PutCharNode*>(n)->value); return;
+            case NT::COLOR:     scan_expr(static_cast<ColorNode*>(n)->value); return;
+            case NT::RETURN:    scan_expr(static_cast<ReturnNode*>(n)->value); return;
+            case NT::FUNC_CALL: for (auto a : static_cast<FuncCall*>(n)->args) scan_expr(a); return;
+            // Generated from the AST: these name the variable's storage
+            case NT::READKEY:   escape(static_cast<ReadKeyNode*>(n)->var); return;
+            case NT::READCHAR:  escape(static_cast<ReadCharNode*>(n)->var); return;
+            case NT::DEALLOC_NODE: escape(static_cast<DeallocNode*>(n)->ptr); return;
+            case NT::ALLOC_NODE: escape(static_cast<AllocNode*>(n)->size); return;
+            case NT::DRV_CALL:  escape(static_cast<DriverCall*>(n)->driver_target); return;
+            default: return;
+        }
+    }
+
+public:
+    Builder(Function& fn, const Interner& n) : f(fn), names(n) {
+        Block* e = f.new_block("entry");
+        e->sealed = true;
+        enter(e);
+    }
+
+    // Finds the variables whose storage the IR cannot stand in for, and the
+    // loop counters of `for`
+    void scan(const NodeList& decls, const NodeList& stmts) {
+        for (auto d : decls) {
+            auto v = static_cast<VarDecl*>(d);
+            if (v->init && v->init->kind == EK::ADDR && v->init->lhs) escape(v->init->lhs->sym);
+        }
+        scan_body(stmts);
+    }
+    const std::vector<Sym>& for_vars() const { return loop_vars; }
+    bool escapes(Sym s) const { return s < escaped.size() && escaped[s]; }
+
+    Inst* constant(long long v, bool wide = false) { return f.constant(v, wide); }
+    Inst* arg(size_t i) {
+        Inst* a = inst(Op::Arg);
+        a->imm = (long long)i;
+        return a;
+    }
+
+    // s holds 64-bit values: its phis, loads and every expression that
+    // reads it are wide. The backend calls this for i64 in 64-bit code.
+    void widen(Sym s) {
+        if (s >= wide_syms.size()) wide_syms.resize(s + 1, false);
+        wide_syms[s] = true;
+    }
+    // s is an array of n elements: every s[i] first checks 0 <= i < n. The
+    // backend calls this for #SAFE programs.
+    void bound(Sym s, int n) {
+        if (s >= bounds.size()) bounds.resize(s + 1, 0);
+        bounds[s] = n;
+    }
+    // 64-bit code passes whole registers, so constant call arguments keep
+    // 64 bits (a callee's i32 takes the low half); so does the returned
+    // constant of a region whose result is an i64. Calls to the functions
+    // named in fns return 64 bits.
+    void wide_code(bool wide_result, const std::unordered_set<std::string>& fns) {
+        wide_args = true;
+        wide_ret = wide_result;
+        wide_calls = &fns;
+    }
+
+    // s lives in SSA values from here on, starting with initial; a const
+    // keeps that value
+    void promote(Sym s, Inst* initial, bool is_const = false) {
+        if (s >= promoted.size()) { promoted.resize(s + 1, false); readonly.resize(s + 1, false); }
+        promoted[s] = true;
+        readonly[s] = is_const;
+        write(s, cur, initial);
+    }
+
+    void build(const NodeList& stmts) {
+        body(stmts);
+        inst(Op::End);
+        f.remove_unreachable();
+        for (Block* b : f.blocks) { b->defs.clear(); b->defs.rehash(0); }
+    }
+};
+
+inline const char* op_name(const Inst* i) {
+    switch (i->op) {
+        case Op::Const: return "const";       case Op::Str: return "str";
+        case Op::Arg: return "arg";           case Op::Phi: return "phi";
+        case Op::Bin: return op_str(i->bop);
+        case Op::Neg: return "neg";           case Op::Not: return "not";
+        case Op::Load: return "load";         case Op::Store: return "store";
+        case Op::Addr: return "addr";         case Op::LoadElem: return "load.elem";
+        case Op::StoreElem: return "store.elem"; case Op::LoadField: return "load.field";
+        case Op::StoreField: return "store.field"; case Op::LoadDeref: return "load.deref";
+        case Op::StoreDeref: return "store.deref"; case Op::GetReg: return "getreg";
+        case Op::SetReg: return "setreg";     case Op::Print: return "printnum";
+        case Op::PutChar: return "putchar";   case Op::Color: return "color";
+        case Op::Call: return "call";         case Op::Stmt: return "stmt";
+        case Op::Check: return "check";       case Op::Count: return "count";
+        case Op::Br: return "br";             case Op::CondBr: return "condbr";
+        case Op::Switch: return "switch";     case Op::Ret: return "ret";
+        case Op::End: return "end";
+    }
+    return "?";
+}
+
+// Readable listing, for --print-ir
+inline void print(const Function& f, std::ostream& out) {
+    out << "fn " << f.name << ":\n";
+    for (Block* b : f.blocks) {
+        out << "  bb" << b->id << " (" << b->tag << ")";
+        if (b->count >= 0) out << " x" << b->count;
+        if (!b->preds.empty()) {
+            out << "  <-";
+            for (Block* p : b->preds) out << " bb" << p->id;
+        }
+        out << "\n";
+        for (Inst* i : b->insts) {
+            out << "    ";
+            if (i->has_value()) out << "v" << i->id << " = ";
+            if (i->op == Op::Const) { out << i->imm << "\n"; continue; }
+            out << op_name(i);
+            if (i->wide) out << ".w";
+            if (i->op == Op::CondBr || i->op == Op::Check) out << " " << op_str(i->bop);
+            if (i->op == Op::Arg || i->op == Op::Count) out << " " << i->imm;
+            if (!i->name.empty()) out << " " << i->name;
+            if (i->op == Op::LoadField || i->op == Op::StoreField) out << "." << i->expr->val;
+            if (i->op == Op::Str) out << " \"" << i->expr->val << "\"";
+            if (i->op == Op::Call) out << " " << static_cast<FuncCall*>(i->node)->name;
+            for (size_t k = 0; k < i->ops.size(); k++) {
+                Inst* o = i->ops[k];
+                out << (k ? ", " : " ");
+                if (o->is_const()) out << o->imm; else out << "v" << o->id;
+                if (i->op == Op::Phi) out << " [bb" << b->preds[k]->id << "]";
+            }
+            if (i->op == Op::Check) out << ", " << i->imm;
+            if (!b->succs.empty() && i->is_term()) {
+                out << " ->";
+                for (Block* s : b->succs) out << " bb" << s->id;
+            }
+            out << "\n";
+        }
+    }
+}
+
+}  // namespace ir
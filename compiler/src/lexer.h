@@ -1,13 +1,91 @@
 #pragma once
 #include "defacto.h"
 #include <cctype>
+#include <cstring>
 #include <stdexcept>
 
+// Keyword table indexed by a compile-time perfect hash. The key packs the
+// length, first, last and middle byte of the word; a multiplicative hash
+// maps the 59 keywords and '#' directives to distinct slots out of 128.
+namespace kwtab {
+    struct Entry { const char* text; TT type; };
+
+    constexpr Entry entries[] = {
+        {"var", TT::VAR}, {"const", TT::CONST}, {"Const.driver", TT::CONST_DRIVER},
+        {"function", TT::FUNCTION}, {"fn", TT::FN}, {"driver", TT::DRIVER_KEYWORD},
+        {"call", TT::CALL}, {"loop", TT::LOOP}, {"if", TT::IF}, {"else", TT::ELSE},
+        {"import", TT::IMPORT}, {"Import", TT::IMPORT}, {"include", TT::INCLUDE}, {"from", TT::FROM},
+        {"return", TT::RETURN}, {"while", TT::WHILE}, {"for", TT::FOR}, {"to", TT::TO},
+        {"enum", TT::ENUM}, {"try", TT::TRY}, {"catch", TT::CATCH}, {"struct", TT::STRUCT},
+        {"switch", TT::SWITCH}, {"case", TT::CASE}, {"default", TT::DEFAULT},
+        {"extern", TT::EXTERN}, {"continue", TT::CONTINUE}, {"stop", TT::STOP},
+        {"display", TT::DISPLAY}, {"printnum", TT::PRINTNUM}, {"free", TT::FREE},
+        {"color", TT::COLOR}, {"readkey", TT::READKEY}, {"readchar", TT::READCHAR},
+        {"putchar", TT::PUTCHAR}, {"clear", TT::CLEAR}, {"reboot", TT::REBOOT},
+        {"i32", TT::I32}, {"i64", TT::I64}, {"u8", TT::U8}, {"string", TT::STR},
+        {"pointer", TT::PTR}, {"bool", TT::BOOL}, {"true", TT::TRUE}, {"false", TT::FALSE},
+        {"null", TT::TOK_NULL}, {"alloc", TT::ALLOC}, {"dealloc", TT::DEALLOC},
+        {"type", TT::TYPE},
+        // Directives are matched including their '#'
+        {"#DRIVER", TT::DRIVER}, {"#DRIVER.stop", TT::DRIVER_STOP},
+        {"#Mainprogramm.start", TT::PROG_START}, {"#Mainprogramm.end", TT::PROG_END},
+        {"#NO_RUNTIME", TT::NO_RUNTIME}, {"#SAFE", TT::SAFE}, {"#INTERRUPT", TT::INTERRUPT},
+        {"#MOV", TT::MOV}, {"#STATIC", TT::REG_STATIC}, {"#STOP", TT::REG_STOP},
+    };
+    constexpr int count = sizeof(entries) / sizeof(entries[0]);
+    constexpr uint32_t MULT = 0x7ce3e007u;
+    constexpr int BITS = 7;
+
+    constexpr size_t len(const char* s) { size_t n = 0; while (s[n]) n++; return n; }
+
+    constexpr uint32_t slot(const char* s, size_t n) {
+        uint32_t key = (uint32_t)n | (uint32_t)(unsigned char)s[0] << 8
+                     | (uint32_t)(unsigned char)s[n - 1] << 16 | (uint32_t)(unsigned char)s[n / 2] << 24;
+        return (key * MULT) >> (32 - BITS);
+    }
+
+    struct Table { signed char idx[1 << BITS]; };
+
+    constexpr Table build() {
+        Table t{};
+        for (auto& i : t.idx) i = -1;
+        for (int k = 0; k < count; k++) {
+            auto h = slot(entries[k].text, len(entries[k].text));
+            if (t.idx[h] >= 0) return Table{};  // collision: caught below
+            t.idx[h] = (signed char)k;
+        }
+        return t;
+    }
+    constexpr Table table = build();
+
+    constexpr bool perfect() {
+        int used = 0;
+        for (auto i : table.idx) used += i >= 0;
+        return used == count;
+    }
+    static_assert(perfect(), "keyword hash is not collision-free; pick another MULT");
+
+    // One hash, one table probe, one compare
+    inline TT lookup(std::string_view w, TT fallback) {
+        if (w.empty()) return fallback;
+        int k = table.idx[slot(w.data(), w.size())];
+        if (k < 0) return fallback;
+        const char* t = entries[k].text;
+        return w.size() == len(t) && std::memcmp(w.data(), t, w.size()) == 0 ? entries[k].type : fallback;
+    }
+}
+
+// Tokens are views into the source buffer, which must outlive the AST.
+// Only string literals with escape sequences are copied (into the arena).
 class Lexer {
     const std::string& src;
+    Arena&    arena;
+    Interner& names;
     size_t pos = 0;
     int    line = 1, col = 0;
 
+    static bool ident_char(char c) { return isalnum((unsigned char)c) || c == '_' || c == '.'; }
+
     char cur()           const { return pos < src.size() ? src[pos] : 0; }
     char pk(int n=1)     const { return pos+n < src.size() ? src[pos+n] : 0; }
     void adv() {
@@ -16,95 +94,63 @@ class Lexer {
             if (src[pos++] == '\n') { line++; col = 0; }
         }
     }
-    void skip_ws()  { while (cur()==' '||cur()=='\t'||cur()=='\r') adv(); }
-    void skip_cmt() { while (cur()!='\n'&&cur()) adv(); }
+    // Faster than adv() for runs known not to contain newlines
+    void skip(size_t n) { pos += n; col += (int)n; }
+    void skip_ws()  { while (cur()==' '||cur()=='\t'||cur()=='\r') skip(1); }
+    void skip_cmt() { while (cur()!='\n'&&cur()) skip(1); }
 
-    std::string read_ident() {
-        std::string s;
-        while (isalnum(cur())||cur()=='_'||cur()=='.') { s+=cur(); adv(); }
-        return s;
+    Str slice(size_t from) const { return Str(src.data() + from, pos - from); }
+
+    Str read_ident() {
+        size_t start = pos;
+        while (ident_char(cur())) skip(1);
+        return slice(start);
     }
-    std::string read_num() {
-        std::string s;
-        while (isdigit(cur())) { s+=cur(); adv(); }
-        return s;
+    Str read_num() {
+        size_t start = pos;
+        while (isdigit((unsigned char)cur())) skip(1);
+        return slice(start);
     }
-    std::string read_str() {
-        adv(); std::string s;
+    Str read_str() {
+        adv();
+        size_t start = pos;
+        while (cur()!='"'&&cur()&&cur()!='\\') adv();
+        if (cur()!='\\') {
+            Str s = slice(start);
+            if (cur()=='"') adv();
+            return s;
+        }
+        // Escapes need a decoded copy; it is never longer than the raw text
+        size_t end = pos;
+        while (end < src.size() && src[end] != '"') end += src[end] == '\\' ? 2 : 1;
+        char* buf = arena.array<char>(end - start);
+        size_t n = pos - start;
+        std::memcpy(buf, src.data() + start, n);
         while (cur()!='"'&&cur()) {
             if (cur()=='\\') { adv();
                 switch(cur()) {
-                    case 'n': s+='\n'; break;
-                    case 't': s+='\t'; break;
-                    default:  s+=cur();
+                    case 'n': buf[n++]='\n'; break;
+                    case 't': buf[n++]='\t'; break;
+                    default:  buf[n++]=cur();
                 }
-            } else s+=cur();
+            } else buf[n++]=cur();
             adv();
         }
         if (cur()=='"') adv();
-        return s;
+        return Str(buf, n);
     }
 
-    TT kw(const std::string& w) {
-        if(w=="var")           return TT::VAR;
-        if(w=="const")         return TT::CONST;
-        if(w=="Const.driver")  return TT::CONST_DRIVER;
-        if(w=="function")      return TT::FUNCTION;
-        if(w=="fn")            return TT::FN;
-        if(w=="driver")        return TT::DRIVER_KEYWORD;
-        if(w=="call")          return TT::CALL;
-        if(w=="loop")          return TT::LOOP;
-        if(w=="if")            return TT::IF;
-        if(w=="else")          return TT::ELSE;
-        if(w=="import")        return TT::IMPORT;
-        if(w=="include")       return TT::INCLUDE;
-        if(w=="from")          return TT::FROM;
-        if(w=="return")        return TT::RETURN;
-        if(w=="while")         return TT::WHILE;
-        if(w=="for")           return TT::FOR;
-        if(w=="to")            return TT::TO;
-        if(w=="enum")          return TT::ENUM;
-        if(w=="try")           return TT::TRY;
-        if(w=="catch")         return TT::CATCH;
-        if(w=="struct")        return TT::STRUCT;
-        if(w=="switch")        return TT::SWITCH;
-        if(w=="case")          return TT::CASE;
-        if(w=="default")       return TT::DEFAULT;
-        if(w=="extern")        return TT::EXTERN;
-        if(w=="continue")      return TT::CONTINUE;
-        if(w=="stop")          return TT::STOP;
-        if(w=="display")       return TT::DISPLAY;
-        if(w=="printnum")      return TT::PRINTNUM;
-        if(w=="free")          return TT::FREE;
-        if(w=="color")         return TT::COLOR;
-        if(w=="readkey")       return TT::READKEY;
-        if(w=="readchar")      return TT::READCHAR;
-        if(w=="putchar")       return TT::PUTCHAR;
-        if(w=="clear")         return TT::CLEAR;
-        if(w=="reboot")        return TT::REBOOT;
-        if(w=="i32")           return TT::I32;
-        if(w=="i64")           return TT::I64;
-        if(w=="u8")            return TT::U8;
-        if(w=="string")        return TT::STR;
-        if(w=="pointer")       return TT::PTR;
-        if(w=="bool")          return TT::BOOL;
-        if(w=="true")          return TT::TRUE;
-        if(w=="false")         return TT::FALSE;
-        if(w=="null")          return TT::TOK_NULL;
-        if(w=="alloc")         return TT::ALLOC;
-        if(w=="dealloc")       return TT::DEALLOC;
-        if(w=="keyboard")      return TT::IDENT;
-        if(w=="mouse")         return TT::IDENT;
-        if(w=="volume")        return TT::IDENT;
-        if(w=="type")          return TT::TYPE;
-        return TT::IDENT;
+    void ident(std::vector<Token>& out, Str w, int l, int c) {
+        out.emplace_back(TT::IDENT, w, l, c);
+        out.back().sym = names.intern(w);
     }
 
 public:
-    explicit Lexer(const std::string& s) : src(s) {}
+    Lexer(const std::string& s, Arena& a, Interner& n) : src(s), arena(a), names(n) {}
 
     std::vector<Token> tokenize() {
         std::vector<Token> out;
+        out.reserve(src.size() / 4 + 16);
         while (pos < src.size()) {
             skip_ws();
             if (!cur()) break;
@@ -114,30 +160,22 @@ public:
             int l=line, c=col;
 
             if (cur()=='#') {
+                size_t start = pos;
                 adv();
                 if (cur()=='0'&&(pk()=='x'||pk()=='X')) {
-                    std::string h="0x"; adv(); adv();
-                    while (isxdigit(cur())) { h+=cur(); adv(); }
-                    out.emplace_back(TT::HEX, h, l, c); continue;
+                    size_t h = pos; skip(2);
+                    while (isxdigit((unsigned char)cur())) skip(1);
+                    out.emplace_back(TT::HEX, slice(h), l, c); continue;
                 }
-                std::string w = read_ident();
-                if      (w=="DRIVER")        out.emplace_back(TT::DRIVER, "#DRIVER", l, c);
-                else if (w=="DRIVER.stop")   out.emplace_back(TT::DRIVER_STOP, "#DRIVER.stop", l, c);
-                else if (w=="keyboard")      out.emplace_back(TT::IDENT, "#keyboard", l, c);
-                else if (w=="mouse")         out.emplace_back(TT::IDENT, "#mouse", l, c);
-                else if (w=="volume")        out.emplace_back(TT::IDENT, "#volume", l, c);
-                else if (w=="Mainprogramm.start") out.emplace_back(TT::PROG_START, w, l, c);
-                else if (w=="Mainprogramm.end")   out.emplace_back(TT::PROG_END,   w, l, c);
-                else if (w=="NO_RUNTIME")         out.emplace_back(TT::NO_RUNTIME, w, l, c);
-                else if (w=="SAFE")               out.emplace_back(TT::SAFE,       w, l, c);
-                else if (w=="INTERRUPT")          out.emplace_back(TT::INTERRUPT,  w, l, c);
-                else if (w=="MOV")                out.emplace_back(TT::MOV,        w, l, c);
-                else if (w=="STATIC")             out.emplace_back(TT::REG_STATIC, w, l, c);
-                else if (w=="STOP")               out.emplace_back(TT::REG_STOP,   w, l, c);
-                else if (!w.empty()&&w[0]=='R'&&w.size()>1&&isdigit(w[1]))
-                    out.emplace_back(TT::REGISTER, "#"+w, l, c);
+                read_ident();
+                Str w = slice(start);  // includes the '#'
+                TT t = kwtab::lookup(w, TT::IDENT);
+                if (t != TT::IDENT)
+                    out.emplace_back(t, w, l, c);
+                else if (w.size()>2&&w[1]=='R'&&isdigit((unsigned char)w[2]))
+                    out.emplace_back(TT::REGISTER, w, l, c);
                 else
-                    out.emplace_back(TT::IDENT, "#"+w, l, c);
+                    ident(out, w, l, c);
                 continue;
             }
 
@@ -196,10 +234,12 @@ public:
             
             if (cur()=='"') { out.emplace_back(TT::STR_LIT, read_str(), l, c); continue; }
             if (isdigit(cur())) { out.emplace_back(TT::NUMBER, read_num(), l, c); continue; }
-            if (isalpha(cur())||cur()=='_') {
-                std::string w = read_ident();
-                if (w=="static.pl"&&cur()=='>') { adv(); out.emplace_back(TT::STATIC_PL,"static.pl>",l,c); }
-                else out.emplace_back(kw(w), w, l, c);
+            if (isalpha((unsigned char)cur())||cur()=='_') {
+                Str w = read_ident();
+                if (w=="static.pl"&&cur()=='>') { adv(); out.emplace_back(TT::STATIC_PL,"static.pl>",l,c); continue; }
+                TT t = kwtab::lookup(w, TT::IDENT);
+                if (t == TT::IDENT) ident(out, w, l, c);
+                else out.emplace_back(t, w, l, c);
                 continue;
             }
             char ch=cur();
@@ -216,11 +256,14 @@ public:
             else if(ch=='>') { adv(); out.emplace_back(TT::GT, ">",l,c); }
             else if(ch=='-'&&pk()=='>') { adv();adv(); out.emplace_back(TT::LSHIFT, "->",l,c); }
             else if(ch=='&') { adv(); out.emplace_back(TT::AMP, "&",l,c); }
+            else if(ch=='|') { adv(); out.emplace_back(TT::PIPE, "|",l,c); }
+            else if(ch=='^') { adv(); out.emplace_back(TT::CARET, "^",l,c); }
             else if(ch=='*') { adv(); out.emplace_back(TT::STAR, "*",l,c); }
             else if(ch=='='){adv();out.emplace_back(TT::EQ,    "=",l,c);}
             else if(ch=='+'){adv();out.emplace_back(TT::PLUS,  "+",l,c);}
             else if(ch=='-'){adv();out.emplace_back(TT::MINUS, "-",l,c);}
             else if(ch=='/'){adv();out.emplace_back(TT::DIV,   "/",l,c);}
+            else if(ch=='%'){adv();out.emplace_back(TT::MOD,   "%",l,c);}
             else if(ch=='('){adv();out.emplace_back(TT::LPAREN,"(",l,c);}
             else if(ch==')'){adv();out.emplace_back(TT::RPAREN,")",l,c);}
             else if(ch=='{'){adv();out.emplace_back(TT::LBRACE,"{",l,c);}
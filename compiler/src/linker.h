@@ -0,0 +1,371 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Static linker for the relocatable objects of the x86 terminal targets
+// (ELF32 i386 with REL, ELF64 x86-64 with RELA), built-in or from nasm.
+// It merges .text, .rodata, .data and .bss from every object, resolves
+// globals across them and writes an ET_EXEC with two PT_LOAD segments
+// (headers + code + read-only data, then data + bss). No dynamic section,
+// no interpreter: anything left undefined is an error, which the caller
+// uses to decide whether the system linker and libc are needed.
+namespace x86 {
+
+class Linker {
+    static constexpr uint64_t PAGE = 0x1000;
+
+    struct InSection {
+        std::string name;
+        uint32_t type = 0;       // SHT_PROGBITS / SHT_NOBITS
+        uint64_t flags = 0, align = 1, size = 0;
+        std::string bytes;       // empty for nobits
+        int group = -1;          // output group, -1 if not allocated
+        uint64_t addr = 0;       // final address
+    };
+    struct InSymbol {
+        std::string name;
+        uint64_t value = 0;
+        uint16_t shndx = 0;
+        uint8_t bind = 0, type = 0;
+    };
+    struct InReloc {
+        uint32_t section;        // relocated section (object-local index)
+        uint64_t offset;
+        uint32_t symbol, type;
+        int64_t addend;
+        bool has_addend;
+    };
+    struct Object {
+        std::string name;
+        std::vector<InSection> sections;
+        std::vector<InSymbol> symbols;
+        std::vector<InReloc> relocs;
+    };
+
+    // Output groups in layout order
+    enum Group { TEXT, RODATA, DATA, BSS, NGROUPS };
+    static constexpr const char* group_name[NGROUPS] = {".text", ".rodata", ".data", ".bss"};
+
+    bool elf64;
+    std::vector<Object> objects;
+    struct Def { size_t object; size_t symbol; };
+    std::unordered_map<std::string, Def> globals;
+
+    static uint64_t rd(const std::string& f, size_t off, int n) {
+        if (off + n > f.size()) throw std::runtime_error("truncated object file");
+        uint64_t v = 0;
+        for (int i = 0; i < n; i++) v |= (uint64_t)(unsigned char)f[off + i] << (8 * i);
+        return v;
+    }
+    static void wr(std::string& f, size_t off, uint64_t v, int n) {
+        for (int i = 0; i < n; i++) f[off + i] = (char)(v >> (8 * i));
+    }
+    static void put(std::string& o, uint64_t v, int n) { for (int i = 0; i < n; i++) o += (char)(v >> (8 * i)); }
+    static uint64_t align_up(uint64_t v, uint64_t a) { return a > 1 ? (v + a - 1) / a * a : v; }
+
+    static int group_of(const InSection& s) {
+        if (!(s.flags & 2)) return -1;                  // not SHF_ALLOC
+        if (s.type == 8) return BSS;                    // SHT_NOBITS
+        if (s.flags & 4) return TEXT;                   // SHF_EXECINSTR
+        if (s.flags & 1) return DATA;                   // SHF_WRITE
+        return RODATA;
+    }
+
+    uint64_t symbol_address(const Object& o, const InSymbol& s) const {
+        if (s.shndx == 0) {
+            auto it = globals.find(s.name);
+            if (it == globals.end()) throw std::runtime_error("undefined reference to '" + s.name + "'");
+            const Object& d = objects[it->second.object];
+            return symbol_address(d, d.symbols[it->second.symbol]);
+        }
+        if (s.shndx == 0xFFF1) return s.value;          // SHN_ABS
+        if (s.shndx >= o.sections.size()) throw std::runtime_error(o.name + ": unsupported symbol section");
+        return o.sections[s.shndx].addr + s.value;
+    }
+
+public:
+    explicit Linker(bool is64) : elf64(is64) {}
+
+    // Sizes of the merged groups after link(), for -v
+    uint64_t group_size[NGROUPS] = {};
+
+    void add_object(const std::string& f, const std::string& name) {
+        if (f.size() < 52 || f.compare(0, 4, "\x7f" "ELF") != 0) throw std::runtime_error(name + ": not an ELF object");
+        bool is64 = f[4] == 2;
+        if (is64 != elf64) throw std::runtime_error(name + ": wrong ELF class for this target");
+        if (rd(f, 16, 2) != 1) throw std::runtime_error(name + ": not a relocatable object");
+        uint64_t machine = rd(f, 18, 2);
+        if (machine != (elf64 ? 62u : 3u)) throw std::runtime_error(name + ": wrong machine type");
+        const int W = elf64 ? 8 : 4;
+        uint64_t shoff = rd(f, elf64 ? 0x28 : 0x20, W);
+        uint64_t shentsize = rd(f, elf64 ? 0x3A : 0x2E, 2), shnum = rd(f, elf64 ? 0x3C : 0x30, 2);
+        uint64_t shstrndx = rd(f, elf64 ? 0x3E : 0x32, 2);
+
+        struct SH { uint64_t name, type, flags, offset, size, link, info, align, entsize; };
+        std::vector<SH> sh(shnum);
+        for (uint64_t i = 0; i < shnum; i++) {
+            size_t b = shoff + i * shentsize;
+            if (elf64) sh[i] = {rd(f, b, 4), rd(f, b + 4, 4), rd(f, b + 8, 8), rd(f, b + 24, 8), rd(f, b + 32, 8),
+                                rd(f, b + 40, 4), rd(f, b + 44, 4), rd(f, b + 48, 8), rd(f, b + 56, 8)};
+            else       sh[i] = {rd(f, b, 4), rd(f, b + 4, 4), rd(f, b + 8, 4), rd(f, b + 16, 4), rd(f, b + 20, 4),
+                                rd(f, b + 24, 4), rd(f, b + 28, 4), rd(f, b + 32, 4), rd(f, b + 36, 4)};
+        }
+        auto cstr = [&](uint64_t table, uint64_t off) {
+            size_t p = sh[table].offset + off;
+            if (p >= f.size()) throw std::runtime_error(name + ": bad string offset");
+            return std::string(f.c_str() + p);
+        };
+
+        Object o;
+        o.name = name;
+        o.sections.resize(shnum);
+        for (uint64_t i = 0; i < shnum; i++) {
+            InSection& s = o.sections[i];
+            s.name = cstr(shstrndx, sh[i].name);
+            s.type = (uint32_t)sh[i].type;
+            s.flags = sh[i].flags;
+            s.align = sh[i].align ? sh[i].align : 1;
+            s.size = sh[i].size;
+            s.group = group_of(s);
+            if (s.group >= 0 && s.type != 8) {
+                if (sh[i].offset + sh[i].size > f.size()) throw std::runtime_error(name + ": section past end of file");
+                s.bytes = f.substr(sh[i].offset, sh[i].size);
+            }
+        }
+        for (uint64_t i = 0; i < shnum; i++) {
+            if (sh[i].type == 2) {                      // SHT_SYMTAB
+                for (uint64_t e = 0; e < sh[i].size; e += sh[i].entsize) {
+                    size_t b = sh[i].offset + e;
+                    InSymbol s;
+                    uint64_t nm = rd(f, b, 4);
+                    uint8_t info;
+                    if (elf64) { info = (uint8_t)rd(f, b + 4, 1); s.shndx = (uint16_t)rd(f, b + 6, 2); s.value = rd(f, b + 8, 8); }
+                    else       { s.value = rd(f, b + 4, 4); info = (uint8_t)rd(f, b + 12, 1); s.shndx = (uint16_t)rd(f, b + 14, 2); }
+                    s.bind = info >> 4;
+                    s.type = info & 15;
+                    s.name = cstr(sh[i].link, nm);
+                    if (s.shndx == 0xFFF2) throw std::runtime_error(name + ": common symbol '" + s.name + "' is not supported");
+                    o.symbols.push_back(s);
+                }
+            }
+        }
+        for (uint64_t i = 0; i < shnum; i++) {
+            if (sh[i].type != 9 && sh[i].type != 4) continue;   // SHT_REL / SHT_RELA
+            if (o.sections[sh[i].info].group < 0) continue;
+            bool rela = sh[i].type == 4;
+            for (uint64_t e = 0; e < sh[i].size; e += sh[i].entsize) {
+                size_t b = sh[i].offset + e;
+                uint64_t info = rd(f, b + W, W);
+                InReloc r;
+                r.section = (uint32_t)sh[i].info;
+                r.offset = rd(f, b, W);
+                r.symbol = (uint32_t)(elf64 ? info >> 32 : info >> 8);
+                r.type = (uint32_t)(elf64 ? info & 0xffffffff : info & 0xff);
+                r.addend = rela ? (int64_t)rd(f, b + 2 * W, W) : 0;
+                r.has_addend = rela;
+                o.relocs.push_back(r);
+            }
+        }
+
+        size_t idx = objects.size();
+        for (size_t i = 0; i < o.symbols.size(); i++) {
+            const InSymbol& s = o.symbols[i];
+            if (s.bind == 0 || s.shndx == 0) continue;  // local or undefined
+            auto [it, fresh] = globals.emplace(s.name, Def{idx, i});
+            if (!fresh) {
+                // A weak definition yields to a strong one
+                const InSymbol& old = objects[it->second.object].symbols[it->second.symbol];
+                if (old.bind == 2 && s.bind != 2) it->second = Def{idx, i};
+                else if (s.bind != 2 && old.bind != 2)
+                    throw std::runtime_error("'" + s.name + "' is defined in both " +
+                                             objects[it->second.object].name + " and " + name);
+            }
+        }
+        objects.push_back(std::move(o));
+    }
+
+    // Global names referenced but not defined by any object added so far
+    std::vector<std::string> undefined() const {
+        std::vector<std::string> out;
+        for (auto& o : objects)
+            for (auto& r : o.relocs) {
+                const InSymbol& s = o.symbols.at(r.symbol);
+                if (s.shndx == 0 && !globals.count(s.name) &&
+                    std::find(out.begin(), out.end(), s.name) == out.end())
+                    out.push_back(s.name);
+            }
+        return out;
+    }
+
+    std::string link(const std::string& entry = "_start") {
+        const uint64_t base = elf64 ? 0x400000 : 0x08048000;
+        const int W = elf64 ? 8 : 4;
+        const uint64_t ehsize = elf64 ? 64 : 52, phentsize = elf64 ? 56 : 32;
+        const int nphdr = 3;                            // text, data, GNU_STACK
+
+        // Layout: headers, then text and rodata in the first segment; data
+        // and bss in the second, whose address is congruent to its file
+        // offset modulo the page size
+        uint64_t off = ehsize + phentsize * nphdr;
+        uint64_t group_off[NGROUPS] = {}, group_addr[NGROUPS] = {};
+        for (int g = 0; g < NGROUPS; g++) group_size[g] = 0;
+        auto place = [&](int g, uint64_t& cursor) {
+            uint64_t start = cursor;
+            bool first = true;
+            for (auto& o : objects)
+                for (auto& s : o.sections) {
+                    if (s.group != g) continue;
+                    cursor = align_up(cursor, s.align);
+                    if (first) { start = cursor; first = false; }
+                    s.addr = cursor;                    // relative for now
+                    cursor += s.size;
+                }
+            group_off[g] = start;
+            group_size[g] = cursor - start;
+        };
+        place(TEXT, off);
+        place(RODATA, off);
+        uint64_t text_end = off;
+        uint64_t data_off = align_up(off, 16);
+        uint64_t cursor = data_off;
+        place(DATA, cursor);
+        uint64_t data_file_end = cursor;
+        uint64_t data_addr = align_up(base + text_end, PAGE) + data_off % PAGE;
+        // bss follows data in memory only
+        uint64_t mem = cursor;
+        place(BSS, mem);
+
+        for (int g = 0; g < NGROUPS; g++) {
+            uint64_t delta = g < DATA ? base : data_addr - data_off;
+            group_addr[g] = group_off[g] + delta;
+            for (auto& o : objects)
+                for (auto& s : o.sections)
+                    if (s.group == g) s.addr += delta;
+        }
+        uint64_t data_mem_end = mem + data_addr - data_off;
+
+        // File image with section contents in place
+        std::string out(data_file_end, '\0');
+        for (auto& o : objects)
+            for (auto& s : o.sections) {
+                if (s.group < 0 || s.group == BSS) continue;
+                uint64_t at = s.addr - (s.group < DATA ? base : data_addr - data_off);
+                out.replace(at, s.bytes.size(), s.bytes);
+            }
+
+        // Relocations
+        for (auto& o : objects) {
+            for (auto& r : o.relocs) {
+                const InSection& sec = o.sections[r.section];
+                const InSymbol& sym = o.symbols.at(r.symbol);
+                uint64_t S = symbol_address(o, sym);
+                uint64_t P = sec.addr + r.offset;
+                uint64_t at = P - (sec.group < DATA ? base : data_addr - data_off);
+                if (sec.group == BSS) throw std::runtime_error(o.name + ": relocation in .bss");
+                int64_t v;
+                int bytes = 4;
+                if (!elf64) {
+                    int64_t A = (int32_t)rd(out, at, 4);
+                    switch (r.type) {
+                        case 1: v = (int64_t)(S + A); break;              // R_386_32
+                        case 2: v = (int64_t)(S + A - P); break;          // R_386_PC32
+                        case 4: v = (int64_t)(S + A - P); break;          // R_386_PLT32, no PLT when static
+                        default: throw std::runtime_error(o.name + ": unsupported relocation type " + std::to_string(r.type));
+                    }
+                } else {
+                    int64_t A = r.addend;
+                    switch (r.type) {
+                        case 1:  v = (int64_t)(S + A); bytes = 8; break;  // R_X86_64_64
+                        case 2:                                            // R_X86_64_PC32
+                        case 4:  v = (int64_t)(S + A - P);                 // R_X86_64_PLT32
+                                 if (v < INT32_MIN || v > INT32_MAX) throw std::runtime_error(o.name + ": PC32 relocation out of range");
+                                 break;
+                        case 10: v = (int64_t)(S + A);                     // R_X86_64_32
+                                 if ((uint64_t)v > UINT32_MAX) throw std::runtime_error(o.name + ": R_X86_64_32 out of range");
+                                 break;
+                        case 11: v = (int64_t)(S + A);                     // R_X86_64_32S
+                                 if (v < INT32_MIN || v > INT32_MAX) throw std::runtime_error(o.name + ": R_X86_64_32S out of range");
+                                 break;
+                        default: throw std::runtime_error(o.name + ": unsupported relocation type " + std::to_string(r.type));
+                    }
+                }
+                wr(out, at, (uint64_t)v, bytes);
+            }
+        }
+
+        auto e = globals.find(entry);
+        if (e == globals.end()) throw std::runtime_error("entry symbol '" + entry + "' is not defined");
+        uint64_t entry_addr = symbol_address(objects[e->second.object], objects[e->second.object].symbols[e->second.symbol]);
+
+        // Section headers for tools; the loader only needs the segments
+        std::string shstr(1, '\0');
+        struct SH { uint32_t name, type; uint64_t flags, addr, offset, size, align; };
+        std::vector<SH> sh{{0, 0, 0, 0, 0, 0, 0}};
+        static const uint64_t gflags[NGROUPS] = {6, 2, 3, 3};
+        for (int g = 0; g < NGROUPS; g++) {
+            if (!group_size[g]) continue;
+            uint32_t nm = (uint32_t)shstr.size();
+            shstr += group_name[g]; shstr += '\0';
+            uint64_t fo = g == BSS ? data_file_end : group_off[g];
+            sh.push_back({nm, g == BSS ? 8u : 1u, gflags[g], group_addr[g], fo, group_size[g], 16});
+        }
+        uint32_t shstr_name = (uint32_t)shstr.size();
+        shstr += ".shstrtab"; shstr += '\0';
+        uint64_t shstr_off = out.size();
+        out += shstr;
+        while (out.size() % W) out += '\0';
+        uint64_t shoff = out.size();
+        sh.push_back({shstr_name, 3, 0, 0, shstr_off, shstr.size(), 1});
+        for (auto& h : sh) {
+            if (elf64) {
+                put(out, h.name, 4); put(out, h.type, 4); put(out, h.flags, 8); put(out, h.addr, 8);
+                put(out, h.offset, 8); put(out, h.size, 8); put(out, 0, 4); put(out, 0, 4);
+                put(out, h.align, 8); put(out, 0, 8);
+            } else {
+                put(out, h.name, 4); put(out, h.type, 4); put(out, h.flags, 4); put(out, h.addr, 4);
+                put(out, h.offset, 4); put(out, h.size, 4); put(out, 0, 4); put(out, 0, 4);
+                put(out, h.align, 4); put(out, 0, 4);
+            }
+        }
+
+        // ELF header and program headers
+        std::string hdr;
+        hdr += "\x7f" "ELF";
+        hdr += (char)(elf64 ? 2 : 1); hdr += (char)1; hdr += (char)1; hdr += (char)0;
+        hdr.append(8, '\0');
+        put(hdr, 2, 2);                                 // ET_EXEC
+        put(hdr, elf64 ? 62 : 3, 2);
+        put(hdr, 1, 4);
+        put(hdr, entry_addr, W);
+        put(hdr, ehsize, W);                            // phoff
+        put(hdr, shoff, W);
+        put(hdr, 0, 4);
+        put(hdr, ehsize, 2);
+        put(hdr, phentsize, 2); put(hdr, nphdr, 2);
+        put(hdr, elf64 ? 64 : 40, 2);
+        put(hdr, sh.size(), 2);
+        put(hdr, sh.size() - 1, 2);
+        auto phdr = [&](uint32_t type, uint32_t flags, uint64_t offset, uint64_t vaddr, uint64_t filesz, uint64_t memsz, uint64_t align) {
+            if (elf64) {
+                put(hdr, type, 4); put(hdr, flags, 4); put(hdr, offset, 8); put(hdr, vaddr, 8); put(hdr, vaddr, 8);
+                put(hdr, filesz, 8); put(hdr, memsz, 8); put(hdr, align, 8);
+            } else {
+                put(hdr, type, 4); put(hdr, offset, 4); put(hdr, vaddr, 4); put(hdr, vaddr, 4);
+                put(hdr, filesz, 4); put(hdr, memsz, 4); put(hdr, flags, 4); put(hdr, align, 4);
+            }
+        };
+        phdr(1, 5, 0, base, text_end, text_end, PAGE);                              // PT_LOAD r-x
+        uint64_t data_memsz = data_mem_end - data_addr;
+        // An empty second segment still gets a valid (zero-sized) entry
+        phdr(1, 6, data_off, data_addr, data_file_end - data_off, data_memsz, PAGE); // PT_LOAD rw-
+        phdr(0x6474e551, 6, 0, 0, 0, 0, 16);                                        // PT_GNU_STACK rw-
+        out.replace(0, hdr.size(), hdr);
+        return out;
+    }
+};
+
+} // namespace x86
@@ -1,5 +1,6 @@
 #pragma once
 #include "defacto.h"
+#include "trace.h"
 #ifdef HAS_LLVM
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
@@ -27,7 +28,10 @@ class LLVMCodeGen {
     llvm::IRBuilder<> builder;
     std::unique_ptr<llvm::Module> module;
     
-    std::map<std::string, llvm::Value*> variables;
+    // Variable tables are indexed by interned symbol
+    struct VarInfo { llvm::Value* slot = nullptr; std::string type; };
+    const Interner* names = nullptr;
+    std::vector<VarInfo> vars;
     std::map<std::string, llvm::Type*> struct_types;
     std::map<std::string, std::map<std::string, int>> struct_field_offsets;
     std::map<std::string, int> struct_sizes;
@@ -152,178 +156,95 @@ public:
         builder.CreateStore(value, ptr);
     }
     
-    llvm::Value* parse_expression(const std::string& expr) {
-        std::string s = expr;
-        
-        // Remove outer parentheses
-        while (s.size() >= 2 && s[0] == '(' && s[s.size()-1] == ')') {
-            int depth = 0;
-            bool match = true;
-            for (size_t i = 0; i < s.size(); i++) {
-                if (s[i] == '(') depth++;
-                else if (s[i] == ')') depth--;
-                if (depth == 0 && i < s.size() - 1) {
-                    match = false;
-                    break;
-                }
-            }
-            if (match) s = s.substr(1, s.size() - 2);
-            else break;
-        }
-        
-        // Find main operator (lowest precedence first)
-        size_t op_pos = std::string::npos;
-        char op_char = 0;
-        int paren_depth = 0;
-        
-        // Look for + or -
-        for (int i = (int)s.size() - 1; i >= 0; i--) {
-            char c = s[i];
-            if (c == ')') paren_depth++;
-            else if (c == '(') paren_depth--;
-            else if (paren_depth == 0 && (c == '+' || c == '-')) {
-                if (i == 0 || (s[i-1] != '(' && s[i-1] != '+' && s[i-1] != '-' && 
-                               s[i-1] != '*' && s[i-1] != '/' && s[i-1] != '&' && 
-                               s[i-1] != '|' && s[i-1] != '^')) {
-                    op_pos = i;
-                    op_char = c;
-                    break;
-                }
-            }
-        }
-        
-        // Look for * or /
-        if (op_pos == std::string::npos) {
-            paren_depth = 0;
-            for (int i = (int)s.size() - 1; i >= 0; i--) {
-                char c = s[i];
-                if (c == ')') paren_depth++;
-                else if (c == '(') paren_depth--;
-                else if (paren_depth == 0 && (c == '*' || c == '/')) {
-                    op_pos = i;
-                    op_char = c;
-                    break;
-                }
-            }
-        }
-        
-        // Look for bitwise operators
-        if (op_pos == std::string::npos) {
-            paren_depth = 0;
-            for (int i = (int)s.size() - 1; i >= 0; i--) {
-                char c = s[i];
-                if (c == ')') paren_depth++;
-                else if (c == '(') paren_depth--;
-                else if (paren_depth == 0 && c == '&') {
-                    op_pos = i;
-                    op_char = c;
-                    break;
-                }
-            }
-        }
-        
-        if (op_pos == std::string::npos) {
-            paren_depth = 0;
-            for (int i = (int)s.size() - 1; i >= 0; i--) {
-                char c = s[i];
-                if (c == ')') paren_depth++;
-                else if (c == '(') paren_depth--;
-                else if (paren_depth == 0 && (c == '|' || c == '^')) {
-                    op_pos = i;
-                    op_char = c;
-                    break;
-                }
+    llvm::Value* as_i32(llvm::Value* v) {
+        if (v->getType()->isPointerTy()) return builder.CreatePtrToInt(v, i32_type);
+        if (v->getType() != i32_type) return builder.CreateZExtOrTrunc(v, i32_type);
+        return v;
+    }
+    
+    llvm::Value* as_bool(llvm::Value* v) {
+        return builder.CreateICmpNE(as_i32(v), llvm::ConstantInt::get(i32_type, 0));
+    }
+    
+    VarInfo& var(const Expr* e) {
+        if (e->sym >= vars.size() || !vars[e->sym].slot)
+            throw std::runtime_error("undeclared variable '" + e->val + "'");
+        return vars[e->sym];
+    }
+    
+    llvm::Value* lookup(const Expr* e) { return var(e).slot; }
+    
+    // Address of an lvalue expression
+    llvm::Value* gen_lvalue(const Expr* e) {
+        switch (e->kind) {
+            case EK::VAR: return lookup(e);
+            case EK::DEREF: return builder.CreateIntToPtr(gen_expr(e->lhs), ptr_type);
+            case EK::INDEX: {
+                auto& v = var(e->lhs);
+                return builder.CreateGEP(get_llvm_type(v.type), v.slot, as_i32(gen_expr(e->rhs)));
             }
-        }
-        
-        // Look for shift operators
-        if (op_pos == std::string::npos) {
-            for (size_t i = 0; i + 1 < s.size(); i++) {
-                if ((s[i] == '<' && s[i+1] == '<') || (s[i] == '>' && s[i+1] == '>')) {
-                    op_pos = i;
-                    op_char = s[i];
-                    break;
-                }
+            case EK::FIELD: {
+                auto& v = var(e->lhs);
+                int off = struct_field_offsets[v.type][e->val];
+                return builder.CreateGEP(i8_type, v.slot, llvm::ConstantInt::get(i32_type, off));
             }
+            default: throw std::runtime_error("expression is not assignable");
         }
-        
-        // No operator: it's a value
-        if (op_pos == std::string::npos) {
-            return parse_primary(s);
-        }
-        
-        std::string left_str = s.substr(0, op_pos);
-        std::string right_str = s.substr(op_pos + 1);
-        
-        llvm::Value* left = parse_expression(left_str);
-        llvm::Value* right = parse_expression(right_str);
-        
-        if (!left || !right) return nullptr;
-        
-        switch (op_char) {
-            case '+': return builder.CreateAdd(left, right);
-            case '-': return builder.CreateSub(left, right);
-            case '*': return builder.CreateMul(left, right);
-            case '/': return builder.CreateSDiv(left, right);
-            case '&': return builder.CreateAnd(left, right);
-            case '|': return builder.CreateOr(left, right);
-            case '^': return builder.CreateXor(left, right);
-            case '<': 
-                if (s[op_pos+1] == '<') return builder.CreateShl(left, right);
-                return builder.CreateICmpSLT(left, right);
-            case '>':
-                if (s[op_pos+1] == '>') return builder.CreateAShr(left, right);
-                return builder.CreateICmpSGT(left, right);
-        }
-        
-        return left;
     }
     
-    llvm::Value* parse_primary(const std::string& s) {
-        if (s.empty()) return nullptr;
-        
-        // Number
-        if (isdigit(s[0]) || (s[0] == '-' && s.size() > 1 && isdigit(s[1]))) {
-            if (s.find('.') != std::string::npos) {
-                // Float literal - treat as i64 for now
-                return llvm::ConstantInt::get(i64_type, std::stoll(s));
+    // IRBuilder folds operations on constants as they are created
+    llvm::Value* gen_expr(const Expr* e) {
+        switch (e->kind) {
+            case EK::NUM: return llvm::ConstantInt::get(i32_type, parse_int(e->val));
+            case EK::STR: return builder.CreateGlobalStringPtr(e->val);
+            case EK::VAR: return load_value(lookup(e), var(e).type);
+            case EK::ADDR: return lookup(e->lhs);
+            case EK::DEREF:
+            case EK::INDEX: {
+                auto ty = e->kind == EK::INDEX && var(e->lhs).type == "u8" ? i8_type : i32_type;
+                return as_i32(builder.CreateLoad(ty, gen_lvalue(e)));
             }
-            return llvm::ConstantInt::get(i32_type, std::stoll(s));
-        }
-        
-        // Hex number
-        if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
-            return llvm::ConstantInt::get(i32_type, std::stoll(s.substr(2), nullptr, 16));
-        }
-        
-        // Address-of: &var
-        if (s[0] == '&') {
-            std::string varname = s.substr(1);
-            auto it = variables.find(varname);
-            if (it != variables.end()) return it->second;
-            return nullptr;
-        }
-        
-        // Dereference: *ptr
-        if (s[0] == '*') {
-            std::string ptrname = s.substr(1);
-            auto it = variables.find(ptrname);
-            if (it != variables.end()) {
-                return builder.CreateLoad(ptr_type, it->second);
+            case EK::FIELD: return builder.CreateLoad(i32_type, gen_lvalue(e));
+            case EK::UNARY: {
+                llvm::Value* v = as_i32(gen_expr(e->lhs));
+                if (e->op == OP::NEG) return builder.CreateNeg(v);
+                return builder.CreateZExt(builder.CreateNot(as_bool(v)), i32_type);
             }
-            return nullptr;
+            case EK::BINARY: break;
+            default: throw std::runtime_error("unsupported expression in LLVM backend");
         }
         
-        // Variable reference
-        auto it = variables.find(s);
-        if (it != variables.end()) {
-            return load_value(it->second, "i32"); // TODO: get actual type
+        llvm::Value* l = as_i32(gen_expr(e->lhs));
+        llvm::Value* r = as_i32(gen_expr(e->rhs));
+        switch (e->op) {
+            case OP::ADD: return builder.CreateAdd(l, r);
+            case OP::SUB: return builder.CreateSub(l, r);
+            case OP::MUL: return builder.CreateMul(l, r);
+            case OP::DIV: return builder.CreateSDiv(l, r);
+            case OP::MOD: return builder.CreateSRem(l, r);
+            case OP::AND: return builder.CreateAnd(l, r);
+            case OP::OR:  return builder.CreateOr(l, r);
+            case OP::XOR: return builder.CreateXor(l, r);
+            case OP::SHL: return builder.CreateShl(l, r);
+            case OP::SHR: return builder.CreateAShr(l, r);
+            case OP::LAND: return builder.CreateZExt(builder.CreateAnd(as_bool(l), as_bool(r)), i32_type);
+            case OP::LOR:  return builder.CreateZExt(builder.CreateOr(as_bool(l), as_bool(r)), i32_type);
+            default: break;
         }
-        
-        return nullptr;
+        llvm::CmpInst::Predicate pred;
+        switch (e->op) {
+            case OP::EQ: pred = llvm::CmpInst::ICMP_EQ; break;
+            case OP::NE: pred = llvm::CmpInst::ICMP_NE; break;
+            case OP::LT: pred = llvm::CmpInst::ICMP_SLT; break;
+            case OP::GT: pred = llvm::CmpInst::ICMP_SGT; break;
+            case OP::LE: pred = llvm::CmpInst::ICMP_SLE; break;
+            default:     pred = llvm::CmpInst::ICMP_SGE; break;
+        }
+        return builder.CreateZExt(builder.CreateICmp(pred, l, r), i32_type);
     }
     
     void gen_var(VarDecl* v) {
+        long long cv;
         llvm::Type* ty = get_llvm_type(v->type);
         llvm::Value* alloc;
         
@@ -336,14 +257,99 @@ public:
             alloc = builder.CreateAlloca(ty, nullptr, "var_" + v->name);
         }
         
-        variables[v->name] = alloc;
+        vars[v->sym] = {alloc, v->type};
         
-        // Initialize if needed
-        if (!v->init.empty()) {
-            llvm::Value* init_val = parse_expression(v->init);
-            if (init_val) {
-                store_value(init_val, alloc);
+        // Initialize if needed; runtime initializers arrive as an Assign
+        if (v->init && !v->is_arr && (v->init->kind == EK::STR || const_value(v->init, cv)))
+            store_value(gen_expr(v->init), alloc);
+    }
+    
+    void gen_body(const NodeList& body) {
+        for (auto& s : body) gen_stmt(s);
+    }
+    
+    void gen_stmt(Node* n) {
+        llvm::Function* fn = builder.GetInsertBlock()->getParent();
+        switch (n->kind) {
+            case NT::ASSIGN: {
+                auto a = static_cast<Assign*>(n);
+                llvm::Value* v = gen_expr(a->value);
+                const Expr* t = a->target;
+                if (t->kind == EK::VAR && get_llvm_type(var(t).type)->isPointerTy()) {
+                    if (!v->getType()->isPointerTy()) v = builder.CreateIntToPtr(v, ptr_type);
+                    store_value(v, lookup(t));
+                } else if (t->kind == EK::INDEX && var(t->lhs).type == "u8") {
+                    store_value(builder.CreateTrunc(as_i32(v), i8_type), gen_lvalue(t));
+                } else if (t->kind != EK::REG) {
+                    store_value(as_i32(v), gen_lvalue(t));
+                }
+                break;
             }
+            case NT::DISPLAY: gen_display(static_cast<DisplayNode*>(n)); break;
+            case NT::IF_STMT: {
+                auto i = static_cast<IfNode*>(n);
+                auto then_bb = llvm::BasicBlock::Create(context, "if_then", fn);
+                auto else_bb = llvm::BasicBlock::Create(context, "if_else", fn);
+                auto end_bb = llvm::BasicBlock::Create(context, "if_end", fn);
+                builder.CreateCondBr(as_bool(gen_expr(i->cond)), then_bb, else_bb);
+                builder.SetInsertPoint(then_bb);
+                gen_body(i->then_body);
+                builder.CreateBr(end_bb);
+                builder.SetInsertPoint(else_bb);
+                gen_body(i->else_body);
+                builder.CreateBr(end_bb);
+                builder.SetInsertPoint(end_bb);
+                break;
+            }
+            case NT::WHILE:
+            case NT::FOR:
+            case NT::LOOP: {
+                auto cond_bb = llvm::BasicBlock::Create(context, "loop_cond", fn);
+                auto body_bb = llvm::BasicBlock::Create(context, "loop_body", fn);
+                auto step_bb = llvm::BasicBlock::Create(context, "loop_step", fn);
+                auto end_bb = llvm::BasicBlock::Create(context, "loop_end", fn);
+                const Expr* cond = nullptr;
+                const NodeList* body;
+                ForNode* f = nullptr;
+                if (n->kind == NT::WHILE) {
+                    cond = static_cast<WhileNode*>(n)->cond;
+                    body = &static_cast<WhileNode*>(n)->body;
+                } else if (n->kind == NT::FOR) {
+                    f = static_cast<ForNode*>(n);
+                    auto& iv = vars[f->init_sym];
+                    if (!iv.slot) iv = {builder.CreateAlloca(i32_type, nullptr, "var_" + f->init_var), "i32"};
+                    store_value(as_i32(gen_expr(f->init)), iv.slot);
+                    cond = f->cond;
+                    body = &f->body;
+                } else {
+                    body = &static_cast<LoopNode*>(n)->body;
+                }
+                builder.CreateBr(cond_bb);
+                builder.SetInsertPoint(cond_bb);
+                if (cond) builder.CreateCondBr(as_bool(gen_expr(cond)), body_bb, end_bb);
+                else builder.CreateBr(body_bb);
+                builder.SetInsertPoint(body_bb);
+                loop_ends.push_back(end_bb);
+                loop_continues.push_back(step_bb);
+                gen_body(*body);
+                loop_ends.pop_back();
+                loop_continues.pop_back();
+                builder.CreateBr(step_bb);
+                builder.SetInsertPoint(step_bb);
+                if (f) store_value(as_i32(gen_expr(f->step)), vars[f->init_sym].slot);
+                builder.CreateBr(cond_bb);
+                builder.SetInsertPoint(end_bb);
+                break;
+            }
+            case NT::BREAK:
+            case NT::CONTINUE_STMT: {
+                if (loop_ends.empty()) break;
+                builder.CreateBr(n->kind == NT::BREAK ? loop_ends.back() : loop_continues.back());
+                // Code after a jump is unreachable but still needs a block
+                builder.SetInsertPoint(llvm::BasicBlock::Create(context, "after_jump", fn));
+                break;
+            }
+            default: break;
         }
     }
     
@@ -357,10 +363,10 @@ public:
                 llvm::Function::ExternalLinkage, "printf", module.get());
         }
         
-        auto it = variables.find(d->var);
-        if (it == variables.end()) return;
+        Sym s = names->find(d->var);
+        if (!s || !vars[s].slot) return;
         
-        llvm::Value* var_ptr = it->second;
+        llvm::Value* var_ptr = vars[s].slot;
         llvm::Value* var_val = load_value(var_ptr, "i32");
         
         // Create format string
@@ -376,8 +382,10 @@ public:
         builder.CreateCall(printf_func, {fmt_ptr, var_val});
     }
     
-    std::string generate(std::vector<NodePtr>& nodes, bool is_64bit_mode) {
+    std::string generate(ProgramNode* prog, bool is_64bit_mode) {
         set_64bit(is_64bit_mode);
+        names = prog->names;
+        vars.assign(names->size(), VarInfo{});
         
         // Create main function
         llvm::FunctionType* main_type = llvm::FunctionType::get(i32_type, false);
@@ -388,13 +396,11 @@ public:
         builder.SetInsertPoint(entry);
         
         // Process all nodes
-        for (auto& node : nodes) {
-            if (auto* var = dynamic_cast<VarDecl*>(node.get())) {
-                gen_var(var);
-            } else if (auto* display = dynamic_cast<DisplayNode*>(node.get())) {
-                gen_display(display);
-            }
-            // TODO: Handle other node types
+        for (auto& node : prog->main_sec) {
+            if (node->kind != NT::SECTION) continue;
+            auto* sec = static_cast<SectionNode*>(node);
+            for (auto& d : sec->decls) gen_var(static_cast<VarDecl*>(d));
+            gen_body(sec->stmts);
         }
         
         // Return 0
@@ -412,6 +418,7 @@ public:
         fpm.doInitialization();
         
         for (auto& func : *module) {
+            TraceScope trace("LLVM passes", func.getName().str());
             fpm.run(func);
         }
         
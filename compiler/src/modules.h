@@ -0,0 +1,158 @@
+#pragma once
+#include "defacto.h"
+#include "lexer.h"
+#include "parser.h"
+#include "trace.h"
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+// Resolves Import{...} as separate modules. Every file is read, lexed and
+// parsed once per compilation no matter how often it is imported; modules
+// share the compilation's arena and interner so symbols agree across files.
+class ModuleLoader {
+    struct Module {
+        std::string  path;      // canonical
+        std::string  src;       // tokens and AST strings point into this
+        ProgramNode* ast = nullptr;
+    };
+
+    Arena&    arena;
+    Interner& names;
+    std::vector<std::string> search;                          // extra import directories
+    std::unordered_map<std::string, std::unique_ptr<Module>> by_path;
+    std::vector<Module*> order;                               // dependencies before dependents
+    size_t dedup_hits = 0, tokens = 0;
+    bool verbose = false;
+
+    static std::string read_file(const std::string& p) {
+        std::ifstream f(p);
+        if (!f) throw std::runtime_error("cannot open '" + p + "'");
+        std::ostringstream s; s << f.rdbuf(); return s.str();
+    }
+
+    static std::string canonical(const std::filesystem::path& p) {
+        std::error_code ec;
+        auto c = std::filesystem::weakly_canonical(p, ec);
+        return (ec ? p : c).string();
+    }
+
+    // name.de and name/name.de (stdlib layout) in each search directory,
+    // starting with the importing file's own directory
+    std::string resolve(const std::string& name, const std::string& from_dir) const {
+        std::filesystem::path rel(name);
+        if (rel.extension() != ".de") rel += ".de";
+        std::vector<std::string> dirs{from_dir, "."};
+        dirs.insert(dirs.end(), search.begin(), search.end());
+        dirs.push_back("lib");
+        dirs.push_back("stdlib");
+        for (auto& d : dirs) {
+            std::filesystem::path base(d);
+            for (auto cand : {base / rel, base / name / rel.filename()}) {
+                std::error_code ec;
+                if (std::filesystem::is_regular_file(cand, ec)) return canonical(cand);
+            }
+        }
+        std::string tried;
+        for (auto& d : dirs) tried += (tried.empty() ? "" : ", ") + (d.empty() ? std::string(".") : d);
+        throw std::runtime_error("library not found: " + name + " (searched " + tried + ")");
+    }
+
+    Module* load(const std::string& path, bool is_library) {
+        auto& slot = by_path[path];
+        if (slot) {
+            // Already loaded, or an import cycle back to a module in progress
+            dedup_hits++;
+            return slot.get();
+        }
+        slot = std::make_unique<Module>();
+        Module* m = slot.get();
+        m->path = path;
+        m->src  = read_file(path);
+        if (verbose) std::cout << "  module: " << path << "\n";
+
+        TraceScope trace("module", path);
+        Lexer  lexer(m->src, arena, names);
+        std::vector<Token> toks;
+        {
+            TraceScope t("Lexer::tokenize", path);
+            toks = lexer.tokenize();
+        }
+        tokens += toks.size();
+        Parser parser(std::move(toks), arena, names);
+        {
+            TraceScope t("Parser::parse", path);
+            m->ast = parser.parse(is_library);
+        }
+        if (is_library && !m->ast->main_sec.empty())
+            warn("module '" + path + "' has a main section; it is ignored when imported");
+
+        std::string dir = std::filesystem::path(path).parent_path().string();
+        for (auto& imp : m->ast->imports) load(resolve(imp, dir), true);
+        order.push_back(m);
+        return m;
+    }
+
+    template<class T>
+    static void append(Arena& a, List<T>& dst, const List<T>& src) {
+        for (auto& x : src) dst.push_back(a, x);
+    }
+
+public:
+    ModuleLoader(Arena& a, Interner& n, bool v = false) : arena(a), names(n), verbose(v) {
+        // DEFACTO_PATH=dir1:dir2 adds import directories ahead of lib/ and stdlib/
+        if (const char* env = std::getenv("DEFACTO_PATH")) {
+            std::string s = env;
+            size_t start = 0;
+            while (start <= s.size()) {
+                size_t end = s.find(':', start);
+                if (end == std::string::npos) end = s.size();
+                if (end > start) search.push_back(s.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+    }
+
+    // Loads the program and everything it imports, and returns one program
+    // whose structs, drivers, externs, interrupts and functions come from all
+    // modules, dependencies first. Directives and the main section are the
+    // entry file's.
+    ProgramNode* load_program(const std::string& input) {
+        TraceScope trace("import resolution", input);
+        Module* root = load(canonical(input), false);
+        auto p = arena.make<ProgramNode>(*root->ast);
+        if (order.size() == 1) return p;
+
+        p->interrupts = {}; p->functions = {};
+        p->structs = {}; p->drivers = {}; p->externs = {};
+        std::unordered_map<std::string_view, const Module*> defined;
+        for (Module* m : order) {
+            auto ast = m->ast;
+            for (auto f : ast->functions) {
+                Str name = static_cast<FuncDecl*>(f)->name;
+                auto ins = defined.emplace(name, m);
+                if (!ins.second)
+                    throw std::runtime_error("function '" + name + "' is defined in both '" +
+                                             ins.first->second->path + "' and '" + m->path + "'");
+            }
+            append(arena, p->interrupts, ast->interrupts);
+            append(arena, p->functions,  ast->functions);
+            append(arena, p->structs,    ast->structs);
+            append(arena, p->drivers,    ast->drivers);
+            append(arena, p->externs,    ast->externs);
+        }
+        return p;
+    }
+
+    // Canonical path and text of every loaded module, dependencies first
+    template<class F>
+    void each_source(F&& f) const { for (auto m : order) f(m->path, m->src); }
+
+    size_t module_count() const { return order.size(); }
+    size_t dedup_count() const  { return dedup_hits; }
+    size_t token_count() const  { return tokens; }
+};
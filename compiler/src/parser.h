@@ -3,6 +3,8 @@
 #include <stdexcept>
 
 class Parser {
+    Arena& arena;
+    Interner& names;
     std::vector<Token> tk;
     size_t pos = 0;
     std::set<std::string> const_vars;
@@ -10,33 +12,59 @@ class Parser {
     Token& cur()        { return tk[pos < tk.size() ? pos : tk.size()-1]; }
     void   adv()        { if (pos < tk.size()) pos++; }
     bool   at(TT t)     { return cur().type == t; }
+    // fn, or the inline/noinline that may precede it; both words stay
+    // ordinary identifiers everywhere else
+    bool   at_fn()      {
+        if (at(TT::FN)) return true;
+        return at(TT::IDENT) && (cur().val == "inline" || cur().val == "noinline") &&
+               pos + 1 < tk.size() && tk[pos + 1].type == TT::FN;
+    }
 
     void expect(TT t, const std::string& msg) {
         if (!at(t)) throw std::runtime_error(msg+" (got '"+cur().val+"' at line "+std::to_string(cur().line)+")");
         adv();
     }
 
-    // Expression AST node
-    struct ExprNode {
-        std::string op;       // "", "+", "-", "*", "/"
-        std::string value;    // variable, number, etc.
-        std::unique_ptr<ExprNode> left, right;
-        ExprNode() {}
-        ExprNode(std::string v) : value(v) {}
-        ExprNode(std::string o, std::unique_ptr<ExprNode> l, std::unique_ptr<ExprNode> r)
-            : op(o), left(std::move(l)), right(std::move(r)) {}
-    };
-    
-    std::unique_ptr<ExprNode> parse_primary() {
+    ExprPtr leaf(EK k, Str v) {
+        auto e = arena.make<Expr>(k, v, cur().line, cur().col);
+        if (k == EK::VAR) e->sym = cur().sym ? cur().sym : names.intern(v);
+        adv();
+        return e;
+    }
+
+    ExprPtr var_ref(Str name, Sym sym, int l, int c) {
+        auto e = arena.make<Expr>(EK::VAR, name, l, c);
+        e->sym = sym;
+        return e;
+    }
+
+    // name or name.field (the lexer keeps dots inside identifiers)
+    ExprPtr parse_name() {
+        if (!at(TT::IDENT)) throw std::runtime_error("expected variable name at line " + std::to_string(cur().line));
+        int l = cur().line, c = cur().col;
+        Str name = cur().val;
+        Sym sym = cur().sym;
+        adv();
+        auto dot = name.find('.');
+        if (dot == Str::npos || dot == 0 || dot + 1 == name.size())
+            return var_ref(name, sym, l, c);
+        auto f = arena.make<Expr>(EK::FIELD, name.substr(dot + 1), l, c);
+        Str base = name.substr(0, dot);
+        f->lhs = var_ref(base, names.intern(base), l, c);
+        return f;
+    }
+
+    ExprPtr parse_primary() {
+        int l = cur().line, c = cur().col;
         // Handle & (address-of)
         if (at(TT::AMP)) {
             adv();
             if (!at(TT::IDENT)) {
                 throw std::runtime_error("expected variable name after '&' at line " + std::to_string(cur().line));
             }
-            std::string var = cur().val;
-            adv();
-            return std::make_unique<ExprNode>("&" + var);
+            auto e = arena.make<Expr>(EK::ADDR, "", l, c);
+            e->lhs = leaf(EK::VAR, cur().val);
+            return e;
         }
 
         // Handle * (dereference): *ptr
@@ -45,61 +73,38 @@ class Parser {
             if (!at(TT::IDENT)) {
                 throw std::runtime_error("expected variable name after '*' at line " + std::to_string(cur().line));
             }
-            std::string ptr = cur().val;
-            adv();
-            return std::make_unique<ExprNode>("*" + ptr);
+            auto e = arena.make<Expr>(EK::DEREF, "", l, c);
+            e->lhs = leaf(EK::VAR, cur().val);
+            return e;
         }
 
         // Handle logical NOT: !x
         if (at(TT::LOGIC_NOT)) {
             adv();
-            auto operand = parse_primary();
-            return std::make_unique<ExprNode>("!", std::move(operand), std::make_unique<ExprNode>("0"));
+            return make_unary(arena, OP::NOT, parse_primary(), l, c);
         }
 
-        // Handle true/false literals
-        if (at(TT::TRUE)) {
-            adv();
-            return std::make_unique<ExprNode>("1");
-        }
-        if (at(TT::FALSE)) {
-            adv();
-            return std::make_unique<ExprNode>("0");
-        }
+        // Handle true/false/null literals
+        if (at(TT::TRUE))     return leaf(EK::NUM, "1");
+        if (at(TT::FALSE))    return leaf(EK::NUM, "0");
+        if (at(TT::TOK_NULL)) return leaf(EK::NUM, "0");
 
         // Handle array initialization: [1, 2, 3]
         if (at(TT::LBRACK)) {
-            adv();  // consume '['
-            std::string arr_init = "[";
-            bool first = true;
+            auto arr = leaf(EK::ARRAY, "");
             while (!at(TT::RBRACK) && !at(TT::EOF_T)) {
-                if (!first) arr_init += ",";
-                first = false;
-                if (at(TT::NUMBER) || at(TT::HEX) || at(TT::STR_LIT)) {
-                    arr_init += cur().val;
-                    adv();
-                } else if (at(TT::TRUE)) {
-                    arr_init += "1";
-                    adv();
-                } else if (at(TT::FALSE)) {
-                    arr_init += "0";
-                    adv();
-                } else if (at(TT::IDENT)) {
-                    arr_init += cur().val;
-                    adv();
-                } else {
-                    break;
-                }
+                arr->items.push_back(arena, parse_expression());
+                if (!at(TT::COMMA)) break;
+                adv();
             }
-            arr_init += "]";
-            if (at(TT::RBRACK)) adv();  // consume ']'
-            return std::make_unique<ExprNode>(arr_init);
+            expect(TT::RBRACK, "expected ']' after array initializer");
+            return arr;
         }
 
         // Handle parenthesized expressions
         if (at(TT::LPAREN)) {
             adv();  // consume '('
-            auto expr = parse_additive();
+            auto expr = parse_expression();
             if (!at(TT::RPAREN)) {
                 throw std::runtime_error("expected ')' at line " + std::to_string(cur().line));
             }
@@ -110,98 +115,107 @@ class Parser {
         // Handle negative numbers (unary minus)
         if (at(TT::MINUS)) {
             adv();
-            std::string val = cur().val;
-            adv();
-            // Check if it's a number
-            bool is_number = !val.empty() && (isdigit(val[0]) || (val.size() > 1 && val[0] == '-' && isdigit(val[1])));
-            if (is_number) {
-                return std::make_unique<ExprNode>("-" + val);
+            if (at(TT::NUMBER) || at(TT::HEX)) {
+                auto e = leaf(EK::NUM, arena.str("-" + cur().val));
+                e->line = l; e->col = c;
+                return e;
             }
-            return std::make_unique<ExprNode>("-" + val);
+            return make_unary(arena, OP::NEG, parse_primary(), l, c);
         }
 
-        std::string v = cur().val;
-        adv();
-        return std::make_unique<ExprNode>(v);
-    }
-    
-    // Parse multiplication and division (higher precedence)
-    std::unique_ptr<ExprNode> parse_multiplicative() {
-        auto left = parse_primary();
-        while (at(TT::STAR) || at(TT::DIV)) {
-            std::string op = cur().val;
-            adv();
-            auto right = parse_primary();
-            left = std::make_unique<ExprNode>(op, std::move(left), std::move(right));
-        }
-        return left;
-    }
-    
-    // Parse addition and subtraction (lower precedence)
-    std::unique_ptr<ExprNode> parse_additive() {
-        auto left = parse_multiplicative();
-        while (at(TT::PLUS) || at(TT::MINUS)) {
-            std::string op = cur().val;
-            adv();
-            auto right = parse_multiplicative();
-            left = std::make_unique<ExprNode>(op, std::move(left), std::move(right));
+        if (at(TT::NUMBER) || at(TT::HEX)) return leaf(EK::NUM, cur().val);
+        if (at(TT::STR_LIT))  return leaf(EK::STR, cur().val);
+        if (at(TT::REGISTER)) return leaf(EK::REG, cur().val);
+        if (at(TT::IDENT)) {
+            auto e = parse_name();
+            if (e->kind == EK::VAR && at(TT::LBRACK)) {
+                adv();
+                auto idx = arena.make<Expr>(EK::INDEX, "", l, c);
+                idx->lhs = (e);
+                idx->rhs = parse_expression();
+                expect(TT::RBRACK, "expected ']' after array index");
+                return idx;
+            }
+            return e;
         }
-        return left;
+        throw std::runtime_error("expected expression (got '" + cur().val + "' at line " + std::to_string(cur().line) + ")");
     }
 
-    // Parse comparison operators (even lower precedence)
-    std::unique_ptr<ExprNode> parse_comparison() {
-        auto left = parse_additive();
-        while (at(TT::EQEQ) || at(TT::NEQ) || at(TT::LT) || at(TT::GT) || at(TT::LTE) || at(TT::GTE)) {
-            std::string op = cur().val;
-            adv();
-            auto right = parse_additive();
-            left = std::make_unique<ExprNode>(op, std::move(left), std::move(right));
+    // Binary operator at the current token, or OP::NONE.
+    // '<' and '>' may arrive as generic angle brackets and '>>' shares its token with ']'.
+    OP binary_op() {
+        switch (cur().type) {
+            case TT::STAR:   return OP::MUL;
+            case TT::DIV:    return OP::DIV;
+            case TT::MOD:    return OP::MOD;
+            case TT::PLUS:   return OP::ADD;
+            case TT::MINUS:  return OP::SUB;
+            case TT::DRV_FUNC_ASSIGN: return OP::SHL;
+            case TT::RBRACK: return cur().val == ">>" ? OP::SHR : OP::NONE;
+            case TT::LT: case TT::LANGLE: return OP::LT;
+            case TT::GT: case TT::RANGLE: return OP::GT;
+            case TT::LTE:    return OP::LE;
+            case TT::GTE:    return OP::GE;
+            case TT::EQEQ:   return OP::EQ;
+            case TT::NEQ:    return OP::NE;
+            case TT::AMP:    return OP::AND;
+            case TT::CARET:  return OP::XOR;
+            case TT::PIPE:   return OP::OR;
+            case TT::LOGIC_AND: return OP::LAND;
+            case TT::LOGIC_OR:  return OP::LOR;
+            default:         return OP::NONE;
         }
-        return left;
     }
 
-    // Parse logical AND (&&) - higher precedence than ||
-    std::unique_ptr<ExprNode> parse_logic_and() {
-        auto left = parse_comparison();
-        while (at(TT::LOGIC_AND)) {
-            std::string op = cur().val;
-            adv();
-            auto right = parse_comparison();
-            left = std::make_unique<ExprNode>(op, std::move(left), std::move(right));
+    // C precedence: * / % > + - > << >> > relational > equality > & > ^ > | > && > ||
+    static int precedence(OP op) {
+        switch (op) {
+            case OP::MUL: case OP::DIV: case OP::MOD: return 10;
+            case OP::ADD: case OP::SUB: return 9;
+            case OP::SHL: case OP::SHR: return 8;
+            case OP::LT: case OP::GT: case OP::LE: case OP::GE: return 7;
+            case OP::EQ: case OP::NE: return 6;
+            case OP::AND:  return 5;
+            case OP::XOR:  return 4;
+            case OP::OR:   return 3;
+            case OP::LAND: return 2;
+            case OP::LOR:  return 1;
+            default:       return 0;
         }
-        return left;
     }
 
-    // Parse logical OR (||) - lowest precedence
-    std::unique_ptr<ExprNode> parse_logic_or() {
-        auto left = parse_logic_and();
-        while (at(TT::LOGIC_OR)) {
-            std::string op = cur().val;
+    // Precedence climbing: one pass over the tokens, left-associative
+    ExprPtr parse_binary(int min_prec) {
+        auto left = parse_primary();
+        for (;;) {
+            OP op = binary_op();
+            int prec = precedence(op);
+            if (prec == 0 || prec < min_prec) break;
+            int l = cur().line, c = cur().col;
             adv();
-            auto right = parse_logic_and();
-            left = std::make_unique<ExprNode>(op, std::move(left), std::move(right));
+            auto right = parse_binary(prec + 1);
+            left = make_binary(arena, op, (left), (right), l, c);
         }
         return left;
     }
 
-    std::unique_ptr<ExprNode> parse_expression() {
-        return parse_logic_or();
+    ExprPtr parse_expression() {
+        return parse_binary(1);
     }
-    
-    // Serialize expression AST to string for codegen
-    // Format: "a+b*c" or "(a+b)*c" with proper parentheses
-    std::string serialize_expr(ExprNode* node) {
-        if (!node) return "";
-        if (node->op.empty()) {
-            return node->value;
-        }
-        std::string left = serialize_expr(node->left.get());
-        std::string right = serialize_expr(node->right.get());
-        return "(" + left + node->op + right + ")";
+
+    // Initializers that can be laid out in the data section at compile time
+    static bool is_static_init(const Expr* e) {
+        long long v;
+        if (e->kind == EK::STR || e->kind == EK::ADDR) return true;
+        if (e->kind == EK::ARRAY) {
+            for (auto& it : e->items)
+                if (!const_value(it, v)) return false;
+            return true;
+        }
+        return const_value(e, v);
     }
 
-    NodePtr parse_decl() {
+    VarDecl* parse_decl() {
         bool is_const_decl = false;
         if(at(TT::CONST)) {
             is_const_decl = true;
@@ -210,10 +224,10 @@ class Parser {
             expect(TT::VAR,"expected 'var'");
         }
 
-        auto n=std::make_unique<VarDecl>();
+        auto n=arena.make<VarDecl>();
         n->is_const = is_const_decl;
         if(!at(TT::IDENT)) throw std::runtime_error("expected variable name at line "+std::to_string(cur().line));
-        n->name=cur().val; adv();
+        n->name = cur().val; n->sym = cur().sym; adv();
         expect(TT::COLON,"expected ':' after variable name at line "+std::to_string(cur().line));
         
         // Parse pointer types: *i32, **i32, *struct, etc.
@@ -226,12 +240,12 @@ class Parser {
         // Accept built-in types or struct names (IDENT)
         if(at(TT::I32)||at(TT::I64)||at(TT::U8)||at(TT::STR)||at(TT::PTR)||at(TT::BOOL)){
             type_str += cur().val;
-            n->type = type_str;
+            n->type = arena.str(type_str);
             adv();
         } else if(at(TT::IDENT)){
             // Struct type or unknown type
             type_str += cur().val;
-            n->type = type_str;
+            n->type = arena.str(type_str);
             adv();
         } else {
             throw std::runtime_error("expected type at line "+std::to_string(cur().line));
@@ -246,67 +260,12 @@ class Parser {
         }
         if(at(TT::EQ)) {
             adv();
-            if(at(TT::STR_LIT))      { n->init="\""+cur().val+"\""; adv(); }
-            else if(at(TT::NUMBER))   { n->init=cur().val; adv(); }
-            else if(at(TT::HEX))      { n->init=cur().val; adv(); }
-            else if(at(TT::TOK_NULL))     { n->init="0"; adv(); }  // null initializer for pointers
-            else if(at(TT::TRUE))     { n->init="1"; adv(); }  // true for bool
-            else if(at(TT::FALSE))    { n->init="0"; adv(); }  // false for bool
-            else if(at(TT::MINUS)) {
-                // Negative number: var x: i32 = -42
-                adv();
-                if(at(TT::NUMBER)) {
-                    n->init = "-" + cur().val;
-                    adv();
-                } else {
-                    throw std::runtime_error("expected number after '-' at line " + std::to_string(cur().line));
-                }
-            }
-            else if(at(TT::AMP)) {
-                // Address-of initializer: var ptr: *i32 = &x
-                adv();
-                if(!at(TT::IDENT)) throw std::runtime_error("expected variable name after '&' at line " + std::to_string(cur().line));
-                n->init = "&" + cur().val;
-                adv();
-            }
-            else if(at(TT::STAR)) {
-                // Dereference initializer: var y: i32 = *ptr
-                adv();
-                if(!at(TT::IDENT)) throw std::runtime_error("expected variable name after '*' at line " + std::to_string(cur().line));
-                n->init = "*" + cur().val;
-                adv();
-            }
-            else if(at(TT::LBRACK)) {
-                // Array initializer: var arr: i32[5] = [1, 2, 3]
-                n->init = "[";
-                bool first = true;
-                adv();  // consume '['
-                while (!at(TT::RBRACK) && !at(TT::EOF_T)) {
-                    if (!first) n->init += ",";
-                    first = false;
-                    if (at(TT::NUMBER) || at(TT::HEX) || at(TT::STR_LIT)) {
-                        n->init += cur().val;
-                        adv();
-                    } else if (at(TT::TRUE)) {
-                        n->init += "1";
-                        adv();
-                    } else if (at(TT::FALSE)) {
-                        n->init += "0";
-                        adv();
-                    } else if (at(TT::IDENT)) {
-                        n->init += cur().val;
-                        adv();
-                    } else {
-                        break;
-                    }
-                }
-                n->init += "]";
-                if (at(TT::RBRACK)) adv();
-            }
-            else throw std::runtime_error("expected initializer at line "+std::to_string(cur().line));
+            n->init = parse_expression();
         }
-        if(is_const_decl && n->init.empty())
+        if(is_const_decl && !n->init)
             throw std::runtime_error("const requires initializer at line "+std::to_string(cur().line));
+        if(is_const_decl && !is_static_init(n->init))
+            throw std::runtime_error("const initializer must be a constant expression at line "+std::to_string(cur().line));
         if(is_const_decl) const_vars.insert(n->name);
         return n;
     }
@@ -314,107 +273,102 @@ class Parser {
     NodePtr parse_stmt() {
         if (at(TT::FREE) || at(TT::DEALLOC)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<DeallocNode>(); n->ptr=cur().val; adv();
+            auto n=arena.make<DeallocNode>(); n->ptr = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::ALLOC)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<AllocNode>(); n->size=cur().val; adv();
+            auto n=arena.make<AllocNode>(); n->size = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::DISPLAY)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<DisplayNode>(); n->var=cur().val; adv();
+            auto n=arena.make<DisplayNode>(); n->var = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::PRINTNUM)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<PrintNumNode>(); n->var=cur().val; adv();
+            auto n=arena.make<PrintNumNode>(); n->var = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::COLOR)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<ColorNode>(); n->value=cur().val; adv();
+            auto n=arena.make<ColorNode>(); n->value = parse_expression();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::READKEY)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<ReadKeyNode>(); n->var=cur().val; adv();
+            auto n=arena.make<ReadKeyNode>(); n->var = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::READCHAR)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<ReadCharNode>(); n->var=cur().val; adv();
+            auto n=arena.make<ReadCharNode>(); n->var = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::PUTCHAR)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<PutCharNode>(); n->value=cur().val; adv();
+            auto n=arena.make<PutCharNode>(); n->value = parse_expression();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::CLEAR)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<ClearNode>();
+            auto n=arena.make<ClearNode>();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::REBOOT)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<RebootNode>();
+            auto n=arena.make<RebootNode>();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
-        if (at(TT::CALL)) {
-            adv();
-            auto n=std::make_unique<FuncCall>(); n->name=cur().val; adv(); return n;
-        }
+        if (at(TT::CALL)) return parse_call();
         if (at(TT::LOOP)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<LoopNode>();
-            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->body.push_back(std::move(s)); }
+            auto n=arena.make<LoopNode>();
+            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->body.push_back(arena, s); }
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::WHILE)) {
             adv();
-            auto n=std::make_unique<WhileNode>();
-            n->left=cur().val; adv(); n->op=cur().val; adv(); n->right=cur().val; adv();
+            auto n=arena.make<WhileNode>();
+            n->cond=parse_expression();
             expect(TT::LBRACE,"expected '{'");
-            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->body.push_back(std::move(s)); }
+            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->body.push_back(arena, s); }
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::FOR)) {
             adv();
-            auto n = std::make_unique<ForNode>();
+            auto n = arena.make<ForNode>();
             // Syntax: for i = 0 to 10 { }
+            int l = cur().line, c = cur().col;
             n->init_var = cur().val;
-            adv();
+            n->init_sym = cur().sym;
+            expect(TT::IDENT, "expected loop variable after 'for'");
             expect(TT::EQ, "expected '='");
-            n->init_value = cur().val;
-            adv();
+            n->init = parse_expression();
             expect(TT::TO, "expected 'to' - old for syntax with ';' is no longer supported");
-            n->cond_left = n->init_var;
-            n->cond_op = "<";
-            n->cond_right = cur().val;
-            adv();  // consume the limit value
-            // Step is always i = (i + 1)
-            n->step_var = n->init_var;
-            n->step_value = "(" + n->init_var + "+1)";
+            // Condition is init_var < limit, step is always init_var = init_var + 1
+            n->cond = make_binary(arena, OP::LT, var_ref(n->init_var, n->init_sym, l, c), parse_expression(), l, c);
+            n->step = make_binary(arena, OP::ADD, var_ref(n->init_var, n->init_sym, l, c),
+                                  arena.make<Expr>(EK::NUM, "1", l, c), l, c);
 
             expect(TT::LBRACE, "expected '{'");
-            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->body.push_back(std::move(s)); }
+            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->body.push_back(arena, s); }
             expect(TT::RBRACE, "expected '}'");
             return n;
         }
         if (at(TT::IF)) {
             adv();
-            auto n=std::make_unique<IfNode>();
-            n->left=cur().val; adv(); n->op=cur().val; adv(); n->right=cur().val; adv();
+            auto n=arena.make<IfNode>();
+            n->cond=parse_expression();
             expect(TT::LBRACE,"expected '{'");
-            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->then_body.push_back(std::move(s)); }
+            while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->then_body.push_back(arena, s); }
             expect(TT::RBRACE,"expected '}'");
             // Check for else block
             if (at(TT::ELSE)) {
                 adv();  // consume 'else'
                 expect(TT::LBRACE,"expected '{' after 'else'");
-                while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->else_body.push_back(std::move(s)); }
+                while(!at(TT::RBRACE)&&!at(TT::EOF_T)) { auto s=parse_stmt(); if(s) n->else_body.push_back(arena, s); }
                 expect(TT::RBRACE,"expected '}'");
             }
             return n;
@@ -422,92 +376,64 @@ class Parser {
         if (at(TT::SWITCH)) {
             return parse_switch();
         }
-        if (at(TT::STOP)) { adv(); return std::make_unique<BreakNode>(); }
-        if (at(TT::CONTINUE)) { adv(); return std::make_unique<ContinueNode>(); }
+        if (at(TT::STOP)) { adv(); return arena.make<BreakNode>(); }
+        if (at(TT::CONTINUE)) { adv(); return arena.make<ContinueNode>(); }
         if (at(TT::RETURN)) {
             adv();  // consume 'return'
-            auto n = std::make_unique<ReturnNode>();
+            auto n = arena.make<ReturnNode>();
             expect(TT::LBRACE, "expected '{'");
-            n->value = cur().val;
-            adv();
+            if (!at(TT::RBRACE)) n->value = parse_expression();
             expect(TT::RBRACE, "expected '}'");
             return n;
         }
         if (at(TT::MOV)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<RegOp>(); n->op="MOV";
-            n->target=cur().val; adv();
+            auto n=arena.make<RegOp>(); n->op="MOV";
+            n->target = cur().val; adv();
             expect(TT::COMMA,"expected ','");
-            n->source=cur().val; adv();
+            n->source = parse_expression();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         if (at(TT::REG_STATIC)) {
             adv(); expect(TT::LBRACE,"expected '{'");
-            auto n=std::make_unique<RegOp>(); n->op="STATIC"; n->target=cur().val; adv();
+            auto n=arena.make<RegOp>(); n->op="STATIC"; n->target = cur().val; adv();
             expect(TT::RBRACE,"expected '}'"); return n;
         }
         // Check for dereference assignment: *ptr = value
         if (at(TT::STAR)) {
-            adv();
-            if (!at(TT::IDENT)) {
-                throw std::runtime_error("expected variable name after '*' at line " + std::to_string(cur().line));
-            }
-            auto n=std::make_unique<Assign>();
-            n->target = "*" + cur().val;
-            adv();
+            auto n=arena.make<Assign>();
+            n->target = parse_primary();
             expect(TT::EQ,"expected '='");
-            // Parse full expression with nested support
-            auto expr = parse_expression();
-            // Convert expression AST to string for codegen
-            std::string expr_str = "";
-            if (expr) {
-                // Simple case: just a value
-                if (expr->op.empty()) {
-                    expr_str = expr->value;
-                } else {
-                    expr_str = serialize_expr(expr.get());
-                }
-            }
-            n->value = expr_str;
+            n->value = parse_expression();
             return n;
         }
-        if (at(TT::IDENT)||at(TT::REGISTER)) {
-            auto n=std::make_unique<Assign>();
-            std::string target_name = cur().val;
-            adv();
-            // Check for struct field access: struct.field
-            if (at(TT::DOT)) {
-                adv();  // consume '.'
-                if (at(TT::IDENT)) {
-                    n->target = target_name + "." + cur().val;
-                    n->is_arr = true;  // Use is_arr flag to indicate struct field access
-                    adv();
-                } else {
-                    throw std::runtime_error("expected field name after '.' at line " + std::to_string(cur().line));
-                }
-            } else {
-                n->target = target_name;
-            }
-            if (n->target.size()>=2&&n->target[0]=='#'&&n->target[1]=='R') n->is_reg=true;
-            if(!n->is_reg && const_vars.count(n->target))
-                throw std::runtime_error("cannot assign to const '"+n->target+"' at line "+std::to_string(cur().line));
-            if (at(TT::LBRACK)) { n->is_arr=true; adv(); n->idx=cur().val; adv(); expect(TT::RBRACK,"expected ']'"); }
+        if (at(TT::REGISTER)) {
+            auto n=arena.make<Assign>();
+            n->target = leaf(EK::REG, cur().val);
             expect(TT::EQ,"expected '='");
-            // Parse full expression with nested support
-            auto expr = parse_expression();
-            // Convert expression AST to string for codegen
-            std::string expr_str = "";
-            if (expr) {
-                // Simple case: just a value
-                if (expr->op.empty()) {
-                    expr_str = expr->value;
-                } else {
-                    // Complex expression - need to generate temp variables
-                    // For now, store as flattened string (will be handled by codegen)
-                    expr_str = serialize_expr(expr.get());
-                }
+            n->value = parse_expression();
+            return n;
+        }
+        if (at(TT::IDENT)) {
+            auto n=arena.make<Assign>();
+            // Target: name, struct.field or name[index]
+            n->target = parse_primary();
+            const Expr* base = n->target;
+            if (base->kind == EK::FIELD || base->kind == EK::INDEX) base = base->lhs;
+            if (base->kind != EK::VAR)
+                throw std::runtime_error("invalid assignment target at line "+std::to_string(cur().line));
+            if(const_vars.count(base->val))
+                throw std::runtime_error("cannot assign to const '"+base->val+"' at line "+std::to_string(cur().line));
+            expect(TT::EQ,"expected '='");
+            if (at(TT::CALL)) {
+                // x = call #f(a, b): the return value goes to x
+                if (n->target->kind != EK::VAR)
+                    throw std::runtime_error("call result must go to a variable at line "+std::to_string(cur().line));
+                auto c = parse_call();
+                c->result = n->target->val;
+                return c;
             }
-            n->value = expr_str;
+            n->value = parse_expression();
             return n;
         }
         if (!at(TT::SEC_CLOSE)&&!at(TT::RBRACE)&&!at(TT::EOF_T)) {
@@ -516,13 +442,36 @@ class Parser {
         return nullptr;
     }
 
-    std::unique_ptr<SectionNode> parse_section() {
+    // call #name or call #name(a, 5, -x, i * 3, &x, *p, arr[i], #R1)
+    FuncCall* parse_call() {
+        expect(TT::CALL, "expected 'call'");
+        auto n=arena.make<FuncCall>(); n->name = cur().val; adv();
+        if (!at(TT::LPAREN)) return n;
+        adv();
+        while (!at(TT::RPAREN) && !at(TT::EOF_T)) {
+            n->args.push_back(arena, parse_expression());
+            if (!at(TT::COMMA)) break;
+            adv();
+        }
+        expect(TT::RPAREN, "expected ')' after arguments");
+        return n;
+    }
+
+    SectionNode* parse_section() {
         expect(TT::SEC_OPEN, "expected '<.de'");
-        auto s = std::make_unique<SectionNode>();
+        auto s = arena.make<SectionNode>();
         // Declarations and statements can be mixed freely
         while (!at(TT::SEC_CLOSE) && !at(TT::EOF_T)) {
             if (at(TT::VAR) || at(TT::CONST)) {
-                s->decls.push_back(parse_decl());
+                auto d = parse_decl();
+                if (d->init && !is_static_init(d->init)) {
+                    // Runtime initializer: evaluate it where the declaration appears
+                    auto a = arena.make<Assign>();
+                    a->target = var_ref(d->name, d->sym, d->init->line, d->init->col);
+                    a->value = (d->init);
+                    s->stmts.push_back(arena, a);
+                }
+                s->decls.push_back(arena, d);
             } else if (at(TT::STRUCT) || at(TT::ENUM)) {
                 // Nested struct/enum definitions not allowed in sections
                 throw std::runtime_error(
@@ -530,16 +479,16 @@ class Parser {
             } else {
                 // Parse statement
                 auto st = parse_stmt();
-                if (st) s->stmts.push_back(std::move(st));
+                if (st) s->stmts.push_back(arena, st);
             }
         }
         expect(TT::SEC_CLOSE, "expected '.>'");
         return s;
     }
 
-    std::unique_ptr<StructDecl> parse_struct() {
+    StructDecl* parse_struct() {
         expect(TT::STRUCT, "expected 'struct'");
-        auto s = std::make_unique<StructDecl>();
+        auto s = arena.make<StructDecl>();
         s->name = cur().val;
         expect(TT::IDENT, "expected struct name");
         expect(TT::LBRACE, "expected '{'");
@@ -574,15 +523,15 @@ class Parser {
                 adv();  // consume number
                 expect(TT::RBRACK, "expected ']'");
             }
-            s->fields.push_back({fname, ftype});
+            s->fields.push_back(arena, {arena.str(fname), arena.str(ftype)});
         }
         expect(TT::RBRACE, "expected '}'");
         return s;
     }
 
-    std::unique_ptr<EnumDecl> parse_enum() {
+    EnumDecl* parse_enum() {
         expect(TT::ENUM, "expected 'enum'");
-        auto e = std::make_unique<EnumDecl>();
+        auto e = arena.make<EnumDecl>();
         e->name = cur().val;
         expect(TT::IDENT, "expected enum name");
         expect(TT::LBRACE, "expected '{'");
@@ -590,7 +539,7 @@ class Parser {
         while (!at(TT::RBRACE) && !at(TT::EOF_T)) {
             std::string vname = cur().val;
             expect(TT::IDENT, "expected variant name");
-            e->variants.push_back(vname);
+            e->variants.push_back(arena, arena.str(vname));
             // Check for = value
             if (at(TT::EQ)) {
                 adv();
@@ -609,19 +558,19 @@ class Parser {
         return e;
     }
 
-    std::unique_ptr<DriverSectionNode> parse_driver_section() {
+    DriverSectionNode* parse_driver_section() {
         expect(TT::DRV_OPEN, "expected '<drv.'");
-        auto s=std::make_unique<DriverSectionNode>();
+        auto s=arena.make<DriverSectionNode>();
 
         // Parse Const.driver declaration
         if (at(TT::CONST_DRIVER)) {
             adv();
             expect(TT::EQ, "expected '='");
-            auto cd = std::make_unique<ConstDriverDecl>();
+            auto cd = arena.make<ConstDriverDecl>();
             cd->name = cur().val;
             adv();
             s->driver_name = cd->name;
-            s->decls.push_back(std::move(cd));
+            s->decls.push_back(arena, cd);
         }
 
         // Parse driver function assignment: name <<func = keyboard>>
@@ -648,11 +597,11 @@ class Parser {
                     adv();
                 }
 
-                auto dfa = std::make_unique<DriverFuncAssign>();
-                dfa->driver_name = name;
-                dfa->driver_type = driver_type;
-                s->driver_type = driver_type;
-                s->stmts.push_back(std::move(dfa));
+                auto dfa = arena.make<DriverFuncAssign>();
+                dfa->driver_name = arena.str(name);
+                dfa->driver_type = arena.str(driver_type);
+                s->driver_type = dfa->driver_type;
+                s->stmts.push_back(arena, dfa);
             }
         }
 
@@ -661,8 +610,12 @@ class Parser {
     }
 
     NodePtr parse_function() {
+        auto n = arena.make<FuncDecl>();
+        if (at(TT::IDENT)) {
+            n->hint = cur().val == "inline" ? FuncDecl::INLINE : FuncDecl::NOINLINE;
+            adv();
+        }
         expect(TT::FN, "expected 'fn'");
-        auto n = std::make_unique<FuncDecl>();
         n->name = cur().val;
         adv();
         
@@ -684,7 +637,7 @@ class Parser {
                 } else {
                     throw std::runtime_error("expected parameter type at line " + std::to_string(cur().line));
                 }
-                n->params.push_back({param_name, param_type});
+                n->params.push_back(arena, {arena.str(param_name), arena.str(param_type)});
                 if (at(TT::COMMA)) {
                     adv();
                 } else {
@@ -693,6 +646,12 @@ class Parser {
             }
             expect(TT::RPAREN, "expected ')' after parameters");
         }
+        // Optional return type: fn name(...) -> i32
+        if (at(TT::LSHIFT) && cur().val == "->") {
+            adv();
+            n->return_type = cur().val;
+            adv();
+        }
         
         // fn name { <.de ... .> }
         expect(TT::LBRACE, "expected '{' after function name");
@@ -704,15 +663,15 @@ class Parser {
     NodePtr parse_interrupt() {
         expect(TT::INTERRUPT,"expected '#INTERRUPT'");
         expect(TT::LBRACE,"expected '{'");
-        auto n=std::make_unique<InterruptNode>(); n->num=std::stoi(cur().val); adv();
+        auto n=arena.make<InterruptNode>(); n->num=std::stoi(cur().val); adv();
         expect(TT::RBRACE,"expected '}'");
         expect(TT::EQEQ,"expected '=='");
-        n->func=cur().val; adv(); return n;
+        n->func = cur().val; adv(); return n;
     }
 
-    std::unique_ptr<DriverDecl> parse_driver() {
+    DriverDecl* parse_driver() {
         expect(TT::DRIVER_KEYWORD, "expected 'driver'");
-        auto d = std::make_unique<DriverDecl>();
+        auto d = arena.make<DriverDecl>();
         d->name = cur().val;
         expect(TT::IDENT, "expected driver name");
         
@@ -723,7 +682,7 @@ class Parser {
                 if (at(TT::TYPE)) {
                     adv();  // consume 'type'
                     expect(TT::EQ, "expected '='");
-                    d->type = "#" + cur().val;
+                    d->type = arena.str("#" + cur().val);
                     adv();
                 } else {
                     adv();
@@ -732,16 +691,17 @@ class Parser {
             expect(TT::RBRACE, "expected '}'");
         } else {
             // No type specified, use name as type
-            d->type = "#" + d->name;
+            d->type = arena.str("#" + d->name);
         }
         return d;
     }
 
 public:
-    explicit Parser(std::vector<Token> tokens) : tk(std::move(tokens)) {}
+    Parser(std::vector<Token> tokens, Arena& a, Interner& n) : arena(a), names(n), tk(std::move(tokens)) {}
 
-    std::unique_ptr<ProgramNode> parse(bool is_library = false) {
-        auto p=std::make_unique<ProgramNode>();
+    ProgramNode* parse(bool is_library = false) {
+        auto p=arena.make<ProgramNode>();
+        p->names = &names;
         
         // Libraries don't require #Mainprogramm.start
         if (!is_library) {
@@ -751,31 +711,15 @@ public:
                 if(at(TT::NO_RUNTIME)){p->no_runtime=true;adv();}
                 if(at(TT::SAFE)){p->safe=true;adv();}
                 if(at(TT::DRIVER)){p->no_runtime=true;adv();}
-                if(at(TT::IMPORT)) {
-                    adv();
-                    expect(TT::LBRACE, "expected '{' after 'import'");
-                    std::string libname = cur().val;
-                    expect(TT::IDENT, "expected library name");
-                    expect(TT::RBRACE, "expected '}' after library name");
-                    p->imports.push_back(libname);
-                    adv();
-                }
+                if(at(TT::IMPORT)) parse_import(p);
             }
         } else {
             // For libraries, skip comments and whitespace until we find content
-            while(!at(TT::EOF_T) && !at(TT::FN) && !at(TT::STRUCT) && !at(TT::IMPORT)) {
+            while(!at(TT::EOF_T) && !at_fn() && !at(TT::STRUCT) && !at(TT::IMPORT)) {
                 adv();
             }
             // Parse imports in library
-            while(at(TT::IMPORT)) {
-                adv();
-                expect(TT::LBRACE, "expected '{' after 'import'");
-                std::string libname = cur().val;
-                expect(TT::IDENT, "expected library name");
-                expect(TT::RBRACE, "expected '}' after library name");
-                p->imports.push_back(libname);
-                adv();
-            }
+            while(at(TT::IMPORT)) parse_import(p);
         }
 
         // Parse top-level declarations in any order
@@ -783,23 +727,25 @@ public:
             if (at(TT::ENUM)) {
                 parse_enum();
             } else if (at(TT::DRIVER_KEYWORD)) {
-                p->drivers.push_back(parse_driver());
+                p->drivers.push_back(arena, parse_driver());
             } else if (at(TT::EXTERN)) {
                 auto ext = parse_extern();
-                p->externs.push_back(std::unique_ptr<ExternDecl>(static_cast<ExternDecl*>(ext.release())));
+                p->externs.push_back(arena, static_cast<ExternDecl*>(ext));
             } else if (at(TT::STRUCT)) {
-                p->structs.push_back(parse_struct());
+                p->structs.push_back(arena, parse_struct());
             } else if (at(TT::INTERRUPT)) {
-                p->interrupts.push_back(parse_interrupt());
-            } else if (at(TT::FN)) {
-                p->functions.push_back(parse_function());
+                p->interrupts.push_back(arena, parse_interrupt());
+            } else if (at_fn()) {
+                p->functions.push_back(arena, parse_function());
+            } else if (at(TT::IMPORT)) {
+                parse_import(p);
             } else if (at(TT::INCLUDE)) {
-                p->main_sec.push_back(parse_include());
+                p->main_sec.push_back(arena, parse_include());
             } else {
                 adv();  // skip unknown token
             }
         }
-        if(at(TT::SEC_OPEN))     p->main_sec.push_back(parse_section());
+        if(at(TT::SEC_OPEN))     p->main_sec.push_back(arena, parse_section());
         if (!is_library) {
             expect(TT::PROG_END,"file must end with '#Mainprogramm.end'");
         }
@@ -807,9 +753,21 @@ public:
         return p;
     }
 
+    // Import{name} or import {"path/to/lib"}; the module loader resolves the name
+    void parse_import(ProgramNode* p) {
+        expect(TT::IMPORT, "expected 'Import'");
+        expect(TT::LBRACE, "expected '{' after 'Import'");
+        // Library names may collide with keywords (string, type, ...)
+        if (cur().val.empty() || at(TT::RBRACE) || at(TT::EOF_T))
+            throw std::runtime_error("expected library name at line " + std::to_string(cur().line));
+        p->imports.push_back(arena, cur().val);
+        adv();
+        expect(TT::RBRACE, "expected '}' after library name");
+    }
+
     NodePtr parse_extern() {
         expect(TT::EXTERN, "expected 'extern'");
-        auto e = std::make_unique<ExternDecl>();
+        auto e = arena.make<ExternDecl>();
         e->name = cur().val;
         expect(TT::IDENT, "expected function name");
         // Optional: extern name from "library"
@@ -825,7 +783,7 @@ public:
 
     NodePtr parse_include() {
         expect(TT::INCLUDE, "expected 'include'");
-        auto i = std::make_unique<IncludeNode>();
+        auto i = arena.make<IncludeNode>();
         i->path = cur().val;
         if (at(TT::STR_LIT)) {
             i->path = cur().val;
@@ -838,29 +796,27 @@ public:
 
     NodePtr parse_switch() {
         expect(TT::SWITCH, "expected 'switch'");
-        auto s = std::make_unique<SwitchNode>();
-        s->value = cur().val;
-        adv();
+        auto s = arena.make<SwitchNode>();
+        s->value = parse_expression();
         expect(TT::LBRACE, "expected '{'");
         
         while (!at(TT::RBRACE) && !at(TT::EOF_T)) {
             if (at(TT::CASE)) {
                 adv();  // consume 'case'
-                std::string case_val = cur().val;
-                adv();
+                ExprPtr case_val = parse_expression();
                 expect(TT::COLON, "expected ':'");
                 NodeList body;
                 while (!at(TT::CASE) && !at(TT::DEFAULT) && !at(TT::RBRACE) && !at(TT::EOF_T)) {
                     auto stmt = parse_stmt();
-                    if (stmt) body.push_back(std::move(stmt));
+                    if (stmt) body.push_back(arena, stmt);
                 }
-                s->cases.push_back({case_val, std::move(body)});
+                s->cases.push_back(arena, {case_val, body});
             } else if (at(TT::DEFAULT)) {
                 adv();  // consume 'default'
                 expect(TT::COLON, "expected ':'");
                 while (!at(TT::CASE) && !at(TT::RBRACE) && !at(TT::EOF_T)) {
                     auto stmt = parse_stmt();
-                    if (stmt) s->default_body.push_back(std::move(stmt));
+                    if (stmt) s->default_body.push_back(arena, stmt);
                 }
             } else {
                 adv();
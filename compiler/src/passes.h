@@ -0,0 +1,1351 @@
+#pragma once
+#include "ir.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Optimization passes over the IR of ir.h, and the pass manager that runs
+// them for -O0..-O3. Every pass returns whether it changed anything.
+
+namespace ir {
+
+// Constant folding and propagation: operations on constants become
+// constants (with the 32-bit arithmetic of the generated code), algebraic
+// identities are applied, and branches on constants become jumps.
+inline bool constfold(Function& f) {
+    bool changed = false;
+    auto fold = [&](Inst* i, Inst* v) {
+        f.replace(i, v);
+        f.erase(i);
+        changed = true;
+    };
+    // Keeps the edge b -> succs[keep] and drops the others
+    auto jump = [&](Block* b, size_t keep) {
+        Inst* t = b->term();
+        Block* target = b->succs[keep];
+        for (size_t k = 0; k < b->succs.size(); k++)
+            if (k != keep) f.remove_pred(b->succs[k], b);
+        b->succs.assign(1, target);
+        f.add(b, Op::Br);
+        f.erase(t);
+        changed = true;
+    };
+    for (Block* b : f.blocks) {
+        for (size_t k = 0; k < b->insts.size(); k++) {
+            Inst* i = b->insts[k];
+            const size_t n = b->insts.size();
+            auto c = [&](size_t j) { return i->ops[j]->is_const(); };
+            auto val = [&](size_t j) { return i->ops[j]->imm; };
+            long long r;
+            switch (i->op) {
+                case Op::Neg:
+                    if (c(0)) fold(i, f.constant(i->wide ? (long long)(0 - (uint64_t)val(0)) : -val(0), i->wide));
+                    break;
+                case Op::Not:
+                    if (c(0)) fold(i, f.constant(!val(0)));
+                    break;
+                case Op::Bin: {
+                    Inst* a = i->ops[0];
+                    Inst* x = i->ops[1];
+                    if (c(0) && c(1)) {
+                        if (eval(i->bop, val(0), val(1), r, i->wide)) fold(i, f.constant(r, i->wide));
+                        break;
+                    }
+                    if (i->wide || a->wide || x->wide) break;
+                    // x op k and k op x
+                    const bool rc = c(1), lc = c(0);
+                    const long long k2 = rc ? val(1) : lc ? val(0) : 0;
+                    Inst* other = rc ? a : x;
+                    switch (i->bop) {
+                        case OP::ADD:
+                            if ((rc || lc) && k2 == 0) fold(i, other);
+                            break;
+                        case OP::OR:
+                            if ((rc || lc) && k2 == 0) fold(i, other);
+                            else if (a == x) fold(i, a);
+                            break;
+                        case OP::XOR:
+                            if ((rc || lc) && k2 == 0) fold(i, other);
+                            else if (a == x) fold(i, f.constant(0));
+                            break;
+                        case OP::SUB:
+                            if (rc && k2 == 0) fold(i, a);
+                            else if (a == x) fold(i, f.constant(0));
+                            break;
+                        case OP::MUL:
+                            if ((rc || lc) && k2 == 1) fold(i, other);
+                            else if ((rc || lc) && k2 == 0) fold(i, f.constant(0));
+                            break;
+                        case OP::AND:
+                            if ((rc || lc) && k2 == 0) fold(i, f.constant(0));
+                            else if ((rc || lc) && k2 == -1) fold(i, other);
+                            else if (a == x) fold(i, a);
+                            break;
+                        case OP::DIV:
+                            if (rc && k2 == 1) fold(i, a);
+                            break;
+                        case OP::MOD:
+                            if (rc && k2 == 1) fold(i, f.constant(0));
+                            break;
+                        case OP::SHL: case OP::SHR:
+                            if (rc && (k2 & 31) == 0) fold(i, a);
+                            else if (lc && val(0) == 0) fold(i, f.constant(0));
+                            break;
+                        case OP::EQ: case OP::LE: case OP::GE:
+                            if (a == x) fold(i, f.constant(1));
+                            break;
+                        case OP::NE: case OP::LT: case OP::GT:
+                            if (a == x) fold(i, f.constant(0));
+                            break;
+                        default: break;
+                    }
+                    break;
+                }
+                case Op::CondBr:
+                    if (c(0) && c(1) && eval(i->bop, val(0), val(1), r, i->wide)) jump(b, r ? 0 : 1);
+                    else if (i->ops[0] == i->ops[1])
+                        jump(b, (i->bop == OP::EQ || i->bop == OP::LE || i->bop == OP::GE) ? 0 : 1);
+                    break;
+                case Op::Switch: {
+                    if (!c(0)) break;
+                    // The first case that matches, as long as every one
+                    // before it is known not to
+                    size_t target = b->succs.size() - 1;
+                    bool known = true;
+                    for (size_t j = 1; j < i->ops.size(); j++) {
+                        if (!c(j)) { known = false; break; }
+                        if (val(j) == val(0)) { target = j - 1; break; }
+                    }
+                    if (known) jump(b, target);
+                    break;
+                }
+                default: break;
+            }
+            // An instruction removed or replaced: look at the same slot again
+            if (b->insts.size() < n || (k < b->insts.size() && b->insts[k] != i)) k--;
+        }
+    }
+    return changed;
+}
+
+// Copy propagation. The builder never emits copies: an assignment of one
+// variable to another just names the same value. What is left are phis
+// that merge a single value (all operands equal, or the phi itself), which
+// passes such as constfold and simplifycfg keep producing.
+inline bool copyprop(Function& f) {
+    bool changed = false;
+    for (bool again = true; again;) {
+        again = false;
+        for (Block* b : f.blocks) {
+            for (size_t k = 0; k < b->insts.size() && b->insts[k]->op == Op::Phi; k++) {
+                Inst* phi = b->insts[k];
+                Inst* same = nullptr;
+                bool trivial = true;
+                for (Inst* o : phi->ops) {
+                    if (o == phi || o == same) continue;
+                    if (same) { trivial = false; break; }
+                    same = o;
+                }
+                if (!trivial || !same) continue;
+                f.replace(phi, same);
+                f.erase(phi);
+                k--;
+                again = changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Dead-code elimination: values nothing with an effect depends on
+inline bool dce(Function& f) {
+    std::vector<bool> live(f.inst_count(), false);
+    std::vector<Inst*> work;
+    for (Block* b : f.blocks)
+        for (Inst* i : b->insts)
+            if (!i->pure() && !i->reads_state()) { live[i->id] = true; work.push_back(i); }
+    while (!work.empty()) {
+        Inst* i = work.back();
+        work.pop_back();
+        for (Inst* o : i->ops)
+            if (!live[o->id]) { live[o->id] = true; work.push_back(o); }
+    }
+    bool changed = false;
+    for (Block* b : f.blocks) {
+        auto dead = [&](Inst* i) { return !live[i->id]; };
+        if (std::none_of(b->insts.begin(), b->insts.end(), dead)) continue;
+        for (Inst* i : b->insts) if (dead(i)) f.kill(i);
+        b->insts.erase(std::remove_if(b->insts.begin(), b->insts.end(), [](Inst* i) { return !i->block; }), b->insts.end());
+        changed = true;
+    }
+    return changed;
+}
+
+// CFG simplification: conditional branches to one place become jumps,
+// unreachable blocks go, a block is merged into its only predecessor when
+// it is that predecessor's only successor, and jumps through empty blocks
+// are threaded to where those blocks lead.
+inline bool simplifycfg(Function& f) {
+    bool changed = false;
+    for (bool again = true; again;) {
+        again = false;
+        for (Block* b : f.blocks) {
+            Inst* t = b->term();
+            if (t && t->op == Op::CondBr && b->succs[0] == b->succs[1]) {
+                f.remove_pred(b->succs[1], b);
+                b->succs.pop_back();
+                f.add(b, Op::Br);
+                f.erase(t);
+                again = true;
+            }
+        }
+        if (f.remove_unreachable()) again = true;
+
+        // Merge b into its predecessor p
+        for (size_t bi = 1; bi < f.blocks.size(); bi++) {
+            Block* b = f.blocks[bi];
+            if (b->preds.size() != 1) continue;
+            Block* p = b->preds[0];
+            if (p == b || p->succs.size() != 1 || p->term()->op != Op::Br) continue;
+            while (!b->insts.empty() && b->insts.front()->op == Op::Phi) {
+                Inst* phi = b->insts.front();
+                f.replace(phi, phi->ops[0]);
+                f.erase(phi);
+            }
+            f.erase(p->term());
+            if (p->count < 0) p->count = b->count;
+            for (Inst* i : b->insts) { i->block = p; p->insts.push_back(i); }
+            b->insts.clear();
+            p->succs = b->succs;
+            for (Block* s : b->succs)
+                for (auto& q : s->preds) if (q == b) q = p;
+            b->succs.clear();
+            b->preds.clear();
+            f.blocks.erase(f.blocks.begin() + bi);
+            bi--;
+            again = true;
+        }
+
+        // Thread p -> b -> s to p -> s when b only jumps. A phi in s needs
+        // one operand per edge, so p must not already lead to s then.
+        for (size_t bi = 1; bi < f.blocks.size(); bi++) {
+            Block* b = f.blocks[bi];
+            if (b->insts.size() != 1 || b->insts[0]->op != Op::Br) continue;
+            Block* s = b->succs[0];
+            if (s == b) continue;
+            const size_t from = s->pred_index(b);
+            std::vector<Inst*> phis;
+            for (Inst* i : s->insts) { if (i->op != Op::Phi) break; phis.push_back(i); }
+            auto preds = b->preds;
+            for (Block* p : preds) {
+                if (!phis.empty() && std::find(s->preds.begin(), s->preds.end(), p) != s->preds.end()) continue;
+                // One edge of p at a time: a switch may name b for several cases
+                for (auto& q : p->succs) {
+                    if (q != b) continue;
+                    q = s;
+                    b->preds.erase(std::find(b->preds.begin(), b->preds.end(), p));
+                    s->preds.push_back(p);
+                    for (Inst* phi : phis) f.use(phi, phi->ops[from]);
+                    again = true;
+                    if (!phis.empty()) break;
+                }
+            }
+        }
+        if (again) changed = true;
+    }
+    return changed;
+}
+
+// Global value numbering: a pure instruction equal to one that dominates
+// it (same operation on the same values) is replaced by it. Walks the
+// dominator tree with a scoped table.
+inline bool gvn(Function& f) {
+    DomTree dom(f);
+    std::vector<std::vector<Block*>> kids(dom.idom.size());
+    for (Block* b : dom.rpo)
+        if (b != f.entry()) kids[dom.idom[b->id]->id].push_back(b);
+
+    std::unordered_map<std::string, Inst*> table;
+    std::vector<std::string> added;
+    auto key = [](const Inst* i) {
+        std::string k = std::to_string((int)i->op) + ":" + std::to_string((int)i->bop) + ":" +
+                        std::to_string(i->imm) + ":" + std::to_string(i->sym) + (i->wide ? "w" : "");
+        if (i->op == Op::Str) k += ":" + i->expr->val;
+        if (i->op == Op::Phi) k += ":b" + std::to_string(i->block->id);
+        std::vector<int> ids;
+        for (const Inst* o : i->ops) ids.push_back(o->id);
+        if (i->op == Op::Bin && commutative(i->bop)) std::sort(ids.begin(), ids.end());
+        for (int id : ids) k += "," + std::to_string(id);
+        return k;
+    };
+
+    bool changed = false;
+    // Explicit stack: (block, size of `added` when it was entered)
+    std::vector<std::pair<Block*, size_t>> stack{{f.entry(), 0}};
+    std::vector<size_t> next{0};
+    while (!stack.empty()) {
+        auto [b, mark] = stack.back();
+        size_t& child = next.back();
+        if (child == 0) {
+            for (size_t k = 0; k < b->insts.size(); k++) {
+                Inst* i = b->insts[k];
+                if (!i->pure() || i->op == Op::Const || i->op == Op::Arg) continue;
+                std::string kk = key(i);
+                auto it = table.find(kk);
+                if (it != table.end()) {
+                    f.replace(i, it->second);
+                    f.erase(i);
+                    k--;
+                    changed = true;
+                    continue;
+                }
+                table.emplace(kk, i);
+                added.push_back(std::move(kk));
+            }
+        }
+        if (child < kids[b->id].size()) {
+            Block* c = kids[b->id][child++];
+            stack.push_back({c, added.size()});
+            next.push_back(0);
+            continue;
+        }
+        for (size_t n = added.size(); n > mark; n--) table.erase(added[n - 1]);
+        added.resize(mark);
+        stack.pop_back();
+        next.pop_back();
+    }
+    return changed;
+}
+
+// Natural loops: a back edge b -> h, where h dominates b, makes h a loop
+// header, and the loop is h plus every block that reaches b without passing
+// through h. entry is the one block outside the loop that enters it, and
+// pre the preheader: entry if it leads nowhere else (the builder makes one
+// for every loop, but simplifycfg may since have threaded it away).
+struct Loop {
+    Block* header = nullptr;
+    Block* entry = nullptr;
+    Block* pre = nullptr;
+    std::vector<Block*> blocks, latches;  // blocks in layout order
+    std::vector<bool> in;                 // by block id
+};
+
+// The loops of f, inner ones first
+inline std::vector<Loop> find_loops(const Function& f, const DomTree& dom) {
+    int n = 0;
+    for (Block* b : f.blocks) n = std::max(n, b->id + 1);
+    std::vector<Loop> loops;
+    for (Block* h : f.blocks) {
+        Loop l;
+        l.header = h;
+        for (Block* p : h->preds) if (dom.dominates(h, p)) l.latches.push_back(p);
+        if (l.latches.empty()) continue;
+        l.in.assign(n, false);
+        l.in[h->id] = true;
+        std::vector<Block*> work(l.latches);
+        while (!work.empty()) {
+            Block* b = work.back();
+            work.pop_back();
+            if (l.in[b->id]) continue;
+            l.in[b->id] = true;
+            for (Block* p : b->preds) work.push_back(p);
+        }
+        for (Block* b : f.blocks) if (l.in[b->id]) l.blocks.push_back(b);
+        int entries = 0;
+        for (Block* p : h->preds) if (!l.in[p->id]) { entries++; l.entry = p; }
+        if (entries != 1) l.entry = nullptr;
+        else if (l.entry->succs.size() == 1) l.pre = l.entry;
+        loops.push_back(std::move(l));
+    }
+    std::stable_sort(loops.begin(), loops.end(),
+                     [](const Loop& a, const Loop& b) { return a.blocks.size() < b.blocks.size(); });
+    return loops;
+}
+
+// The preheader of loops[k], made on the edge from its entry if it has
+// none; the new block joins every loop around its header
+inline Block* preheader(Function& f, std::vector<Loop>& loops, size_t k) {
+    Loop& l = loops[k];
+    if (l.pre || !l.entry) return l.pre;
+    Block* p = l.entry;
+    Block* h = l.header;
+    Block* e = f.new_block("pre");
+    e->sealed = true;
+    *std::find(p->succs.begin(), p->succs.end(), h) = e;
+    e->preds.push_back(p);
+    h->preds[h->pred_index(p)] = e;
+    e->succs.push_back(h);
+    f.add(e, Op::Br);
+    f.blocks.insert(std::find(f.blocks.begin(), f.blocks.end(), h), e);
+    for (Loop& m : loops) {
+        m.in.resize(e->id + 1, false);
+        if (m.header == h || !m.in[h->id]) continue;
+        m.in[e->id] = true;
+        m.blocks.insert(std::find(m.blocks.begin(), m.blocks.end(), h), e);
+    }
+    return l.pre = e;
+}
+
+// Loop-invariant code motion: an instruction whose operands all come from
+// outside its loop computes the same value on every iteration and moves
+// to the preheader. That is arithmetic that cannot trap, and loads of
+// variables, fields and constant-index elements the loop never stores to,
+// in loops without calls, statements or stores through pointers (any of
+// which could write them). Inner loops go first, so an invariant of a
+// nest climbs one level per loop.
+inline bool licm(Function& f) {
+    DomTree dom(f);
+    auto loops = find_loops(f, dom);
+    bool changed = false;
+    for (size_t li = 0; li < loops.size(); li++) {
+        Loop& l = loops[li];
+        if (!l.entry) continue;
+        bool opaque = false;
+        std::vector<Sym> stored;
+        for (Block* b : l.blocks)
+            for (Inst* i : b->insts) {
+                if (i->op == Op::Store || i->op == Op::StoreElem || i->op == Op::StoreField) stored.push_back(i->sym);
+                if (i->op == Op::StoreDeref || i->op == Op::Call || i->op == Op::Stmt) opaque = true;
+            }
+        auto writes = [&](Sym s) { return opaque || std::find(stored.begin(), stored.end(), s) != stored.end(); };
+        auto outside = [&](const Inst* o) { return !l.in[o->block->id]; };
+        for (Block* b : l.blocks) {
+            for (size_t k = 0; k < b->insts.size(); k++) {
+                Inst* i = b->insts[k];
+                if (!std::all_of(i->ops.begin(), i->ops.end(), outside)) continue;
+                bool hoist = false;
+                switch (i->op) {
+                    case Op::Bin: {
+                        const long long d = i->ops[1]->is_const() ? wrap32(i->ops[1]->imm) : 0;
+                        hoist = (i->bop != OP::DIV && i->bop != OP::MOD) || (d != 0 && d != -1);
+                        break;
+                    }
+                    case Op::Neg: case Op::Not: hoist = true; break;
+                    case Op::Load: case Op::LoadField: hoist = !writes(i->sym); break;
+                    case Op::LoadElem: hoist = i->ops[0]->is_const() && !writes(i->sym); break;
+                    default: break;
+                }
+                if (!hoist) continue;
+                Block* pre = preheader(f, loops, li);
+                b->insts.erase(b->insts.begin() + k--);
+                pre->insts.insert(pre->insts.end() - 1, i);
+                i->block = pre;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Induction-variable strength reduction: in a loop whose counter i steps
+// by a constant c on its one back edge, i * k (or i << k) for a k the loop
+// does not change becomes a counter of its own that starts at init * k and
+// steps by c * k, so the multiply leaves the loop. The arithmetic wraps
+// the same way either way.
+inline bool ivsr(Function& f) {
+    DomTree dom(f);
+    auto loops = find_loops(f, dom);
+    bool changed = false;
+    for (size_t li = 0; li < loops.size(); li++) {
+        Loop& l = loops[li];
+        Block* h = l.header;
+        if (!l.entry || l.latches.size() != 1 || h->preds.size() != 2) continue;
+        const size_t kp = h->pred_index(l.entry), kl = h->pred_index(l.latches[0]);
+        std::vector<Inst*> phis;
+        for (Inst* i : h->insts) { if (i->op != Op::Phi) break; phis.push_back(i); }
+        for (Inst* phi : phis) {
+            if (phi->wide) continue;
+            const Inst* next = phi->ops[kl];
+            if (next->op != Op::Bin) continue;
+            long long c;
+            if (next->bop == OP::ADD && next->ops[0] == phi && next->ops[1]->is_const()) c = next->ops[1]->imm;
+            else if (next->bop == OP::ADD && next->ops[1] == phi && next->ops[0]->is_const()) c = next->ops[0]->imm;
+            else if (next->bop == OP::SUB && next->ops[0] == phi && next->ops[1]->is_const()) c = -next->ops[1]->imm;
+            else continue;
+            const std::vector<Inst*> users = phi->users;
+            for (Inst* u : users) {
+                if (!u->block || !l.in[u->block->id] || u->op != Op::Bin) continue;
+                // the factor: a constant, or a value from outside the loop
+                Inst* k = nullptr;
+                if (u->bop == OP::MUL && u->ops[0] != u->ops[1]) k = u->ops[u->ops[0] == phi ? 1 : 0];
+                else if (u->bop == OP::SHL && u->ops[0] == phi && u->ops[1]->is_const())
+                    k = f.constant(wrap32(1LL << (u->ops[1]->imm & 31)));
+                if (!k || k->wide || l.in[k->block->id]) continue;
+                if (k->is_const() && (wrap32(k->imm) == 0 || wrap32(k->imm) == 1 || wrap32(k->imm) == -1)) continue;  // constfold's
+                Block* pre = preheader(f, loops, li);
+                Inst* step = k;
+                if (k->is_const()) step = f.constant(wrap32(c * k->imm));
+                else if (c != 1) {
+                    step = f.add(pre, Op::Bin);
+                    step->bop = OP::MUL;
+                    f.use(step, k);
+                    f.use(step, f.constant(c));
+                }
+                Inst* scaled = f.add(h, Op::Phi);
+                for (size_t p = 0; p < h->preds.size(); p++) {
+                    Inst* v = f.add(h->preds[p], Op::Bin);
+                    v->bop = p == kp ? OP::MUL : OP::ADD;
+                    f.use(v, p == kp ? phi->ops[kp] : scaled);
+                    f.use(v, p == kp ? k : step);
+                    f.use(scaled, v);
+                }
+                f.replace(u, scaled);
+                f.erase(u);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// For targets that compute the base of arr[i] into a register (ARM64
+// needs an adrp/add pair): every element access in a loop takes the
+// array's address as an extra operand, computed once in the preheader of
+// the outermost loop that has one.
+inline bool hoist_bases(Function& f) {
+    DomTree dom(f);
+    auto loops = find_loops(f, dom);
+    bool changed = false;
+    for (size_t li = loops.size(); li-- > 0;) {
+        if (!loops[li].entry) continue;
+        std::unordered_map<Sym, Inst*> base;
+        const std::vector<Block*> blocks = loops[li].blocks;
+        for (Block* b : blocks)
+            for (Inst* i : b->insts) {
+                const size_t n = i->op == Op::LoadElem ? 1 : i->op == Op::StoreElem ? 2 : 0;
+                if (!n || i->ops.size() != n) continue;
+                Inst*& a = base[i->sym];
+                if (!a) {
+                    a = f.add(preheader(f, loops, li), Op::Addr);
+                    a->sym = i->sym;
+                    a->name = i->name;
+                    a->wide = true;
+                }
+                f.use(i, a);
+                changed = true;
+            }
+    }
+    return changed;
+}
+
+// A loop counter's step: x is phi + c (or phi itself, c = 0) for a
+// constant c
+inline bool counter_step(const Inst* phi, const Inst* x, long long& c) {
+    if (x == phi) { c = 0; return true; }
+    if (x->op != Op::Bin || x->wide) return false;
+    if (x->bop == OP::ADD && x->ops[0] == phi && x->ops[1]->is_const()) c = wrap32(x->ops[1]->imm);
+    else if (x->bop == OP::ADD && x->ops[1] == phi && x->ops[0]->is_const()) c = wrap32(x->ops[0]->imm);
+    else if (x->bop == OP::SUB && x->ops[0] == phi && x->ops[1]->is_const()) c = -wrap32(x->ops[1]->imm);
+    else return false;
+    return true;
+}
+
+// Intervals of the 32-bit values of a function: constants; + - * << that
+// cannot wrap; x & m, x % d, x / d, x >> d; phis, and among them loop
+// counters that only ever step one way from where they start. The
+// branches that lead to a block narrow what holds there. Wide values are
+// not tracked.
+class Ranges {
+public:
+    struct Range { long long lo, hi; };
+    static constexpr Range full{INT32_MIN, INT32_MAX};
+
+    explicit Ranges(const DomTree& dom) : dom(dom) {}
+
+    // v where b runs
+    Range at(const Inst* v, const Block* b, int depth = 0) {
+        if (v->wide || depth > 16) return full;
+        if (v->is_const()) return {wrap32(v->imm), wrap32(v->imm)};
+        const long long key = (long long)v->id << 32 | (uint32_t)b->id;
+        if (!open) {
+            auto it = memo.find(key);
+            if (it != memo.end()) return it->second;
+        }
+        Range r = own(v, depth);
+        // b runs only where the branch into each of its dominators that has
+        // a single predecessor went that way
+        for (const Block* x = b; (size_t)x->id < dom.idom.size();) {
+            if (x->preds.size() == 1) {
+                const Block* p = x->preds[0];
+                const Inst* t = p->term();
+                if (t && t->op == Op::CondBr && !t->wide && p->succs[0] != p->succs[1])
+                    r = narrow(r, t, v, x == p->succs[0], p, depth);
+            }
+            const Block* d = dom.idom[x->id];
+            if (!d || d == x) break;
+            x = d;
+        }
+        if (!open) memo[key] = r;
+        return r;
+    }
+
+private:
+    const DomTree& dom;
+    std::unordered_map<long long, Range> memo;    // at(), by value and block
+    std::unordered_map<const Inst*, Range> phis;  // own() of a phi, once begun
+    std::vector<const Inst*> begun;               // phis in the order begun
+    int open = 0;                                 // phis begun but not done
+
+    static Range fit(long long lo, long long hi) {
+        return lo < INT32_MIN || hi > INT32_MAX ? full : Range{lo, hi};
+    }
+
+    // r where t went to its first successor (taken) or its second
+    Range narrow(Range r, const Inst* t, const Inst* v, bool taken, const Block* p, int depth) {
+        OP op = t->bop;
+        const Inst* o;
+        if (t->ops[0] == v) o = t->ops[1];
+        else if (t->ops[1] == v) { o = t->ops[0]; op = swap_cmp(op); }
+        else return r;
+        if (!taken) op = negate_cmp(op);
+        const Range q = at(o, p, depth + 1);
+        switch (op) {
+            case OP::LT: r.hi = std::min(r.hi, q.hi - 1); break;
+            case OP::LE: r.hi = std::min(r.hi, q.hi); break;
+            case OP::GT: r.lo = std::max(r.lo, q.lo + 1); break;
+            case OP::GE: r.lo = std::max(r.lo, q.lo); break;
+            case OP::EQ: r.lo = std::max(r.lo, q.lo); r.hi = std::min(r.hi, q.hi); break;
+            default: break;
+        }
+        return r;
+    }
+
+    // What v holds wherever it is defined
+    Range own(const Inst* v, int depth) {
+        switch (v->op) {
+            case Op::Bin: return bin(v, depth);
+            case Op::Neg: {
+                const Range a = at(v->ops[0], v->block, depth + 1);
+                return a.lo == INT32_MIN ? full : Range{-a.hi, -a.lo};
+            }
+            case Op::Not: return {0, 1};
+            case Op::Phi: return phi(v, depth);
+            default: return full;
+        }
+    }
+
+    Range bin(const Inst* v, int depth) {
+        const Range a = at(v->ops[0], v->block, depth + 1), b = at(v->ops[1], v->block, depth + 1);
+        const bool k = b.lo == b.hi;
+        switch (v->bop) {
+            case OP::ADD: return fit(a.lo + b.lo, a.hi + b.hi);
+            case OP::SUB: return fit(a.lo - b.hi, a.hi - b.lo);
+            case OP::MUL: {
+                const long long p[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+                return fit(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+            }
+            case OP::SHL: return k ? fit(a.lo * (1LL << (b.lo & 31)), a.hi * (1LL << (b.lo & 31))) : full;
+            case OP::SHR: return k ? Range{a.lo >> (b.lo & 31), a.hi >> (b.lo & 31)} : full;
+            case OP::DIV: return k && b.lo > 0 ? Range{a.lo / b.lo, a.hi / b.lo} : full;
+            case OP::MOD: {
+                if (b.lo <= 0 && b.hi >= 0) return full;
+                const long long m = std::max(-b.lo, b.hi) - 1;  // |x % d| < |d|
+                if (a.lo >= 0) return {0, std::min(a.hi, m)};
+                if (a.hi <= 0) return {std::max(a.lo, -m), 0};
+                return {-m, m};
+            }
+            case OP::AND:
+                if (a.lo >= 0 && b.lo >= 0) return {0, std::min(a.hi, b.hi)};
+                if (a.lo >= 0 || b.lo >= 0) return {0, a.lo >= 0 ? a.hi : b.hi};
+                return full;
+            case OP::OR: case OP::XOR: {
+                if (a.lo < 0 || b.lo < 0) return full;
+                long long m = 1;
+                while (m <= std::max(a.hi, b.hi)) m <<= 1;
+                return {0, m - 1};
+            }
+            case OP::EQ: case OP::NE: case OP::LT: case OP::GT: case OP::LE: case OP::GE:
+            case OP::LAND: case OP::LOR:
+                return {0, 1};
+            default: return full;
+        }
+    }
+
+    // A counter steps by constants of one sign on its back edges: assuming
+    // it never wraps, it stays on one side of where it entered, and the
+    // branches to each back edge bound how far it gets; that bound then
+    // shows whether it can wrap. Any other phi is the union of its operands.
+    Range phi(const Inst* v, int depth) {
+        auto it = phis.find(v);
+        if (it != phis.end()) return it->second;
+        const Block* h = v->block;
+        const size_t mark = begun.size();
+        phis[v] = full;
+        begun.push_back(v);
+        open++;
+        bool counter = true, up = false, down = false;
+        Range e{INT32_MAX, INT32_MIN};  // union of the entry values
+        for (size_t k = 0; k < v->ops.size(); k++) {
+            long long c;
+            if (!dom.dominates(h, h->preds[k])) {
+                const Range a = at(v->ops[k], h->preds[k], depth + 1);
+                e = {std::min(e.lo, a.lo), std::max(e.hi, a.hi)};
+            } else if (!counter_step(v, v->ops[k], c)) counter = false;
+            else { up |= c > 0; down |= c < 0; }
+        }
+        Range r = full;
+        if (counter && !(up && down) && e.lo <= e.hi) {
+            phis[v] = up ? Range{e.lo, INT32_MAX} : Range{INT32_MIN, e.hi};
+            r = e;
+            bool wraps = false;
+            for (size_t k = 0; k < v->ops.size(); k++) {
+                long long c;
+                if (!dom.dominates(h, h->preds[k]) || !counter_step(v, v->ops[k], c) || !c) continue;
+                const Range a = at(v, h->preds[k], depth + 1);
+                if (up) { wraps |= a.hi + c > INT32_MAX; r.hi = std::max(r.hi, a.hi + c); }
+                else { wraps |= a.lo + c < INT32_MIN; r.lo = std::min(r.lo, a.lo + c); }
+            }
+            if (wraps) {
+                // what was worked out assuming it cannot wrap goes
+                for (size_t k = mark + 1; k < begun.size(); k++) phis.erase(begun[k]);
+                begun.resize(mark + 1);
+                r = full;
+            }
+        } else if (!counter) {
+            r = e;
+            for (size_t k = 0; k < v->ops.size(); k++) {
+                if (!dom.dominates(h, h->preds[k])) continue;
+                const Range a = at(v->ops[k], h->preds[k], depth + 1);
+                r = {std::min(r.lo, a.lo), std::max(r.hi, a.hi)};
+            }
+            if (r.lo > r.hi) r = full;
+        }
+        phis[v] = r;
+        open--;
+        return r;
+    }
+};
+
+// Bounds-check elimination (#SAFE, see Builder::bound). A check whose
+// index Ranges puts in [0, n) goes, and so does one that an equal or
+// tighter check of the same value has made before it. In a loop with no
+// inner loop and nothing an earlier iteration could leave visible (output,
+// calls, statements, registers, stores through pointers), that counts i by
+// 1 to a limit L from outside it and leaves only at that test, a check of
+// i + k that runs on every iteration and passes for the first becomes one
+// check of L before the loop. The program then stops there instead of in
+// the iteration that would index out of range, which nobody can tell apart.
+inline bool bce(Function& f) {
+    std::vector<Inst*> checks;
+    for (Block* b : f.blocks)
+        for (Inst* i : b->insts)
+            if (i->op == Op::Check) checks.push_back(i);
+    if (checks.empty()) return false;
+    DomTree dom(f);
+    Ranges ranges(dom);
+    auto before = [&](const Inst* a, const Inst* c) {  // a has run wherever c runs
+        if (a->block != c->block) return dom.dominates(a->block, c->block);
+        const auto& is = c->block->insts;
+        return std::find(is.begin(), is.end(), a) < std::find(is.begin(), is.end(), c);
+    };
+    bool changed = false;
+    for (Inst* c : checks) {
+        const Inst* v = c->ops[0];
+        const Ranges::Range r = ranges.at(v, c->block);
+        bool done = c->bop == OP::LT ? r.lo >= 0 && r.hi < c->imm : r.hi <= c->imm;
+        for (const Inst* u : v->users)
+            done = done || (u != c && u->block && u->op == Op::Check && u->bop == c->bop && u->imm <= c->imm && before(u, c));
+        if (!done) continue;
+        f.erase(c);
+        changed = true;
+    }
+
+    auto loops = find_loops(f, dom);
+    auto hoist = [&](size_t li, Inst* c) {
+        const Loop& l = loops[li];
+        Block* h = l.header;
+        const Inst* t = h->term();
+        if (!l.entry || c->block == h || !t || t->op != Op::CondBr || t->wide || h->succs.size() != 2) return false;
+        const bool first = l.in[h->succs[0]->id];
+        if (first == l.in[h->succs[1]->id]) return false;
+        for (Block* b : l.blocks) {
+            if (b != h && (b->succs.empty() || std::any_of(b->succs.begin(), b->succs.end(), [&](Block* s) {
+                    return !l.in[s->id] || (s != h && dom.dominates(s, b)); })))
+                return false;
+            for (Inst* i : b->insts)
+                switch (i->op) {
+                    case Op::Print: case Op::PutChar: case Op::Color: case Op::Call: case Op::Stmt:
+                    case Op::SetReg: case Op::StoreDeref:
+                        return false;
+                    default: break;
+                }
+        }
+        for (Block* p : l.latches) if (!dom.dominates(c->block, p)) return false;
+        // i < L or i <= L keeps the loop going
+        OP op = first ? t->bop : negate_cmp(t->bop);
+        Inst* iv = t->ops[0];
+        Inst* lim = t->ops[1];
+        if (lim->op == Op::Phi && lim->block == h) { std::swap(iv, lim); op = swap_cmp(op); }
+        if ((op != OP::LT && op != OP::LE) || iv->op != Op::Phi || iv->block != h || iv->wide || lim->wide ||
+            l.in[lim->block->id]) return false;
+        Inst* init = nullptr;
+        for (size_t k = 0; k < h->preds.size(); k++) {
+            long long s;
+            if (!l.in[h->preds[k]->id]) init = iv->ops[k];
+            else if (!counter_step(iv, iv->ops[k], s) || s != 1) return false;
+        }
+        // the index: i + k
+        const Inst* x = c->ops[0];
+        long long k = 0;
+        if (x != iv && !counter_step(iv, x, k)) return false;
+        const Ranges::Range a = ranges.at(init, l.entry);
+        if (a.lo + k < 0 || a.hi + k >= c->imm) return false;
+        const long long bound = (op == OP::LT ? c->imm : c->imm - 1) - k;
+        if (bound < INT32_MIN) return false;
+        if (bound <= INT32_MAX) {
+            Inst* g = f.add(preheader(f, loops, li), Op::Check);
+            g->bop = OP::LE;
+            g->imm = bound;
+            g->sym = c->sym;
+            g->name = c->name;
+            f.use(g, lim);
+        }
+        f.erase(c);
+        return true;
+    };
+    for (Inst* c : checks) {
+        if (!c->block || c->bop != OP::LT) continue;
+        for (size_t li = 0; li < loops.size(); li++)
+            if (loops[li].in[c->block->id]) { changed |= hoist(li, c); break; }
+    }
+    return changed;
+}
+
+// A counted loop a backend can run several elements per instruction:
+// `for i = from to to` with constant bounds and one body block that
+// computes, from elements x[i] of arrays of one element type, values from
+// outside the loop and (for i32) i itself, either a single store
+// dst[i] = ... (a map) or a single reduction s = s op ... for op one of
+// + ^ & | (acc set). No element is read or written at any other index, so
+// iterations depend on each other only through acc.
+struct VecLoop {
+    Block* header = nullptr;
+    Block* body = nullptr;
+    Inst* iv = nullptr;         // the counter phi
+    long long from = 0, to = 0;
+    Inst* acc = nullptr;        // the reduction's phi, null for a map
+    Inst* root = nullptr;       // the StoreElem, or the Bin that updates acc
+    int esize = 4;              // bytes per element: 4 (i32) or 1 (u8)
+};
+
+// Whether h heads a VecLoop; elem(sym) is the element size of an array,
+// 0 for anything else
+template <class ElemSize>
+bool vector_loop(Block* h, ElemSize elem, VecLoop& v) {
+    Inst* t = h->term();
+    if (!t || t->op != Op::CondBr || t->bop != OP::LT || t->wide || h->preds.size() != 2) return false;
+    Block* body = h->succs[0];
+    if (body == h || body->preds.size() != 1 || body->succs.size() != 1 || body->succs[0] != h) return false;
+    const size_t kb = h->pred_index(body), ke = 1 - kb;
+    Inst* iv = t->ops[0];
+    if (iv->op != Op::Phi || iv->block != h || !t->ops[1]->is_const() || !iv->ops[ke]->is_const()) return false;
+    Inst* step = iv->ops[kb];
+    if (step->block != body || step->op != Op::Bin || step->bop != OP::ADD) return false;
+    if (!(step->ops[0] == iv && step->ops[1]->is_const() && step->ops[1]->imm == 1) &&
+        !(step->ops[1] == iv && step->ops[0]->is_const() && step->ops[0]->imm == 1)) return false;
+    for (Inst* u : step->users) if (u != iv) return false;
+    v = VecLoop{};
+    v.header = h;
+    v.body = body;
+    v.iv = iv;
+    v.from = iv->ops[ke]->imm;
+    v.to = t->ops[1]->imm;
+    for (Inst* i : h->insts) {
+        if (i == t || i == iv) continue;
+        if (i->op != Op::Phi || v.acc || i->wide) return false;
+        Inst* r = i->ops[kb];
+        if (r->block != body || r->op != Op::Bin || (r->ops[0] == i) == (r->ops[1] == i)) return false;
+        if (r->bop != OP::ADD && r->bop != OP::XOR && r->bop != OP::AND && r->bop != OP::OR) return false;
+        for (Inst* u : i->users) if ((u->block == h || u->block == body) && u != r) return false;
+        v.acc = i;
+        v.root = r;
+    }
+    int esize = 0;
+    bool iv_value = false;
+    for (Inst* i : body->insts) {
+        if (i->op == Op::Br || i == step) continue;
+        for (Inst* u : i->users) if (u->block != body && !(i == v.root && u == v.acc)) return false;
+        switch (i->op) {
+            case Op::LoadElem: case Op::StoreElem: {
+                if (i->ops[0] != iv || i->ops.size() != (i->op == Op::LoadElem ? 1u : 2u)) return false;
+                const int s = elem(i->sym);
+                if (!s || (esize && s != esize)) return false;
+                esize = s;
+                if (i->op == Op::StoreElem) {
+                    if (v.root) return false;
+                    v.root = i;
+                }
+                break;
+            }
+            case Op::Bin:
+                switch (i->bop) {
+                    case OP::ADD: case OP::SUB: case OP::MUL: case OP::AND: case OP::OR: case OP::XOR: break;
+                    case OP::SHL: case OP::SHR: if (!i->ops[1]->is_const()) return false; break;
+                    default: return false;
+                }
+                break;
+            case Op::Neg: case Op::Not: break;
+            default: return false;
+        }
+        for (size_t k = 0; k < i->ops.size(); k++) {
+            const Inst* o = i->ops[k];
+            if (o->wide) return false;
+            if (o == iv && !(k == 0 && (i->op == Op::LoadElem || i->op == Op::StoreElem))) iv_value = true;
+        }
+    }
+    if (!v.root) return false;
+    v.esize = esize ? esize : 4;
+    if (v.esize == 1) {
+        // Bytes wrap like the low byte of i32 arithmetic only for + - & | ^;
+        // a reduction widens each element, so it takes them as loaded
+        if (iv_value) return false;
+        for (Inst* i : body->insts)
+            if ((i->op == Op::Bin && (i->bop == OP::MUL || i->bop == OP::SHL || i->bop == OP::SHR)) ||
+                (v.acc && i->op != Op::LoadElem && i != v.root && i != step && i->op != Op::Br)) return false;
+        if (v.acc && v.root->ops[v.root->ops[0] == v.acc ? 1 : 0]->op != Op::LoadElem) return false;
+    }
+    return true;
+}
+
+// Loop unrolling, with a profile (-fprofile-use, -O2 and up). An innermost
+// loop that the profile run went round at least 4 times per entry, in a
+// block at least an eighth as hot as the hottest of its fn, gets copies of
+// its blocks chained behind it: 3 when it has up to 12 instructions, 1 up
+// to 32. Every copy keeps the exit test, so the trip count need not be
+// known, but the back edge and the phi moves come once per chain and the
+// passes see several iterations at once. The loop must leave only at the
+// header's test, into a block nothing else enters, and run no statements
+// the backend generates from the AST; loops the vectorizer can take are
+// left to it.
+inline bool unroll(Function& f) {
+    if (!f.profiled()) return false;
+    long long hottest = 0;
+    for (Block* b : f.blocks) hottest = std::max(hottest, b->count);
+    DomTree dom(f);
+    auto loops = find_loops(f, dom);
+    int n = 0;
+    for (Block* b : f.blocks) n = std::max(n, b->id + 1);
+    std::vector<bool> header(n, false);
+    for (Loop& l : loops) header[l.header->id] = true;
+    bool changed = false;
+    for (Loop& l : loops) {
+        auto inside = [&](const Block* b) { return (size_t)b->id < l.in.size() && l.in[b->id]; };
+        Block* h = l.header;
+        Inst* t = h->term();
+        if (!l.entry || l.latches.size() != 1 || h->preds.size() != 2 || !t || t->op != Op::CondBr) continue;
+        Block* latch = l.latches[0];
+        if (latch == h || latch->term()->op != Op::Br || inside(h->succs[0]) == inside(h->succs[1])) continue;
+        Block* exit = h->succs[inside(h->succs[0]) ? 1 : 0];
+        if (exit->preds.size() != 1 || (!exit->insts.empty() && exit->insts.front()->op == Op::Phi)) continue;
+        const long long entries = h->count - latch->count;
+        if (latch->count < 0 || entries <= 0 || latch->count < 4 * entries || latch->count * 8 < hottest) continue;
+        int size = 0;
+        bool simple = true;
+        for (Block* b : l.blocks) {
+            const Inst* bt = b->term();
+            if (!bt || bt->op == Op::Ret || bt->op == Op::End || (b != h && header[b->id])) simple = false;
+            if (b != h) for (Block* s : b->succs) simple = simple && inside(s);
+            for (Inst* i : b->insts) {
+                if (i->op == Op::Stmt || i->op == Op::Count) simple = false;
+                size += i->op != Op::Phi && i->op != Op::Br;
+            }
+        }
+        VecLoop v;
+        if (!simple || size > 32 || vector_loop(h, [](Sym) { return 4; }, v)) continue;
+        const int copies = size <= 12 ? 3 : 1;
+
+        // Code after the loop reads only values of h, the one way out
+        std::vector<std::pair<Inst*, std::vector<Inst*>>> live_out;
+        for (Inst* i : h->insts) {
+            std::vector<Inst*> outside;
+            for (Inst* u : i->users)
+                if (u->block && !inside(u->block) && std::find(outside.begin(), outside.end(), u) == outside.end())
+                    outside.push_back(u);
+            if (!outside.empty()) live_out.push_back({i, outside});
+        }
+
+        const size_t kl = h->pred_index(latch);
+        std::vector<std::unordered_map<const Inst*, Inst*>> vmap(1);  // by copy; the loop itself is 0
+        auto value = [&](size_t c, Inst* v) {
+            auto it = vmap[c].find(v);
+            return it == vmap[c].end() ? v : it->second;
+        };
+        std::vector<Block*> added;
+        Block* last = latch;
+        for (int c = 1; c <= copies; c++) {
+            std::unordered_map<const Inst*, Inst*> vm;
+            std::unordered_map<const Block*, Block*> bm;
+            for (Block* b : l.blocks) {
+                Block* nb = f.new_block(b->tag);
+                nb->sealed = true;
+                nb->count = b->count < 0 ? -1 : b->count / (copies + 1);
+                bm[b] = nb;
+                added.push_back(nb);
+            }
+            // h's phis are what the previous copy passes round
+            for (Inst* i : h->insts) {
+                if (i->op != Op::Phi) break;
+                vm[i] = value(c - 1, i->ops[kl]);
+            }
+            for (Block* b : l.blocks)
+                for (Inst* i : b->insts) {
+                    if (vm.count(i)) continue;
+                    Inst* d = f.make(i->op);
+                    d->bop = i->bop;
+                    d->wide = i->wide;
+                    d->imm = i->imm;
+                    d->sym = i->sym;
+                    d->name = i->name;
+                    d->expr = i->expr;
+                    d->node = i->node;
+                    d->block = bm[b];
+                    bm[b]->insts.push_back(d);
+                    vm[i] = d;
+                }
+            for (Block* b : l.blocks) {
+                Block* nb = bm[b];
+                for (Inst* i : b->insts) {
+                    if (i->op == Op::Phi && b == h) continue;
+                    for (Inst* o : i->ops) {
+                        auto it = vm.find(o);
+                        f.use(vm[i], it == vm.end() ? o : it->second);
+                    }
+                }
+                // latch's one successor is the previous copy's header by now
+                for (Block* s : b->succs) nb->succs.push_back(b == latch ? h : inside(s) ? bm[s] : s);
+                if (b != h) for (Block* p : b->preds) nb->preds.push_back(bm[p]);
+            }
+            // The previous copy's latch leads here, this copy's back to h
+            Block* nh = bm[h];
+            for (auto& s : last->succs) if (s == h) s = nh;
+            nh->preds.push_back(last);
+            last = bm[latch];
+            h->preds[kl] = last;
+            exit->preds.push_back(nh);
+            vmap.push_back(std::move(vm));
+        }
+        std::vector<Inst*> round;
+        for (Inst* i : h->insts) {
+            if (i->op != Op::Phi) break;
+            round.push_back(value(copies, i->ops[kl]));
+        }
+        for (size_t k = 0; k < round.size(); k++) f.set_op(h->insts[k], kl, round[k]);
+        for (auto& [v, users] : live_out) {
+            Inst* phi = f.add(exit, Op::Phi);
+            phi->wide = v->wide;
+            for (int c = 0; c <= copies; c++) f.use(phi, value(c, v));
+            for (Inst* u : users)
+                for (size_t k = 0; k < u->ops.size(); k++)
+                    if (u->ops[k] == v) f.set_op(u, k, phi);
+        }
+        for (Block* b : l.blocks) if (b->count > 0) b->count /= copies + 1;
+        f.blocks.insert(std::find(f.blocks.begin(), f.blocks.end(), l.blocks.back()) + 1, added.begin(), added.end());
+        changed = true;
+    }
+    return changed;
+}
+
+// Order in which the backends emit the blocks of f. Without a profile it
+// is the layout. With one, a side of an if (or of && and ||) that the
+// profile run took on fewer than 1 in 4 of the branch's runs moves out of
+// line to the end, with every block it dominates, so that the likely side
+// falls through; loop tests are left alone. Only the emitted order changes:
+// f.blocks keeps the layout the register allocator relies on.
+inline std::vector<Block*> layout(const Function& f) {
+    if (!f.profiled()) return f.blocks;
+    DomTree dom(f);
+    int n = 0;
+    for (Block* b : f.blocks) n = std::max(n, b->id + 1);
+    // Runs of the edge p -> b: b's own when p is its only way in, else
+    // what p's other successor leaves (edge blocks have no count)
+    auto runs = [](const Block* p, const Block* b) -> long long {
+        if (b->preds.size() == 1 && b->count >= 0) return b->count;
+        const Block* o = p->succs[p->succs[0] == b ? 1 : 0];
+        if (o->preds.size() == 1 && o->count >= 0 && p->count >= o->count) return p->count - o->count;
+        return -1;
+    };
+    std::vector<bool> cold(n, false);
+    for (Block* b : f.blocks) {
+        if (b == f.entry()) continue;
+        const Block* d = dom.idom[b->id];
+        if (d && cold[d->id]) { cold[b->id] = true; continue; }
+        if (b->preds.size() != 1) continue;
+        const Block* p = b->preds[0];
+        const Inst* t = p->term();
+        if (!t || t->op != Op::CondBr || p->succs[0] == p->succs[1] || p->count <= 0) continue;
+        bool loop_test = false;
+        for (const Block* q : p->preds) loop_test = loop_test || dom.dominates(p, q);
+        if (loop_test) continue;
+        const long long r = runs(p, b);
+        cold[b->id] = r >= 0 && r * 4 < p->count;
+    }
+    std::vector<Block*> order;
+    for (Block* b : f.blocks) if (!cold[b->id]) order.push_back(b);
+    for (Block* b : f.blocks) if (cold[b->id]) order.push_back(b);
+    return order;
+}
+
+// -O0: none. -O1: each pass once. -O2: adds value numbering and the loop
+// passes and repeats until nothing changes (a few rounds at most); -O3
+// allows more rounds. With a profile, -O2 and up unroll hot loops last and
+// clean up after them once.
+class PassManager {
+    int level;
+    bool addr_regs;  // the target wants array bases hoisted (hoist_bases)
+
+    bool run(const char* name, bool (*pass)(Function&), Function& f) {
+        TraceScope trace(name, f.name);
+        return pass(f);
+    }
+
+public:
+    explicit PassManager(int opt_level, bool addr_regs = false) : level(opt_level), addr_regs(addr_regs) {}
+
+    void run(Function& f) {
+        if (level <= 0) return;
+        const int rounds = level == 1 ? 1 : level == 2 ? 4 : 16;
+        for (int r = 0; r < rounds; r++) {
+            bool changed = false;
+            changed |= run("constfold", constfold, f);
+            changed |= run("copyprop", copyprop, f);
+            if (level >= 2) changed |= run("gvn", gvn, f);
+            changed |= run("dce", dce, f);
+            changed |= run("simplifycfg", simplifycfg, f);
+            changed |= run("bce", bce, f);
+            if (level >= 2) {
+                changed |= run("licm", licm, f);
+                changed |= run("ivsr", ivsr, f);
+            }
+            if (!changed) break;
+        }
+        if (level >= 2 && run("unroll", unroll, f)) {
+            run("constfold", constfold, f);
+            run("copyprop", copyprop, f);
+            run("gvn", gvn, f);
+            run("dce", dce, f);
+            run("simplifycfg", simplifycfg, f);
+        }
+        if (level >= 2 && addr_regs) run("hoist_bases", hoist_bases, f);
+    }
+};
+
+
+// Inlining of leaf functions. A fn is a candidate when its parameters and
+// locals are all scalars the IR can promote and its optimized IR computes
+// and branches only: no memory, registers, calls or statements the backend
+// generates from the AST. Its IR is built once, as a template, and a call
+// to it is replaced by a copy with the arguments in place of the
+// parameters; the passes that run afterwards fold what constant arguments
+// decide. -O1 inlines only `inline fn`, -O2 and up also every candidate
+// whose size, less what its constant arguments remove, is within the limit
+// (-finline-limit), which a profile raises for hot calls (see choose).
+// `noinline fn` is never inlined.
+class Inliner {
+    struct Callee {
+        const FuncDecl* decl = nullptr;
+        std::unique_ptr<Function> body;
+        int size = 0;               // instructions a copy adds
+        std::vector<int> arg_uses;  // by parameter: instructions that use it
+    };
+    std::unordered_map<std::string, Callee> callees;
+    int level, limit;
+
+    static bool scalar(std::string_view t) { return t == "i32" || t == "i64" || t == "u8" || t == "bool"; }
+
+    // Whether the call is worth inlining; the callee if so. With a profile
+    // (Block::count), a call that never ran is only inlined when asked, and
+    // one that ran at least an eighth as often as the hottest block of its
+    // fn takes callees of up to hot_factor times the limit.
+    const Callee* choose(const Inst* call, long long hottest) const {
+        if (level <= 0 || call->wide) return nullptr;
+        auto c = static_cast<const FuncCall*>(call->node);
+        Str nm = c->name;
+        if (!nm.empty() && nm[0] == '#') nm = nm.substr(1);
+        auto it = callees.find(std::string(nm));
+        if (it == callees.end()) return nullptr;
+        const Callee& e = it->second;
+        if (e.decl->params.size() != call->ops.size()) return nullptr;
+        if (e.decl->hint == FuncDecl::INLINE) return &e;
+        if (level < 2) return nullptr;
+        const long long runs = call->block->count;
+        if (runs == 0 && hottest > 0) return nullptr;
+        const int most = runs > 0 && runs * 8 >= hottest ? limit * hot_factor : limit;
+        int cost = e.size;
+        for (size_t k = 0; k < call->ops.size(); k++)
+            if (call->ops[k]->is_const()) cost -= e.arg_uses[k];
+        return cost <= most ? &e : nullptr;
+    }
+
+    // Replaces the call at b->insts[k] by a copy of e's body: b ends in a
+    // jump to the copy, whose returns jump to a new block holding the rest of b
+    void splice(Function& f, size_t bi, size_t k, const Callee& e) const {
+        Block* b = f.blocks[bi];
+        Inst* call = b->insts[k];
+        const Function& t = *e.body;
+        Block* cont = f.new_block("inl_end");
+        cont->sealed = true;
+        cont->count = b->count;
+        cont->insts.assign(b->insts.begin() + k + 1, b->insts.end());
+        for (Inst* i : cont->insts) i->block = cont;
+        b->insts.resize(k + 1);
+        cont->succs.swap(b->succs);
+        for (Block* s : cont->succs)
+            for (auto& p : s->preds) if (p == b) p = cont;
+
+        std::unordered_map<const Block*, Block*> bmap;
+        std::unordered_map<const Inst*, Inst*> vmap;
+        std::vector<Block*> copies;
+        for (Block* tb : t.blocks) {
+            Block* nb = f.new_block(tb->tag);
+            nb->sealed = true;
+            bmap[tb] = nb;
+            copies.push_back(nb);
+        }
+        for (Block* tb : t.blocks)
+            for (Inst* i : tb->insts) {
+                if (i->op == Op::Const) { vmap[i] = f.constant(i->imm); continue; }
+                if (i->op == Op::Arg) { vmap[i] = call->ops[i->imm]; continue; }
+                Inst* c = f.make(i->op == Op::Ret || i->op == Op::End ? Op::Br : i->op);
+                c->bop = i->bop;
+                c->wide = i->wide;
+                c->imm = i->imm;
+                vmap[i] = c;
+            }
+        std::vector<Inst*> results;  // by predecessor of cont
+        for (Block* tb : t.blocks) {
+            Block* nb = bmap[tb];
+            for (Block* p : tb->preds) nb->preds.push_back(bmap[p]);
+            for (Block* s : tb->succs) nb->succs.push_back(bmap[s]);
+            for (Inst* i : tb->insts) {
+                if (i->op == Op::Const || i->op == Op::Arg) continue;
+                Inst* c = vmap[i];
+                c->block = nb;
+                nb->insts.push_back(c);
+                if (i->op == Op::Ret || i->op == Op::End) {
+                    nb->succs.push_back(cont);
+                    cont->preds.push_back(nb);
+                    // Falling off the end returns nothing in particular
+                    results.push_back(i->ops.empty() ? f.constant(0) : vmap[i->ops[0]]);
+                    continue;
+                }
+                for (Inst* o : i->ops) f.use(c, vmap[o]);
+            }
+        }
+
+        Inst* result;
+        if (results.size() == 1) result = results[0];
+        else if (results.empty()) result = f.constant(0);
+        else {
+            result = f.make(Op::Phi);
+            result->block = cont;
+            cont->insts.insert(cont->insts.begin(), result);
+            for (Inst* r : results) f.use(result, r);
+        }
+        f.replace(call, result);
+        f.erase(call);
+        Block* entry = bmap[t.entry()];
+        b->succs.push_back(entry);
+        entry->preds.push_back(b);
+        f.add(b, Op::Br);
+
+        copies.push_back(cont);
+        f.blocks.insert(f.blocks.begin() + bi + 1, copies.begin(), copies.end());
+    }
+
+public:
+    static constexpr int default_limit = 12;
+    static constexpr int hot_factor = 4;
+
+    Inliner(int opt_level, int size_limit) : level(opt_level), limit(size_limit) {}
+
+    // Builds fd's template. Empty if it is a candidate, else why not.
+    std::string add(const FuncDecl* fd, const Interner& names) {
+        if (level <= 0 || fd->hint == FuncDecl::NOINLINE || !fd->body) return "noinline";
+        if (!fd->type_params.empty()) return "it is generic";
+        const SectionNode* s = fd->body;
+        auto body = std::make_unique<Function>(std::string(fd->name));
+        Builder b(*body, names);
+        b.scan(s->decls, s->stmts);
+        std::vector<Sym> own;
+        for (auto& p : fd->params) {
+            Sym sym = names.find(p.first);
+            if (!scalar(p.second) || b.escapes(sym)) return "parameter '" + std::string(p.first) + "' is not a scalar value";
+            own.push_back(sym);
+        }
+        for (auto d : s->decls) {
+            auto v = static_cast<const VarDecl*>(d);
+            if (v->is_arr || !scalar(v->type) || b.escapes(v->sym)) return "local '" + std::string(v->name) + "' lives in memory";
+            own.push_back(v->sym);
+        }
+        for (Sym fv : b.for_vars())
+            if (std::find(own.begin(), own.end(), fv) == own.end()) return "a loop counter is not its own";
+        for (size_t i = 0; i < fd->params.size(); i++) b.promote(own[i], b.arg(i));
+        for (auto d : s->decls) {
+            auto v = static_cast<const VarDecl*>(d);
+            long long iv = 0;
+            if (v->init) const_value(v->init, iv);  // a runtime initializer is an assignment in place
+            b.promote(v->sym, b.constant(iv), v->is_const);
+        }
+        try {
+            b.build(s->stmts);
+        } catch (const std::exception&) {
+            return "its body does not compile on its own";
+        }
+        PassManager(level).run(*body);
+        Callee e;
+        e.decl = fd;
+        e.arg_uses.assign(fd->params.size(), 0);
+        if (!body->entry()->preds.empty()) return "its entry is a loop header";
+        for (Block* bl : body->blocks)
+            for (Inst* i : bl->insts) {
+                switch (i->op) {
+                    case Op::Const: continue;
+                    case Op::Arg: e.arg_uses[i->imm] = (int)i->users.size(); continue;
+                    case Op::Br: case Op::Ret: case Op::End: continue;
+                    case Op::Phi: case Op::Bin: case Op::Neg: case Op::Not:
+                    case Op::CondBr: case Op::Switch:
+                        break;
+                    case Op::Print: case Op::PutChar: case Op::Color:
+                        if (i->node || i->ops.empty()) return "it prints a variable from memory";
+                        break;
+                    case Op::Call: return "it calls a function";
+                    default: return "it reads or writes memory";
+                }
+                e.size++;
+            }
+        e.body = std::move(body);
+        std::string nm(fd->name);
+        if (!nm.empty() && nm[0] == '#') nm = nm.substr(1);
+        callees[nm] = std::move(e);
+        return "";
+    }
+
+    // Inlines the calls of f that are worth it; how many
+    int run(Function& f) const {
+        if (callees.empty()) return 0;
+        TraceScope trace("inline", f.name);
+        int n = 0;
+        long long hottest = 0;
+        for (Block* b : f.blocks) hottest = std::max(hottest, b->count);
+        for (size_t bi = 0; bi < f.blocks.size(); bi++) {
+            Block* b = f.blocks[bi];
+            for (size_t k = 0; k < b->insts.size(); k++) {
+                const Inst* c = b->insts[k];
+                if (c->op != Op::Call) continue;
+                if (const Callee* e = choose(c, hottest)) {
+                    splice(f, bi, k, *e);
+                    n++;
+                    break;  // the rest of b is in the block after the copy
+                }
+            }
+        }
+        if (n) f.remove_unreachable();
+        return n;
+    }
+};
+
+}  // namespace ir
@@ -0,0 +1,372 @@
+#pragma once
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Peephole optimizer over the NASM text of the x86 backend, run on the
+// whole code section between CodeGen and the assembler at -O1 and above.
+// The text is split into a list of labels, instructions (mnemonic plus
+// operands) and everything else (directives, comments), the rules below
+// rewrite the list until none applies, and unchanged lines are written back
+// as they came. Rules only look at straight-line code: labels, jumps,
+// calls, int/syscall and directives end every window, so no rule has to
+// know who jumps where.
+//
+// Working on text rather than on an instruction list from CodeGen keeps the
+// backend's many emit sites as they are, at a price: operands are strings,
+// so two memory operands are the same only when written the same way
+// ([rdx + 4] and [rdx+4] differ) and one that merely overlaps another is
+// not recognized; any line the parser does not take apart (macros, %
+// directives, data) ends a window; and an emit site that changes its
+// spelling can turn a rule off without anything failing. Every such case
+// only misses an optimization.
+namespace x86 {
+
+class Peephole {
+public:
+    // Instructions each rule removed (zero-idiom rewrites instead)
+    struct Rule { const char* name; int count = 0; };
+    enum : int { STORE_RELOAD, SELF_MOVE, DEAD_MOVE, PUSH_POP, JUMP_NEXT, BRANCH_OVER, UNREACHABLE, ZERO_IDIOM, RULES };
+    Rule rules[RULES] = {{"store-reload"}, {"self-move"}, {"dead-move"}, {"push-pop"},
+                         {"jump-to-next"}, {"branch-over-jump"}, {"unreachable"}, {"zero-idiom"}};
+    int before = 0, after = 0;  // instructions in and out
+
+    explicit Peephole(bool bits64) : bits64(bits64) {}
+
+    std::string run(const std::string& text) {
+        parse(text);
+        for (const Line& l : lines) before += l.kind == INST;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t k = 0; k < lines.size(); k++)
+                if (!lines[k].dead && lines[k].kind == INST && step(k)) changed = true;
+            compact();
+        }
+        std::string out;
+        out.reserve(text.size());
+        for (const Line& l : lines) {
+            after += l.kind == INST;
+            out += l.text;
+            out += '\n';
+        }
+        return out;
+    }
+
+    std::string report() const {
+        std::ostringstream s;
+        s << "  peephole: " << before << " -> " << after << " instructions";
+        if (before) s << " (-" << (before - after) * 1000 / before / 10.0 << "%)";
+        s << "\n";
+        for (const Rule& r : rules)
+            if (r.count) s << "    " << r.name << ": " << r.count << (&r == &rules[ZERO_IDIOM] ? " rewritten" : "") << "\n";
+        return s.str();
+    }
+
+private:
+    enum Kind : uint8_t { INST, LABEL, OTHER };
+    struct Line {
+        Kind kind = OTHER;
+        std::string op;                 // INST: mnemonic; LABEL: name
+        std::vector<std::string> args;  // INST: operands as written
+        std::string text;               // the line as it is output
+        bool dead = false;
+    };
+    std::vector<Line> lines;
+    bool bits64;
+
+    static std::string trim(const std::string& s) {
+        size_t a = 0, b = s.size();
+        while (a < b && isspace((unsigned char)s[a])) a++;
+        while (b > a && isspace((unsigned char)s[b - 1])) b--;
+        return s.substr(a, b - a);
+    }
+
+    void parse(const std::string& text) {
+        static const char* directives[] = {"db", "dw", "dd", "dq", "times", "resb", "resw", "resd", "resq",
+                                           "align", "section", "global", "extern", "default", "bits", "org"};
+        std::istringstream in(text);
+        std::string raw;
+        while (std::getline(in, raw)) {
+            Line l;
+            l.text = raw;
+            // Comments: everything after a ';' outside quotes
+            std::string s;
+            char quote = 0;
+            for (char c : raw) {
+                if (quote) { if (c == quote) quote = 0; }
+                else if (c == '"' || c == '\'' || c == '`') quote = c;
+                else if (c == ';') break;
+                s += c;
+            }
+            s = trim(s);
+            if (s.empty() || s[0] == '[' || quote) { lines.push_back(std::move(l)); continue; }
+            size_t sp = 0;
+            while (sp < s.size() && !isspace((unsigned char)s[sp])) sp++;
+            std::string head = s.substr(0, sp);
+            if (head.back() == ':') {
+                if (sp == s.size()) { l.kind = LABEL; l.op = head.substr(0, head.size() - 1); }
+                lines.push_back(std::move(l));
+                continue;
+            }
+            bool directive = false;
+            for (const char* d : directives) directive |= head == d;
+            if (directive) { lines.push_back(std::move(l)); continue; }
+            l.kind = INST;
+            l.op = head;
+            const std::string rest = trim(s.substr(sp));
+            int depth = 0;
+            std::string cur;
+            for (char c : rest) {
+                if (c == '[') depth++;
+                if (c == ']') depth--;
+                if (c == ',' && depth == 0) { l.args.push_back(trim(cur)); cur.clear(); }
+                else cur += c;
+            }
+            if (!rest.empty()) l.args.push_back(trim(cur));
+            lines.push_back(std::move(l));
+        }
+    }
+
+    void compact() {
+        size_t n = 0;
+        for (size_t k = 0; k < lines.size(); k++)
+            if (!lines[k].dead) {
+                if (n != k) lines[n] = std::move(lines[k]);
+                n++;
+            }
+        lines.resize(n);
+    }
+
+    void kill(size_t k, int rule) {
+        lines[k].dead = true;
+        rules[rule].count++;
+    }
+
+    static void set(Line& l, const std::string& op, std::vector<std::string> args) {
+        l.op = op;
+        l.args = std::move(args);
+        l.text = "    " + op;
+        for (size_t k = 0; k < l.args.size(); k++) l.text += (k ? ", " : " ") + l.args[k];
+    }
+
+    // Next live line after k that is not a comment or blank, or npos
+    size_t next(size_t k) const {
+        for (k++; k < lines.size(); k++)
+            if (!lines[k].dead && (lines[k].kind != OTHER || !blank(lines[k]))) return k;
+        return std::string::npos;
+    }
+    static bool blank(const Line& l) {
+        const std::string s = trim(l.text);
+        return s.empty() || s[0] == ';';
+    }
+
+    // ---- registers ----
+    // Family (0-15, the 64-bit register) and width of a register name, or -1
+    static int reg(const std::string& s, int& bits) {
+        static const char* r64[] = {"rax","rcx","rdx","rbx","rsp","rbp","rsi","rdi"};
+        static const char* r32[] = {"eax","ecx","edx","ebx","esp","ebp","esi","edi"};
+        static const char* r16[] = {"ax","cx","dx","bx","sp","bp","si","di"};
+        static const char* r8[]  = {"al","cl","dl","bl","spl","bpl","sil","dil"};
+        static const char* r8h[] = {"ah","ch","dh","bh"};
+        for (int i = 0; i < 8; i++) {
+            if (s == r64[i]) { bits = 64; return i; }
+            if (s == r32[i]) { bits = 32; return i; }
+            if (s == r16[i]) { bits = 16; return i; }
+            if (s == r8[i])  { bits = 8;  return i; }
+            if (i < 4 && s == r8h[i]) { bits = 8; return i; }
+        }
+        if (s.size() >= 2 && s[0] == 'r' && isdigit((unsigned char)s[1])) {
+            size_t p = 1;
+            int n = 0;
+            while (p < s.size() && isdigit((unsigned char)s[p])) n = n * 10 + (s[p++] - '0');
+            const std::string suf = s.substr(p);
+            if (n < 8 || n > 15) return -1;
+            if (suf.empty()) bits = 64;
+            else if (suf == "d") bits = 32;
+            else if (suf == "w") bits = 16;
+            else if (suf == "b" || suf == "l") bits = 8;
+            else return -1;
+            return n;
+        }
+        return -1;
+    }
+    static int reg(const std::string& s) { int b; return reg(s, b); }
+    static std::string name32(int r) {
+        static const char* r32[] = {"eax","ecx","edx","ebx","esp","ebp","esi","edi"};
+        return r < 8 ? r32[r] : "r" + std::to_string(r) + "d";
+    }
+
+    // Whether operand a names register family r anywhere (also as an address)
+    static bool mentions(const std::string& a, int r) {
+        std::string tok;
+        for (size_t k = 0; k <= a.size(); k++) {
+            if (k < a.size() && (isalnum((unsigned char)a[k]) || a[k] == '_')) { tok += a[k]; continue; }
+            if (!tok.empty() && reg(tok) == r) return true;
+            tok.clear();
+        }
+        return false;
+    }
+    static bool is_mem(const std::string& a) { return a.find('[') != std::string::npos; }
+
+    // Instructions whose first operand, a full register, is only written
+    static bool write_only(const Line& l) {
+        return l.op == "mov" || l.op == "movzx" || l.op == "movsx" || l.op == "movsxd" || l.op == "lea" || l.op == "pop";
+    }
+    // Instructions with no effect on registers and memory beyond their
+    // explicit operands and the flags
+    static bool plain(const std::string& op) {
+        static const char* ops[] = {"mov", "movzx", "movsx", "movsxd", "lea", "add", "sub", "and", "or", "xor",
+                                    "cmp", "test", "inc", "dec", "neg", "not", "shl", "shr", "sar", "imul", "push", "pop"};
+        for (const char* o : ops) if (op == o) return true;
+        return op.compare(0, 3, "set") == 0 || op.compare(0, 4, "cmov") == 0;
+    }
+    static bool jump(const std::string& op) { return op[0] == 'j'; }
+    static bool ends_flow(const std::string& op) { return op == "jmp" || op == "ret"; }
+
+    // Whether register family r is dead after line k: some later
+    // instruction of the same straight-line run writes all of it before
+    // anything reads it. Anything unknown counts as a read.
+    bool dead_after(size_t k, int r) const {
+        for (size_t j = next(k); j != std::string::npos; j = next(j)) {
+            const Line& l = lines[j];
+            if (l.kind != INST || !plain(l.op)) return false;
+            if (l.op == "imul" && l.args.size() == 1) return false;  // edx:eax
+            int bits = 0;
+            const bool full = !l.args.empty() && reg(l.args[0], bits) == r && bits >= 32;
+            const bool zero = (l.op == "xor" || l.op == "sub") && l.args.size() == 2 && l.args[0] == l.args[1];
+            if (full && zero) return true;
+            for (size_t a = 0; a < l.args.size(); a++) {
+                if (a == 0 && full && write_only(l)) continue;
+                if (mentions(l.args[a], r)) return false;
+            }
+            if (full && write_only(l)) return true;
+        }
+        return false;
+    }
+
+    // Whether the flags are dead after line k: overwritten before any
+    // instruction reads them, within the run
+    bool flags_dead_after(size_t k) const {
+        for (size_t j = next(k); j != std::string::npos; j = next(j)) {
+            const Line& l = lines[j];
+            if (l.kind != INST) return false;
+            const std::string& op = l.op;
+            if (op == "call") return true;
+            if (op == "cmp" || op == "test" || op == "add" || op == "sub" || op == "and" || op == "or" ||
+                op == "xor" || op == "neg" || op == "imul" || op == "mul") return true;
+            if (op == "mov" || op == "movzx" || op == "movsx" || op == "movsxd" || op == "lea" ||
+                op == "push" || op == "pop" || op == "not") continue;
+            return false;
+        }
+        return false;
+    }
+
+    static bool has_label_before(const std::vector<Line>& ls, size_t from, size_t to) {
+        for (size_t j = from + 1; j < to; j++)
+            if (!ls[j].dead && ls[j].kind == LABEL) return true;
+        return false;
+    }
+
+    static const char* invert(const std::string& jcc) {
+        static const char* pairs[][2] = {{"je", "jne"}, {"jz", "jnz"}, {"jl", "jge"}, {"jg", "jle"}, {"jb", "jae"},
+                                         {"ja", "jbe"}, {"js", "jns"}, {"jo", "jno"}, {"jc", "jnc"}, {"jp", "jnp"}};
+        for (auto& p : pairs) {
+            if (jcc == p[0]) return p[1];
+            if (jcc == p[1]) return p[0];
+        }
+        return nullptr;
+    }
+
+    // Applies the first rule that matches at instruction k
+    bool step(size_t k) {
+        Line& i = lines[k];
+        const size_t n = next(k);
+        Line* nx = n != std::string::npos && !has_label_before(lines, k, n) ? &lines[n] : nullptr;
+        if (nx && nx->kind != INST) nx = nullptr;
+        const auto& a = i.args;
+        int bits = 0;
+
+        if (i.op == "mov" && a.size() == 2) {
+            const int r = reg(a[0], bits);
+            // mov r, r (a 32-bit self-move zero-extends in 64-bit code)
+            if (a[0] == a[1] && r >= 0 && (!bits64 || bits == 64)) { kill(k, SELF_MOVE); return true; }
+            // mov x, y followed by mov y, x or by itself
+            if (nx && nx->op == "mov" && nx->args.size() == 2 && (r >= 0 || reg(a[1]) >= 0)) {
+                const auto& b = nx->args;
+                // the reload zero-extends a 32-bit register in 64-bit code
+                int bb = 0;
+                const int rb = reg(b[0], bb);
+                const bool back = b[0] == a[1] && b[1] == a[0] && !(r >= 0 && mentions(a[1], r)) &&
+                                  !(bits64 && rb >= 0 && bb == 32);
+                const bool again = b == a && !(r >= 0 && mentions(a[1], r)) && !(is_mem(a[0]) && is_mem(a[1]));
+                if (back || again) { kill(n, STORE_RELOAD); return true; }
+            }
+            // mov r, 0 -> xor r, r
+            if (r >= 0 && bits >= 32 && a[1] == "0" && flags_dead_after(k)) {
+                const std::string r32 = name32(r);
+                set(i, "xor", {r32, r32});
+                rules[ZERO_IDIOM].count++;
+                return true;
+            }
+        }
+        // A register written and overwritten before anyone reads it
+        if ((i.op == "mov" || i.op == "movzx" || i.op == "movsx" || i.op == "movsxd" || i.op == "lea") && a.size() == 2) {
+            const int r = reg(a[0], bits);
+            if (r >= 0 && r != 4 && r != 5 && bits >= 32 && dead_after(k, r)) { kill(k, DEAD_MOVE); return true; }
+        }
+        // push x / pop y
+        if (i.op == "push" && a.size() == 1 && nx && nx->op == "pop" && nx->args.size() == 1) {
+            int b1 = 0, b2 = 0;
+            if (a[0] == nx->args[0]) {
+                kill(k, PUSH_POP);
+                kill(n, PUSH_POP);
+                return true;
+            }
+            if (reg(a[0], b1) >= 0 && reg(nx->args[0], b2) >= 0 && b1 == b2) {
+                set(*nx, "mov", {nx->args[0], a[0]});
+                kill(k, PUSH_POP);
+                return true;
+            }
+        }
+        if (jump(i.op) && a.size() == 1) {
+            // jmp L / jcc L directly before L:
+            for (size_t j = k + 1; j < lines.size(); j++) {
+                const Line& l = lines[j];
+                if (l.dead || (l.kind == OTHER && blank(l))) continue;
+                if (l.kind != LABEL) break;
+                if (l.op == a[0]) { kill(k, JUMP_NEXT); return true; }
+            }
+            // jcc L / jmp M / L:  ->  jncc M / L:
+            const char* inv = invert(i.op);
+            if (inv && nx && nx->op == "jmp" && nx->args.size() == 1 && !is_mem(nx->args[0])) {
+                for (size_t j = n + 1; j < lines.size(); j++) {
+                    const Line& l = lines[j];
+                    if (l.dead || (l.kind == OTHER && blank(l))) continue;
+                    if (l.kind != LABEL) break;
+                    if (l.op == a[0]) {
+                        set(i, inv, {nx->args[0]});
+                        kill(n, BRANCH_OVER);
+                        return true;
+                    }
+                }
+            }
+        }
+        // Nothing falls into the instructions between jmp/ret and a label
+        if (ends_flow(i.op)) {
+            bool any = false;
+            for (size_t j = k + 1; j < lines.size(); j++) {
+                Line& l = lines[j];
+                if (l.dead || (l.kind == OTHER && blank(l))) continue;
+                if (l.kind != INST) break;
+                kill(j, UNREACHABLE);
+                any = true;
+            }
+            return any;
+        }
+        return false;
+    }
+};
+
+}  // namespace x86
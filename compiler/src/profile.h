@@ -0,0 +1,128 @@
+#pragma once
+#include "ir.h"
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Profile-guided optimization (-fprofile-generate, -fprofile-use).
+//
+// An instrumented build gives every block the builder made a 64-bit counter
+// that an Op::Count at its top increments. The counters of each region sit
+// in the program's data behind a small header, and the whole image is
+// written out as the program ends: to a .deprof file in terminal modes,
+// byte by byte to the first serial port on bare metal. Blocks are numbered
+// before any pass runs, so a later build of the same source, at any -O
+// level and for any target, finds the same blocks and gives them their
+// counts (Block::count) for the passes and the backends to use.
+//
+// The file, little-endian: "DEPROF1\n", u32 regions, u32 0; then for each
+// region u32 name bytes, u32 counters, u32 shape (see shape()), u32 0, the
+// name zero-padded to a multiple of 8 bytes, and a u64 per counter.
+namespace ir {
+
+constexpr char profile_magic[] = "DEPROF1\n";
+constexpr size_t profile_header_bytes = 16;
+
+// Bytes of a region's record in the file
+inline size_t profile_record_bytes(size_t name_bytes, size_t counters) {
+    return 16 + (name_bytes + 7) / 8 * 8 + 8 * counters;
+}
+
+// Checksum of the blocks of a freshly built f: their number, what the
+// source made them and how many successors each has. Instructions are left
+// out, since targets build some expressions differently.
+inline uint32_t shape(const Function& f) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    auto mix = [&](uint8_t byte) { h = (h ^ byte) * 16777619u; };
+    for (int k = 0; k < 4; k++) mix((uint8_t)(f.blocks.size() >> (8 * k)));
+    for (const Block* b : f.blocks) {
+        for (const char* t = b->tag; *t; t++) mix((uint8_t)*t);
+        mix((uint8_t)b->succs.size());
+    }
+    return h;
+}
+
+// Starts every block of a freshly built f with a Count of its own,
+// numbered in layout order (after the phis, and the entry's arguments and
+// constants); the number of counters
+inline int instrument(Function& f) {
+    int n = 0;
+    for (Block* b : f.blocks) {
+        Inst* c = f.make(Op::Count);
+        c->imm = n++;
+        c->block = b;
+        b->insts.insert(std::find_if(b->insts.begin(), b->insts.end(), [](Inst* i) {
+            return i->op != Op::Phi && i->op != Op::Arg && i->op != Op::Const;
+        }), c);
+    }
+    return n;
+}
+
+// The counts of a profile run, by region name
+class Profile {
+    struct Region {
+        uint32_t shape = 0;
+        std::vector<long long> counts;
+    };
+    std::unordered_map<std::string, Region> regions;
+
+public:
+    enum Match { MATCHED, MISSING, STALE };
+
+    // Reads what an instrumented program wrote
+    void read(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot read profile '" + path + "'");
+        const std::string s((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const auto bad = [&] { return std::runtime_error("'" + path + "' is not a .deprof profile"); };
+        size_t at = 0;
+        auto u32 = [&] {
+            if (at + 4 > s.size()) throw bad();
+            uint32_t v = 0;
+            for (int k = 3; k >= 0; k--) v = v << 8 | (uint8_t)s[at + k];
+            at += 4;
+            return v;
+        };
+        if (s.compare(0, 8, profile_magic) != 0) throw bad();
+        at = 8;
+        const uint32_t n = u32();
+        u32();
+        for (uint32_t r = 0; r < n; r++) {
+            const uint32_t len = u32(), counters = u32();
+            Region g;
+            g.shape = u32();
+            u32();
+            if (at + profile_record_bytes(len, counters) - 16 > s.size()) throw bad();
+            std::string name = s.substr(at, len);
+            at += (len + 7) / 8 * 8;
+            g.counts.resize(counters);
+            for (auto& c : g.counts) {
+                uint64_t v = 0;
+                for (int k = 7; k >= 0; k--) v = v << 8 | (uint8_t)s[at + k];
+                at += 8;
+                c = (long long)std::min<uint64_t>(v, INT64_MAX);
+            }
+            regions[std::move(name)] = std::move(g);
+        }
+    }
+
+    size_t size() const { return regions.size(); }
+
+    // Gives the blocks of a freshly built f, numbered as instrument() does,
+    // the counts of the region called name. f is left alone unless they
+    // were made for the same blocks.
+    Match annotate(Function& f, const std::string& name) const {
+        auto it = regions.find(name);
+        if (it == regions.end()) return MISSING;
+        const Region& g = it->second;
+        if (g.shape != shape(f) || g.counts.size() != f.blocks.size()) return STALE;
+        for (size_t k = 0; k < f.blocks.size(); k++) f.blocks[k]->count = g.counts[k];
+        return MATCHED;
+    }
+};
+
+}  // namespace ir
@@ -0,0 +1,335 @@
+#pragma once
+#include "defacto.h"
+#include "ir.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Liveness and linear-scan register allocation for the native backends.
+//
+// Allocation works on the SSA values of one IR function (ir.h). Every
+// instruction k of the block layout has two positions: 2k where it reads
+// its operands and 2k+1 where it writes its result. A value is live in a
+// list of segments, exact per block, so a value that dies in a loop body
+// leaves a hole its register can be reused in. A phi is written at the end
+// of every predecessor (by the moves the backend puts there) and its
+// operands are read just before, so a loop counter and its next value can
+// share a register. Each use weighs 8^loop depth; under pressure the
+// lighter side spills (gets a stack or .data slot).
+
+struct LiveRange {
+    ir::Inst* value = nullptr;
+    std::vector<std::pair<int, int>> segs;  // sorted, disjoint, inclusive
+    double weight = 0;
+    std::vector<int> hints;  // ids of values that would like the same register
+    int reg = -1;            // index into the pool, -1 = memory
+
+    int start() const { return segs.front().first; }
+};
+
+// Positions and live ranges of one function; ranges are indexed by value id
+// (empty for values nobody reads and for constants, which are immediates)
+class Liveness {
+public:
+    std::vector<int> pos;                  // instruction index by id, in layout order
+    std::vector<int> first, last;          // by block id: first and terminator index
+    std::vector<int> depth;                // loop depth by block id
+    std::vector<LiveRange> ranges;
+
+    explicit Liveness(const ir::Function& f) {
+        int nb = 0;
+        for (auto b : f.blocks) nb = std::max(nb, b->id + 1);
+        pos.assign(f.inst_count(), -1);
+        first.assign(nb, 0);
+        last.assign(nb, 0);
+        depth.assign(nb, 0);
+        std::vector<int> index(nb, 0);
+        int k = 0;
+        for (size_t i = 0; i < f.blocks.size(); i++) {
+            auto b = f.blocks[i];
+            index[b->id] = (int)i;
+            first[b->id] = k;
+            for (auto in : b->insts) pos[in->id] = k++;
+            last[b->id] = k - 1;
+        }
+        // Loops: a jump back to a block laid out earlier; the blocks in
+        // between are its body
+        for (auto b : f.blocks)
+            for (auto s : b->succs)
+                if (index[s->id] <= index[b->id])
+                    for (int i = index[s->id]; i <= index[b->id]; i++) depth[f.blocks[i]->id]++;
+
+        ranges.resize(f.inst_count());
+        // Per value: the blocks it is live into and out of (found by walking
+        // up from every use) and the last use in each block
+        std::vector<int> seen(nb, -1), in(nb, -1), out(nb, -1), need(nb, -1);
+        std::vector<ir::Block*> touched, work;
+        for (auto b : f.blocks)
+            for (auto v : b->insts) {
+                if (!v->has_value() || v->is_const() || v->users.empty()) continue;
+                const int id = v->id;
+                ir::Block* d = v->block;
+                LiveRange& r = ranges[id];
+                touched.clear();
+                auto touch = [&](ir::Block* x) {
+                    if (seen[x->id] == id) return;
+                    seen[x->id] = id;
+                    need[x->id] = -1;
+                    touched.push_back(x);
+                };
+                auto live_in = [&](ir::Block* x) {
+                    if (x == d || in[x->id] == id) return;
+                    in[x->id] = id;
+                    work.push_back(x);
+                };
+                auto use_at = [&](ir::Block* x, int p) {
+                    touch(x);
+                    need[x->id] = std::max(need[x->id], p);
+                    double w = 1;
+                    for (int i = 0; i < depth[x->id] && i < 6; i++) w *= 8;
+                    r.weight += w;
+                    live_in(x);
+                };
+                for (auto u : v->users) {
+                    if (u->op != ir::Op::Phi) { use_at(u->block, 2 * pos[u->id]); continue; }
+                    for (size_t j = 0; j < u->ops.size(); j++) {
+                        if (u->ops[j] != v) continue;
+                        ir::Block* p = u->block->preds[j];
+                        use_at(p, 2 * last[p->id]);
+                        r.hints.push_back(u->id);
+                        ranges[u->id].hints.push_back(id);
+                    }
+                }
+                while (!work.empty()) {
+                    ir::Block* x = work.back();
+                    work.pop_back();
+                    for (auto p : x->preds) {
+                        touch(p);
+                        out[p->id] = id;
+                        live_in(p);
+                    }
+                }
+                touch(d);
+                r.value = v;
+                const int def = v->op == ir::Op::Phi ? 2 * first[d->id] : 2 * pos[id] + 1;
+                for (auto x : touched) {
+                    const int from = x == d ? def : 2 * first[x->id];
+                    const int to = out[x->id] == id ? 2 * last[x->id] + 1 : std::max(need[x->id], from);
+                    r.segs.push_back({from, to});
+                }
+                // A phi is written where its predecessors end
+                if (v->op == ir::Op::Phi)
+                    for (auto p : d->preds) r.segs.push_back({2 * last[p->id] + 1, 2 * last[p->id] + 1});
+                // Two-address operations like their result where the left operand is
+                if (v->op == ir::Op::Bin || v->op == ir::Op::Neg || v->op == ir::Op::Not) {
+                    auto a = v->ops[0];
+                    if (!a->is_const()) { r.hints.push_back(a->id); ranges[a->id].hints.push_back(id); }
+                }
+                std::sort(r.segs.begin(), r.segs.end());
+                std::vector<std::pair<int, int>> merged;
+                for (auto& s : r.segs) {
+                    if (!merged.empty() && s.first <= merged.back().second + 1)
+                        merged.back().second = std::max(merged.back().second, s.second);
+                    else merged.push_back(s);
+                }
+                r.segs.swap(merged);
+            }
+    }
+
+    bool has_range(const ir::Inst* v) const { return !ranges[v->id].segs.empty(); }
+
+    // Whether v holds a value that instruction i must leave intact: live
+    // before i (a segment starting at i's read position is live into its
+    // block) and read after it
+    bool live_across(const ir::Inst* v, const ir::Inst* i) const {
+        const int k = 2 * pos[i->id];
+        for (auto& s : ranges[v->id].segs) if (s.first <= k && s.second > k + 1) return true;
+        return false;
+    }
+};
+
+// Linear scan with lifetime holes: ranges in order of their start take the
+// first register none of whose holders overlaps them, trying the registers
+// of their hints first. When every register is taken, the new range evicts
+// the holders of the register they weigh least on, if that is less than
+// its own weight; otherwise it goes to memory.
+inline void linear_scan(std::vector<LiveRange>& ranges, int nregs) {
+    std::vector<LiveRange*> order;
+    for (auto& r : ranges) if (!r.segs.empty()) order.push_back(&r);
+    std::sort(order.begin(), order.end(), [](const LiveRange* a, const LiveRange* b) {
+        return a->start() != b->start() ? a->start() < b->start() : a->value->id < b->value->id;
+    });
+    struct Held { int from, to; LiveRange* owner; };
+    std::vector<std::vector<Held>> held(nregs);  // by register, sorted, disjoint
+    auto conflicts = [&](int reg, const LiveRange& r, std::vector<LiveRange*>* out) {
+        bool any = false;
+        auto& h = held[reg];
+        for (auto& s : r.segs) {
+            auto it = std::lower_bound(h.begin(), h.end(), s.first, [](const Held& x, int p) { return x.to < p; });
+            for (; it != h.end() && it->from <= s.second; ++it) {
+                any = true;
+                if (!out) return true;
+                if (std::find(out->begin(), out->end(), it->owner) == out->end()) out->push_back(it->owner);
+            }
+        }
+        return any;
+    };
+    auto take = [&](int reg, LiveRange& r) {
+        r.reg = reg;
+        auto& h = held[reg];
+        for (auto& s : r.segs) {
+            auto it = std::lower_bound(h.begin(), h.end(), s.first, [](const Held& x, int p) { return x.from < p; });
+            h.insert(it, {s.first, s.second, &r});
+        }
+    };
+    for (LiveRange* cur : order) {
+        int reg = -1;
+        for (int hint : cur->hints) {
+            int hr = ranges[hint].reg;
+            if (hr >= 0 && !conflicts(hr, *cur, nullptr)) { reg = hr; break; }
+        }
+        for (int r = 0; r < nregs && reg < 0; r++) if (!conflicts(r, *cur, nullptr)) reg = r;
+        if (reg >= 0) { take(reg, *cur); continue; }
+        // Evict the cheapest register's holders, if they weigh less
+        int best = -1;
+        double best_w = cur->weight;
+        std::vector<LiveRange*> victims;
+        for (int r = 0; r < nregs; r++) {
+            std::vector<LiveRange*> owners;
+            conflicts(r, *cur, &owners);
+            double w = 0;
+            for (auto o : owners) w += o->weight;
+            if (w < best_w) { best_w = w; best = r; victims = owners; }
+        }
+        if (best < 0) continue;
+        for (auto v : victims) {
+            v->reg = -1;
+            auto& h = held[best];
+            h.erase(std::remove_if(h.begin(), h.end(), [&](const Held& x) { return x.owner == v; }), h.end());
+        }
+        take(best, *cur);
+    }
+}
+
+// Walks the statements of one region for what register planning needs
+// before any IR exists: the variables it mentions, the explicit #R
+// registers (which the allocator keeps its hands off) and the loop
+// counters of `for`.
+class UseScan {
+    const Interner& names;
+
+public:
+    std::vector<Sym> used;                   // every variable mentioned, unsorted, may repeat
+    std::vector<std::string> explicit_regs;  // "#R1".. as written
+    std::vector<Sym> for_vars;               // loop counters of `for`, in order
+
+    explicit UseScan(const Interner& n) : names(n) {}
+
+    void decl_inits(const NodeList& decls) {
+        for (auto d : decls) expr(static_cast<VarDecl*>(d)->init);
+    }
+    void region(const NodeList& stmts) { body(stmts); }
+
+    // Every variable the statements mention, for the "shared with a
+    // function" check of the main section
+    void mentions(const NodeList& stmts, std::vector<bool>& out) {
+        region(stmts);
+        for (Sym s : used) {
+            if (s >= out.size()) out.resize(s + 1);
+            out[s] = true;
+        }
+    }
+
+private:
+    void touch(Sym s) { if (s) used.push_back(s); }
+
+    static bool is_reg(Str s) { return s.size() >= 3 && s[0] == '#' && s[1] == 'R'; }
+
+    // Operands that the backends still carry as text: a name, #Rn, a number,
+    // &x, *p or arr[i]
+    void text(Str s) {
+        if (s.empty()) return;
+        if (is_reg(s)) { explicit_regs.push_back(s.str()); return; }
+        if (s[0] == '&' || s[0] == '*') { touch(names.find(s.substr(1))); return; }
+        auto lb = s.find('[');
+        if (lb != Str::npos) {
+            touch(names.find(s.substr(0, lb)));
+            auto rb = s.find(']', lb);
+            if (rb != Str::npos) text(s.substr(lb + 1, rb - lb - 1));
+            return;
+        }
+        touch(names.find(s));
+    }
+
+    void expr(const Expr* e) {
+        if (!e) return;
+        switch (e->kind) {
+            case EK::VAR: touch(e->sym); return;
+            case EK::REG: explicit_regs.push_back(e->val.str()); return;
+            default: break;
+        }
+        expr(e->lhs);
+        expr(e->rhs);
+        for (auto i : e->items) expr(i);
+    }
+
+    void body(const NodeList& l) { for (auto s : l) stmt(s); }
+
+    void stmt(Node* n) {
+        if (!n) return;
+        switch (n->kind) {
+            case NT::ASSIGN: {
+                auto a = static_cast<Assign*>(n);
+                expr(a->target); expr(a->value);
+                return;
+            }
+            case NT::REG_OP: {
+                auto r = static_cast<RegOp*>(n);
+                text(r->target); expr(r->source);
+                return;
+            }
+            case NT::LOOP:  body(static_cast<LoopNode*>(n)->body); return;
+            case NT::WHILE: {
+                auto w = static_cast<WhileNode*>(n);
+                expr(w->cond); body(w->body);
+                return;
+            }
+            case NT::FOR: {
+                auto f = static_cast<ForNode*>(n);
+                for_vars.push_back(f->init_sym);
+                touch(f->init_sym); expr(f->init); expr(f->cond); body(f->body); expr(f->step);
+                return;
+            }
+            case NT::IF_STMT: {
+                auto i = static_cast<IfNode*>(n);
+                expr(i->cond); body(i->then_body); body(i->else_body);
+                return;
+            }
+            case NT::SWITCH_STMT: {
+                auto s = static_cast<SwitchNode*>(n);
+                expr(s->value);
+                for (auto& c : s->cases) { expr(c.first); body(c.second); }
+                body(s->default_body);
+                return;
+            }
+            case NT::DISPLAY:  text(static_cast<DisplayNode*>(n)->var); return;
+            case NT::PRINTNUM: text(static_cast<PrintNumNode*>(n)->var); return;
+            case NT::COLOR:    expr(static_cast<ColorNode*>(n)->value); return;
+            case NT::PUTCHAR:  expr(static_cast<PutCharNode*>(n)->value); return;
+            case NT::ALLOC_NODE: text(static_cast<AllocNode*>(n)->size); return;
+            case NT::RETURN:   expr(static_cast<ReturnNode*>(n)->value); return;
+            case NT::READKEY:  text(static_cast<ReadKeyNode*>(n)->var); return;
+            case NT::READCHAR: text(static_cast<ReadCharNode*>(n)->var); return;
+            case NT::DEALLOC_NODE: text(static_cast<DeallocNode*>(n)->ptr); return;
+            case NT::DRV_CALL: text(static_cast<DriverCall*>(n)->driver_target); return;
+            case NT::FREE:     text(static_cast<FreeNode*>(n)->var); return;
+            case NT::FUNC_CALL: {
+                auto c = static_cast<FuncCall*>(n);
+                for (auto a : c->args) expr(a);
+                text(c->result);
+                return;
+            }
+            default: return;
+        }
+    }
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+// Minimal runtime linked into static terminal executables in place of libc.
+// It provides the three functions the x86 backend declares extern:
+//   malloc  first-fit over a free list, grows the heap with brk
+//   free    pushes the block onto the free list (no coalescing)
+//   exit    exit syscall; there are no stdio buffers to flush
+// Every block carries a header holding its rounded size. Assembled by
+// x86::Assembler and linked only when the program references one of them.
+
+namespace x86 {
+
+// i386, cdecl: argument on the stack, ebx preserved
+inline const char* runtime_source_32 = R"(
+[BITS 32]
+global malloc
+global free
+global exit
+section .text
+malloc:
+    push ebx
+    mov ecx, [esp+8]
+    add ecx, 7
+    and ecx, -8
+    jnz .sized
+    mov ecx, 8
+.sized:
+    mov edx, __rt_free_list
+.scan:
+    mov eax, [edx]
+    test eax, eax
+    jz .grow
+    cmp [eax-8], ecx
+    jae .take
+    mov edx, eax
+    jmp .scan
+.take:
+    mov ebx, [eax]
+    mov [edx], ebx
+    pop ebx
+    ret
+.grow:
+    mov eax, [__rt_brk]
+    test eax, eax
+    jnz .have
+    push ecx
+    mov eax, 45
+    xor ebx, ebx
+    int 0x80
+    pop ecx
+    add eax, 7
+    and eax, -8
+    mov [__rt_brk], eax
+.have:
+    lea ebx, [eax+ecx+8]
+    push eax
+    push ecx
+    mov eax, 45
+    int 0x80
+    pop ecx
+    mov edx, eax
+    pop eax
+    cmp edx, ebx
+    jb .fail
+    mov [__rt_brk], ebx
+    mov [eax], ecx
+    add eax, 8
+    pop ebx
+    ret
+.fail:
+    xor eax, eax
+    pop ebx
+    ret
+free:
+    mov eax, [esp+4]
+    test eax, eax
+    jz .done
+    mov ecx, [__rt_free_list]
+    mov [eax], ecx
+    mov [__rt_free_list], eax
+.done:
+    ret
+exit:
+    mov ebx, [esp+4]
+    mov eax, 1
+    int 0x80
+section .bss
+__rt_brk: resd 1
+__rt_free_list: resd 1
+)";
+
+// x86-64, System V: argument in rdi; syscall clobbers rcx and r11
+inline const char* runtime_source_64 = R"(
+BITS 64
+DEFAULT REL
+global malloc
+global free
+global exit
+section .text
+malloc:
+    lea rcx, [rdi+15]
+    and rcx, -16
+    jnz .sized
+    mov ecx, 16
+.sized:
+    lea rdx, [__rt_free_list]
+.scan:
+    mov rax, [rdx]
+    test rax, rax
+    jz .grow
+    cmp [rax-16], rcx
+    jae .take
+    mov rdx, rax
+    jmp .scan
+.take:
+    mov rsi, [rax]
+    mov [rdx], rsi
+    ret
+.grow:
+    mov r8, rcx
+    mov rax, [__rt_brk]
+    test rax, rax
+    jnz .have
+    mov eax, 12
+    xor edi, edi
+    syscall
+    add rax, 15
+    and rax, -16
+    mov [__rt_brk], rax
+.have:
+    mov r9, rax
+    lea rdi, [rax+r8+16]
+    mov r10, rdi
+    mov eax, 12
+    syscall
+    cmp rax, r10
+    jb .fail
+    mov [__rt_brk], r10
+    mov [r9], r8
+    lea rax, [r9+16]
+    ret
+.fail:
+    xor eax, eax
+    ret
+free:
+    test rdi, rdi
+    jz .done
+    mov rax, [__rt_free_list]
+    mov [rdi], rax
+    mov [__rt_free_list], rdi
+.done:
+    ret
+exit:
+    mov eax, 60
+    syscall
+section .bss
+__rt_brk: resq 1
+__rt_free_list: resq 1
+)";
+
+} // namespace x86
@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Records compiler phases for --time-trace=<file> as Chrome trace event
+// JSON (chrome://tracing, ui.perfetto.dev). Spans are complete ("X")
+// events on the thread that ran them; counters are sampled where the
+// driver calls counter(). Until start() every call is a single branch.
+class TimeTrace {
+    struct Event {
+        char        ph;       // 'X' span, 'C' counter
+        std::string name, detail;
+        int64_t     ts, dur;  // microseconds since start()
+        uint32_t    tid;
+        uint64_t    value;
+    };
+
+    std::atomic<bool> on{false};
+    std::chrono::steady_clock::time_point t0;
+    std::mutex mu;
+    std::vector<Event> events;
+    std::atomic<uint32_t> next_tid{1};
+
+    static void escape(std::ostream& o, std::string_view s) {
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\') o << '\\' << c;
+            else if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof buf, "\\u%04x", c);
+                o << buf;
+            } else o << c;
+        }
+    }
+
+public:
+    static TimeTrace& get() {
+        static TimeTrace t;
+        return t;
+    }
+
+    void start() {
+        t0 = std::chrono::steady_clock::now();
+        tid();  // the driver thread is tid 1
+        on = true;
+    }
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    // Small stable id per thread, in order of first use
+    uint32_t tid() {
+        thread_local uint32_t id = next_tid++;
+        return id;
+    }
+
+    void span(std::string_view name, std::string detail, int64_t ts, int64_t dur) {
+        const uint32_t t = tid();
+        std::lock_guard<std::mutex> lock(mu);
+        events.push_back({'X', std::string(name), std::move(detail), ts, dur, t, 0});
+    }
+
+    void counter(std::string_view name, uint64_t value) {
+        if (!enabled()) return;
+        const int64_t ts = now();
+        std::lock_guard<std::mutex> lock(mu);
+        events.push_back({'C', std::string(name), {}, ts, 0, 1, value});
+    }
+
+    void write(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mu);
+        std::ofstream o(path);
+        if (!o) throw std::runtime_error("cannot write '" + path + "'");
+        o << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        o << "{\"ph\":\"M\",\"pid\":1,\"tid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"defacto\"}}";
+        for (uint32_t t = 1; t < next_tid; t++)
+            o << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+              << (t == 1 ? std::string("main") : "worker " + std::to_string(t - 1)) << "\"}}";
+        for (auto& e : events) {
+            o << ",\n{\"ph\":\"" << e.ph << "\",\"pid\":1,\"tid\":" << e.tid << ",\"ts\":" << e.ts << ",\"name\":\"";
+            escape(o, e.name);
+            o << "\"";
+            if (e.ph == 'X') {
+                o << ",\"dur\":" << e.dur;
+                if (!e.detail.empty()) { o << ",\"args\":{\"detail\":\""; escape(o, e.detail); o << "\"}"; }
+            } else {
+                o << ",\"args\":{\"";
+                escape(o, e.name);
+                o << "\":" << e.value << "}";
+            }
+            o << "}";
+        }
+        o << "\n]}\n";
+    }
+};
+
+// Times the enclosing scope; the detail is copied only while tracing
+class TraceScope {
+    std::string_view name;
+    std::string detail;
+    int64_t ts = -1;
+
+public:
+    explicit TraceScope(std::string_view n, std::string_view d = {}) : name(n) {
+        TimeTrace& t = TimeTrace::get();
+        if (!t.enabled()) return;
+        detail.assign(d.data(), d.size());
+        ts = t.now();
+    }
+    ~TraceScope() {
+        if (ts < 0) return;
+        TimeTrace& t = TimeTrace::get();
+        t.span(name, std::move(detail), ts, t.now() - ts);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// Peak resident set size of the process so far (0 where unavailable)
+inline uint64_t peak_rss_bytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage ru {};
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (uint64_t)ru.ru_maxrss;         // bytes
+#else
+    return (uint64_t)ru.ru_maxrss * 1024;  // kilobytes
+#endif
+#endif
+}
@@ -0,0 +1,1841 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// In-process assembler for the NASM dialect the x86 backend emits, so a
+// build does not have to spawn nasm. It covers the instructions, operand
+// forms and directives CodeGen produces; anything else raises
+// x86::Unsupported and the caller falls back to the external assembler.
+// Encodings follow NASM's choices (shortest immediate/displacement forms,
+// accumulator short forms, relaxed jumps), so the bytes match `nasm -O`.
+namespace x86 {
+
+struct Unsupported : std::runtime_error { using std::runtime_error::runtime_error; };
+
+enum class Fix : uint8_t { ABS8, ABS16, ABS32, ABS32S, ABS64, PC8, PC32 };
+
+struct Reloc {
+    uint64_t offset;   // within the section
+    int      symbol;   // Assembler::symbols index
+    int64_t  addend;   // relative to the symbol (already includes -4 etc. for PC32)
+    Fix      kind;
+};
+
+struct Section {
+    std::string name;
+    std::vector<uint8_t> data;
+    uint64_t size = 0;      // == data.size() unless nobits
+    uint32_t align = 1;
+    bool exec = false, write = false, nobits = false;
+    std::vector<Reloc> relocs;
+};
+
+struct Symbol {
+    std::string name;
+    int      section = -1;  // -1: undefined / external
+    uint64_t value = 0;
+    bool     global = false, external = false, defined = false, is_equ = false;
+    int64_t  equ = 0;
+};
+
+class Assembler {
+public:
+    std::vector<Section> sections;
+    std::vector<Symbol>  symbols;
+    int      bits = 16;
+    bool     has_org = false;
+    uint64_t org = 0;
+
+private:
+    // ---- registers -------------------------------------------------------
+    enum : uint8_t { R_GP = 0, R_XMM = 1, R_YMM = 2 };
+    struct RegInfo { int8_t id; uint8_t size; bool rex8, high8; uint8_t cls; };
+
+    static bool reg_lookup(std::string_view n, RegInfo& r) {
+        static const std::unordered_map<std::string_view, RegInfo> table = [] {
+            std::unordered_map<std::string_view, RegInfo> t;
+            static const char* r64[] = {"rax","rcx","rdx","rbx","rsp","rbp","rsi","rdi"};
+            static const char* r32[] = {"eax","ecx","edx","ebx","esp","ebp","esi","edi"};
+            static const char* r16[] = {"ax","cx","dx","bx","sp","bp","si","di"};
+            static const char* r8l[] = {"al","cl","dl","bl"};
+            static const char* r8h[] = {"ah","ch","dh","bh"};
+            static const char* r8x[] = {"spl","bpl","sil","dil"};
+            for (int i = 0; i < 8; i++) {
+                t[r64[i]] = {(int8_t)i, 64, false, false, R_GP};
+                t[r32[i]] = {(int8_t)i, 32, false, false, R_GP};
+                t[r16[i]] = {(int8_t)i, 16, false, false, R_GP};
+            }
+            for (int i = 0; i < 4; i++) {
+                t[r8l[i]] = {(int8_t)i, 8, false, false, R_GP};
+                t[r8h[i]] = {(int8_t)(i + 4), 8, false, true, R_GP};
+                t[r8x[i]] = {(int8_t)(i + 4), 8, true, false, R_GP};
+            }
+            static std::deque<std::string> names;  // backing storage for the views; never moves
+            for (int i = 8; i < 16; i++) {
+                std::string b = "r" + std::to_string(i);
+                for (auto& [suffix, size] : std::vector<std::pair<std::string, int>>{
+                         {"", 64}, {"d", 32}, {"w", 16}, {"b", 8}, {"l", 8}}) {
+                    names.push_back(b + suffix);
+                    t[names.back()] = {(int8_t)i, (uint8_t)size, size == 8, false, R_GP};
+                }
+            }
+            for (int i = 0; i < 16; i++) {
+                names.push_back("xmm" + std::to_string(i));
+                t[names.back()] = {(int8_t)i, 128, false, false, R_XMM};
+                names.push_back("ymm" + std::to_string(i));
+                t[names.back()] = {(int8_t)i, 255, false, false, R_YMM};
+            }
+            return t;
+        }();
+        auto it = table.find(n);
+        if (it == table.end()) return false;
+        r = it->second;
+        return true;
+    }
+
+    // ---- expressions -----------------------------------------------------
+    // Linear form k + sum(coef * symbol); enough for labels, label +/- n
+    // and label - label
+    struct Expr {
+        int64_t k = 0;
+        std::vector<std::pair<int, int>> terms;  // (symbol, coefficient)
+        bool is_const() const { return terms.empty(); }
+    };
+
+    struct Operand {
+        enum Kind : uint8_t { NONE, REG, IMM, MEM } kind = NONE;
+        int     size = 0;          // explicit or register size in bits (0 = unknown)
+        RegInfo reg{};
+        // memory
+        int  base = -1, index = -1, scale = 1, addr_size = 0;
+        bool rel = false, abs = false;
+        Expr disp;                 // MEM displacement or IMM value
+        bool strict_short = false, strict_near = false;
+    };
+
+    enum class IK : uint8_t { INSN, DATA, ALIGN, RESB };
+    struct Item {
+        IK kind;
+        int section;
+        int line;
+        uint64_t offset = 0;
+        uint32_t size = 0;
+        int64_t  times = 1;
+        // INSN
+        std::string mnem;
+        std::vector<Operand> ops;
+        uint8_t prefix = 0;        // rep/lock
+        bool    long_jump = false; // relaxed
+        int     bits = 32;
+        bool    default_rel = false;
+        // DATA
+        int unit = 1;
+        std::vector<Expr> values;
+        std::vector<std::string> strings;   // parallel to values; non-empty = string item
+        // ALIGN / RESB
+        uint64_t amount = 0;
+
+        Item(IK k, int sec, int ln) : kind(k), section(sec), line(ln) {}
+    };
+
+    std::vector<Item> items;
+    std::vector<std::pair<int, size_t>> label_at;   // (symbol, index of the next item)
+    std::unordered_map<std::string, int> sym_index;
+    std::string last_global;
+    int  cur_section = -1;
+    bool default_rel = false;
+    int  line_no = 0;
+
+    [[noreturn]] void fail(const std::string& m) const {
+        throw Unsupported("line " + std::to_string(line_no) + ": " + m);
+    }
+
+    int section_index(const std::string& name) {
+        for (size_t i = 0; i < sections.size(); i++) if (sections[i].name == name) return (int)i;
+        Section s;
+        s.name = name;
+        if (name == ".text") { s.exec = true; s.align = 16; }
+        else if (name == ".bss") { s.write = true; s.nobits = true; s.align = 4; }
+        else if (name == ".rodata") { s.align = 4; }
+        else { s.write = true; s.align = 4; }
+        sections.push_back(s);
+        return (int)sections.size() - 1;
+    }
+
+    int symbol(const std::string& raw) {
+        std::string name = raw;
+        if (!name.empty() && name[0] == '.' && name.compare(0, 3, "..@") != 0) name = last_global + name;
+        auto it = sym_index.find(name);
+        if (it != sym_index.end()) return it->second;
+        Symbol s; s.name = name;
+        symbols.push_back(s);
+        sym_index.emplace(name, (int)symbols.size() - 1);
+        return (int)symbols.size() - 1;
+    }
+
+    // ---- lexing helpers --------------------------------------------------
+    static bool ident_start(char c) { return isalpha((unsigned char)c) || c == '_' || c == '.' || c == '?' || c == '@' || c == '$'; }
+    static bool ident_char(char c)  { return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '?' || c == '@' || c == '$' || c == '#' || c == '~'; }
+
+    static std::string_view trim(std::string_view s) {
+        while (!s.empty() && isspace((unsigned char)s.front())) s.remove_prefix(1);
+        while (!s.empty() && isspace((unsigned char)s.back())) s.remove_suffix(1);
+        return s;
+    }
+
+    static std::string lower(std::string_view s) {
+        std::string r(s);
+        for (auto& c : r) c = (char)tolower((unsigned char)c);
+        return r;
+    }
+
+    // Splits on top-level commas (outside quotes and brackets)
+    static std::vector<std::string_view> split_operands(std::string_view s) {
+        std::vector<std::string_view> out;
+        int depth = 0; char q = 0; size_t start = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            char c = s[i];
+            if (q) { if (c == q) q = 0; continue; }
+            if (c == '\'' || c == '"' || c == '`') q = c;
+            else if (c == '[' || c == '(') depth++;
+            else if (c == ']' || c == ')') depth--;
+            else if (c == ',' && depth == 0) { out.push_back(trim(s.substr(start, i - start))); start = i + 1; }
+        }
+        auto last = trim(s.substr(start));
+        if (!last.empty() || !out.empty()) out.push_back(last);
+        return out;
+    }
+
+    bool parse_number(std::string_view t, int64_t& v) const {
+        if (t.empty()) return false;
+        std::string s = lower(t);
+        s.erase(std::remove(s.begin(), s.end(), '_'), s.end());
+        int base = 10;
+        if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'h')) { base = 16; s = s.substr(2); }
+        else if (s.size() > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'y')) { base = 2; s = s.substr(2); }
+        else if (s.size() > 1 && s.back() == 'h' && isdigit((unsigned char)s[0])) { base = 16; s.pop_back(); }
+        else if (s.size() > 1 && (s.back() == 'b' || s.back() == 'y') && isdigit((unsigned char)s[0])
+                 && s.find_first_not_of("01", 0) == s.size() - 1) { base = 2; s.pop_back(); }
+        if (s.empty()) return false;
+        uint64_t r = 0;
+        for (char c : s) {
+            int d = isdigit((unsigned char)c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : 99;
+            if (d >= base) return false;
+            r = r * base + d;
+        }
+        v = (int64_t)r;
+        return true;
+    }
+
+    // ---- expression parser -------------------------------------------------
+    struct ExprParser {
+        Assembler& a;
+        std::string_view s;
+        size_t p = 0;
+
+        void ws() { while (p < s.size() && isspace((unsigned char)s[p])) p++; }
+        bool eat(char c) { ws(); if (p < s.size() && s[p] == c) { p++; return true; } return false; }
+
+        static Expr scale(Expr e, int64_t m) {
+            e.k *= m;
+            for (auto& t : e.terms) t.second *= (int)m;
+            return e;
+        }
+        static Expr add(Expr a, const Expr& b, int sign) {
+            a.k += sign * b.k;
+            for (auto t : b.terms) {
+                bool merged = false;
+                for (auto& u : a.terms) if (u.first == t.first) { u.second += sign * t.second; merged = true; }
+                if (!merged) a.terms.push_back({t.first, sign * t.second});
+            }
+            std::vector<std::pair<int, int>> kept;
+            for (auto& u : a.terms) if (u.second) kept.push_back(u);
+            a.terms = kept;
+            return a;
+        }
+
+        Expr primary() {
+            ws();
+            if (p >= s.size()) a.fail("expected expression");
+            char c = s[p];
+            if (c == '(') { p++; Expr e = sum(); if (!eat(')')) a.fail("expected ')'"); return e; }
+            if (c == '-') { p++; return scale(primary(), -1); }
+            if (c == '+') { p++; return primary(); }
+            if (c == '~') { p++; Expr e = primary(); if (!e.is_const()) a.fail("'~' on a symbol"); e.k = ~e.k; return e; }
+            if (c == '\'' || c == '"' || c == '`') {
+                char q = c; size_t start = ++p;
+                while (p < s.size() && s[p] != q) p++;
+                if (p >= s.size()) a.fail("unterminated character constant");
+                std::string_view lit = s.substr(start, p - start); p++;
+                Expr e;
+                for (size_t i = 0; i < lit.size() && i < 8; i++) e.k |= (int64_t)(unsigned char)lit[i] << (8 * i);
+                return e;
+            }
+            if (c == '$') {
+                if (p + 1 < s.size() && ident_char(s[p + 1]) && s[p + 1] != '$') { p++; }  // $name: escaped identifier
+                else a.fail("'$' is not supported");
+            }
+            size_t start = p;
+            while (p < s.size() && (ident_char(s[p]))) p++;
+            std::string_view tok = s.substr(start, p - start);
+            if (tok.empty()) a.fail("unexpected '" + std::string(1, c) + "'");
+            Expr e;
+            int64_t v;
+            if (isdigit((unsigned char)tok[0])) {
+                if (!a.parse_number(tok, v)) a.fail("bad number '" + std::string(tok) + "'");
+                e.k = v;
+                return e;
+            }
+            int sym = a.symbol(std::string(tok));
+            if (a.symbols[sym].is_equ) { e.k = a.symbols[sym].equ; return e; }
+            e.terms.push_back({sym, 1});
+            return e;
+        }
+        Expr product() {
+            Expr e = primary();
+            for (;;) {
+                ws();
+                if (p < s.size() && (s[p] == '*' || s[p] == '/' || s[p] == '%')) {
+                    char op = s[p++];
+                    Expr r = primary();
+                    if (op == '*') {
+                        if (r.is_const()) e = scale(e, r.k);
+                        else if (e.is_const()) e = scale(r, e.k);
+                        else a.fail("product of two symbols");
+                    } else {
+                        if (!e.is_const() || !r.is_const() || r.k == 0) a.fail("division needs constants");
+                        e.k = op == '/' ? (int64_t)((uint64_t)e.k / (uint64_t)r.k) : (int64_t)((uint64_t)e.k % (uint64_t)r.k);
+                    }
+                } else return e;
+            }
+        }
+        Expr sum() {
+            Expr e = product();
+            for (;;) {
+                ws();
+                if (p < s.size() && (s[p] == '+' || s[p] == '-')) {
+                    char op = s[p++];
+                    e = add(e, product(), op == '+' ? 1 : -1);
+                } else return e;
+            }
+        }
+        Expr full() {
+            Expr e = sum();
+            ws();
+            if (p != s.size()) a.fail("junk in expression '" + std::string(s) + "'");
+            return e;
+        }
+    };
+
+    Expr expr(std::string_view s) { ExprParser ep{*this, s}; return ep.full(); }
+
+    // ---- operand parser ----------------------------------------------------
+    static int size_kw(std::string_view w) {
+        if (w == "byte") return 8;
+        if (w == "word") return 16;
+        if (w == "dword") return 32;
+        if (w == "qword") return 64;
+        if (w == "oword" || w == "xmmword") return 128;
+        if (w == "yword" || w == "ymmword") return 256;
+        return 0;
+    }
+
+    Operand operand(std::string_view text) {
+        Operand o;
+        std::string_view s = trim(text);
+        // Leading size / distance keywords
+        for (;;) {
+            size_t sp = 0;
+            while (sp < s.size() && isalpha((unsigned char)s[sp])) sp++;
+            std::string w = lower(s.substr(0, sp));
+            if (sp == 0 || (sp < s.size() && !isspace((unsigned char)s[sp]) && s[sp] != '[')) break;
+            if (int sz = size_kw(w)) { o.size = sz; s = trim(s.substr(sp)); continue; }
+            if (w == "short") { o.strict_short = true; s = trim(s.substr(sp)); continue; }
+            if (w == "near")  { o.strict_near = true; s = trim(s.substr(sp)); continue; }
+            if (w == "strict") { s = trim(s.substr(sp)); continue; }
+            if (w == "ptr") { s = trim(s.substr(sp)); continue; }
+            break;
+        }
+        if (!s.empty() && s.front() == '[') {
+            if (s.back() != ']') fail("unterminated memory operand");
+            o.kind = Operand::MEM;
+            std::string_view in = trim(s.substr(1, s.size() - 2));
+            // Segment overrides are not produced by the backend
+            for (;;) {
+                size_t sp = 0;
+                while (sp < in.size() && isalpha((unsigned char)in[sp])) sp++;
+                std::string w = lower(in.substr(0, sp));
+                if (sp && sp < in.size() && isspace((unsigned char)in[sp]) && (w == "rel" || w == "abs")) {
+                    (w == "rel" ? o.rel : o.abs) = true;
+                    in = trim(in.substr(sp));
+                    continue;
+                }
+                if (int sz = size_kw(w); sz && sp < in.size() && isspace((unsigned char)in[sp])) {
+                    if (!o.size) o.size = sz;
+                    in = trim(in.substr(sp));
+                    continue;
+                }
+                break;
+            }
+            if (in.find(':') != std::string_view::npos) fail("segment overrides are not supported");
+            // Split into +/- separated terms at depth 0, pick out registers
+            std::string rest;
+            size_t i = 0;
+            while (i < in.size()) {
+                size_t start = i;
+                char sign = '+';
+                if (in[i] == '+' || in[i] == '-') { sign = in[i]; i++; start = i; }
+                int depth = 0;
+                while (i < in.size() && (depth > 0 || (in[i] != '+' && in[i] != '-'))) {
+                    if (in[i] == '(') depth++;
+                    if (in[i] == ')') depth--;
+                    i++;
+                }
+                std::string_view term = trim(in.substr(start, i - start));
+                // reg, reg*scale or scale*reg
+                std::string_view lhs = term, rhs;
+                size_t star = term.find('*');
+                if (star != std::string_view::npos) { lhs = trim(term.substr(0, star)); rhs = trim(term.substr(star + 1)); }
+                RegInfo r;
+                std::string l1 = lower(lhs), r1 = lower(rhs);
+                bool is_reg = false;
+                int scale = 1;
+                if (reg_lookup(l1, r)) {
+                    is_reg = true;
+                    if (!rhs.empty()) { int64_t v; if (!parse_number(rhs, v)) fail("bad scale"); scale = (int)v; }
+                } else if (!rhs.empty() && reg_lookup(r1, r)) {
+                    is_reg = true;
+                    int64_t v; if (!parse_number(lhs, v)) fail("bad scale"); scale = (int)v;
+                }
+                if (is_reg) {
+                    if (sign == '-') fail("negative register in address");
+                    if (r.cls != R_GP || r.size < 32) fail("unsupported address register");
+                    if (o.addr_size && o.addr_size != r.size) fail("mixed address sizes");
+                    o.addr_size = r.size;
+                    if (scale == 1 && o.base < 0 && star == std::string_view::npos) o.base = r.id;
+                    else if (o.index < 0) { o.index = r.id; o.scale = scale; }
+                    else if (scale == 1 && o.base < 0) o.base = r.id;
+                    else fail("too many registers in address");
+                } else {
+                    rest += sign;
+                    rest += std::string(term);
+                }
+            }
+            // [reg + reg]: NASM makes the first one the base
+            if (o.base < 0 && o.index >= 0 && o.scale == 1) { o.base = o.index; o.index = -1; }
+            if (o.scale != 1 && o.scale != 2 && o.scale != 4 && o.scale != 8) fail("bad scale");
+            if (o.index == 4 && o.addr_size) {
+                // esp cannot be an index; swap when it is unscaled
+                if (o.scale == 1 && o.base >= 0 && o.base != 4) std::swap(o.base, o.index);
+                else fail("esp cannot be an index register");
+            }
+            if (!rest.empty()) o.disp = expr(rest);
+            return o;
+        }
+        RegInfo r;
+        std::string w = lower(s);
+        if (reg_lookup(w, r)) {
+            o.kind = Operand::REG;
+            o.reg = r;
+            o.size = r.cls == R_GP ? r.size : (r.cls == R_XMM ? 128 : 256);
+            return o;
+        }
+        o.kind = Operand::IMM;
+        o.disp = expr(s);
+        return o;
+    }
+
+    // ---- parsing ---------------------------------------------------------
+    void define_label(const std::string& raw) {
+        if (raw.empty() || raw[0] != '.' || raw.compare(0, 3, "..@") == 0) last_global = raw;
+        int s = symbol(raw);
+        if (symbols[s].defined) fail("label '" + symbols[s].name + "' redefined");
+        if (cur_section < 0) cur_section = section_index(".text");
+        symbols[s].defined = true;
+        symbols[s].section = cur_section;
+        label_at.push_back({s, items.size()});
+    }
+
+    static int data_unit(const std::string& w) {
+        if (w == "db") return 1;
+        if (w == "dw") return 2;
+        if (w == "dd") return 4;
+        if (w == "dq") return 8;
+        return 0;
+    }
+    static int res_unit(const std::string& w) {
+        if (w == "resb") return 1;
+        if (w == "resw") return 2;
+        if (w == "resd") return 4;
+        if (w == "resq") return 8;
+        return 0;
+    }
+
+    void statement(std::string_view s, int64_t times) {
+        s = trim(s);
+        if (s.empty()) return;
+        size_t sp = 0;
+        while (sp < s.size() && !isspace((unsigned char)s[sp])) sp++;
+        std::string w = lower(s.substr(0, sp));
+        std::string_view rest = trim(s.substr(sp));
+        if (cur_section < 0) cur_section = section_index(".text");
+
+        if (w == "times") {
+            // times <count> <statement>; the count is a constant
+            size_t i = 0; int depth = 0;
+            while (i < rest.size() && (depth || !isspace((unsigned char)rest[i]))) {
+                if (rest[i] == '(') depth++;
+                if (rest[i] == ')') depth--;
+                i++;
+            }
+            Expr n = expr(rest.substr(0, i));
+            if (!n.is_const() || n.k < 0) fail("'times' needs a non-negative constant");
+            statement(rest.substr(i), times * n.k);
+            return;
+        }
+        if (int unit = data_unit(w)) {
+            Item it(IK::DATA, cur_section, line_no);
+            it.unit = unit;
+            it.times = times;
+            for (auto v : split_operands(rest)) {
+                if (!v.empty() && (v.front() == '\'' || v.front() == '"' || v.front() == '`') && v.back() == v.front() && v.size() >= 2) {
+                    // Strings are stored as bytes, padded to the unit; '' is nothing
+                    std::string str(v.substr(1, v.size() - 2));
+                    if (str.empty()) continue;
+                    it.values.push_back(Expr{});
+                    it.strings.push_back(str);
+                    continue;
+                }
+                it.values.push_back(expr(v));
+                it.strings.push_back("");
+            }
+            items.push_back(std::move(it));
+            return;
+        }
+        if (int unit = res_unit(w)) {
+            Expr n = expr(rest);
+            if (!n.is_const()) fail("reservation size must be constant");
+            Item it(IK::RESB, cur_section, line_no);
+            it.amount = (uint64_t)(n.k * unit * times);
+            items.push_back(std::move(it));
+            return;
+        }
+        if (w == "align" || w == "alignb") {
+            auto args = split_operands(rest);
+            Expr n = expr(args.at(0));
+            if (!n.is_const() || n.k <= 0 || (n.k & (n.k - 1))) fail("bad alignment");
+            Item it(IK::ALIGN, cur_section, line_no);
+            it.amount = (uint64_t)n.k;
+            it.unit = w == "alignb" || sections[cur_section].nobits ? 0 : 0x90;
+            items.push_back(std::move(it));
+            if ((uint64_t)sections[cur_section].align < it.amount) sections[cur_section].align = (uint32_t)it.amount;
+            return;
+        }
+
+        Item it(IK::INSN, cur_section, line_no);
+        it.times = times;
+        it.bits = bits;
+        it.default_rel = default_rel;
+        if (w == "rep" || w == "repe" || w == "repz" || w == "repne" || w == "repnz" || w == "lock") {
+            it.prefix = w == "lock" ? 0xF0 : (w == "repne" || w == "repnz") ? 0xF2 : 0xF3;
+            size_t sp2 = 0;
+            while (sp2 < rest.size() && !isspace((unsigned char)rest[sp2])) sp2++;
+            w = lower(rest.substr(0, sp2));
+            rest = trim(rest.substr(sp2));
+        }
+        it.mnem = w;
+        auto texts = split_operands(rest);
+        it.ops.reserve(texts.size());
+        for (auto o : texts) it.ops.push_back(operand(o));
+        items.push_back(std::move(it));
+    }
+
+    void directive_or_line(std::string_view line) {
+        std::string_view s = trim(line);
+        if (s.empty()) return;
+        if (s.front() == '[') {
+            if (s.back() != ']') fail("unterminated directive");
+            s = trim(s.substr(1, s.size() - 2));
+        }
+        size_t sp = 0;
+        while (sp < s.size() && !isspace((unsigned char)s[sp])) sp++;
+        std::string w = lower(s.substr(0, sp));
+        std::string_view rest = trim(s.substr(sp));
+        if (w == "bits") {
+            Expr e = expr(rest);
+            if (!e.is_const() || (e.k != 16 && e.k != 32 && e.k != 64)) fail("bad BITS");
+            if (e.k == 16) fail("16-bit code is not supported");
+            bits = (int)e.k;
+            return;
+        }
+        if (w == "org") {
+            Expr e = expr(rest);
+            if (!e.is_const()) fail("ORG needs a constant");
+            has_org = true; org = (uint64_t)e.k;
+            return;
+        }
+        if (w == "default") {
+            std::string v = lower(rest);
+            if (v == "rel") default_rel = true;
+            else if (v == "abs") default_rel = false;
+            else fail("bad DEFAULT");
+            return;
+        }
+        if (w == "section" || w == "segment") {
+            size_t e = 0;
+            while (e < rest.size() && !isspace((unsigned char)rest[e])) e++;
+            cur_section = section_index(std::string(rest.substr(0, e)));
+            return;
+        }
+        if (w == "global" || w == "extern" || w == "common") {
+            if (w == "common") fail("common symbols are not supported");
+            for (auto n : split_operands(rest)) {
+                auto name = trim(n.substr(0, n.find(':')));
+                int sidx = symbol(std::string(name));
+                (w == "global" ? symbols[sidx].global : symbols[sidx].external) = true;
+            }
+            return;
+        }
+        if (w == "cpu") return;
+        // label: [statement]
+        size_t i = 0;
+        while (i < s.size() && ident_char(s[i])) i++;
+        if (i > 0 && i < s.size() && s[i] == ':' && (i + 1 >= s.size() || s[i + 1] != ':')) {
+            std::string name(s.substr(0, i));
+            RegInfo r;
+            if (!reg_lookup(lower(name), r)) {
+                define_label(name);
+                statement(s.substr(i + 1), 1);
+                return;
+            }
+        }
+        // name equ value
+        if (i > 0) {
+            std::string_view after = trim(s.substr(i));
+            if (after.size() > 4 && lower(after.substr(0, 4)) == "equ ") {
+                int sidx = symbol(std::string(s.substr(0, i)));
+                Expr e = expr(after.substr(4));
+                if (!e.is_const()) fail("equ needs a constant");
+                symbols[sidx].is_equ = symbols[sidx].defined = true;
+                symbols[sidx].equ = e.k;
+                return;
+            }
+        }
+        statement(s, 1);
+    }
+
+    // ---- encoding ----------------------------------------------------------
+    struct PendingFix { uint32_t pos; Fix kind; Expr value; };
+
+    struct Buf {
+        uint8_t b[32]; uint32_t n = 0;
+        std::vector<PendingFix> fixes;
+        void put(uint8_t v) { b[n++] = v; }
+        void imm(int64_t v, int bytes) { for (int i = 0; i < bytes; i++) put((uint8_t)(v >> (8 * i))); }
+    };
+
+    // Value of an expression that is a plain constant; anything involving a
+    // symbol is sized for the worst case and resolved by apply()
+    bool const_value(const Expr& e, int64_t& v) const {
+        if (e.is_const()) { v = e.k; return true; }
+        return false;
+    }
+
+    static bool fits8(int64_t v)  { return v >= -128 && v <= 127; }
+    static bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+    static int cond_code(std::string_view c) {
+        static const std::pair<const char*, int> cc[] = {
+            {"o",0},{"no",1},{"b",2},{"c",2},{"nae",2},{"ae",3},{"nb",3},{"nc",3},{"e",4},{"z",4},
+            {"ne",5},{"nz",5},{"be",6},{"na",6},{"a",7},{"nbe",7},{"s",8},{"ns",9},{"p",10},{"pe",10},
+            {"np",11},{"po",11},{"l",12},{"nge",12},{"ge",13},{"nl",13},{"le",14},{"ng",14},{"g",15},{"nle",15}};
+        for (auto& p : cc) if (c == p.first) return p.second;
+        return -1;
+    }
+
+    struct Enc {
+        Assembler& a;
+        const Item& it;
+        Buf& out;
+        bool rex_w = false;
+        uint8_t rex = 0;
+        bool need_rex = false, forbid_rex = false;
+        bool opsize = false, addrsize = false;
+        uint8_t mand = 0;              // F2/F3 prefix of an SSE opcode
+        bool vex = false, vex_w = false;
+        uint8_t vex_l = 0, vex_pp = 0, vex_map = 1, vex_v = 0;
+        uint8_t op[3]; int nop = 0;
+        bool has_modrm = false;
+        uint8_t modrm = 0, sib = 0; bool has_sib = false;
+        int disp_bytes = 0; Expr disp; bool disp_pc = false;
+        int imm_bytes = 0; Expr imm; Fix imm_kind = Fix::ABS32;
+
+        Enc(Assembler& as, const Item& i, Buf& o) : a(as), it(i), out(o) {}
+
+        void opcode(std::initializer_list<uint8_t> o) { nop = 0; for (auto x : o) op[nop++] = x; }
+
+        void reg_operand_rex(const RegInfo& r, uint8_t bit) {
+            if (r.id >= 8) { rex |= bit; }
+            if (r.size == 8 && r.rex8) need_rex = true;
+            if (r.size == 8 && r.high8) forbid_rex = true;
+        }
+
+        // ModRM with a register in the reg field and `rm` (register or memory)
+        void set_rm(int regfield, const Operand& rm) {
+            has_modrm = true;
+            if (regfield >= 8) rex |= 0x04;
+            regfield &= 7;
+            if (rm.kind == Operand::REG) {
+                reg_operand_rex(rm.reg, 0x01);
+                modrm = (uint8_t)(0xC0 | regfield << 3 | (rm.reg.id & 7));
+                return;
+            }
+            if (rm.kind != Operand::MEM) a.fail("expected register or memory operand");
+            int asz = rm.addr_size ? rm.addr_size : (it.bits == 64 ? 64 : 32);
+            if (it.bits == 64 && asz == 32) addrsize = true;
+            if (it.bits == 32 && asz == 64) a.fail("64-bit address in 32-bit code");
+            int base = rm.base, index = rm.index;
+            int64_t dv = 0;
+            bool dconst = a.const_value(rm.disp, dv);
+            bool nodisp = dconst && dv == 0 && rm.disp.is_const() && rm.disp.k == 0;
+            disp = rm.disp;
+            if (base < 0 && index < 0) {
+                if (it.bits == 64 && !rm.abs && (rm.rel || it.default_rel)) {
+                    modrm = (uint8_t)(0x00 | regfield << 3 | 5);
+                    disp_bytes = 4; disp_pc = true;
+                } else if (it.bits == 64) {
+                    modrm = (uint8_t)(0x04 | regfield << 3);
+                    sib = 0x25; has_sib = true;
+                    disp_bytes = 4;
+                } else {
+                    modrm = (uint8_t)(regfield << 3 | 5);
+                    disp_bytes = 4;
+                }
+                return;
+            }
+            if (base >= 8) rex |= 0x01;
+            if (index >= 8) rex |= 0x02;
+            int mod;
+            if (nodisp && (base < 0 || (base & 7) != 5)) mod = 0;
+            else if (dconst && rm.disp.is_const() && fits8(dv) && base >= 0) mod = 1;
+            else mod = 2;
+            if (base < 0) {
+                // [index*scale + disp32]
+                mod = 0;
+                disp_bytes = 4;
+            } else disp_bytes = mod == 1 ? 1 : mod == 2 ? 4 : 0;
+            if (index >= 0 || base < 0 || (base & 7) == 4) {
+                has_sib = true;
+                int ss = rm.scale == 1 ? 0 : rm.scale == 2 ? 1 : rm.scale == 4 ? 2 : 3;
+                int idx = index >= 0 ? (index & 7) : 4;
+                int bs = base >= 0 ? (base & 7) : 5;
+                sib = (uint8_t)(ss << 6 | idx << 3 | bs);
+                modrm = (uint8_t)(mod << 6 | regfield << 3 | 4);
+            } else {
+                modrm = (uint8_t)(mod << 6 | regfield << 3 | (base & 7));
+            }
+        }
+
+        void set_imm(const Expr& e, int bytes, Fix kind) { imm = e; imm_bytes = bytes; imm_kind = kind; }
+
+        void finish() {
+            if (it.prefix) out.put(it.prefix);
+            if (addrsize) out.put(0x67);
+            if (vex) {
+                // two-byte form when X, B and W are clear and the map is 0F
+                const int v = ~vex_v & 15;
+                if (!(rex & 0x03) && !vex_w && vex_map == 1) {
+                    out.put(0xC5);
+                    out.put((uint8_t)((rex & 0x04 ? 0 : 0x80) | v << 3 | vex_l << 2 | vex_pp));
+                } else {
+                    out.put(0xC4);
+                    out.put((uint8_t)((rex & 0x04 ? 0 : 0x80) | (rex & 0x02 ? 0 : 0x40) | (rex & 0x01 ? 0 : 0x20) | vex_map));
+                    out.put((uint8_t)((vex_w ? 0x80 : 0) | v << 3 | vex_l << 2 | vex_pp));
+                }
+                if (it.bits != 64 && (rex || vex_v >= 8)) a.fail("xmm8-15 in 32-bit code");
+                rex = 0;
+                need_rex = false;
+            }
+            if (opsize) out.put(0x66);
+            if (mand) out.put(mand);
+            if (rex_w) rex |= 0x08;
+            if (rex || need_rex) {
+                if (it.bits != 64) a.fail("64-bit registers or REX in 32-bit code");
+                if (forbid_rex) a.fail("ah/bh/ch/dh cannot be used with REX");
+                out.put((uint8_t)(0x40 | rex));
+            }
+            for (int i = 0; i < nop; i++) out.put(op[i]);
+            if (has_modrm) out.put(modrm);
+            if (has_sib) out.put(sib);
+            if (disp_bytes) {
+                Fix k = disp_bytes == 1 ? Fix::ABS8 : disp_pc ? Fix::PC32 : (it.bits == 64 ? Fix::ABS32S : Fix::ABS32);
+                out.fixes.push_back({out.n, k, disp});
+                out.imm(0, disp_bytes);
+            }
+            if (imm_bytes) {
+                out.fixes.push_back({out.n, imm_kind, imm});
+                out.imm(0, imm_bytes);
+            }
+        }
+    };
+
+    int op_size(const Item& it, const Operand& a, const Operand* b = nullptr) const {
+        int s = a.size;
+        if (b && b->kind == Operand::REG && b->reg.cls == R_GP) {
+            if (s && s != b->size && a.kind == Operand::REG) fail("operand size mismatch");
+            if (!s) s = b->size;
+        }
+        if (!s) fail("operation size not specified in '" + it.mnem + "'");
+        return s;
+    }
+
+    void size_prefix(Enc& e, int size) const {
+        if (size == 16) e.opsize = true;
+        else if (size == 64) e.rex_w = true;
+    }
+
+    // Immediate encoding for `size`-bit operations: how many bytes and fixup kind
+    Fix imm_fix(int size, int bytes) const {
+        if (bytes == 1) return Fix::ABS8;
+        if (bytes == 2) return Fix::ABS16;
+        if (bytes == 8) return Fix::ABS64;
+        return size == 64 ? Fix::ABS32S : Fix::ABS32;
+    }
+
+    bool small_imm(const Expr& e) const { int64_t v; return const_value(e, v) && fits8(v); }
+
+    void encode(const Item& it, Buf& out, uint64_t here) {
+        const std::string& m = it.mnem;
+        const auto& ops = it.ops;
+        Enc e(*this, it, out);
+        auto need = [&](size_t n) { if (ops.size() != n) fail("'" + m + "' takes " + std::to_string(n) + " operand(s)"); };
+        auto is_reg = [&](size_t i) { return ops[i].kind == Operand::REG && ops[i].reg.cls == R_GP; };
+        auto is_mem = [&](size_t i) { return ops[i].kind == Operand::MEM; };
+        auto is_imm = [&](size_t i) { return ops[i].kind == Operand::IMM; };
+        auto is_rm  = [&](size_t i) { return is_reg(i) || is_mem(i); };
+        auto zero_ops = [&](std::initializer_list<uint8_t> bytes) {
+            need(0);
+            e.opcode(bytes);
+            e.finish();
+        };
+
+        static const char* alu[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+        for (int n = 0; n < 8; n++) {
+            if (m != alu[n]) continue;
+            need(2);
+            if (is_rm(0) && is_reg(1)) {
+                int sz = op_size(it, ops[0], &ops[1]);
+                size_prefix(e, sz);
+                e.reg_operand_rex(ops[1].reg, 0x04);
+                e.opcode({(uint8_t)(n * 8 + (sz == 8 ? 0 : 1))});
+                e.set_rm(ops[1].reg.id, ops[0]);
+            } else if (is_reg(0) && is_mem(1)) {
+                int sz = op_size(it, ops[0], &ops[0]);
+                size_prefix(e, sz);
+                e.reg_operand_rex(ops[0].reg, 0x04);
+                e.opcode({(uint8_t)(n * 8 + (sz == 8 ? 2 : 3))});
+                e.set_rm(ops[0].reg.id, ops[1]);
+            } else if (is_rm(0) && is_imm(1)) {
+                int sz = op_size(it, ops[0]);
+                size_prefix(e, sz);
+                bool acc = is_reg(0) && ops[0].reg.id == 0;
+                if (sz == 8) {
+                    if (acc) e.opcode({(uint8_t)(n * 8 + 4)});
+                    else { e.opcode({0x80}); e.set_rm(n, ops[0]); }
+                    e.set_imm(ops[1].disp, 1, Fix::ABS8);
+                } else if (small_imm(ops[1].disp)) {
+                    e.opcode({0x83}); e.set_rm(n, ops[0]);
+                    e.set_imm(ops[1].disp, 1, Fix::ABS8);
+                } else {
+                    int b = sz == 16 ? 2 : 4;
+                    if (acc) e.opcode({(uint8_t)(n * 8 + 5)});
+                    else { e.opcode({0x81}); e.set_rm(n, ops[0]); }
+                    e.set_imm(ops[1].disp, b, imm_fix(sz, b));
+                }
+                if (is_reg(0)) e.reg_operand_rex(ops[0].reg, 0);
+            } else fail("bad operands for '" + m + "'");
+            e.finish();
+            return;
+        }
+
+        if (m == "mov") {
+            need(2);
+            if (is_rm(0) && is_reg(1)) {
+                int sz = op_size(it, ops[0], &ops[1]);
+                // mov [abs], al/eax: NASM picks the moffs form in 32-bit code
+                if (it.bits == 32 && is_mem(0) && ops[0].base < 0 && ops[0].index < 0 && ops[1].reg.id == 0) {
+                    size_prefix(e, sz);
+                    e.opcode({(uint8_t)(sz == 8 ? 0xA2 : 0xA3)});
+                    e.set_imm(ops[0].disp, 4, Fix::ABS32);
+                } else {
+                    size_prefix(e, sz);
+                    e.reg_operand_rex(ops[1].reg, 0x04);
+                    e.opcode({(uint8_t)(sz == 8 ? 0x88 : 0x89)});
+                    e.set_rm(ops[1].reg.id, ops[0]);
+                }
+            } else if (is_reg(0) && is_mem(1)) {
+                int sz = op_size(it, ops[0]);
+                if (it.bits == 32 && ops[1].base < 0 && ops[1].index < 0 && ops[0].reg.id == 0) {
+                    size_prefix(e, sz);
+                    e.opcode({(uint8_t)(sz == 8 ? 0xA0 : 0xA1)});
+                    e.set_imm(ops[1].disp, 4, Fix::ABS32);
+                } else {
+                    size_prefix(e, sz);
+                    e.reg_operand_rex(ops[0].reg, 0x04);
+                    e.opcode({(uint8_t)(sz == 8 ? 0x8A : 0x8B)});
+                    e.set_rm(ops[0].reg.id, ops[1]);
+                }
+            } else if (is_reg(0) && is_imm(1)) {
+                int sz = ops[0].size;
+                const RegInfo& r = ops[0].reg;
+                int64_t v;
+                bool c = const_value(ops[1].disp, v);
+                // Like nasm -O: a 64-bit move of a positive 32-bit constant
+                // is encoded as the zero-extending 32-bit move
+                if (sz == 64 && c && v >= 0 && v <= (int64_t)UINT32_MAX) sz = 32;
+                size_prefix(e, sz);
+                e.reg_operand_rex(r, 0x01);
+                if (sz == 64 && (!c || !fits32(v))) {
+                    e.opcode({(uint8_t)(0xB8 + (r.id & 7))});
+                    e.set_imm(ops[1].disp, 8, Fix::ABS64);
+                } else if (sz == 64) {
+                    e.opcode({0xC7}); e.set_rm(0, ops[0]);
+                    e.set_imm(ops[1].disp, 4, Fix::ABS32S);
+                } else {
+                    e.opcode({(uint8_t)((sz == 8 ? 0xB0 : 0xB8) + (r.id & 7))});
+                    int b = sz / 8;
+                    e.set_imm(ops[1].disp, b, imm_fix(sz, b));
+                }
+            } else if (is_mem(0) && is_imm(1)) {
+                int sz = op_size(it, ops[0]);
+                size_prefix(e, sz);
+                e.opcode({(uint8_t)(sz == 8 ? 0xC6 : 0xC7)});
+                e.set_rm(0, ops[0]);
+                int b = sz == 8 ? 1 : sz == 16 ? 2 : 4;
+                e.set_imm(ops[1].disp, b, imm_fix(sz, b));
+            } else fail("bad operands for 'mov'");
+            e.finish();
+            return;
+        }
+
+        if (m == "lea") {
+            need(2);
+            if (!is_reg(0) || !is_mem(1)) fail("bad operands for 'lea'");
+            size_prefix(e, ops[0].size);
+            e.reg_operand_rex(ops[0].reg, 0x04);
+            e.opcode({0x8D});
+            e.set_rm(ops[0].reg.id, ops[1]);
+            e.finish();
+            return;
+        }
+
+        if (m == "movzx" || m == "movsx") {
+            need(2);
+            if (!is_reg(0) || !is_rm(1)) fail("bad operands for '" + m + "'");
+            int src = ops[1].size;
+            if (!src) fail("operation size not specified in '" + m + "'");
+            size_prefix(e, ops[0].size);
+            e.reg_operand_rex(ops[0].reg, 0x04);
+            uint8_t base = m == "movzx" ? 0xB6 : 0xBE;
+            e.opcode({0x0F, (uint8_t)(base + (src == 16 ? 1 : 0))});
+            e.set_rm(ops[0].reg.id, ops[1]);
+            e.finish();
+            return;
+        }
+
+        if (m == "movsxd") {
+            need(2);
+            e.rex_w = true;
+            e.reg_operand_rex(ops[0].reg, 0x04);
+            e.opcode({0x63});
+            e.set_rm(ops[0].reg.id, ops[1]);
+            e.finish();
+            return;
+        }
+
+        if (m == "push" || m == "pop") {
+            need(1);
+            bool push = m == "push";
+            if (is_reg(0)) {
+                const RegInfo& r = ops[0].reg;
+                if (r.size == 8) fail("cannot push a byte register");
+                if (r.size == 16) e.opsize = true;
+                else if ((it.bits == 64) != (r.size == 64)) fail("bad push/pop register size");
+                e.reg_operand_rex(r, 0x01);
+                e.opcode({(uint8_t)((push ? 0x50 : 0x58) + (r.id & 7))});
+            } else if (is_mem(0)) {
+                int sz = ops[0].size ? ops[0].size : (it.bits == 64 ? 64 : 32);
+                if (sz == 16) e.opsize = true;
+                e.opcode({(uint8_t)(push ? 0xFF : 0x8F)});
+                e.set_rm(push ? 6 : 0, ops[0]);
+            } else if (push && is_imm(0)) {
+                if (ops[0].size == 16) e.opsize = true;
+                if (small_imm(ops[0].disp) && ops[0].size != 16) {
+                    e.opcode({0x6A}); e.set_imm(ops[0].disp, 1, Fix::ABS8);
+                } else {
+                    int b = ops[0].size == 16 ? 2 : 4;
+                    e.opcode({0x68}); e.set_imm(ops[0].disp, b, b == 2 ? Fix::ABS16 : it.bits == 64 ? Fix::ABS32S : Fix::ABS32);
+                }
+            } else fail("bad operand for '" + m + "'");
+            e.finish();
+            return;
+        }
+
+        static const char* grp3[] = {"test", "", "not", "neg", "mul", "imul", "div", "idiv"};
+        for (int n = 2; n < 8; n++) {
+            if (m != grp3[n] || ops.size() != 1) continue;
+            if (!is_rm(0)) fail("bad operand for '" + m + "'");
+            int sz = op_size(it, ops[0]);
+            size_prefix(e, sz);
+            e.opcode({(uint8_t)(sz == 8 ? 0xF6 : 0xF7)});
+            e.set_rm(n, ops[0]);
+            e.finish();
+            return;
+        }
+
+        if (m == "imul") {
+            if (ops.size() == 2 && is_reg(0) && is_rm(1)) {
+                size_prefix(e, ops[0].size);
+                e.reg_operand_rex(ops[0].reg, 0x04);
+                e.opcode({0x0F, 0xAF});
+                e.set_rm(ops[0].reg.id, ops[1]);
+            } else if ((ops.size() == 3 && is_reg(0) && is_rm(1) && is_imm(2)) ||
+                       (ops.size() == 2 && is_reg(0) && is_imm(1))) {
+                const Operand& src = ops.size() == 3 ? ops[1] : ops[0];
+                const Operand& im  = ops.size() == 3 ? ops[2] : ops[1];
+                int sz = ops[0].size;
+                size_prefix(e, sz);
+                e.reg_operand_rex(ops[0].reg, 0x04);
+                if (small_imm(im.disp)) { e.opcode({0x6B}); e.set_imm(im.disp, 1, Fix::ABS8); }
+                else { int b = sz == 16 ? 2 : 4; e.opcode({0x69}); e.set_imm(im.disp, b, imm_fix(sz, b)); }
+                e.set_rm(ops[0].reg.id, src);
+            } else fail("bad operands for 'imul'");
+            e.finish();
+            return;
+        }
+
+        if (m == "inc" || m == "dec") {
+            need(1);
+            int n = m == "inc" ? 0 : 1;
+            int sz = op_size(it, ops[0]);
+            if (it.bits == 32 && is_reg(0) && sz != 8) {
+                if (sz == 16) e.opsize = true;
+                e.opcode({(uint8_t)(0x40 + n * 8 + ops[0].reg.id)});
+            } else {
+                size_prefix(e, sz);
+                e.opcode({(uint8_t)(sz == 8 ? 0xFE : 0xFF)});
+                e.set_rm(n, ops[0]);
+            }
+            e.finish();
+            return;
+        }
+
+        static const char* shifts[] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar"};
+        for (int n = 0; n < 8; n++) {
+            if (m != shifts[n]) continue;
+            int ext = n == 6 ? 4 : n;
+            need(2);
+            if (!is_rm(0)) fail("bad operand for '" + m + "'");
+            int sz = op_size(it, ops[0]);
+            size_prefix(e, sz);
+            if (is_reg(1) && ops[1].reg.size == 8 && ops[1].reg.id == 1) {
+                e.opcode({(uint8_t)(sz == 8 ? 0xD2 : 0xD3)});
+            } else if (is_imm(1)) {
+                int64_t v;
+                if (const_value(ops[1].disp, v) && v == 1) e.opcode({(uint8_t)(sz == 8 ? 0xD0 : 0xD1)});
+                else { e.opcode({(uint8_t)(sz == 8 ? 0xC0 : 0xC1)}); e.set_imm(ops[1].disp, 1, Fix::ABS8); }
+            } else fail("bad shift count");
+            e.set_rm(ext, ops[0]);
+            e.finish();
+            return;
+        }
+
+        if (m == "test") {
+            need(2);
+            if (is_rm(0) && is_reg(1)) {
+                int sz = op_size(it, ops[0], &ops[1]);
+                size_prefix(e, sz);
+                e.reg_operand_rex(ops[1].reg, 0x04);
+                e.opcode({(uint8_t)(sz == 8 ? 0x84 : 0x85)});
+                e.set_rm(ops[1].reg.id, ops[0]);
+            } else if (is_rm(0) && is_imm(1)) {
+                int sz = op_size(it, ops[0]);
+                size_prefix(e, sz);
+                int b = sz == 8 ? 1 : sz == 16 ? 2 : 4;
+                if (is_reg(0) && ops[0].reg.id == 0) e.opcode({(uint8_t)(sz == 8 ? 0xA8 : 0xA9)});
+                else { e.opcode({(uint8_t)(sz == 8 ? 0xF6 : 0xF7)}); e.set_rm(0, ops[0]); }
+                e.set_imm(ops[1].disp, b, imm_fix(sz, b));
+            } else fail("bad operands for 'test'");
+            e.finish();
+            return;
+        }
+
+        if (m == "xchg") {
+            need(2);
+            if (!is_rm(0) || !is_reg(1)) fail("bad operands for 'xchg'");
+            int sz = op_size(it, ops[0], &ops[1]);
+            size_prefix(e, sz);
+            // xchg with the accumulator has a one-byte form (90+r)
+            if (sz != 8 && is_reg(0) && (ops[0].reg.id == 0 || ops[1].reg.id == 0) && ops[0].reg.id != ops[1].reg.id) {
+                const RegInfo& r = ops[0].reg.id == 0 ? ops[1].reg : ops[0].reg;
+                e.reg_operand_rex(r, 0x01);
+                e.opcode({(uint8_t)(0x90 + (r.id & 7))});
+                e.finish();
+                return;
+            }
+            e.reg_operand_rex(ops[1].reg, 0x04);
+            e.opcode({(uint8_t)(sz == 8 ? 0x86 : 0x87)});
+            e.set_rm(ops[1].reg.id, ops[0]);
+            e.finish();
+            return;
+        }
+
+        // Branches. Same-section label targets are relaxed: short unless the
+        // displacement does not fit (decided by layout()).
+        int cc = -1;
+        if (m == "jmp" || m == "call" || (m.size() > 1 && m[0] == 'j' && (cc = cond_code(std::string_view(m).substr(1))) >= 0)) {
+            need(1);
+            bool call = m == "call";
+            if (is_rm(0)) {
+                if (cc >= 0) fail("indirect conditional jump");
+                if (is_reg(0) && (ops[0].size != (it.bits == 64 ? 64 : 32))) fail("bad indirect branch register");
+                e.opcode({0xFF});
+                e.set_rm(call ? 2 : 4, ops[0]);
+                e.finish();
+                return;
+            }
+            if (!is_imm(0)) fail("bad branch target");
+            bool is_long = call || it.long_jump || ops[0].strict_near;
+            if (is_long) {
+                if (call) e.opcode({0xE8});
+                else if (cc < 0) e.opcode({0xE9});
+                else e.opcode({0x0F, (uint8_t)(0x80 + cc)});
+                e.set_imm(ops[0].disp, 4, Fix::PC32);
+            } else {
+                if (cc < 0) e.opcode({0xEB});
+                else e.opcode({(uint8_t)(0x70 + cc)});
+                e.set_imm(ops[0].disp, 1, Fix::PC8);
+            }
+            e.finish();
+            return;
+        }
+
+        if (m.size() > 3 && m.compare(0, 3, "set") == 0 && (cc = cond_code(std::string_view(m).substr(3))) >= 0) {
+            need(1);
+            if (!is_rm(0)) fail("bad operand for '" + m + "'");
+            e.opcode({0x0F, (uint8_t)(0x90 + cc)});
+            e.set_rm(0, ops[0]);
+            e.finish();
+            return;
+        }
+        if (m.size() > 4 && m.compare(0, 4, "cmov") == 0 && (cc = cond_code(std::string_view(m).substr(4))) >= 0) {
+            need(2);
+            if (!is_reg(0) || !is_rm(1)) fail("bad operands for '" + m + "'");
+            size_prefix(e, ops[0].size);
+            e.reg_operand_rex(ops[0].reg, 0x04);
+            e.opcode({0x0F, (uint8_t)(0x40 + cc)});
+            e.set_rm(ops[0].reg.id, ops[1]);
+            e.finish();
+            return;
+        }
+
+        if (m == "int") {
+            need(1);
+            int64_t v;
+            if (!is_imm(0) || !const_value(ops[0].disp, v)) fail("bad interrupt vector");
+            if (v == 3) { e.opcode({0xCC}); e.finish(); return; }
+            e.opcode({0xCD}); e.set_imm(ops[0].disp, 1, Fix::ABS8);
+            e.finish();
+            return;
+        }
+
+        if (m == "ret") {
+            if (ops.empty()) { e.opcode({0xC3}); e.finish(); return; }
+            need(1);
+            e.opcode({0xC2}); e.set_imm(ops[0].disp, 2, Fix::ABS16);
+            e.finish();
+            return;
+        }
+
+        if (m == "in" || m == "out") {
+            need(2);
+            bool in = m == "in";
+            const Operand& acc = in ? ops[0] : ops[1];
+            const Operand& port = in ? ops[1] : ops[0];
+            if (acc.kind != Operand::REG || acc.reg.id != 0) fail("'" + m + "' needs al/ax/eax");
+            if (acc.size == 16) e.opsize = true;
+            uint8_t w = acc.size == 8 ? 0 : 1;
+            if (port.kind == Operand::REG && port.reg.size == 16 && port.reg.id == 2) {
+                e.opcode({(uint8_t)((in ? 0xEC : 0xEE) + w)});
+            } else if (port.kind == Operand::IMM) {
+                e.opcode({(uint8_t)((in ? 0xE4 : 0xE6) + w)});
+                e.set_imm(port.disp, 1, Fix::ABS8);
+            } else fail("bad port operand");
+            e.finish();
+            return;
+        }
+
+        if (m == "syscall") return zero_ops({0x0F, 0x05});
+        if (m == "cdq")     return zero_ops({0x99});
+        if (m == "cwde")    return zero_ops({0x98});
+        if (m == "cqo")     { need(0); e.rex_w = true; e.opcode({0x99}); e.finish(); return; }
+        if (m == "cdqe")    { need(0); e.rex_w = true; e.opcode({0x98}); e.finish(); return; }
+        if (m == "pushad" || m == "pusha") { if (it.bits == 64) fail("pushad in 64-bit code"); return zero_ops({0x60}); }
+        if (m == "popad" || m == "popa")   { if (it.bits == 64) fail("popad in 64-bit code"); return zero_ops({0x61}); }
+        if (m == "pushfd" || m == "pushf" || m == "pushfq") return zero_ops({0x9C});
+        if (m == "popfd" || m == "popf" || m == "popfq")    return zero_ops({0x9D});
+        if (m == "int3")  return zero_ops({0xCC});
+        if (m == "hlt")   return zero_ops({0xF4});
+        if (m == "cli")   return zero_ops({0xFA});
+        if (m == "sti")   return zero_ops({0xFB});
+        if (m == "cld")   return zero_ops({0xFC});
+        if (m == "std")   return zero_ops({0xFD});
+        if (m == "nop")   return zero_ops({0x90});
+        if (m == "leave") return zero_ops({0xC9});
+        if (m == "ud2")   return zero_ops({0x0F, 0x0B});
+        if (m == "stosb") return zero_ops({0xAA});
+        if (m == "stosw") { need(0); e.opsize = true; e.opcode({0xAB}); e.finish(); return; }
+        if (m == "stosd") return zero_ops({0xAB});
+        if (m == "movsb") return zero_ops({0xA4});
+        if (m == "movsd" && ops.empty()) return zero_ops({0xA5});
+        if (m == "lodsb") return zero_ops({0xAC});
+        if (simd(it, e)) return;
+
+        (void)here;
+        fail("unsupported instruction '" + m + "'");
+    }
+
+    // SSE2 integer instructions, `op x, x/m`, and their AVX2 forms, `vop
+    // x/y, x/y, x/y/m`, plus the few AVX2-only ones the vectorizer uses
+    enum class Simd : uint8_t { RM, RMI, SHI, MOV, MOVD, BCAST, EXTRACT, NONE };
+    struct SimdOp { const char* name; uint8_t pp, map, op; Simd form; uint8_t ext; bool vex_only; };
+
+    bool simd(const Item& it, Enc& e) const {
+        static const SimdOp table[] = {
+            {"paddb", 1, 1, 0xFC, Simd::RM, 0, false},     {"paddd", 1, 1, 0xFE, Simd::RM, 0, false},
+            {"paddq", 1, 1, 0xD4, Simd::RM, 0, false},     {"psubb", 1, 1, 0xF8, Simd::RM, 0, false},
+            {"psubd", 1, 1, 0xFA, Simd::RM, 0, false},     {"pand", 1, 1, 0xDB, Simd::RM, 0, false},
+            {"por", 1, 1, 0xEB, Simd::RM, 0, false},       {"pxor", 1, 1, 0xEF, Simd::RM, 0, false},
+            {"pmuludq", 1, 1, 0xF4, Simd::RM, 0, false},   {"psadbw", 1, 1, 0xF6, Simd::RM, 0, false},
+            {"punpcklbw", 1, 1, 0x60, Simd::RM, 0, false}, {"punpcklwd", 1, 1, 0x61, Simd::RM, 0, false},
+            {"punpckldq", 1, 1, 0x62, Simd::RM, 0, false}, {"pcmpeqb", 1, 1, 0x74, Simd::RM, 0, false},
+            {"pcmpeqd", 1, 1, 0x76, Simd::RM, 0, false},   {"pmulld", 1, 2, 0x40, Simd::RM, 0, false},
+            {"pshufd", 1, 1, 0x70, Simd::RMI, 0, false},   {"pshuflw", 3, 1, 0x70, Simd::RMI, 0, false},
+            {"psrld", 1, 1, 0x72, Simd::SHI, 2, false},    {"psrad", 1, 1, 0x72, Simd::SHI, 4, false},
+            {"pslld", 1, 1, 0x72, Simd::SHI, 6, false},    {"psrlq", 1, 1, 0x73, Simd::SHI, 2, false},
+            {"movdqa", 1, 1, 0x6F, Simd::MOV, 0, false},   {"movdqu", 2, 1, 0x6F, Simd::MOV, 0, false},
+            {"movd", 1, 1, 0x6E, Simd::MOVD, 0, false},
+            {"pbroadcastb", 1, 2, 0x78, Simd::BCAST, 0, true}, {"pbroadcastd", 1, 2, 0x58, Simd::BCAST, 0, true},
+            {"extracti128", 1, 3, 0x39, Simd::EXTRACT, 0, true}, {"zeroupper", 0, 1, 0x77, Simd::NONE, 0, true},
+        };
+        std::string_view m = it.mnem;
+        const bool v = m.size() > 1 && m[0] == 'v';
+        const SimdOp* d = nullptr;
+        for (auto& t : table) if (m.substr(v) == t.name) d = &t;
+        if (!d || (d->vex_only && !v)) return false;
+        const auto& ops = it.ops;
+        auto vec = [&](size_t i) { return i < ops.size() && ops[i].kind == Operand::REG && ops[i].reg.cls != R_GP; };
+        auto rm = [&](size_t i) { return vec(i) || (i < ops.size() && ops[i].kind == Operand::MEM); };
+        auto gp_rm = [&](size_t i) {
+            return i < ops.size() && ((ops[i].kind == Operand::REG && ops[i].reg.cls == R_GP && ops[i].reg.size == 32) ||
+                                      ops[i].kind == Operand::MEM);
+        };
+        auto imm8 = [&](size_t i) {
+            if (i >= ops.size() || ops[i].kind != Operand::IMM) fail("'" + it.mnem + "' needs an immediate");
+            e.set_imm(ops[i].disp, 1, Fix::ABS8);
+        };
+        auto bad = [&] { fail("bad operands for '" + it.mnem + "'"); };
+        if (v) {
+            e.vex = true;
+            e.vex_pp = d->pp;
+            e.vex_map = d->map;
+            e.vex_l = !ops.empty() && ops[0].kind == Operand::REG && ops[0].reg.cls == R_YMM;
+        } else if (d->pp == 1) e.opsize = true;
+        else if (d->pp) e.mand = d->pp == 2 ? 0xF3 : 0xF2;
+        if (!v) {
+            if (d->map == 2) e.opcode({0x0F, 0x38, d->op});
+            else if (d->map == 3) e.opcode({0x0F, 0x3A, d->op});
+            else e.opcode({0x0F, d->op});
+        } else e.opcode({d->op});
+        switch (d->form) {
+            case Simd::RM:
+                if (v ? !(ops.size() == 3 && vec(0) && vec(1) && rm(2)) : !(ops.size() == 2 && vec(0) && rm(1))) bad();
+                if (v) e.vex_v = (uint8_t)ops[1].reg.id;
+                e.set_rm(ops[0].reg.id, ops[v ? 2 : 1]);
+                break;
+            case Simd::RMI:
+                if (ops.size() != 3 || !vec(0) || !rm(1)) bad();
+                e.set_rm(ops[0].reg.id, ops[1]);
+                imm8(2);
+                break;
+            case Simd::SHI:
+                if (v ? !(ops.size() == 3 && vec(0) && vec(1)) : !(ops.size() == 2 && vec(0))) bad();
+                if (v) e.vex_v = (uint8_t)ops[0].reg.id;
+                e.set_rm(d->ext, ops[v ? 1 : 0]);
+                imm8(v ? 2 : 1);
+                break;
+            case Simd::MOV:
+                if (ops.size() != 2) bad();
+                if (vec(0) && rm(1)) e.set_rm(ops[0].reg.id, ops[1]);
+                else if (ops[0].kind == Operand::MEM && vec(1)) {
+                    e.op[e.nop - 1] = 0x7F;
+                    e.vex_l = ops[1].reg.cls == R_YMM;
+                    e.set_rm(ops[1].reg.id, ops[0]);
+                } else bad();
+                break;
+            case Simd::MOVD:
+                if (ops.size() != 2) bad();
+                if (vec(0) && gp_rm(1)) e.set_rm(ops[0].reg.id, ops[1]);
+                else if (gp_rm(0) && vec(1)) {
+                    e.op[e.nop - 1] = 0x7E;
+                    e.set_rm(ops[1].reg.id, ops[0]);
+                } else bad();
+                e.vex_l = 0;
+                break;
+            case Simd::BCAST:
+                if (ops.size() != 2 || !vec(0) || !rm(1)) bad();
+                e.set_rm(ops[0].reg.id, ops[1]);
+                break;
+            case Simd::EXTRACT:
+                if (ops.size() != 3 || !rm(0) || !vec(1) || ops[1].reg.cls != R_YMM) bad();
+                e.vex_l = 1;
+                e.set_rm(ops[1].reg.id, ops[0]);
+                imm8(2);
+                break;
+            case Simd::NONE:
+                if (!ops.empty()) bad();
+                break;
+        }
+        e.finish();
+        return true;
+    }
+
+    // ---- layout ------------------------------------------------------------
+    // Symbol address for relaxation decisions: section offset, or -1 if not
+    // in `sec`
+    bool local_target(const Expr& e, int sec, int64_t& off) const {
+        if (e.terms.size() != 1 || e.terms[0].second != 1) return false;
+        const Symbol& s = symbols[e.terms[0].first];
+        if (!s.defined || s.is_equ || s.section != sec) return false;
+        off = (int64_t)s.value + e.k;
+        return true;
+    }
+
+    bool relaxable(const Item& it) const {
+        if (it.kind != IK::INSN || it.ops.size() != 1 || it.ops[0].kind != Operand::IMM) return false;
+        if (it.ops[0].strict_near) return false;
+        const std::string& m = it.mnem;
+        return m == "jmp" || (m.size() > 1 && m[0] == 'j' && cond_code(std::string_view(m).substr(1)) >= 0);
+    }
+
+    uint64_t item_size(Item& it, uint64_t at) {
+        switch (it.kind) {
+            case IK::DATA: {
+                uint64_t n = 0;
+                for (size_t i = 0; i < it.values.size(); i++) {
+                    if (!it.strings[i].empty()) {
+                        uint64_t l = it.strings[i].size();
+                        n += (l + it.unit - 1) / it.unit * it.unit;
+                    } else n += it.unit;
+                }
+                return n * it.times;
+            }
+            case IK::ALIGN: return (it.amount - at % it.amount) % it.amount;
+            case IK::RESB:  return it.amount;
+            case IK::INSN: {
+                line_no = it.line;
+                Buf b;
+                encode(it, b, at);
+                it.size = b.n;
+                return (uint64_t)b.n * it.times;
+            }
+        }
+        return 0;
+    }
+
+    void layout() {
+        // Every item is sized once; afterwards only relaxed jumps change
+        std::vector<uint64_t> off(sections.size());
+        std::vector<uint64_t> sizes(items.size());
+        size_t li = 0;
+        for (size_t i = 0; i < items.size(); i++) {
+            auto& it = items[i];
+            while (li < label_at.size() && label_at[li].second == i) symbols[label_at[li++].first].value = off[it.section];
+            it.offset = off[it.section];
+            sizes[i] = item_size(it, off[it.section]);
+            off[it.section] += sizes[i];
+        }
+        for (; li < label_at.size(); li++) {
+            auto& s = symbols[label_at[li].first];
+            s.value = off[s.section];
+        }
+        for (bool changed = true; changed;) {
+            changed = false;
+            std::fill(off.begin(), off.end(), 0);
+            li = 0;
+            for (size_t i = 0; i < items.size(); i++) {
+                auto& it = items[i];
+                while (li < label_at.size() && label_at[li].second == i) symbols[label_at[li++].first].value = off[it.section];
+                it.offset = off[it.section];
+                if (it.kind == IK::ALIGN) sizes[i] = item_size(it, off[it.section]);
+                off[it.section] += sizes[i];
+            }
+            for (; li < label_at.size(); li++) {
+                auto& s = symbols[label_at[li].first];
+                s.value = off[s.section];
+            }
+            for (size_t i = 0; i < items.size(); i++) {
+                auto& it = items[i];
+                if (it.long_jump || !relaxable(it)) continue;
+                int64_t target;
+                bool grow = !local_target(it.ops[0].disp, it.section, target);
+                if (!grow) {
+                    int64_t d = target - (int64_t)(it.offset + it.size);
+                    grow = !fits8(d);
+                }
+                if (grow && it.ops[0].strict_short) { line_no = it.line; fail("short jump out of range"); }
+                if (grow) {
+                    it.long_jump = true;
+                    sizes[i] = item_size(it, it.offset);
+                    changed = true;
+                }
+            }
+        }
+        for (size_t s = 0; s < sections.size(); s++) sections[s].size = off[s];
+    }
+
+    // ---- emission ----------------------------------------------------------
+    // Resolves a fixup. In flat mode every symbol has an address; in object
+    // mode anything outside the current section (or any absolute use of a
+    // label) becomes a relocation against a section or external symbol.
+    void apply(Section& sec, int sec_idx, uint64_t at, uint64_t insn_end, const PendingFix& f,
+               bool flat, const std::vector<uint64_t>& base) {
+        const Expr& e = f.value;
+        int64_t k = e.k;
+        int reloc_sym = -1;
+        // Fold same-section symbol pairs and resolve what flat mode can
+        std::vector<std::pair<int, int>> left;
+        for (auto& t : e.terms) {
+            const Symbol& s = symbols[t.first];
+            if (s.is_equ) { k += t.second * s.equ; continue; }
+            if (!s.defined && !s.external) throw std::runtime_error("undefined symbol '" + s.name + "'");
+            if (flat) {
+                if (!s.defined) throw std::runtime_error("external symbol '" + s.name + "' in a flat binary");
+                k += t.second * (int64_t)(org + base[s.section] + s.value);
+                continue;
+            }
+            left.push_back(t);
+        }
+        if (!flat) {
+            // label - label in one section is a constant
+            for (size_t i = 0; i < left.size(); i++)
+                for (size_t j = 0; j < left.size(); j++) {
+                    if (i == j || !left[i].second || !left[j].second) continue;
+                    const Symbol& a = symbols[left[i].first];
+                    const Symbol& b = symbols[left[j].first];
+                    if (a.defined && b.defined && a.section == b.section && left[i].second == 1 && left[j].second == -1) {
+                        k += (int64_t)a.value - (int64_t)b.value;
+                        left[i].second = left[j].second = 0;
+                    }
+                }
+            std::vector<std::pair<int, int>> rest;
+            for (auto& t : left) if (t.second) rest.push_back(t);
+            if (rest.size() > 1 || (rest.size() == 1 && rest[0].second != 1))
+                throw std::runtime_error("expression is not relocatable");
+            if (!rest.empty()) {
+                const Symbol& s = symbols[rest[0].first];
+                bool pc = f.kind == Fix::PC8 || f.kind == Fix::PC32;
+                if (pc && s.defined && s.section == sec_idx) {
+                    k += (int64_t)s.value;  // same section: resolved here
+                } else {
+                    reloc_sym = rest[0].first;
+                }
+            }
+        }
+        bool pc = f.kind == Fix::PC8 || f.kind == Fix::PC32;
+        int bytes = f.kind == Fix::ABS8 || f.kind == Fix::PC8 ? 1 : f.kind == Fix::ABS16 ? 2 : f.kind == Fix::ABS64 ? 8 : 4;
+        int64_t v;
+        if (reloc_sym >= 0) {
+            if (bytes < 4) throw Unsupported("relocation in a " + std::to_string(bytes * 8) + "-bit field");
+            // Defined symbols relocate against their section; the addend
+            // carries the offset
+            int64_t addend = k;
+            const Symbol& s = symbols[reloc_sym];
+            if (s.defined) addend += (int64_t)s.value;
+            if (pc) addend -= (int64_t)(insn_end - at);
+            Fix kind = f.kind;
+            sec.relocs.push_back({at, reloc_sym, addend, kind});
+            v = addend;   // REL formats keep the addend in place; RELA writers zero it
+        } else {
+            v = pc ? k - (int64_t)((flat ? org + base[sec_idx] : 0) + insn_end) : k;
+            if (f.kind == Fix::PC8 && !fits8(v)) throw std::runtime_error("short jump out of range");
+            if (f.kind == Fix::ABS8 && (v < -128 || v > 255)) throw Unsupported("byte value out of range");
+        }
+        for (int i = 0; i < bytes; i++) sec.data[at + i] = (uint8_t)(v >> (8 * i));
+    }
+
+    void emit(bool flat) {
+        std::vector<uint64_t> base(sections.size(), 0);
+        if (flat) {
+            // Sections follow .text in order, each aligned to 4 (NASM bin default)
+            uint64_t p = 0;
+            int text = -1;
+            for (size_t i = 0; i < sections.size(); i++) if (sections[i].name == ".text") text = (int)i;
+            std::vector<int> order;
+            if (text >= 0) order.push_back(text);
+            for (size_t i = 0; i < sections.size(); i++) if ((int)i != text && !sections[i].nobits) order.push_back((int)i);
+            for (size_t i = 0; i < sections.size(); i++) if (sections[i].nobits) order.push_back((int)i);
+            for (int i : order) {
+                if (p % 4 && i != text) p += 4 - p % 4;
+                base[i] = p;
+                p += sections[i].size;
+            }
+        }
+        for (auto& s : sections) {
+            s.data.assign(s.nobits ? 0 : s.size, 0);
+            s.relocs.clear();
+        }
+        for (auto& it : items) {
+            Section& sec = sections[it.section];
+            uint64_t at = it.offset;
+            if (it.kind == IK::ALIGN) {
+                uint64_t n = (it.amount - at % it.amount) % it.amount;
+                if (!sec.nobits) for (uint64_t i = 0; i < n; i++) sec.data[at + i] = (uint8_t)it.unit;
+                continue;
+            }
+            if (it.kind == IK::RESB) {
+                if (!sec.nobits) for (uint64_t i = 0; i < it.amount; i++) sec.data[at + i] = 0;
+                continue;
+            }
+            if (sec.nobits) throw Unsupported("initialized data in " + sec.name);
+            for (int64_t r = 0; r < it.times; r++) {
+                if (it.kind == IK::DATA) {
+                    for (size_t i = 0; i < it.values.size(); i++) {
+                        if (!it.strings[i].empty()) {
+                            auto& str = it.strings[i];
+                            std::memcpy(&sec.data[at], str.data(), str.size());
+                            at += (str.size() + it.unit - 1) / it.unit * it.unit;
+                            continue;
+                        }
+                        Fix k = it.unit == 1 ? Fix::ABS8 : it.unit == 2 ? Fix::ABS16 : it.unit == 4 ? Fix::ABS32 : Fix::ABS64;
+                        apply(sec, it.section, at, at + it.unit, {0, k, it.values[i]}, flat, base);
+                        at += it.unit;
+                    }
+                    continue;
+                }
+                Buf b;
+                line_no = it.line;
+                encode(it, b, at);
+                if (b.n != it.size) throw std::runtime_error("internal: instruction size changed after layout");
+                std::memcpy(&sec.data[at], b.b, b.n);
+                for (auto& f : b.fixes) apply(sec, it.section, at + f.pos, at + b.n, f, flat, base);
+                at += b.n;
+            }
+        }
+        flat_base = base;
+    }
+
+    std::vector<uint64_t> flat_base;
+
+public:
+    explicit Assembler(int default_bits = 32) : bits(default_bits) {}
+
+    // Parses and lays out the whole source; throws Unsupported for input
+    // outside the subset and runtime_error for genuine errors
+    void assemble(std::string_view src) {
+        items.reserve(items.size() + std::count(src.begin(), src.end(), '\n') + 1);
+        size_t p = 0;
+        while (p <= src.size()) {
+            size_t e = src.find('\n', p);
+            if (e == std::string_view::npos) e = src.size();
+            std::string_view line = src.substr(p, e - p);
+            line_no++;
+            // Strip ';' comments outside quotes
+            char q = 0;
+            for (size_t i = 0; i < line.size(); i++) {
+                char c = line[i];
+                if (q) { if (c == q) q = 0; continue; }
+                if (c == '\'' || c == '"' || c == '`') q = c;
+                else if (c == ';') { line = line.substr(0, i); break; }
+            }
+            directive_or_line(line);
+            p = e + 1;
+        }
+        for (auto& s : symbols)
+            if (s.global && !s.defined) throw std::runtime_error("global symbol '" + s.name + "' is not defined");
+        layout();
+    }
+
+    // [ORG]-based raw image (the -kernel output)
+    std::string flat_binary() {
+        emit(true);
+        std::string out;
+        for (size_t i = 0; i < sections.size(); i++) {
+            if (sections[i].nobits) continue;
+            if (out.size() < flat_base[i]) out.resize(flat_base[i], '\0');
+            out.append(sections[i].data.begin(), sections[i].data.end());
+        }
+        return out;
+    }
+
+    // ELF relocatable object (REL for ELF32 like NASM, RELA for ELF64)
+    std::string elf_object(bool elf64, const std::string& source_name);
+};
+
+// ---- ELF writer ---------------------------------------------------------------
+
+namespace elf_detail {
+    inline void put(std::string& o, uint64_t v, int bytes) { for (int i = 0; i < bytes; i++) o += (char)(v >> (8 * i)); }
+    inline void pad(std::string& o, size_t a) { while (o.size() % a) o += '\0'; }
+}
+
+inline std::string Assembler::elf_object(bool elf64, const std::string& source_name) {
+    using elf_detail::put;
+    using elf_detail::pad;
+    emit(false);
+    const int W = elf64 ? 8 : 4;
+
+    // Section table: null, progbits/nobits..., .shstrtab, .symtab, .strtab, .rel(a).*
+    std::string shstr(1, '\0'), strtab(1, '\0');
+    auto add_str = [](std::string& t, const std::string& s) { size_t o = t.size(); t += s; t += '\0'; return (uint32_t)o; };
+
+    // Symbols: null, file, sections, local labels, then globals/externs
+    struct ESym { uint32_t name; uint64_t value; uint8_t info; uint16_t shndx; };
+    std::vector<ESym> syms;
+    syms.push_back({0, 0, 0, 0});
+    syms.push_back({add_str(strtab, source_name), 0, 4 /*STT_FILE*/, 0xFFF1});
+    for (size_t i = 0; i < sections.size(); i++) syms.push_back({0, 0, 3 /*STT_SECTION*/, (uint16_t)(i + 1)});
+    std::vector<int> sym_out(symbols.size(), -1);
+    for (size_t i = 0; i < symbols.size(); i++) {
+        const Symbol& s = symbols[i];
+        if (s.global || s.external || !s.defined) continue;
+        sym_out[i] = (int)syms.size();
+        if (s.is_equ) syms.push_back({add_str(strtab, s.name), (uint64_t)s.equ, 0, 0xFFF1});
+        else syms.push_back({add_str(strtab, s.name), s.value, 0, (uint16_t)(s.section + 1)});
+    }
+    uint32_t first_global = (uint32_t)syms.size();
+    for (size_t i = 0; i < symbols.size(); i++) {
+        const Symbol& s = symbols[i];
+        if (!s.global && !(s.external && !s.defined)) continue;
+        bool used = s.global;
+        if (!used) for (auto& sec : sections) for (auto& r : sec.relocs) if (r.symbol == (int)i) used = true;
+        if (!used) continue;
+        sym_out[i] = (int)syms.size();
+        if (s.defined) syms.push_back({add_str(strtab, s.name), s.value, 0x10, (uint16_t)(s.section + 1)});
+        else syms.push_back({add_str(strtab, s.name), 0, 0x10, 0});
+    }
+
+    auto rel_type = [&](Fix k) -> uint32_t {
+        if (!elf64) return k == Fix::PC32 ? 2 /*R_386_PC32*/ : 1 /*R_386_32*/;
+        switch (k) {
+            case Fix::PC32:   return 2;   // R_X86_64_PC32
+            case Fix::ABS64:  return 1;   // R_X86_64_64
+            case Fix::ABS32S: return 11;  // R_X86_64_32S
+            default:          return 10;  // R_X86_64_32
+        }
+    };
+
+    std::string out;
+    size_t ehsize = elf64 ? 64 : 52;
+    out.assign(ehsize, '\0');
+
+    struct SH { uint32_t name, type; uint64_t flags, offset, size; uint32_t link, info; uint64_t align, entsize; };
+    std::vector<SH> sh;
+    sh.push_back({0, 0, 0, 0, 0, 0, 0, 0, 0});
+    for (auto& s : sections) {
+        pad(out, s.align ? s.align : 1);
+        SH h{add_str(shstr, s.name), s.nobits ? 8u : 1u,
+             (uint64_t)(2 /*ALLOC*/ | (s.write ? 1 : 0) | (s.exec ? 4 : 0)),
+             out.size(), s.size, 0, 0, s.align, 0};
+        if (!s.nobits) out.append(s.data.begin(), s.data.end());
+        sh.push_back(h);
+    }
+    uint32_t shstr_idx = (uint32_t)sh.size();
+    sh.push_back({add_str(shstr, ".shstrtab"), 3, 0, 0, 0, 0, 0, 1, 0});
+    uint32_t symtab_idx = (uint32_t)sh.size();
+    sh.push_back({add_str(shstr, ".symtab"), 2, 0, 0, 0, 0, first_global, (uint64_t)W, (uint64_t)(elf64 ? 24 : 16)});
+    uint32_t strtab_idx = (uint32_t)sh.size();
+    sh.push_back({add_str(shstr, ".strtab"), 3, 0, 0, 0, 0, 0, 1, 0});
+    sh[symtab_idx].link = strtab_idx;
+    std::vector<std::pair<uint32_t, size_t>> rel_sections;  // (sh index, section)
+    for (size_t i = 0; i < sections.size(); i++) {
+        if (sections[i].relocs.empty()) continue;
+        std::string nm = (elf64 ? ".rela" : ".rel") + sections[i].name;
+        rel_sections.push_back({(uint32_t)sh.size(), i});
+        sh.push_back({add_str(shstr, nm), elf64 ? 4u : 9u, 0, 0, 0, symtab_idx, (uint32_t)(i + 1),
+                      (uint64_t)W, (uint64_t)(elf64 ? 24 : 8)});
+    }
+
+    // .shstrtab
+    sh[shstr_idx].offset = out.size(); out += shstr; sh[shstr_idx].size = shstr.size();
+    // .symtab
+    pad(out, W);
+    sh[symtab_idx].offset = out.size();
+    for (auto& s : syms) {
+        if (elf64) {
+            put(out, s.name, 4); put(out, s.info, 1); put(out, 0, 1); put(out, s.shndx, 2);
+            put(out, s.value, 8); put(out, 0, 8);
+        } else {
+            put(out, s.name, 4); put(out, s.value, 4); put(out, 0, 4);
+            put(out, s.info, 1); put(out, 0, 1); put(out, s.shndx, 2);
+        }
+    }
+    sh[symtab_idx].size = out.size() - sh[symtab_idx].offset;
+    // .strtab
+    sh[strtab_idx].offset = out.size(); out += strtab; sh[strtab_idx].size = strtab.size();
+    // relocations
+    for (auto& [idx, si] : rel_sections) {
+        pad(out, W);
+        sh[idx].offset = out.size();
+        for (auto& r : sections[si].relocs) {
+            const Symbol& s = symbols[r.symbol];
+            uint32_t target = s.defined ? (uint32_t)(2 + s.section) : (uint32_t)sym_out[r.symbol];
+            if (elf64) {
+                put(out, r.offset, 8);
+                put(out, (uint64_t)target << 32 | rel_type(r.kind), 8);
+                put(out, (uint64_t)r.addend, 8);
+                // RELA: the addend lives in the entry, not in the section bytes
+                auto& d = sections[si].data;
+                size_t off = sh[si + 1].offset + r.offset;
+                int bytes = r.kind == Fix::ABS64 ? 8 : 4;
+                for (int b = 0; b < bytes; b++) { out[off + b] = 0; d[r.offset + b] = 0; }
+            } else {
+                put(out, r.offset, 4);
+                put(out, target << 8 | rel_type(r.kind), 4);
+            }
+        }
+        sh[idx].size = out.size() - sh[idx].offset;
+    }
+
+    // Section headers
+    pad(out, W);
+    uint64_t shoff = out.size();
+    for (auto& h : sh) {
+        if (elf64) {
+            put(out, h.name, 4); put(out, h.type, 4); put(out, h.flags, 8); put(out, 0, 8);
+            put(out, h.offset, 8); put(out, h.size, 8); put(out, h.link, 4); put(out, h.info, 4);
+            put(out, h.align, 8); put(out, h.entsize, 8);
+        } else {
+            put(out, h.name, 4); put(out, h.type, 4); put(out, h.flags, 4); put(out, 0, 4);
+            put(out, h.offset, 4); put(out, h.size, 4); put(out, h.link, 4); put(out, h.info, 4);
+            put(out, h.align, 4); put(out, h.entsize, 4);
+        }
+    }
+
+    // ELF header
+    std::string eh;
+    eh += "\x7f" "ELF";
+    eh += (char)(elf64 ? 2 : 1); eh += (char)1; eh += (char)1; eh += (char)0;
+    eh.append(8, '\0');
+    put(eh, 1, 2);                          // ET_REL
+    put(eh, elf64 ? 62 : 3, 2);             // EM_X86_64 / EM_386
+    put(eh, 1, 4);
+    put(eh, 0, W);                          // entry
+    put(eh, 0, W);                          // phoff
+    put(eh, shoff, W);
+    put(eh, 0, 4);                          // flags
+    put(eh, ehsize, 2);
+    put(eh, 0, 2); put(eh, 0, 2);           // phentsize, phnum
+    put(eh, elf64 ? 64 : 40, 2);            // shentsize
+    put(eh, sh.size(), 2);
+    put(eh, shstr_idx, 2);
+    out.replace(0, eh.size(), eh);
+    return out;
+}
+
+// Compares two relocatable objects by what ends up in the program: the
+// bytes of every allocated section and the relocations against them.
+// Symbol table order, padding and section numbering may differ freely.
+// Returns an empty string when they agree, else the first difference.
+inline std::string diff_objects(const std::string& ours, const std::string& theirs) {
+    struct View {
+        std::vector<std::pair<std::string, std::string>> sections;  // name, bytes
+        std::vector<std::string> relocs;
+    };
+    auto rd = [](const std::string& f, size_t off, int n) -> uint64_t {
+        if (off + n > f.size()) throw std::runtime_error("truncated object file");
+        uint64_t v = 0;
+        for (int i = 0; i < n; i++) v |= (uint64_t)(unsigned char)f[off + i] << (8 * i);
+        return v;
+    };
+    auto parse = [&](const std::string& f) {
+        View v;
+        if (f.size() < 52 || f.compare(0, 4, "\x7f" "ELF") != 0) throw std::runtime_error("not an ELF object");
+        bool is64 = f[4] == 2;
+        int W = is64 ? 8 : 4;
+        uint64_t shoff = rd(f, is64 ? 0x28 : 0x20, W);
+        uint64_t shentsize = rd(f, is64 ? 0x3A : 0x2E, 2), shnum = rd(f, is64 ? 0x3C : 0x30, 2);
+        uint64_t shstrndx = rd(f, is64 ? 0x3E : 0x32, 2);
+        struct SH { uint64_t name, type, flags, offset, size, link, info, entsize; };
+        std::vector<SH> sh(shnum);
+        for (uint64_t i = 0; i < shnum; i++) {
+            size_t b = shoff + i * shentsize;
+            if (is64) sh[i] = {rd(f, b, 4), rd(f, b + 4, 4), rd(f, b + 8, 8), rd(f, b + 24, 8), rd(f, b + 32, 8),
+                               rd(f, b + 40, 4), rd(f, b + 44, 4), rd(f, b + 56, 8)};
+            else      sh[i] = {rd(f, b, 4), rd(f, b + 4, 4), rd(f, b + 8, 4), rd(f, b + 16, 4), rd(f, b + 20, 4),
+                               rd(f, b + 24, 4), rd(f, b + 28, 4), rd(f, b + 36, 4)};
+        }
+        auto str = [&](uint64_t table, uint64_t off) { return std::string(f.c_str() + sh[table].offset + off); };
+        auto name = [&](uint64_t i) { return str(shstrndx, sh[i].name); };
+        for (uint64_t i = 0; i < shnum; i++) {
+            if (!(sh[i].flags & 2)) continue;
+            std::string bytes = sh[i].type == 8 ? std::string(sh[i].size, '\0') : f.substr(sh[i].offset, sh[i].size);
+            v.sections.push_back({name(i), bytes});
+        }
+        for (uint64_t i = 0; i < shnum; i++) {
+            if (sh[i].type != 9 && sh[i].type != 4) continue;
+            if (!(sh[sh[i].info].flags & 2)) continue;
+            const SH& symtab = sh[sh[i].link];
+            bool rela = sh[i].type == 4;
+            for (uint64_t e = 0; e < sh[i].size; e += sh[i].entsize) {
+                size_t b = sh[i].offset + e;
+                uint64_t off = rd(f, b, W), info = rd(f, b + W, W);
+                int64_t addend = rela ? (int64_t)rd(f, b + 2 * W, W) : 0;
+                uint64_t sym = is64 ? info >> 32 : info >> 8, type = is64 ? info & 0xffffffff : info & 0xff;
+                size_t sb = symtab.offset + sym * symtab.entsize;
+                uint64_t sname = rd(f, sb, 4);
+                uint64_t sinfo = is64 ? rd(f, sb + 4, 1) : rd(f, sb + 12, 1);
+                uint64_t shndx = is64 ? rd(f, sb + 6, 2) : rd(f, sb + 14, 2);
+                std::string target = (sinfo & 15) == 3 ? name(shndx) : str(symtab.link, sname);
+                v.relocs.push_back(name(sh[i].info) + "+" + std::to_string(off) + " type " + std::to_string(type) +
+                                   " -> " + target + (addend < 0 ? "" : "+") + std::to_string(addend));
+            }
+        }
+        std::sort(v.sections.begin(), v.sections.end());
+        std::sort(v.relocs.begin(), v.relocs.end());
+        return v;
+    };
+    View a = parse(ours), b = parse(theirs);
+    for (auto& [nm, bytes] : b.sections) {
+        auto it = std::find_if(a.sections.begin(), a.sections.end(), [&](auto& s) { return s.first == nm; });
+        if (it == a.sections.end()) {
+            if (bytes.empty()) continue;
+            return "section " + nm + " is missing";
+        }
+        if (it->second.size() != bytes.size())
+            return "section " + nm + ": " + std::to_string(it->second.size()) + " bytes, expected " + std::to_string(bytes.size());
+        for (size_t i = 0; i < bytes.size(); i++)
+            if (it->second[i] != bytes[i]) return "section " + nm + " differs at offset " + std::to_string(i);
+    }
+    for (auto& [nm, bytes] : a.sections) {
+        bool found = std::any_of(b.sections.begin(), b.sections.end(), [&](auto& s) { return s.first == nm; });
+        if (!found && !bytes.empty()) return "unexpected section " + nm;
+    }
+    for (size_t i = 0; i < std::max(a.relocs.size(), b.relocs.size()); i++) {
+        if (i >= a.relocs.size()) return "missing relocation " + b.relocs[i];
+        if (i >= b.relocs.size()) return "unexpected relocation " + a.relocs[i];
+        if (a.relocs[i] != b.relocs[i]) return "relocation " + a.relocs[i] + ", expected " + b.relocs[i];
+    }
+    return "";
+}
+
+} // namespace x86
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Test runner: run.sh <defacto> [test.de ...]
+#
+# Every tests/*.de names the builds it wants on "// run: <flags>" lines.
+# Each build must go through the built-in assembler (no nasm fallback),
+# and the program's stdout and stderr, followed by "rc=<exit code>", must
+# equal tests/<name>.out. Imports resolve against the stdlib.
+D=$(cd "$(dirname "$1")" && pwd)/$(basename "$1"); shift
+dir=$(cd "$(dirname "$0")" && pwd)
+export DEFACTO_PATH="$dir/../../stdlib"
+tests=("$@")
+[ ${#tests[@]} -eq 0 ] && tests=("$dir"/*.de)
+tmp=$(mktemp -d); trap 'rm -rf "$tmp"' EXIT
+pass=0; fail=0
+for t in "${tests[@]}"; do
+    name=$(basename "$t" .de)
+    grep '^// run:' "$t" | sed 's|^// run: *||' > "$tmp/runs"
+    [ -s "$tmp/runs" ] || { echo "FAIL $name: no '// run:' line"; fail=$((fail+1)); continue; }
+    while read -r flags; do
+        cp "$t" "$tmp/p.de"
+        if ! (cd "$tmp" && "$D" $flags --no-cache p.de -o p) > "$tmp/log" 2>&1; then
+            echo "FAIL $name [$flags]: does not compile"; sed 's/^/    /' "$tmp/log"; fail=$((fail+1)); continue
+        fi
+        if grep -q "falling back to nasm" "$tmp/log"; then
+            echo "FAIL $name [$flags]: built-in assembler rejected the output"; sed 's/^/    /' "$tmp/log"; fail=$((fail+1)); continue
+        fi
+        (cd "$tmp" && timeout 10 ./p > out 2>&1; echo "rc=$?" >> out)
+        if cmp -s "$tmp/out" "$dir/$name.out"; then pass=$((pass+1))
+        else echo "FAIL $name [$flags]: output differs"; diff "$dir/$name.out" "$tmp/out" | sed 's/^/    /' | head -20; fail=$((fail+1)); fi
+    done < "$tmp/runs"
+done
+echo "tests: $pass passed, $fail failed"
+[ $fail -eq 0 ]